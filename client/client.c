@@ -12,10 +12,21 @@
  * Usage:
  * The executable expects 2 or 3 command-line arguments: hostname, port, and optionally a player name.
  * If a player name is provided, the client connects as a player; otherwise, it connects as a spectator.
+ * Options of the form --name=value may appear anywhere among them:
+ *   --fps=N    pacing mode: drain bursts of messages and redraw the map at most N times a second,
+ *              always from the newest DISPLAY.
+ *   --predict  prediction mode: move the player's '@' as soon as a key is typed, and reconcile
+ *              with the server's next DISPLAY (see predict.h).
+ *   --batch=MS batching mode: collect the keys typed within MS milliseconds of the first one,
+ *              and send them together in a single KEYS message.
+ *   --reliable reliable mode: messages to and from the server, except DISPLAY, are acknowledged
+ *              and retransmitted until they arrive (see message.h).
+ *   --loss=P   drop a fraction P of the datagrams the client sends, for testing reliable mode.
  * 
  */
 
 
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,13 +36,51 @@
 #include <math.h>
 #include <stdbool.h>
 #include "message.h"
+#include "codec.h"
+#include "legend.h"
 #include "mem.h"
+#include "render.h"
+#include "predict.h"
+
+/**************** file-local constants ****************/
+#define MaxBatch 64 // most keys sent in one KEYS message
+#define MaxPlayerId 16 // longest player id in an OK message, with its NUL
+static const float FlushSeconds = 1; // longest we wait at exit for our messages to be acknowledged
 
 /**************** global types ****************/
 typedef struct localclient {
   int NROWS;  // Number of rows in the game board, based on window size
   int NCOLS;  // Number of columns in the game board, based on window size
   char player; // Represents the player's character in the game
+  char playerId[MaxPlayerId]; // The player's id from the OK message: the character the player is drawn with
+  render_t* render; // Draws the map, remembering what is on screen
+  float paceInterval; // Pacing mode: least seconds between map redraws; 0 draws every DISPLAY
+  char* pendingMap; // Pacing mode: newest map not yet drawn
+  size_t pendingSize; // Bytes allocated for pendingMap
+  bool hasPending; // Whether pendingMap holds a map to draw
+  double lastDraw; // When the map was last drawn, in seconds
+  bool predictOn; // Whether prediction mode was asked for
+  predict_t* predict; // Prediction mode: predicted moves in flight; NULL for spectators
+  float batchInterval; // Batching mode: seconds keys are collected before sending; 0 sends each key
+  char batchKeys[MaxBatch + 1]; // Batching mode: keys typed but not yet sent
+  int nbatch; // Number of keys in batchKeys
+  double batchStart; // When the first key in batchKeys was typed, in seconds
+  bool reliableOn; // Whether reliable mode was asked for
+  float lossRate; // Fraction of outgoing datagrams to drop, for testing
+  char* frame; // The map of the latest DISPLAYZ message, decompressed, or of one with a legend, marked
+  size_t frameSize; // Bytes allocated for frame
+  int mapRows; // Rows of the map, from the GRID message
+  int mapCols; // Columns of the map, from the GRID message
+  int viewRows; // Viewport mode: map rows that fit on screen; 0 if the whole map fits
+  int viewCols; // Viewport mode: map columns that fit on screen
+  int viewTop; // Viewport mode: map row and column drawn at the top left of the screen
+  int viewLeft;
+  int winTop; // Viewport mode: map row and column of the window last received
+  int winLeft;
+  int winRows; // Viewport mode: size of the window last received
+  int winCols;
+  char* full; // Viewport mode: the whole map, holding only the window last received
+  char* view; // Viewport mode: the part of the map drawn on screen
 } localclient_t;
 
 
@@ -39,9 +88,11 @@ typedef struct localclient {
 // handling communications
 static bool handleMessage(void* arg, const addr_t from, const char* message);
 static bool handleInput(void* arg);
+static bool handleTimeout(void* arg);
+static bool parseOption(const char* option);
 static void cursesInit(); 
 static void setupWindow();
-static void displayMap(char* display);
+static void displayMap(const char* display);
 static void displayTempMessage(const char* temp);
 static void clearTempMessage();
 
@@ -50,6 +101,13 @@ static bool gameOk(const char* message);
 static bool gameGrid(const char* message);
 static bool gameGold(const char* message);
 static void gameDisplay(const char* message);
+static bool pasteWindow(const char* body, int top, int left);
+static const char* cropView(const char* map);
+
+// pacing and batching modes
+static void paceFlush(void);
+static void batchFlush(const addr_t server, bool force);
+static double now(void);
 
 // game helper function
 static localclient_t* data_new();
@@ -60,33 +118,52 @@ static localclient_t* data;
 /************** main **************/
 int main(int argc, char *argv[]) 
 {
-  // Validate command line arguments
+  // Initialize data structure
+  data = data_new();
+
+  // Separate options from the positional arguments
   const char* program = argv[0];
-  if (argc != 3 && argc != 4) {
-      fprintf(stderr, "ERROR: Expected either 2 or 3 arguments but recieved %d\n", argc-1);
-      fprintf(stderr, "USAGE: %s hostname port [playername]\n", program);
-      exit(1); // Exit on incorrect argument count
-  }
-  // Check for null arguments
+  const char* args[3] = {NULL, NULL, NULL};
+  int nargs = 0;
   for (int i = 1; i < argc; i++) {
-      if (argv[i] == NULL) {
-          fprintf(stderr, "ERROR: argmument %d is NULL\n", i);
-          exit(2);   // Exit on null argument
+    if (argv[i] == NULL) {
+      fprintf(stderr, "ERROR: argmument %d is NULL\n", i);
+      free(data);
+      exit(2);   // Exit on null argument
+    }
+    if (strncmp(argv[i], "--", 2) == 0) {
+      if (!parseOption(argv[i])) {
+        fprintf(stderr, "USAGE: %s hostname port [playername] [--fps=N] [--predict] [--batch=MS] [--reliable] [--loss=P]\n", program);
+        free(data);
+        exit(1); // Exit on a bad option
       }
+    } else if (nargs < 3) {
+      args[nargs++] = argv[i];
+    } else {
+      nargs++;
+    }
+  }
+  // Validate command line arguments
+  if (nargs != 2 && nargs != 3) {
+      fprintf(stderr, "ERROR: Expected either 2 or 3 arguments but recieved %d\n", nargs);
+      fprintf(stderr, "USAGE: %s hostname port [playername] [--fps=N] [--predict] [--batch=MS] [--reliable] [--loss=P]\n", program);
+      free(data);
+      exit(1); // Exit on incorrect argument count
   }
-
-  // Initialize data structure
-  data = data_new();
 
   // Initialize message module without logging
   if (message_init(stderr) == 0) {
     free(data);
     exit(3); // Exit on message module initialization failure
   }
+  message_setReliable(data->reliableOn); // Must be set before we speak to the server
+  if (data->lossRate > 0) {
+    message_setLoss(data->lossRate, getpid());
+  }
 
   // assign command-line arguments to variables 
-  const char* serverHost = argv[1];
-  const char* serverPort = argv[2];
+  const char* serverHost = args[0];
+  const char* serverPort = args[1];
   addr_t server; // address of the server
   if (!message_setAddr(serverHost, serverPort, &server)) {
       fprintf(stderr, "ERROR: Failure forming address from %s %s\n", serverHost, serverPort);
@@ -95,16 +172,17 @@ int main(int argc, char *argv[])
   }
 
   // connect to server as player or spectator
-  const char* playername = argv[3];
+  const char* playername = args[2];
   if (playername != NULL) {     // send playername to server
     char line[message_MaxBytes];
     strcpy(line, "PLAY ");
     strncat(line, playername, message_MaxBytes-strlen("PLAY "));
-    message_send(server, line);       // connect as player
+    message_sendReliable(server, line);       // connect as player
   } else {
-    message_send(server, "SPECTATE");   // Connect as spectator
+    message_sendReliable(server, "SPECTATE");   // Connect as spectator
     if(!gameOk(NULL)) {  // send quit message
-      message_send(server, "KEY Q");
+      message_sendReliable(server, "KEY Q");
+      message_flush(FlushSeconds);
       message_done();
       free(data);
       exit(6);  // Exit on player initialization failure
@@ -112,12 +190,33 @@ int main(int argc, char *argv[])
   }
 
   // Loop to handle input and messages
-  bool ok = message_loop(&server, 0, NULL, handleInput, handleMessage);
+  // In pacing mode the timeout draws a map left pending at the end of a burst;
+  // in batching mode it sends keys left waiting once typing stops
+  float timeout = data->paceInterval;
+  if (data->batchInterval > 0 && (timeout <= 0 || data->batchInterval < timeout)) {
+    timeout = data->batchInterval;
+  }
+  bool ok;
+  if (timeout > 0) {
+    ok = message_loop(&server, timeout, handleTimeout, handleInput, handleMessage);
+  } else {
+    ok = message_loop(&server, 0, NULL, handleInput, handleMessage);
+  }
 
 
   // clear data
+  if (data->predict != NULL) {
+    predict_report(data->predict, stderr);
+    predict_delete(data->predict);
+  }
+  render_delete(data->render);
+  free(data->pendingMap);
+  free(data->frame);
+  free(data->full);
+  free(data->view);
   free(data);
   endwin();  // Close curses window
+  message_flush(FlushSeconds);  // Give our last messages a chance to be acknowledged
   message_done();  // Shutdown message module
 
   return ok ? 0 : 1;  // Return success or failure status
@@ -134,22 +233,36 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
   // Process various types of messages from the server
   if (strncmp(message, "OK ", strlen("OK ")) == 0){
     if(!gameOk(message)) {
-      message_send(from, "KEY Q");
+      message_sendReliable(from, "KEY Q");
+      message_flush(FlushSeconds);
       message_done();
       free(data);
       exit(6); // Exit on "OK" message handling failure
     }
   } else if (strncmp(message, "GRID ", strlen("GRID ")) == 0) {
     if(!gameGrid(message)) {
-      message_send(from, "KEY Q");
+      message_sendReliable(from, "KEY Q");
+      message_flush(FlushSeconds);
       message_done();
       free(data);
       exit(5); // Exit on "GRID" message handling failure
     }
+    message_sendReliable(from, "COMPRESS"); // We can decode DISPLAYZ frames from now on
+    message_sendReliable(from, "LEGEND"); // We can tell apart players who share a symbol (see legend.h)
+    if (data->viewRows > 0) {
+      char view[64];
+      snprintf(view, sizeof(view), "VIEW %d %d", data->viewRows, data->viewCols);
+      message_sendReliable(from, view); // Only send us the part of the map that fits on screen
+    }
   } else if (strncmp(message, "GOLD ", strlen("GOLD ")) == 0) {
     gameGold(message); // Process "GOLD" message
-  } else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
-    gameDisplay(message); // Process "DISPLAY" message
+  } else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0
+             || strncmp(message, "DISPLAY ", strlen("DISPLAY ")) == 0
+             || strncmp(message, "DISPLAYZ\n", strlen("DISPLAYZ\n")) == 0
+             || strncmp(message, "DISPLAYZ ", strlen("DISPLAYZ ")) == 0
+             || strncmp(message, "DISPLAYV ", strlen("DISPLAYV ")) == 0
+             || strncmp(message, "DISPLAYVZ ", strlen("DISPLAYVZ ")) == 0) {
+    gameDisplay(message); // Process "DISPLAY" message, compressed or not, whole or a window
   } else if (strncmp(message, "QUIT ", strlen("QUIT ")) == 0) {
     endwin();
     fprintf(stdout, "\n%s\n", message);
@@ -161,11 +274,72 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
   } else {
     fprintf(stderr, "ERROR: Malformed message '%s'\n", message); // Log malformed message
   }
-  
+
+  if (data->paceInterval > 0) {
+    paceFlush(); // Draw the newest map, if it is time and the burst is over
+  }
+  batchFlush(from, false); // Send any keys whose window has closed
+  return false; // Continue message loop
+}
+
+
+/**************** handleTimeout ****************/
+static bool handleTimeout(void* arg)
+{
+  addr_t* serverp = arg;
+  paceFlush(); // Nothing arrived for a while: draw any map still pending
+  if (serverp != NULL) {
+    batchFlush(*serverp, false); // and send any keys whose window has closed
+  }
   return false; // Continue message loop
 }
 
 
+/**************** parseOption ****************/
+static bool parseOption(const char* option)
+{
+  if (strcmp(option, "--predict") == 0) {
+    data->predictOn = true;
+    return true;
+  }
+  if (strcmp(option, "--reliable") == 0) {
+    data->reliableOn = true;
+    return true;
+  }
+  if (strncmp(option, "--loss=", strlen("--loss=")) == 0) {
+    char extra;
+    if (sscanf(option + strlen("--loss="), "%f%c", &data->lossRate, &extra) != 1
+        || data->lossRate < 0 || data->lossRate >= 1) {
+      fprintf(stderr, "ERROR: --loss needs a fraction from 0 up to 1\n");
+      return false;
+    }
+    return true;
+  }
+  if (strncmp(option, "--fps=", strlen("--fps=")) == 0) {
+    char extra;
+    float fps;
+    if (sscanf(option + strlen("--fps="), "%f%c", &fps, &extra) != 1 || fps <= 0) {
+      fprintf(stderr, "ERROR: --fps needs a positive number of frames per second\n");
+      return false;
+    }
+    data->paceInterval = 1 / fps;
+    return true;
+  }
+  if (strncmp(option, "--batch=", strlen("--batch=")) == 0) {
+    char extra;
+    float ms;
+    if (sscanf(option + strlen("--batch="), "%f%c", &ms, &extra) != 1 || ms <= 0) {
+      fprintf(stderr, "ERROR: --batch needs a positive number of milliseconds\n");
+      return false;
+    }
+    data->batchInterval = ms / 1000;
+    return true;
+  }
+  fprintf(stderr, "ERROR: unknown option %s\n", option);
+  return false;
+}
+
+
 /**************** handleInput ****************/
 static bool handleInput(void* arg)
 {
@@ -180,14 +354,22 @@ static bool handleInput(void* arg)
   }
 
   char c = getch(); // Read a character from ncurses input.
-  char message[strlen("KEY ") + 2]; // Prepare message buffer.
-  strcpy(message, "KEY "); // Start message with "KEY ".
-  strcat(message, &c); // Append the read character to the message.
-  message[strlen("KEY ") + 1] = '\0'; // Ensure null-termination.
 
   clearTempMessage(); // Clear any existing temporary messages.
 
-  message_send(*serverp, message); // Send the constructed message to the server.
+  // Queue the key; it goes out with the batch, or at once when batching is off
+  if (data->nbatch == 0) {
+    data->batchStart = now();
+  }
+  data->batchKeys[data->nbatch++] = c;
+  batchFlush(*serverp, c == 'Q' || data->nbatch == MaxBatch);
+
+  // Prediction mode: show the move now, rather than when the server's answer arrives
+  if (data->predict != NULL && predict_key(data->predict, c, now())) {
+    displayMap(predict_map(data->predict));
+    data->hasPending = false; // Anything pending is older than what was just drawn
+    data->lastDraw = now();
+  }
 
   return false; // Continue looping for more input.
 }
@@ -225,19 +407,12 @@ static void setupWindow()
 
 
 /* ************ displayMap *********************** */
-static void displayMap(char* display)
+static void displayMap(const char* display)
 {
-  for (int row = 0; row < data->NROWS; row++) {
-    for (int col = 0; col < data->NCOLS; col++) {
-      move(row + 1, col); // Move to position, accounting for the top status line.
-      int idx = row * (data->NCOLS + 1) + col; // Calculate index in the display string.
-      if (idx < strlen(display)) {
-        addch(display[idx]); // Add character from the display string to the screen.
-      } else {
-        addch(' '); // Fill with blank if beyond the display string.
-      }
-    }
+  if (data->render == NULL) {
+    return; // No GRID yet, so nowhere to draw
   }
+  render_frame(data->render, display); // Only the cells that changed reach the terminal
   refresh(); // Refresh the screen to show changes.
 }
 
@@ -300,9 +475,10 @@ static bool gameOk(const char* message)
 {
   data->player = 0; // Reset player character to 0, indicating no player character received yet.
   if (message != NULL) { // Ensure the message is not NULL.
-    if (sscanf(message, "OK %c", &data->player) != 1) { // Attempt to parse player character from the message.
+    if (sscanf(message, "OK %15s", data->playerId) != 1) { // Attempt to parse player id from the message.
       return false; // Return false if parsing fails.
     }
+    data->player = data->playerId[0]; // the id starts with the character the player is drawn with
   }
   cursesInit(); // Initialize the curses library for UI display.
   setupWindow(); // Set up the initial game window with a blank map.
@@ -319,8 +495,17 @@ static bool gameGrid(const char* message)
     fprintf(stderr, "ERROR: Malformed GRID message '%s'", message); // Log error on malformed message.
     return false; // Return false due to parsing failure.
   }
+  // A player whose screen is too small sees the part of the map around them (viewport mode)
+  if (data->player != 0 && (nrows+1 > data->NROWS || ncols > data->NCOLS)) {
+    data->viewRows = nrows < data->NROWS - 1 ? nrows : data->NROWS - 1;
+    data->viewCols = ncols < data->NCOLS ? ncols : data->NCOLS;
+    if (data->viewRows < 1 || data->viewCols < 1) {
+      fprintf(stderr, "ERROR: screen of size [%d, %d] is too small\n", data->NROWS, data->NCOLS);
+      return false;
+    }
+  }
   // Verify that the screen size is sufficient for the grid dimensions.
-  while (nrows+1 > data->NROWS || ncols > data->NCOLS) { // Check if window resize is needed.
+  while (data->viewRows == 0 && (nrows+1 > data->NROWS || ncols > data->NCOLS)) { // Check if window resize is needed.
     endwin(); // Temporarily end curses session to allow for window resizing.
     fprintf(stderr, "ERROR: incompatible screen of size [%d, %d] for [%d, %d]\n", data->NROWS, data->NCOLS, nrows+1, ncols);
     mvprintw(0,0, "ERROR: incompatible screen of size [%d, %d] for [%d, %d]\nRESIZE and press ENTER to continue", data->NROWS, data->NCOLS, nrows+1, ncols);
@@ -330,8 +515,34 @@ static bool gameGrid(const char* message)
       cursesInit(); // Reinitialize curses with the new window size.
     }
   }
-  data->NROWS = nrows+1; // Update stored grid dimensions.
-  data->NCOLS = ncols;
+  data->mapRows = nrows;
+  data->mapCols = ncols;
+  data->frameSize = (size_t)nrows * (ncols + 1) + 1;
+  data->frame = mem_assert(realloc(data->frame, data->frameSize), "Failed to allocate memory for frame.");
+  render_delete(data->render);
+  if (data->viewRows > 0) {
+    data->NROWS = data->viewRows+1; // Update stored screen dimensions.
+    data->NCOLS = data->viewCols;
+    data->render = render_new(data->viewRows, data->viewCols, 1); // The view starts below the status line
+    // The whole map starts blank; each window the server sends is stored in it
+    data->full = mem_assert(realloc(data->full, data->frameSize), "Failed to allocate memory for map.");
+    for (int row = 0; row < nrows; row++) {
+      memset(data->full + row * (ncols + 1), ' ', ncols);
+      data->full[row * (ncols + 1) + ncols] = '\n';
+    }
+    data->full[data->frameSize - 1] = '\0';
+    data->winRows = data->winCols = 0;
+    size_t viewSize = (size_t)data->viewRows * (data->viewCols + 1) + 1;
+    data->view = mem_assert(realloc(data->view, viewSize), "Failed to allocate memory for view.");
+  } else {
+    data->NROWS = nrows+1; // Update stored grid dimensions.
+    data->NCOLS = ncols;
+    data->render = render_new(nrows, ncols, 1); // The map starts below the status line
+  }
+  if (data->predictOn && data->player != 0) {
+    predict_delete(data->predict);
+    data->predict = predict_new(nrows, ncols); // Only players have moves to predict
+  }
   return true; // Return true, indicating successful processing of the "GRID" message.
 }
 
@@ -369,7 +580,7 @@ static bool gameGold(const char* message)
       snprintf(buffer, ncols, "Spectator: %d nuggets unclaimed.", gold_left);
     } else {
       // Format message for player
-      int len_msg = snprintf(buffer, ncols, "Player %c has %d nuggets (%d nuggets unclaimed).", data->player, gold_purse, gold_left);
+      int len_msg = snprintf(buffer, ncols, "Player %s has %d nuggets (%d nuggets unclaimed).", data->playerId, gold_purse, gold_left);
       char gold_left_buffer[ncols]; // Additional buffer for extended message
       int len_gold_left_msg = 0;
       // Append message about collected gold if applicable
@@ -394,17 +605,183 @@ static bool gameGold(const char* message)
 /**************** gameDisplay ****************/
 static void gameDisplay(const char* message)
 {
-  // Calculate the length of the display part of the message
-  size_t headerLength = strlen("DISPLAY\n");
-  size_t displayLength = strlen(message) - headerLength + 1;
-  // Prepare buffer for the display content
-  char display[displayLength]; 
-  // Copy the display content from the message to the buffer
-  strncpy(display, message + headerLength, displayLength);
-  display[displayLength] = '\0'; // Ensure null-termination
-  
-  // Call the function to display the map on the screen
-  displayMap(display);
+  // The map follows the header line; it is drawn straight from the message, or decompressed first
+  size_t word = strcspn(message, " \n"); // DISPLAY, DISPLAYZ, DISPLAYV or DISPLAYVZ
+  bool windowed = message[strlen("DISPLAY")] == 'V';
+  int top = 0;
+  int left = 0;
+  int fields = 0; // Length of the window's fields; the legend, if any, follows them
+  if (windowed && (data->viewRows == 0 || sscanf(message + word, "%d %d%n", &top, &left, &fields) != 2)) {
+    fprintf(stderr, "ERROR: Malformed DISPLAYV message\n");
+    return;
+  }
+  const char* legend = message + word + fields;
+  const char* map = strchr(message, '\n');
+  if (map == NULL) {
+    fprintf(stderr, "ERROR: DISPLAY message without a map\n");
+    return;
+  }
+  map++;
+  if (message[word - 1] == 'Z') {
+    if (data->frame == NULL || codec_decode(map, strlen(map), data->frame, data->frameSize) == 0) {
+      fprintf(stderr, "ERROR: Malformed DISPLAYZ message\n");
+      return;
+    }
+    map = data->frame;
+  }
+  if (*legend != '\n') {
+    // Mark the players the legend names, in our own copy of the map
+    if (map != data->frame) {
+      size_t size = strlen(map) + 1;
+      if (data->frame == NULL || size > data->frameSize) {
+        fprintf(stderr, "ERROR: DISPLAY message larger than the map\n");
+        return;
+      }
+      memcpy(data->frame, map, size);
+      map = data->frame;
+    }
+    if (legend_apply(legend, data->frame) < 0) {
+      fprintf(stderr, "ERROR: Malformed legend in DISPLAY message\n");
+      return;
+    }
+  }
+  if (data->viewRows > 0) {
+    // Viewport mode: store the window; the server centred it on us, and so do we
+    if (!windowed) {
+      const char* at = strchr(map, '@');
+      if (at != NULL) {
+        top = (at - map) / (data->mapCols + 1) - data->viewRows / 2;
+        left = (at - map) % (data->mapCols + 1) - data->viewCols / 2;
+      }
+      top = top < 0 ? 0 : (top > data->mapRows - data->viewRows ? data->mapRows - data->viewRows : top);
+      left = left < 0 ? 0 : (left > data->mapCols - data->viewCols ? data->mapCols - data->viewCols : left);
+      data->viewTop = top;
+      data->viewLeft = left;
+      top = left = 0; // a whole map is a window at the top left
+    } else {
+      data->viewTop = top;
+      data->viewLeft = left;
+    }
+    if (!pasteWindow(map, top, left)) {
+      fprintf(stderr, "ERROR: DISPLAYV window outside the map\n");
+      return;
+    }
+    map = data->full;
+  }
+  if (data->predict != NULL) {
+    // Prediction mode: reconcile, then draw the server's map with our predicted moves
+    predict_server(data->predict, map, now());
+    map = predict_map(data->predict);
+  }
+  if (data->viewRows > 0) {
+    map = cropView(map);
+  }
+  if (data->paceInterval <= 0) {
+    displayMap(map);
+    return;
+  }
+  // Pacing mode: keep only the newest map; paceFlush decides when to draw it
+  size_t size = strlen(map) + 1;
+  if (size > data->pendingSize) {
+    data->pendingMap = mem_assert(realloc(data->pendingMap, size), "Failed to allocate memory for pending map.");
+    data->pendingSize = size;
+  }
+  memcpy(data->pendingMap, map, size);
+  data->hasPending = true;
+}
+
+
+/**************** pasteWindow ****************/
+static bool pasteWindow(const char* body, int top, int left)
+{
+  if (top < 0 || top >= data->mapRows || left < 0 || left >= data->mapCols) {
+    return false;
+  }
+  // Blank the window stored last, so the map only holds what the server sent this time
+  for (int row = 0; row < data->winRows; row++) {
+    memset(data->full + (data->winTop + row) * (data->mapCols + 1) + data->winLeft, ' ', data->winCols);
+  }
+  int rows = 0;
+  int cols = 0;
+  const char* p = body;
+  while (*p != '\0' && top + rows < data->mapRows) {
+    int length = strcspn(p, "\n");
+    int n = length < data->mapCols - left ? length : data->mapCols - left;
+    memcpy(data->full + (top + rows) * (data->mapCols + 1) + left, p, n);
+    cols = n > cols ? n : cols;
+    rows++;
+    p += length;
+    if (*p == '\n') {
+      p++;
+    }
+  }
+  data->winTop = top;
+  data->winLeft = left;
+  data->winRows = rows;
+  data->winCols = cols;
+  return true;
+}
+
+
+/**************** cropView ****************/
+static const char* cropView(const char* map)
+{
+  int width = data->viewCols + 1;
+  for (int row = 0; row < data->viewRows; row++) {
+    memcpy(data->view + row * width, map + (data->viewTop + row) * (data->mapCols + 1) + data->viewLeft, data->viewCols);
+    data->view[row * width + data->viewCols] = '\n';
+  }
+  data->view[data->viewRows * width] = '\0';
+  return data->view;
+}
+
+
+/**************** paceFlush ****************/
+static void paceFlush(void)
+{
+  if (!data->hasPending) {
+    return; // Nothing new to draw
+  }
+  double elapsed = now() - data->lastDraw;
+  if (elapsed < data->paceInterval) {
+    return; // Too soon; a later message or the timeout will draw it
+  }
+  if (message_pending() && elapsed < 2 * data->paceInterval) {
+    return; // More messages are waiting; drain them first, but never fall more than a frame behind
+  }
+  displayMap(data->pendingMap);
+  data->hasPending = false;
+  data->lastDraw = now();
+}
+
+
+/**************** batchFlush ****************/
+static void batchFlush(const addr_t server, bool force)
+{
+  if (data->nbatch == 0) {
+    return; // No keys waiting
+  }
+  if (!force && now() - data->batchStart < data->batchInterval) {
+    return; // The window is still open; more keys may follow
+  }
+  char message[strlen("KEYS ") + MaxBatch + 1];
+  if (data->nbatch == 1) {
+    snprintf(message, sizeof(message), "KEY %c", data->batchKeys[0]); // A lone key needs no batch
+  } else {
+    data->batchKeys[data->nbatch] = '\0';
+    snprintf(message, sizeof(message), "KEYS %s", data->batchKeys);
+  }
+  message_sendReliable(server, message);
+  data->nbatch = 0;
+}
+
+
+/**************** now ****************/
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 
@@ -421,6 +798,29 @@ static localclient_t* data_new()
   data->NROWS = -1;
   data->NCOLS = -1;
   data->player = 0;
+  data->playerId[0] = '\0';
+  data->render = NULL;
+  data->paceInterval = 0;
+  data->pendingMap = NULL;
+  data->pendingSize = 0;
+  data->hasPending = false;
+  data->lastDraw = 0;
+  data->predictOn = false;
+  data->predict = NULL;
+  data->batchInterval = 0;
+  data->nbatch = 0;
+  data->batchStart = 0;
+  data->reliableOn = false;
+  data->lossRate = 0;
+  data->frame = NULL;
+  data->frameSize = 0;
+  data->mapRows = data->mapCols = 0;
+  data->viewRows = data->viewCols = 0;
+  data->viewTop = data->viewLeft = 0;
+  data->winTop = data->winLeft = 0;
+  data->winRows = data->winCols = 0;
+  data->full = NULL;
+  data->view = NULL;
 
   return data; // Return the pointer to the newly allocated structure
 }
@@ -2,12 +2,47 @@
 #define CLIENT_H
 
 #include "message.h" 
+#include "render.h"
+#include "predict.h"
+
+/**************** constants ****************/
+#define MaxBatch 64 // most keys sent in one KEYS message
+#define MaxPlayerId 16 // longest player id in an OK message, with its NUL
 
 /**************** global types ****************/
 typedef struct localclient {
   int NROWS;  // Number of rows in the game board, based on window size
   int NCOLS;  // Number of columns in the game board, based on window size
   char player; // Represents the player's character in the game
+  char playerId[MaxPlayerId]; // The player's id from the OK message: the character the player is drawn with
+  render_t* render; // Draws the map, remembering what is on screen
+  float paceInterval; // Pacing mode: least seconds between map redraws; 0 draws every DISPLAY
+  char* pendingMap; // Pacing mode: newest map not yet drawn
+  size_t pendingSize; // Bytes allocated for pendingMap
+  bool hasPending; // Whether pendingMap holds a map to draw
+  double lastDraw; // When the map was last drawn, in seconds
+  bool predictOn; // Whether prediction mode was asked for
+  predict_t* predict; // Prediction mode: predicted moves in flight; NULL for spectators
+  float batchInterval; // Batching mode: seconds keys are collected before sending; 0 sends each key
+  char batchKeys[MaxBatch + 1]; // Batching mode: keys typed but not yet sent
+  int nbatch; // Number of keys in batchKeys
+  double batchStart; // When the first key in batchKeys was typed, in seconds
+  bool reliableOn; // Whether reliable mode was asked for
+  float lossRate; // Fraction of outgoing datagrams to drop, for testing
+  char* frame; // The map of the latest DISPLAYZ message, decompressed, or of one with a legend, marked
+  size_t frameSize; // Bytes allocated for frame
+  int mapRows; // Rows of the map, from the GRID message
+  int mapCols; // Columns of the map, from the GRID message
+  int viewRows; // Viewport mode: map rows that fit on screen; 0 if the whole map fits
+  int viewCols; // Viewport mode: map columns that fit on screen
+  int viewTop; // Viewport mode: map row and column drawn at the top left of the screen
+  int viewLeft;
+  int winTop; // Viewport mode: map row and column of the window last received
+  int winLeft;
+  int winRows; // Viewport mode: size of the window last received
+  int winCols;
+  char* full; // Viewport mode: the whole map, holding only the window last received
+  char* view; // Viewport mode: the part of the map drawn on screen
 } localclient_t;
 
 
@@ -15,9 +50,11 @@ typedef struct localclient {
 // Functions for game communication handling
 static bool handleMessage(void* arg, const addr_t from, const char* message);
 static bool handleInput(void* arg);
+static bool handleTimeout(void* arg);
+static bool parseOption(const char* option);
 static void cursesInit(); 
 static void setupWindow();
-static void displayMap(char* display);
+static void displayMap(const char* display);
 static void displayTempMessage(const char* temp);
 static void clearTempMessage();
 
@@ -26,6 +63,13 @@ static bool gameOk(const char* message);
 static bool gameGrid(const char* message);
 static bool gameGold(const char* message);
 static void gameDisplay(const char* message);
+static bool pasteWindow(const char* body, int top, int left);
+static const char* cropView(const char* map);
+
+// Functions for pacing and batching modes
+static void paceFlush(void);
+static void batchFlush(const addr_t server, bool force);
+static double now(void);
 
 // game helper function
 static localclient_t* data_new();
@@ -39,9 +83,11 @@ static localclient_t* data_new();
  * each message to the appropriate handler function based on its type. It supports messages, each triggering specific actions within the client:
  * 
  * - "OK": Initializes the player character and sets up the game window.
- * - "GRID": Updates the game grid dimensions and verifies the window size can accommodate it.
+ * - "GRID": Updates the game grid dimensions and verifies the window size can accommodate it,
+ *   then tells the server with "COMPRESS" that we can decode compressed frames, and with "LEGEND"
+ *   that we can tell apart players who share a symbol (see legend.h).
  * - "GOLD": Displays the current gold status, including gold collected, purse, and remaining gold.
- * - "DISPLAY": Updates the ncurses window with the current game map or state.
+ * - "DISPLAY", "DISPLAYZ": Updates the ncurses window with the current game map or state.
  * - "QUIT": Handles game termination by closing the ncurses window and printing the quit message.
  * - "ERROR": Logs and displays error messages to the player.
  * - Malformed messages are logged as errors and ignored.
@@ -66,7 +112,9 @@ static bool handleMessage(void* arg, const addr_t from, const char* message);
  * 
  * This function is designed to be called when stdin has input ready. It reads a single
  * character, packages it as a "KEY" message, and sends it to the server. It also clears
- * any temporary message displayed on the screen.
+ * any temporary message displayed on the screen. In prediction mode, a move whose outcome
+ * is certain is drawn at once, without waiting for the server's answer. In batching mode
+ * the key is only queued, and batchFlush sends it along with the keys typed after it.
  * 
  * @param arg A void pointer to an addr_t structure representing the server's address.
  * @return Returns true to exit the message loop on EOF or fatal error, otherwise false.
@@ -101,10 +149,12 @@ static void setupWindow(void);
  * 
  * Takes the string representation of the game map and displays it in the ncurses window,
  * starting from the second row to leave space for status messages at the top.
+ * Only the cells that differ from the previous map are written (see render.h);
+ * nothing is drawn before the "GRID" message has set up the renderer.
  * 
  * @param display A string containing the map to be displayed.
  */
-static void displayMap(char* display);
+static void displayMap(const char* display);
 
 
 /**************** displayTempMessage ****************/
@@ -135,9 +185,9 @@ static void clearTempMessage(void);
  * @brief Processes the "OK" message from the server, initializing game state.
  * 
  * This function is called upon receiving an "OK" message from the server. It sets
- * the player character in the `data` structure and initializes the ncurses library
- * and game window. If no player character is specified in the message, the function
- * defaults the player character to 0.
+ * the player's id, and the character it starts with, in the `data` structure and initializes
+ * the ncurses library and game window. If no player id is specified in the message, the function
+ * defaults the player character to 0. An id is the character the player is drawn with.
  * 
  * @param message The message received from the server, expected to start with "OK".
  * @return Returns true if the "OK" message is processed successfully, otherwise false.
@@ -151,7 +201,9 @@ static bool gameOk(const char* message);
  * 
  * This function extracts the grid dimensions from the "GRID" message and verifies
  * that the current window size can accommodate the grid. If the window is too small,
- * the function prompts the user to resize the window. The grid dimensions are then
+ * a player switches to viewport mode, showing only the part of the map around them
+ * that fits (the caller then sends the server a VIEW message with that size), while a
+ * spectator is prompted to resize the window. The grid dimensions are then
  * stored in the `data` structure.
  * 
  * @param message The "GRID" message received from the server, containing grid dimensions.
@@ -160,6 +212,32 @@ static bool gameOk(const char* message);
 static bool gameGrid(const char* message);
 
 
+/**************** pasteWindow ****************/
+/**
+ * @brief Viewport mode: stores the window of a DISPLAYV message in the whole-map buffer.
+ *
+ * The window last stored is blanked first, so `data->full` only ever holds the latest
+ * window, as the server sent it; prediction then runs on the whole map as usual.
+ *
+ * @param body The rows of the window, each ending in a newline.
+ * @param top Map row of the window's first row.
+ * @param left Map column of the window's first column.
+ * @return Returns false if the window does not start inside the map.
+ */
+static bool pasteWindow(const char* body, int top, int left);
+
+
+/**************** cropView ****************/
+/**
+ * @brief Viewport mode: cuts the part that fits on screen out of a whole map.
+ *
+ * @param map A map in DISPLAY layout, as big as the GRID.
+ * @return The `data->viewRows` by `data->viewCols` part of it at `data->viewTop`, `data->viewLeft`,
+ * in `data->view`.
+ */
+static const char* cropView(const char* map);
+
+
 /**************** gameGold ****************/
 /**
  * @brief Processes the "GOLD" message from the server and displays gold status.
@@ -178,15 +256,82 @@ static bool gameGold(const char* message);
 /**
  * @brief Processes the "DISPLAY" message from the server and updates the game display.
  * 
- * Extracts the game map from the "DISPLAY" message and displays it in the ncurses
- * window. The map display starts from the second row to leave space for the gold status
- * at the top. This function is responsible for rendering the game's graphical interface.
+ * Displays the game map that follows the "DISPLAY" header in the ncurses window,
+ * reading it in place without copying the message; a "DISPLAYZ" message is first
+ * decompressed into `data->frame` (see codec.h), and the cells named in a legend after
+ * the header's fields are marked in `data->frame` (see legend.h). In viewport mode, the window of a
+ * "DISPLAYV" (or "DISPLAYVZ") message is stored with pasteWindow and the part of the
+ * map around the player that fits on screen is drawn. The map display starts from the
+ * second row to leave space for the gold status at the top. In prediction mode the
+ * map is first reconciled with the moves predicted so far (see predict.h). In pacing
+ * mode the map is only copied aside, and drawn later by paceFlush. This function is responsible for rendering the game's graphical interface.
  * 
- * @param message The "DISPLAY" message received from the server, containing the game map.
+ * @param message The "DISPLAY", "DISPLAYZ", "DISPLAYV" or "DISPLAYVZ" message received from the server, containing the game map.
  */
 static void gameDisplay(const char* message);
 
 
+/**************** handleTimeout ****************/
+/**
+ * @brief Called by the message loop in pacing or batching mode when no message or input has arrived for a while.
+ * 
+ * Draws the newest map if one is still pending, so the last frame of a burst is never left undrawn,
+ * and sends any keys still queued once their batching window has closed.
+ * 
+ * @param arg A void pointer to an addr_t structure representing the server's address.
+ * @return Always false, to keep the message loop running.
+ */
+static bool handleTimeout(void* arg);
+
+
+/**************** parseOption ****************/
+/**
+ * @brief Parses one "--name=value" command-line option into `data`.
+ * 
+ * "--fps=N" turns on pacing mode, with at most N map redraws a second;
+ * "--predict" turns on prediction mode, which takes effect for players once "GRID" arrives;
+ * "--batch=MS" turns on batching mode, collecting keys for MS milliseconds before sending them;
+ * "--reliable" turns on reliable mode, and "--loss=P" drops a fraction P of outgoing datagrams.
+ * 
+ * @param option The command-line argument, starting with "--".
+ * @return Returns true if the option is understood, otherwise false (after printing why).
+ */
+static bool parseOption(const char* option);
+
+
+/**************** paceFlush ****************/
+/**
+ * @brief Draws the pending map in pacing mode, when it is time to.
+ * 
+ * In pacing mode gameDisplay only keeps the newest map. This draws it once a full frame
+ * interval has passed since the last redraw and no more messages are waiting on the socket,
+ * so a burst of DISPLAY messages costs one redraw. If messages keep coming, the map is drawn
+ * anyway after two frame intervals, which bounds how far the screen can fall behind.
+ */
+static void paceFlush(void);
+
+
+/**************** batchFlush ****************/
+/**
+ * @brief Sends the queued keys, once their batching window has closed.
+ * 
+ * A lone key goes out as "KEY c", several as "KEYS <keys>", which the server applies in
+ * order before sending a single round of DISPLAY messages. With batching off the window
+ * is always closed, so every key is sent as soon as it is typed.
+ * 
+ * @param server The server's address.
+ * @param force Send now, whatever the window: used for 'Q', and when the queue is full.
+ */
+static void batchFlush(const addr_t server, bool force);
+
+
+/**************** now ****************/
+/**
+ * @brief Returns the time in seconds on a monotonic clock.
+ */
+static double now(void);
+
+
 /**************** data_new ****************/
 /**
  * @brief Allocates and initializes a new localclient_t structure.
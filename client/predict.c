@@ -0,0 +1,281 @@
+/**
+ * predict.c - the client's movement prediction
+ *
+ * see predict.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "predict.h"
+#include "mem.h"
+#include "legend.h"
+
+/**************** file-local constants ****************/
+#define MaxPending 32                 // keys in flight that we keep track of
+static const double MaxWait = 1.0;    // seconds a key may go unanswered before we give up on it
+static const double MinSettle = 0.05; // least seconds we stop predicting after an unpredicted key
+
+/* how each key moves the player, as (row, column) steps; this must match the server */
+static const char* const MoveKeys = "hljkyubn";
+static const int Moves[8][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, 1}, {1, 1}, {-1, -1}, {1, -1}};
+
+/**************** file-local types ****************/
+typedef struct pending {
+  int x;        // row the key should leave the player on
+  int y;        // column the key should leave the player on
+  double sent;  // when the key was sent
+} pending_t;
+
+/**************** global types ****************/
+typedef struct predict {
+  int nrows;
+  int ncols;
+  char* server;    // latest map from the server: nrows rows of ncols characters and '\n'
+  char* terrain;   // nrows * ncols cells: what lies under any player, as last seen
+  char* shown;     // the map predict_map returns
+  int baseX;       // the player's spot on the server's map; -1 if not shown
+  int baseY;
+  pending_t pending[MaxPending];  // predicted keys not yet answered by the server, oldest first
+  int npending;
+  double blindUntil;  // no predictions before this time: an unpredicted key may still be moving us
+  double rtt;         // smoothed time for the server to answer a predicted key
+  long predicted;   // keys whose move was shown before the server answered
+  long confirmed;   // predictions the server agreed with
+  long rolledBack;  // predictions dropped because the server disagreed or did not answer
+  long unpredicted; // movement keys sent without a prediction
+} predict_t;
+
+static char cell(predict_t* predict, int x, int y);
+static void predicted(predict_t* predict, int* x, int* y);
+static void rollback(predict_t* predict);
+static void consume(predict_t* predict, int k);
+static void expire(predict_t* predict, double now);
+
+
+/**************** predict_new ****************/
+predict_t* predict_new(int nrows, int ncols)
+{
+  predict_t* predict = mem_assert(malloc(sizeof(predict_t)), "Failed to allocate memory for predict_t.");
+  size_t length = (size_t)nrows * (ncols + 1) + 1;
+  predict->nrows = nrows;
+  predict->ncols = ncols;
+  predict->server = mem_assert(malloc(length), "Failed to allocate memory for the server map.");
+  predict->shown = mem_assert(malloc(length), "Failed to allocate memory for the predicted map.");
+  predict->terrain = mem_assert(malloc((size_t)nrows * ncols), "Failed to allocate memory for the terrain.");
+  memset(predict->server, ' ', length - 1);
+  for (int row = 0; row < nrows; row++) {
+    predict->server[row * (ncols + 1) + ncols] = '\n';
+  }
+  predict->server[length - 1] = '\0';
+  memset(predict->terrain, ' ', (size_t)nrows * ncols);
+  predict->baseX = -1;
+  predict->baseY = -1;
+  predict->npending = 0;
+  predict->blindUntil = 0;
+  predict->rtt = 0.1;
+  predict->predicted = 0;
+  predict->confirmed = 0;
+  predict->rolledBack = 0;
+  predict->unpredicted = 0;
+  return predict;
+}
+
+
+/**************** predict_server ****************/
+void predict_server(predict_t* predict, const char* map, double now)
+{
+  // copy the map into our fixed layout, and find the player
+  int sx = -1, sy = -1;
+  const char* p = map;
+  for (int row = 0; row < predict->nrows; row++) {
+    char* line = predict->server + row * (predict->ncols + 1);
+    for (int col = 0; col < predict->ncols; col++) {
+      char c = (*p != '\n' && *p != '\0') ? *p++ : ' ';
+      line[col] = c;
+      if (c == '@') {
+        sx = row;
+        sy = col;
+      } else if (legend_cellPlayer(c) < 0) {  // other players stand on something we cannot see
+        predict->terrain[row * predict->ncols + col] = (c == '*') ? '.' : c;  // gold only lies on floor
+      }
+    }
+    while (*p != '\n' && *p != '\0') {
+      p++;
+    }
+    if (*p == '\n') {
+      p++;
+    }
+  }
+
+  if (sx < 0) {
+    rollback(predict);  // we are not on the map; nothing to predict from
+  } else if (predict->npending > 0) {
+    // the oldest predictions whose spot the server shows us on are confirmed
+    int k = 0;
+    while (k <= predict->npending) {
+      int x = k == 0 ? predict->baseX : predict->pending[k - 1].x;
+      int y = k == 0 ? predict->baseY : predict->pending[k - 1].y;
+      if (x == sx && y == sy) {
+        break;
+      }
+      k++;
+    }
+    if (k <= predict->npending) {
+      if (k > 0) {
+        predict->rtt = 0.875 * predict->rtt + 0.125 * (now - predict->pending[k - 1].sent);
+      }
+      consume(predict, k);
+    } else {
+      rollback(predict);  // the server put us somewhere we did not predict
+    }
+  }
+  predict->baseX = sx;
+  predict->baseY = sy;
+  expire(predict, now);
+}
+
+
+/**************** predict_key ****************/
+bool predict_key(predict_t* predict, char key, double now)
+{
+  const char* m = strchr(MoveKeys, tolower(key));
+  if (key == '\0' || m == NULL) {
+    return false;  // not a movement key
+  }
+  expire(predict, now);
+  if (predict->baseX < 0) {
+    return false;  // not on the map yet; the server's answer will tell
+  }
+  int dx = Moves[m - MoveKeys][0];
+  int dy = Moves[m - MoveKeys][1];
+  int x, y;
+  predicted(predict, &x, &y);
+  bool known = now >= predict->blindUntil && predict->npending < MaxPending;
+  int steps = 0;
+  while (known) {
+    char c = cell(predict, x + dx, y + dy);
+    if (c == '.' || c == '#' || c == '*') {
+      x += dx;
+      y += dy;
+      steps++;
+      if (islower(key)) {
+        break;
+      }
+    } else if (c == '-' || c == '|' || c == '+' || (c == ' ' && steps == 0)) {
+      break;  // a wall; an adjacent blank is solid rock, since adjacent cells are always seen
+    } else {
+      known = false;  // another player, or unexplored space further along a run
+    }
+  }
+  if (!known) {
+    // until the server has had time to answer this key, we cannot tell where we are
+    double settle = 2 * predict->rtt;
+    settle = settle < MinSettle ? MinSettle : (settle > MaxWait ? MaxWait : settle);
+    predict->blindUntil = now + settle;
+    predict->unpredicted++;
+    return false;
+  }
+  if (steps == 0) {
+    return false;  // into a wall: the server will not move us, or answer
+  }
+  pending_t* entry = &predict->pending[predict->npending++];
+  entry->x = x;
+  entry->y = y;
+  entry->sent = now;
+  predict->predicted++;
+  return true;
+}
+
+
+/**************** predict_map ****************/
+const char* predict_map(predict_t* predict)
+{
+  size_t length = (size_t)predict->nrows * (predict->ncols + 1) + 1;
+  memcpy(predict->shown, predict->server, length);
+  int x, y;
+  predicted(predict, &x, &y);
+  if (predict->baseX < 0 || (x == predict->baseX && y == predict->baseY)) {
+    return predict->shown;
+  }
+  char under = predict->terrain[predict->baseX * predict->ncols + predict->baseY];
+  predict->shown[predict->baseX * (predict->ncols + 1) + predict->baseY] = (under == ' ') ? '.' : under;
+  for (int k = 0; k < predict->npending; k++) {
+    char* c = &predict->shown[predict->pending[k].x * (predict->ncols + 1) + predict->pending[k].y];
+    if (*c == '*') {
+      *c = '.';  // we have picked it up on our way
+    }
+  }
+  predict->shown[x * (predict->ncols + 1) + y] = '@';
+  return predict->shown;
+}
+
+
+/**************** predict_report ****************/
+void predict_report(predict_t* predict, FILE* fp)
+{
+  fprintf(fp, "prediction: %ld keys predicted, %ld confirmed, %ld rolled back, %ld sent unpredicted\n",
+          predict->predicted, predict->confirmed, predict->rolledBack, predict->unpredicted);
+}
+
+
+/**************** predict_delete ****************/
+void predict_delete(predict_t* predict)
+{
+  if (predict != NULL) {
+    free(predict->server);
+    free(predict->shown);
+    free(predict->terrain);
+    free(predict);
+  }
+}
+
+
+/* what is on screen at (x, y), as far as moving there goes; out of bounds is a wall */
+static char cell(predict_t* predict, int x, int y)
+{
+  if (x < 0 || x >= predict->nrows || y < 0 || y >= predict->ncols) {
+    return '|';
+  }
+  if (x == predict->baseX && y == predict->baseY) {
+    return predict->terrain[x * predict->ncols + y] == ' ' ? '.' : predict->terrain[x * predict->ncols + y];
+  }
+  return predict->server[x * (predict->ncols + 1) + y];
+}
+
+/* the spot our predictions leave us on: that of the last predicted key, or the server's */
+static void predicted(predict_t* predict, int* x, int* y)
+{
+  *x = predict->baseX;
+  *y = predict->baseY;
+  for (int k = 0; k < predict->npending; k++) {
+    *x = predict->pending[k].x;
+    *y = predict->pending[k].y;
+  }
+}
+
+/* drop every prediction, and show the server's map as is */
+static void rollback(predict_t* predict)
+{
+  predict->rolledBack += predict->npending;
+  predict->npending = 0;
+}
+
+/* the oldest k keys have been answered */
+static void consume(predict_t* predict, int k)
+{
+  predict->confirmed += k;
+  memmove(predict->pending, predict->pending + k, (predict->npending - k) * sizeof(pending_t));
+  predict->npending -= k;
+}
+
+/* give up on predictions once the oldest key has gone unanswered for too long */
+static void expire(predict_t* predict, double now)
+{
+  if (predict->npending > 0 && now - predict->pending[0].sent > MaxWait) {
+    rollback(predict);
+  }
+}
@@ -0,0 +1,91 @@
+/**
+ * predict.h - header file for the client's movement prediction
+ *
+ * In prediction mode the client moves its own '@' as soon as a movement key is
+ * typed, instead of waiting a round trip for the server's next DISPLAY. A move is
+ * only predicted when its outcome is certain from the map already on screen:
+ * a step or run across room floor ('.'), passage ('#') or gold ('*'), stopping at
+ * a known wall. Anything else (a step into another player, a run into unexplored
+ * space) is sent without prediction, and no further keys are predicted for about
+ * two round trips, until the server has had time to answer it.
+ *
+ * The server stays authoritative. Every predicted key is remembered with the spot
+ * it should lead to; each DISPLAY from the server confirms the oldest predictions
+ * whose spot it shows the player on, and the rest stay on screen. If the server
+ * shows the player anywhere else (swapped by another player, say), or a prediction
+ * goes unanswered for too long, all predictions are dropped and the server's map
+ * is shown as is.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct predict predict_t;  // opaque to users of the module
+
+/**************** predict_new ****************/
+/**
+ * @brief Creates the prediction state for a map of the given size.
+ *
+ * @param nrows Number of rows in the map.
+ * @param ncols Number of columns in the map.
+ * @return A new predictor; the caller must free it with predict_delete.
+ */
+predict_t* predict_new(int nrows, int ncols);
+
+/**************** predict_server ****************/
+/**
+ * @brief Reconciles the predictions with a map from the server.
+ *
+ * @param predict The predictor.
+ * @param map The map part of a DISPLAY message, just after "DISPLAY\n".
+ * @param now The current time, in seconds.
+ */
+void predict_server(predict_t* predict, const char* map, double now);
+
+/**************** predict_key ****************/
+/**
+ * @brief Predicts the effect of a key the client is about to send.
+ *
+ * Keys that do not move the player, and moves into a known wall, change nothing.
+ *
+ * @param predict The predictor.
+ * @param key The key, as sent in a KEY message.
+ * @param now The current time, in seconds.
+ * @return True if the predicted map changed and should be redrawn.
+ */
+bool predict_key(predict_t* predict, char key, double now);
+
+/**************** predict_map ****************/
+/**
+ * @brief Returns the map to draw: the server's latest map, with the player's '@'
+ * moved to the predicted spot.
+ *
+ * @param predict The predictor.
+ * @return A map in DISPLAY layout, owned by the predictor and valid until its next call.
+ */
+const char* predict_map(predict_t* predict);
+
+/**************** predict_report ****************/
+/**
+ * @brief Prints how many keys were predicted, confirmed and rolled back.
+ *
+ * @param predict The predictor.
+ * @param fp Where to print.
+ */
+void predict_report(predict_t* predict, FILE* fp);
+
+/**************** predict_delete ****************/
+/**
+ * @brief Frees a predictor; NULL is ignored.
+ *
+ * @param predict The predictor.
+ */
+void predict_delete(predict_t* predict);
+
+#endif // PREDICT_H
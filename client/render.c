@@ -0,0 +1,118 @@
+/**
+ * render.c - the client's map renderer
+ *
+ * see render.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ncurses.h>
+#include "render.h"
+#include "mem.h"
+#include "legend.h"
+
+/**************** file-local constants ****************/
+// how players are drawn in each cycle of symbols (see legend.h)
+static const attr_t CycleStyle[LEGEND_CYCLES] = { A_NORMAL, A_REVERSE, A_UNDERLINE };
+
+/**************** global types ****************/
+typedef struct render {
+  int nrows;    // rows in the map
+  int ncols;    // columns in the map
+  int top;      // screen row of the first map row
+  char* shown;  // nrows * ncols cells, as currently on screen; '\0' where unknown
+} render_t;
+
+/**************** local functions ****************/
+static void drawRun(const render_t* render, int row, int start, int n);
+
+
+/**************** render_new ****************/
+render_t* render_new(int nrows, int ncols, int top)
+{
+  render_t* render = mem_assert(malloc(sizeof(render_t)), "Failed to allocate memory for render_t.");
+  render->nrows = nrows;
+  render->ncols = ncols;
+  render->top = top;
+  render->shown = mem_assert(malloc((size_t)nrows * ncols), "Failed to allocate memory for the shown map.");
+  memset(render->shown, ' ', (size_t)nrows * ncols);
+  return render;
+}
+
+
+/**************** render_frame ****************/
+int render_frame(render_t* render, const char* map)
+{
+  int runs = 0;
+  const char* p = map;  // start of the current row in the message
+  for (int row = 0; row < render->nrows; row++) {
+    char* shown = render->shown + (size_t)row * render->ncols;
+    int start = -1;  // first column of the pending run of changed cells, if any
+    for (int col = 0; col <= render->ncols; col++) {
+      bool changed = false;
+      if (col < render->ncols) {
+        char c = (*p != '\n' && *p != '\0') ? *p++ : ' ';
+        if (shown[col] != c) {
+          shown[col] = c;
+          changed = true;
+        }
+      }
+      if (changed && start < 0) {
+        start = col;
+      } else if (!changed && start >= 0) {
+        drawRun(render, row, start, col - start);
+        runs++;
+        start = -1;
+      }
+    }
+    // skip whatever is left of the row, and its newline
+    while (*p != '\n' && *p != '\0') {
+      p++;
+    }
+    if (*p == '\n') {
+      p++;
+    }
+  }
+  return runs;
+}
+
+
+/**************** drawRun ****************/
+/* Write n cells of a row from those shown; a cell marked by a legend is its player's symbol, in its cycle's style. */
+static void drawRun(const render_t* render, int row, int start, int n)
+{
+  const char* shown = render->shown + (size_t)row * render->ncols;
+  int plain = start;  // first column of the cells not yet written
+  for (int col = start; col < start + n; col++) {
+    int k = (unsigned char)shown[col] >= 0x80 ? legend_cellPlayer(shown[col]) : -1;
+    if (k >= 0) {
+      if (col > plain) {
+        mvaddnstr(render->top + row, plain, shown + plain, col - plain);
+      }
+      mvaddch(render->top + row, col, legend_symbol(k) | CycleStyle[legend_cycle(k) - 1]);
+      plain = col + 1;
+    }
+  }
+  if (start + n > plain) {
+    mvaddnstr(render->top + row, plain, shown + plain, start + n - plain);
+  }
+}
+
+
+/**************** render_invalidate ****************/
+void render_invalidate(render_t* render)
+{
+  memset(render->shown, '\0', (size_t)render->nrows * render->ncols);
+}
+
+
+/**************** render_delete ****************/
+void render_delete(render_t* render)
+{
+  if (render != NULL) {
+    free(render->shown);
+    free(render);
+  }
+}
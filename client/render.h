@@ -0,0 +1,67 @@
+/**
+ * render.h - header file for the client's map renderer
+ *
+ * The renderer remembers the map it last drew, so that each new DISPLAY only
+ * costs terminal updates for the cells that changed. Changed cells are written
+ * in runs, one mvaddnstr per run of adjacent changed cells on a row. A cell that
+ * a legend has marked (see legend.h) is drawn on its own, as its player's symbol
+ * in the style of its cycle: plain, reversed, then underlined.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct render render_t;  // opaque to users of the module
+
+/**************** render_new ****************/
+/**
+ * @brief Creates a renderer for a map of the given size.
+ *
+ * The map is drawn with its top row on screen row `top`, and starts out as all
+ * blanks; this matches a freshly cleared window (see setupWindow in client.c).
+ *
+ * @param nrows Number of rows in the map.
+ * @param ncols Number of columns in the map.
+ * @param top Screen row of the first map row.
+ * @return A new renderer; the caller must free it with render_delete.
+ */
+render_t* render_new(int nrows, int ncols, int top);
+
+/**************** render_frame ****************/
+/**
+ * @brief Draws a map, writing only the cells that differ from the last one drawn.
+ *
+ * The map is read in place: rows separated by '\n', ending at '\0'. Rows shorter
+ * than the map (or missing) are padded with blanks, and longer rows are cut.
+ * The caller is responsible for calling refresh().
+ *
+ * @param render The renderer.
+ * @param map The map part of a DISPLAY message, just after "DISPLAY\n".
+ * @return The number of runs written to the screen.
+ */
+int render_frame(render_t* render, const char* map);
+
+/**************** render_invalidate ****************/
+/**
+ * @brief Forgets what is on screen, so the next render_frame redraws every cell.
+ *
+ * Use it when something else has drawn over the map area.
+ *
+ * @param render The renderer.
+ */
+void render_invalidate(render_t* render);
+
+/**************** render_delete ****************/
+/**
+ * @brief Frees a renderer; NULL is ignored.
+ *
+ * @param render The renderer.
+ */
+void render_delete(render_t* render);
+
+#endif // RENDER_H
@@ -0,0 +1,221 @@
+/**
+ * renderbench.c - benchmark for the client's map renderer
+ *
+ * Draws a series of DISPLAY maps built from a map file on a dummy terminal
+ * (ncurses writing to /dev/null) and reports frames per second for:
+ *   - the renderer (render.c), which writes only the runs of changed cells;
+ *   - the client's previous full redraw, a move+addch per cell with strlen in the loop.
+ * Two workloads are drawn: "walk", where a player walks across the floor and each
+ * frame differs from the last in two cells, and "flip", where every cell changes
+ * on every frame.
+ *
+ * Usage: ./renderbench [map.txt]   (default ../maps/big.txt)
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ncurses.h>
+#include "render.h"
+#include "mem.h"
+
+static const int MaxFrames = 1000;   // frames built per workload
+static const double MinSeconds = 0.5; // each measurement runs at least this long
+
+static char* load_map(const char* path, int* nrows, int* ncols);
+static int build_walk(const char* map, int nrows, int ncols, char** frames);
+static int build_flip(const char* map, int nrows, int ncols, char** frames);
+static double bench_render(char** frames, int nframes, int nrows, int ncols);
+static double bench_redraw(char** frames, int nframes, int nrows, int ncols);
+static void old_displayMap(const char* display, int nrows, int ncols);
+static double now(void);
+
+int main(int argc, char* argv[])
+{
+  const char* path = argc > 1 ? argv[1] : "../maps/big.txt";
+  int nrows, ncols;
+  char* map = load_map(path, &nrows, &ncols);
+  if (map == NULL) {
+    fprintf(stderr, "%s: cannot read map\n", path);
+    return 1;
+  }
+
+  // a dummy terminal big enough for the map and the status line
+  FILE* out = fopen("/dev/null", "w");
+  FILE* in = fopen("/dev/null", "r");
+  const char* term = getenv("TERM") != NULL ? getenv("TERM") : "xterm";
+  SCREEN* screen = newterm(term, out, in);
+  if (screen == NULL) {
+    fprintf(stderr, "cannot open a dummy terminal of type %s\n", term);
+    return 1;
+  }
+  resize_term(nrows + 1, ncols);
+
+  char** frames = mem_assert(calloc(MaxFrames, sizeof(char*)), "Failed to allocate memory for frames.");
+  double results[2][2];
+  int nframes = build_walk(map, nrows, ncols, frames);
+  results[0][0] = bench_render(frames, nframes, nrows, ncols);
+  results[0][1] = bench_redraw(frames, nframes, nrows, ncols);
+  for (int k = 0; k < nframes; k++) {
+    free(frames[k]);
+  }
+  nframes = build_flip(map, nrows, ncols, frames);
+  results[1][0] = bench_render(frames, nframes, nrows, ncols);
+  results[1][1] = bench_redraw(frames, nframes, nrows, ncols);
+  for (int k = 0; k < nframes; k++) {
+    free(frames[k]);
+  }
+
+  endwin();
+  delscreen(screen);
+  fclose(out);
+  fclose(in);
+
+  printf("%s: %d x %d, %d bytes per DISPLAY\n", path, nrows, ncols, nrows * (ncols + 1) + 8);
+  printf("%-6s %14s %14s %8s\n", "frames", "render fps", "redraw fps", "speedup");
+  const char* names[2] = {"walk", "flip"};
+  for (int w = 0; w < 2; w++) {
+    printf("%-6s %14.0f %14.0f %7.1fx\n", names[w], results[w][0], results[w][1], results[w][0] / results[w][1]);
+  }
+  free(frames);
+  free(map);
+  return 0;
+}
+
+/* the map file as a DISPLAY payload: nrows lines of exactly ncols characters */
+static char* load_map(const char* path, int* nrows, int* ncols)
+{
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    return NULL;
+  }
+  int rows = 0, cols = 0, width = 0, c;
+  while ((c = fgetc(fp)) != EOF) {
+    if (c == '\n') {
+      rows++;
+      width = 0;
+    } else if (++width > cols) {
+      cols = width;
+    }
+  }
+  rows += (width > 0);
+  char* map = mem_assert(malloc((size_t)rows * (cols + 1) + 1), "Failed to allocate memory for map.");
+  memset(map, ' ', (size_t)rows * (cols + 1));
+  rewind(fp);
+  int row = 0, col = 0;
+  while ((c = fgetc(fp)) != EOF && row < rows) {
+    if (c == '\n') {
+      row++;
+      col = 0;
+    } else {
+      map[row * (cols + 1) + col++] = c;
+    }
+  }
+  for (row = 0; row < rows; row++) {
+    map[row * (cols + 1) + cols] = '\n';
+  }
+  map[rows * (cols + 1)] = '\0';
+  fclose(fp);
+  *nrows = rows;
+  *ncols = cols;
+  return map;
+}
+
+/* a player walking across the floor cells, one cell per frame */
+static int build_walk(const char* map, int nrows, int ncols, char** frames)
+{
+  size_t length = strlen(map) + 1;
+  int n = 0;
+  for (int i = 0; i < nrows && n < MaxFrames; i++) {
+    for (int j = 0; j < ncols && n < MaxFrames; j++) {
+      if (map[i * (ncols + 1) + j] == '.') {
+        frames[n] = mem_assert(malloc(length), "Failed to allocate memory for frame.");
+        memcpy(frames[n], map, length);
+        frames[n][i * (ncols + 1) + j] = '@';
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+/* the map and its negative, alternately: every cell changes every frame */
+static int build_flip(const char* map, int nrows, int ncols, char** frames)
+{
+  size_t length = strlen(map) + 1;
+  for (int n = 0; n < 2; n++) {
+    frames[n] = mem_assert(malloc(length), "Failed to allocate memory for frame.");
+    memcpy(frames[n], map, length);
+    for (size_t k = 0; k + 1 < length; k++) {
+      if (n == 1 && frames[n][k] != '\n') {
+        frames[n][k] = frames[n][k] == ' ' ? '#' : ' ';
+      }
+    }
+  }
+  return 2;
+}
+
+/* frames per second with the renderer */
+static double bench_render(char** frames, int nframes, int nrows, int ncols)
+{
+  clear();
+  refresh();
+  render_t* render = render_new(nrows, ncols, 1);
+  long drawn = 0;
+  double start = now();
+  double elapsed;
+  do {
+    for (int k = 0; k < nframes; k++) {
+      render_frame(render, frames[k]);
+      refresh();
+    }
+    drawn += nframes;
+  } while ((elapsed = now() - start) < MinSeconds);
+  render_delete(render);
+  return drawn / elapsed;
+}
+
+/* frames per second with the client's previous full redraw */
+static double bench_redraw(char** frames, int nframes, int nrows, int ncols)
+{
+  clear();
+  refresh();
+  long drawn = 0;
+  double start = now();
+  double elapsed;
+  do {
+    for (int k = 0; k < nframes; k++) {
+      old_displayMap(frames[k], nrows + 1, ncols);
+    }
+    drawn += nframes;
+  } while ((elapsed = now() - start) < MinSeconds);
+  return drawn / elapsed;
+}
+
+/* displayMap as it was before render.c, for comparison (NROWS counts the status line) */
+static void old_displayMap(const char* display, int NROWS, int NCOLS)
+{
+  for (int row = 0; row < NROWS; row++) {
+    for (int col = 0; col < NCOLS; col++) {
+      move(row + 1, col);
+      int idx = row * (NCOLS + 1) + col;
+      if (idx < strlen(display)) {
+        addch(display[idx]);
+      } else {
+        addch(' ');
+      }
+    }
+  }
+  refresh();
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
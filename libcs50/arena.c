@@ -0,0 +1,211 @@
+/*
+ * arena.c - 'arena' module
+ *
+ * see arena.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "arena.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const size_t DefaultChunk = 64 * 1024;
+static const size_t Alignment = _Alignof(max_align_t);
+
+/**************** local types ****************/
+typedef struct chunk {
+  struct chunk* next;         // the chunk taken before this one
+  size_t size;                // bytes of data
+  size_t used;                // bytes of data handed out
+  max_align_t data[];         // the objects, suitably aligned
+} chunk_t;
+
+/**************** global types ****************/
+typedef struct arena {
+  chunk_t* head;              // the chunk objects are carved from; the rest are full
+  size_t chunkSize;           // data bytes in a regular chunk
+  void* last;                 // the most recent object in head, which may grow in place
+  size_t bytes;               // taken from malloc
+  int chunks;
+} arena_t;
+
+/**************** local functions ****************/
+static chunk_t* chunk_new(arena_t* arena, const size_t size);
+static size_t roundUp(const size_t size);
+
+/**************** arena_new() ****************/
+/* see arena.h for description */
+arena_t*
+arena_new(const size_t chunkSize)
+{
+  arena_t* arena = mem_tmalloc("arena", sizeof(arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->head = NULL;
+  arena->chunkSize = roundUp(chunkSize > 0 ? chunkSize : DefaultChunk);
+  arena->last = NULL;
+  arena->bytes = sizeof(arena_t);
+  arena->chunks = 0;
+  return arena;
+}
+
+/**************** arena_alloc() ****************/
+/* see arena.h for description */
+void*
+arena_alloc(arena_t* arena, const size_t size)
+{
+  if (arena == NULL) {
+    return mem_tmalloc("heap", size);
+  }
+  size_t rounded = roundUp(size > 0 ? size : 1);
+  if (rounded > arena->chunkSize / 4) {
+    // a chunk of its own, behind the head, which stays the one to carve from
+    chunk_t* own = chunk_new(arena, rounded);
+    if (own == NULL) {
+      return NULL;
+    }
+    own->used = rounded;
+    if (arena->head != NULL) {
+      own->next = arena->head->next;
+      arena->head->next = own;
+    } else {
+      arena->head = own;
+      arena->last = NULL;
+    }
+    return own->data;
+  }
+  chunk_t* head = arena->head;
+  if (head == NULL || head->size - head->used < rounded) {
+    head = chunk_new(arena, arena->chunkSize);
+    if (head == NULL) {
+      return NULL;
+    }
+    head->next = arena->head;
+    arena->head = head;
+  }
+  void* p = (char*)head->data + head->used;
+  head->used += rounded;
+  arena->last = p;
+  return p;
+}
+
+/**************** arena_calloc() ****************/
+/* see arena.h for description */
+void*
+arena_calloc(arena_t* arena, const size_t nmemb, const size_t size)
+{
+  if (arena == NULL) {
+    return mem_tcalloc("heap", nmemb, size);
+  }
+  if (size != 0 && nmemb > (size_t)-1 / size) {
+    return NULL;
+  }
+  void* p = arena_alloc(arena, nmemb * size);
+  if (p != NULL) {
+    memset(p, 0, nmemb * size);
+  }
+  return p;
+}
+
+/**************** arena_grow() ****************/
+/* see arena.h for description */
+void*
+arena_grow(arena_t* arena, void* p, const size_t oldSize, const size_t newSize)
+{
+  if (arena == NULL) {
+    return mem_trealloc("heap", p, newSize);
+  }
+  if (p != NULL && p == arena->last) {
+    chunk_t* head = arena->head;
+    size_t start = (char*)p - (char*)head->data;
+    size_t rounded = roundUp(newSize > 0 ? newSize : 1);
+    if (rounded <= head->size - start) {
+      head->used = start + rounded;
+      return p;
+    }
+  }
+  void* q = arena_alloc(arena, newSize);
+  if (q != NULL && p != NULL) {
+    memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+  }
+  return q;
+}
+
+/**************** arena_strdup() ****************/
+/* see arena.h for description */
+char*
+arena_strdup(arena_t* arena, const char* s)
+{
+  size_t length = strlen(s) + 1;
+  char* copy = arena_alloc(arena, length);
+  if (copy != NULL) {
+    memcpy(copy, s, length);
+  }
+  return copy;
+}
+
+/**************** arena_free() ****************/
+/* see arena.h for description */
+void
+arena_free(arena_t* arena, void* p)
+{
+  if (arena == NULL) {
+    mem_tfree(p);
+  }
+}
+
+/**************** arena_bytes() ****************/
+/* see arena.h for description */
+size_t
+arena_bytes(const arena_t* arena, int* chunks)
+{
+  if (chunks != NULL) {
+    *chunks = arena != NULL ? arena->chunks : 0;
+  }
+  return arena != NULL ? arena->bytes : 0;
+}
+
+/**************** arena_delete() ****************/
+/* see arena.h for description */
+void
+arena_delete(arena_t* arena)
+{
+  if (arena != NULL) {
+    for (chunk_t* chunk = arena->head; chunk != NULL; ) {
+      chunk_t* next = chunk->next;
+      mem_tfree(chunk);
+      chunk = next;
+    }
+    mem_tfree(arena);
+  }
+}
+
+/**************** chunk_new ****************/
+/* Take a chunk of size data bytes from malloc, and count it in the arena */
+static chunk_t*
+chunk_new(arena_t* arena, const size_t size)
+{
+  chunk_t* chunk = mem_tmalloc("arena", sizeof(chunk_t) + size);
+  if (chunk != NULL) {
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->bytes += sizeof(chunk_t) + size;
+    arena->chunks++;
+  }
+  return chunk;
+}
+
+/**************** roundUp ****************/
+/* Round size up to a multiple of the alignment */
+static size_t
+roundUp(const size_t size)
+{
+  return (size + Alignment - 1) / Alignment * Alignment;
+}
@@ -0,0 +1,101 @@
+/*
+ * arena.h - header file for 'arena' module
+ *
+ * An 'arena' hands out memory for objects that all live and die together:
+ * it carves them, one after another, out of a few large chunks it takes
+ * from malloc, and gives all of them back at once when it is deleted.
+ * There is no freeing of single objects; an object that is no longer
+ * needed stays in the arena until the arena goes.
+ *
+ * Every function also takes a NULL arena, and then falls back to plain
+ * malloc, realloc and free, so that a module can keep one code path
+ * for objects that live in an arena and objects that live on their own.
+ *
+ * An arena is not safe to share between threads.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**************** global types ****************/
+typedef struct arena arena_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** arena_new ****************/
+/* Create a new (empty) arena.
+ *
+ * Caller provides:
+ *   the size of the chunks to take from malloc, in bytes; 0 for a default of 64KB.
+ * We return:
+ *   pointer to a new arena, or NULL if error.
+ * We guarantee:
+ *   no chunk is allocated until the first object is.
+ * Caller is responsible for:
+ *   later calling arena_delete.
+ */
+arena_t* arena_new(const size_t chunkSize);
+
+/**************** arena_alloc ****************/
+/* Allocate size bytes in the arena.
+ *
+ * Caller provides:
+ *   an arena, or NULL for malloc; and a size in bytes.
+ * We return:
+ *   pointer to the space, aligned for any type, or NULL if error.
+ * Notes:
+ *   the space is not initialized.
+ *   an object larger than a quarter of a chunk gets a chunk of its own,
+ *   so that big objects do not waste the rest of the current chunk.
+ */
+void* arena_alloc(arena_t* arena, const size_t size);
+
+/**************** arena_calloc ****************/
+/* Like arena_alloc, for nmemb objects of the given size, zero-filled.
+ */
+void* arena_calloc(arena_t* arena, const size_t nmemb, const size_t size);
+
+/**************** arena_grow ****************/
+/* Resize the space at p, like realloc.
+ *
+ * Caller provides:
+ *   an arena, or NULL for realloc; space p allocated from that arena
+ *   (or NULL), its current size, and the size wanted.
+ * We return:
+ *   pointer to the resized space, holding the first oldSize bytes of p,
+ *   or NULL if error (p is then unchanged).
+ * Notes:
+ *   the most recent object in the arena grows in place when its chunk has
+ *   room; anything else is copied, and the old space stays in the arena
+ *   until it is deleted, so grow geometrically.
+ */
+void* arena_grow(arena_t* arena, void* p, const size_t oldSize, const size_t newSize);
+
+/**************** arena_strdup ****************/
+/* Copy string s into the arena; return the copy, or NULL if error.
+ */
+char* arena_strdup(arena_t* arena, const char* s);
+
+/**************** arena_free ****************/
+/* Free space p if arena is NULL (p came from malloc); otherwise do nothing,
+ * as the space goes with the arena.
+ */
+void arena_free(arena_t* arena, void* p);
+
+/**************** arena_bytes ****************/
+/* Return the bytes the arena has taken from malloc, and, if chunks is
+ * not NULL, put there how many chunks that is.
+ */
+size_t arena_bytes(const arena_t* arena, int* chunks);
+
+/**************** arena_delete ****************/
+/* Free the arena, and every object in it, at once; NULL is ignored.
+ */
+void arena_delete(arena_t* arena);
+
+#endif // __ARENA_H
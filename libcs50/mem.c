@@ -8,11 +8,20 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Tagged variants that profile allocations per call site and tag.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
+#define _POSIX_C_SOURCE 200809L   // for sigaction and clock_gettime
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
 #include "mem.h"
 
 /**************** file-local global variables ****************/
@@ -21,6 +30,67 @@ static int nmalloc = 0;         // number of successful malloc calls
 static int nfree = 0;           // number of free calls
 static int nfreenull = 0;       // number of free(NULL) calls
 
+/**************** file-local types ****************/
+// what the blocks of one call site, or one tag, did
+typedef struct profile {
+  atomic_llong allocs;          // blocks allocated
+  atomic_llong frees;           // blocks freed
+  atomic_llong bytes;           // bytes allocated, in all
+  atomic_llong live;            // bytes allocated and not yet freed
+  atomic_llong peak;            // most bytes live at once
+  atomic_llong lifetime;        // nanoseconds the freed blocks lived, in all
+  atomic_llong longest;         // nanoseconds the longest-lived of them lived
+} profile_t;
+
+// a slot of the table of call sites or of tags
+typedef struct entry {
+  atomic_int state;             // Empty, Claimed (being filled in) or Ready
+  const char* tag;
+  const char* file;             // NULL for a tag
+  const char* func;
+  int line;
+  struct entry* tagEntry;       // for a call site, the entry of its tag
+  profile_t profile;
+} entry_t;
+
+// in front of every block allocated while profiling
+typedef union header {
+  struct {
+    entry_t* site;              // where it was allocated
+    size_t size;
+    long long born;             // nanoseconds
+  } h;
+  max_align_t align;            // keeps the block after it aligned
+} header_t;
+
+enum { Empty, Claimed, Ready };
+enum { MaxSites = 1024, MaxTags = 64 };
+
+/**************** file-local global variables, for profiling ****************/
+static bool profiling = false;  // set once, by mem_profile_start
+static atomic_bool unprofiled = false;  // a tagged block was allocated before that
+static FILE* profileFP = NULL;
+static volatile sig_atomic_t reportWanted = 0;  // set by SIGUSR1
+static entry_t sites[MaxSites];
+static entry_t tags[MaxTags];
+static entry_t otherTag = { Ready, "(other)", NULL, NULL, 0, NULL };  // when tags is full
+static entry_t otherSite = { Ready, "(other)", "(other)", "(other)", 0, &otherTag };  // when sites is full
+
+/**************** local functions ****************/
+static entry_t* lookup(entry_t* table, const int size, const char* tag,
+                       const char* file, const char* func, const int line);
+static entry_t* siteOf(const char* tag, const char* file,
+                       const char* func, const int line);
+static void countAlloc(entry_t* site, const size_t size);
+static void countFree(const header_t* header);
+static void raiseTo(atomic_llong* max, const long long value);
+static long long now(void);
+static void pollReport(void);
+static void reportAtExit(void);
+static void wantReport(int sig);
+static void printProfiles(FILE* fp, entry_t* table, const int size, bool isSite);
+static int busier(const void* a, const void* b);
+
 
 /**************** mem_assert ****************/
 /* see mem.h for description */
@@ -125,3 +195,312 @@ mem_net(void)
 {
   return nmalloc - nfree - nfreenull;
 }
+
+/**************** mem_profile_malloc() ****************/
+/* see mem.h for description */
+void*
+mem_profile_malloc(const char* tag, const size_t size,
+                   const char* file, const char* func, const int line)
+{
+  if (!profiling) {
+    atomic_store_explicit(&unprofiled, true, memory_order_relaxed);
+    return malloc(size);
+  }
+  pollReport();
+  if (size > (size_t)-1 - sizeof(header_t)) {
+    return NULL;
+  }
+  header_t* header = malloc(sizeof(header_t) + size);
+  if (header == NULL) {
+    return NULL;
+  }
+  entry_t* site = siteOf(tag, file, func, line);
+  header->h.site = site;
+  header->h.size = size;
+  header->h.born = now();
+  countAlloc(site, size);
+  return header + 1;
+}
+
+/**************** mem_profile_calloc() ****************/
+/* see mem.h for description */
+void*
+mem_profile_calloc(const char* tag, const size_t nmemb, const size_t size,
+                   const char* file, const char* func, const int line)
+{
+  if (!profiling) {
+    atomic_store_explicit(&unprofiled, true, memory_order_relaxed);
+    return calloc(nmemb, size);
+  }
+  if (size != 0 && nmemb > (size_t)-1 / size) {
+    return NULL;
+  }
+  void* ptr = mem_profile_malloc(tag, nmemb * size, file, func, line);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_profile_realloc() ****************/
+/* see mem.h for description */
+void*
+mem_profile_realloc(const char* tag, void* ptr, const size_t size,
+                    const char* file, const char* func, const int line)
+{
+  if (!profiling) {
+    atomic_store_explicit(&unprofiled, true, memory_order_relaxed);
+    return realloc(ptr, size);
+  }
+  if (ptr == NULL) {
+    return mem_profile_malloc(tag, size, file, func, line);
+  }
+  pollReport();
+  if (size > (size_t)-1 - sizeof(header_t)) {
+    return NULL;
+  }
+  // a resize counts as freeing the old block and allocating a new one here
+  header_t old = *((header_t*)ptr - 1);
+  header_t* header = realloc((header_t*)ptr - 1, sizeof(header_t) + size);
+  if (header == NULL) {
+    return NULL;
+  }
+  countFree(&old);
+  entry_t* site = siteOf(tag, file, func, line);
+  header->h.site = site;
+  header->h.size = size;
+  header->h.born = now();
+  countAlloc(site, size);
+  return header + 1;
+}
+
+/**************** mem_profile_free() ****************/
+/* see mem.h for description */
+void
+mem_profile_free(void* ptr)
+{
+  if (!profiling) {
+    free(ptr);
+    return;
+  }
+  pollReport();
+  if (ptr != NULL) {
+    header_t* header = (header_t*)ptr - 1;
+    countFree(header);
+    free(header);
+  }
+}
+
+/**************** mem_profile_start() ****************/
+/* see mem.h for description */
+bool
+mem_profile_start(FILE* fp)
+{
+  if (profiling) {
+    return true;
+  }
+  if (atomic_load(&unprofiled)) {
+    return false;               // those blocks have no header
+  }
+  profileFP = fp;
+  profiling = true;
+  atexit(reportAtExit);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = wantReport;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, NULL);
+  return true;
+}
+
+/**************** mem_profile_report() ****************/
+/* see mem.h for description */
+void
+mem_profile_report(FILE* fp)
+{
+  if (!profiling) {
+    return;
+  }
+  fprintf(fp, "Allocation profile (lifetimes in microseconds):\n");
+  fprintf(fp, "%-50s %9s %9s %12s %10s %10s %10s %10s\n", "tag",
+          "allocs", "frees", "bytes", "live", "peak", "mean life", "max life");
+  printProfiles(fp, tags, MaxTags, false);
+  fprintf(fp, "%-50s %9s %9s %12s %10s %10s %10s %10s\n", "call site",
+          "allocs", "frees", "bytes", "live", "peak", "mean life", "max life");
+  printProfiles(fp, sites, MaxSites, true);
+  fflush(fp);
+}
+
+/**************** lookup ****************/
+/* Find the entry for a call site (file and line) or, if file is NULL,
+ * for a tag, in an open-addressed table; claim a slot for it, and find
+ * the entry of its tag, the first time.  Return NULL if the table is full.
+ */
+static entry_t*
+lookup(entry_t* table, const int size, const char* tag,
+       const char* file, const char* func, const int line)
+{
+  const char* key = file != NULL ? file : tag;
+  unsigned long hash = line;
+  for (const char* c = key; *c != '\0'; c++) {
+    hash = hash * 31 + (unsigned char)*c;
+  }
+  for (int probe = 0; probe < size; probe++) {
+    entry_t* entry = &table[(hash + probe) % size];
+    int state = atomic_load(&entry->state);
+    if (state == Empty) {
+      if (atomic_compare_exchange_strong(&entry->state, &state, Claimed)) {
+        entry->tag = tag;
+        entry->file = file;
+        entry->func = func;
+        entry->line = line;
+        if (file != NULL) {
+          entry_t* tagEntry = lookup(tags, MaxTags, tag, NULL, NULL, 0);
+          entry->tagEntry = tagEntry != NULL ? tagEntry : &otherTag;
+        }
+        atomic_store(&entry->state, Ready);
+        return entry;
+      }
+    }
+    while (state == Claimed) {
+      state = atomic_load(&entry->state); // another thread is filling it in
+    }
+    const char* other = file != NULL ? entry->file : entry->tag;
+    if (entry->line == line && strcmp(other, key) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**************** siteOf ****************/
+/* The entry for a call site, or the catch-all one if there are too many */
+static entry_t*
+siteOf(const char* tag, const char* file, const char* func, const int line)
+{
+  entry_t* site = lookup(sites, MaxSites, tag, file, func, line);
+  return site != NULL ? site : &otherSite;
+}
+
+/**************** countAlloc ****************/
+/* Count a block of size bytes allocated at site, under its tag too */
+static void
+countAlloc(entry_t* site, const size_t size)
+{
+  profile_t* profiles[] = { &site->profile, &site->tagEntry->profile };
+  for (int k = 0; k < 2; k++) {
+    profile_t* p = profiles[k];
+    atomic_fetch_add(&p->allocs, 1);
+    atomic_fetch_add(&p->bytes, size);
+    raiseTo(&p->peak, atomic_fetch_add(&p->live, size) + size);
+  }
+}
+
+/**************** countFree ****************/
+/* Count the block behind header as freed, at its site and under its tag */
+static void
+countFree(const header_t* header)
+{
+  long long age = now() - header->h.born;
+  entry_t* site = header->h.site;
+  profile_t* profiles[] = { &site->profile, &site->tagEntry->profile };
+  for (int k = 0; k < 2; k++) {
+    profile_t* p = profiles[k];
+    atomic_fetch_add(&p->frees, 1);
+    atomic_fetch_sub(&p->live, header->h.size);
+    atomic_fetch_add(&p->lifetime, age);
+    raiseTo(&p->longest, age);
+  }
+}
+
+/**************** raiseTo ****************/
+/* Raise *max to value, if value is larger */
+static void
+raiseTo(atomic_llong* max, const long long value)
+{
+  long long old = atomic_load(max);
+  while (value > old && !atomic_compare_exchange_weak(max, &old, value)) {
+    // old now holds what another thread put there; try again
+  }
+}
+
+/**************** now ****************/
+/* A monotonic time in nanoseconds */
+static long long
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**************** pollReport ****************/
+/* Print the report a SIGUSR1 asked for; a signal handler cannot */
+static void
+pollReport(void)
+{
+  if (reportWanted) {
+    reportWanted = 0;
+    mem_profile_report(profileFP);
+  }
+}
+
+/**************** reportAtExit ****************/
+static void
+reportAtExit(void)
+{
+  mem_profile_report(profileFP);
+}
+
+/**************** wantReport ****************/
+/* SIGUSR1 handler */
+static void
+wantReport(int sig)
+{
+  reportWanted = 1;
+}
+
+/**************** printProfiles ****************/
+/* Print one line per entry of a table, busiest first */
+static void
+printProfiles(FILE* fp, entry_t* table, const int size, bool isSite)
+{
+  entry_t* ready[MaxSites + 1];
+  int n = 0;
+  for (int i = 0; i < size; i++) {
+    if (atomic_load(&table[i].state) == Ready) {
+      ready[n++] = &table[i];
+    }
+  }
+  entry_t* other = isSite ? &otherSite : &otherTag;
+  if (atomic_load(&other->profile.allocs) > 0) {
+    ready[n++] = other;
+  }
+  qsort(ready, n, sizeof(entry_t*), busier);
+  for (int i = 0; i < n; i++) {
+    entry_t* e = ready[i];
+    char label[51];
+    if (isSite) {
+      snprintf(label, sizeof(label), "%s:%d %s [%s]", e->file, e->line, e->func, e->tagEntry->tag);
+    } else {
+      snprintf(label, sizeof(label), "%s", e->tag);
+    }
+    long long frees = atomic_load(&e->profile.frees);
+    fprintf(fp, "%-50s %9lld %9lld %12lld %10lld %10lld %10.1f %10.1f\n", label,
+            atomic_load(&e->profile.allocs), frees, atomic_load(&e->profile.bytes),
+            atomic_load(&e->profile.live), atomic_load(&e->profile.peak),
+            frees > 0 ? atomic_load(&e->profile.lifetime) / 1e3 / frees : 0.0,
+            atomic_load(&e->profile.longest) / 1e3);
+  }
+}
+
+/**************** busier ****************/
+/* qsort comparator: the entry with more allocations first */
+static int
+busier(const void* a, const void* b)
+{
+  long long na = atomic_load(&(*(entry_t**)a)->profile.allocs);
+  long long nb = atomic_load(&(*(entry_t**)b)->profile.allocs);
+  return (na < nb) - (na > nb);
+}
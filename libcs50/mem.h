@@ -14,6 +14,11 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. An opt-in allocation profiler: tagged replacements for malloc(),
+ *    calloc(), realloc() and free() that, once mem_profile_start()
+ *    is called, record counts, bytes and lifetimes of the blocks
+ *    allocated at each call site and under each tag.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -22,6 +27,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 /**************** mem_assert **************************/
 /* If pointer p is NULL, print error message to stderr and die,
@@ -113,4 +119,67 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** mem_tmalloc() and friends ****************/
+/* Tagged replacements for malloc(), calloc(), realloc() and free():
+ *   p = mem_tmalloc("frame", length + 1);
+ *   ...
+ *   mem_tfree(p);
+ * Caller provides:
+ *   a tag naming what the block is for (a string that outlives the
+ *   program's last report, normally a literal), and the usual arguments.
+ * We return:
+ *   what malloc(), calloc() and realloc() would.
+ * Notes:
+ *   unless mem_profile_start() has been called these are malloc() and
+ *   friends, and cost one test each.  While profiling, every block has
+ *   a small header in front of it, so a block from these must be
+ *   resized and freed with mem_trealloc() and mem_tfree(), never with
+ *   realloc() or free(), and vice versa.
+ *   the call site is the file, function and line where the macro is used.
+ *   safe to call from any thread.
+ */
+#define mem_tmalloc(tag, size) \
+  mem_profile_malloc((tag), (size), __FILE__, __func__, __LINE__)
+#define mem_tcalloc(tag, nmemb, size) \
+  mem_profile_calloc((tag), (nmemb), (size), __FILE__, __func__, __LINE__)
+#define mem_trealloc(tag, ptr, size) \
+  mem_profile_realloc((tag), (ptr), (size), __FILE__, __func__, __LINE__)
+#define mem_tfree(ptr) mem_profile_free(ptr)
+
+void* mem_profile_malloc(const char* tag, const size_t size,
+                         const char* file, const char* func, const int line);
+void* mem_profile_calloc(const char* tag, const size_t nmemb, const size_t size,
+                         const char* file, const char* func, const int line);
+void* mem_profile_realloc(const char* tag, void* ptr, const size_t size,
+                          const char* file, const char* func, const int line);
+void mem_profile_free(void* ptr);
+
+/**************** mem_profile_start() ****************/
+/* Start profiling the tagged allocations.
+ * Caller provides:
+ *   a FILE open for writing, for the reports.
+ * We return:
+ *   true if profiling is on; false if a tagged block was already
+ *   allocated without profiling, which is then never turned on.
+ * We guarantee:
+ *   a report is printed at exit, and after every SIGUSR1, at the
+ *   first tagged allocation or free that follows it.
+ * Notes:
+ *   call it first thing in main, before any tagged allocation and
+ *   before any other thread is started; it cannot be turned off.
+ */
+bool mem_profile_start(FILE* fp);
+
+/**************** mem_profile_report() ****************/
+/* Print what the tagged allocations did so far, per tag and per call
+ * site: blocks allocated and freed, bytes allocated, bytes live now
+ * and at most, and how long the freed blocks lived, on average and
+ * at most.  Call sites are listed busiest first.
+ * Caller provides:
+ *   a FILE open for writing.
+ * Notes:
+ *   prints nothing unless profiling is on.
+ */
+void mem_profile_report(FILE* fp);
+
 #endif // __MEM_H
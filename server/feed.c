@@ -0,0 +1,217 @@
+/*
+ * feed.c - 'feed' module
+ *
+ * See feed.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for shm_open, ftruncate
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mem.h"
+#include "feed.h"
+
+/**************** file-local constants ****************/
+static const char Magic[8] = "NUGFEED1"; // the start of every feed, so a reader knows what it mapped
+
+/**************** file-local types ****************/
+/* The shared-memory object: this header, then FEED_SLOTS frames of frameSize bytes each.
+ * Everything a reader may find changing under it is atomic; the frames themselves are checked
+ * by the slot's sequence number instead, as usual for a seqlock.
+ */
+typedef struct slot
+{
+    atomic_ullong seq;  // 2n while the slot holds frame n; odd while the server writes it
+    atomic_int length;  // bytes in the frame, its NUL not included
+    atomic_int nuggets; // nuggets left when the frame was published
+} slot_t;
+
+typedef struct shared
+{
+    char magic[8];
+    size_t frameSize;      // bytes per frame, NUL included
+    atomic_ullong latest;  // number of the newest frame published; 0 before the first
+    atomic_int closed;     // the server has closed the feed
+    pid_t server;          // the server's process, so readers notice if it dies without closing
+    slot_t slots[FEED_SLOTS];
+} shared_t;
+
+typedef struct feed
+{
+    shared_t *shared;
+    size_t mapped;  // bytes mapped
+    char *name;     // the name to remove at the end; NULL for a reader
+} feed_t;
+
+/**************** local functions ****************/
+static char *slot_frame(shared_t *shared, unsigned long long n);
+
+feed_t *feed_create(const char *name, size_t frameSize)
+{
+    size_t mapped = sizeof(shared_t) + FEED_SLOTS * frameSize;
+    shm_unlink(name); // a stale feed would have the wrong size; readers still mapping it keep their copy
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        perror(name);
+        return NULL;
+    }
+    if (ftruncate(fd, mapped) != 0)
+    {
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    shared_t *shared = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays
+    if (shared == MAP_FAILED)
+    {
+        perror(name);
+        shm_unlink(name);
+        return NULL;
+    }
+    // the object starts zeroed: no frame yet, and every slot empty
+    shared->frameSize = frameSize;
+    shared->server = getpid();
+    memcpy(shared->magic, Magic, sizeof(Magic));
+
+    feed_t *feed = mem_assert(mem_tmalloc("feed", sizeof(feed_t)), "Failed to allocate memory for feed.");
+    feed->shared = shared;
+    feed->mapped = mapped;
+    feed->name = mem_assert(mem_tmalloc("feed", strlen(name) + 1), "Failed to allocate memory for feed name.");
+    strcpy(feed->name, name);
+    return feed;
+}
+
+void feed_publish(feed_t *feed, const char *frame, int nuggets)
+{
+    shared_t *shared = feed->shared;
+    unsigned long long n = atomic_load_explicit(&shared->latest, memory_order_relaxed) + 1;
+    slot_t *slot = &shared->slots[n % FEED_SLOTS];
+    size_t length = strlen(frame);
+    if (length >= shared->frameSize)
+    {
+        length = shared->frameSize - 1; // cannot happen with frames of the map the feed was made for
+    }
+    // mark the slot as being written before the first byte of it changes
+    atomic_store_explicit(&slot->seq, 2 * n - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    char *data = slot_frame(shared, n);
+    memcpy(data, frame, length);
+    data[length] = '\0';
+    atomic_store_explicit(&slot->length, (int)length, memory_order_relaxed);
+    atomic_store_explicit(&slot->nuggets, nuggets, memory_order_relaxed);
+    // then mark it whole, and make it the newest
+    atomic_store_explicit(&slot->seq, 2 * n, memory_order_release);
+    atomic_store_explicit(&shared->latest, n, memory_order_release);
+}
+
+feed_t *feed_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        perror(name);
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(shared_t))
+    {
+        fprintf(stderr, "%s: not a feed\n", name);
+        close(fd);
+        return NULL;
+    }
+    size_t mapped = status.st_size;
+    shared_t *shared = mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED)
+    {
+        perror(name);
+        return NULL;
+    }
+    if (memcmp(shared->magic, Magic, sizeof(Magic)) != 0 || sizeof(shared_t) + FEED_SLOTS * shared->frameSize > mapped)
+    {
+        fprintf(stderr, "%s: not a feed\n", name);
+        munmap(shared, mapped);
+        return NULL;
+    }
+    feed_t *feed = mem_assert(mem_tmalloc("feed", sizeof(feed_t)), "Failed to allocate memory for feed.");
+    feed->shared = shared;
+    feed->mapped = mapped;
+    feed->name = NULL;
+    return feed;
+}
+
+size_t feed_frame_size(feed_t *feed)
+{
+    return feed->shared->frameSize;
+}
+
+long feed_read(feed_t *feed, long after, char *frame, int *nuggets)
+{
+    shared_t *shared = feed->shared;
+    while (true)
+    {
+        // closed first: a feed is closed after its last frame is published
+        bool closed = atomic_load_explicit(&shared->closed, memory_order_acquire);
+        unsigned long long n = atomic_load_explicit(&shared->latest, memory_order_acquire);
+        if ((long)n <= after)
+        {
+            bool gone = kill(shared->server, 0) != 0 && errno == ESRCH;
+            return closed || gone ? -1 : 0;
+        }
+        slot_t *slot = &shared->slots[n % FEED_SLOTS];
+        unsigned long long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != 2 * n)
+        {
+            continue; // the server is already writing a newer frame there
+        }
+        size_t length = atomic_load_explicit(&slot->length, memory_order_relaxed);
+        int gold = atomic_load_explicit(&slot->nuggets, memory_order_relaxed);
+        if (length >= shared->frameSize)
+        {
+            continue; // torn; the check below would throw it away anyway
+        }
+        memcpy(frame, slot_frame(shared, n), length);
+        frame[length] = '\0';
+        // keep the copy only if the server did not start on the slot meanwhile
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+        {
+            *nuggets = gold;
+            return n;
+        }
+    }
+}
+
+void feed_delete(feed_t *feed)
+{
+    if (feed == NULL)
+    {
+        return;
+    }
+    if (feed->name != NULL)
+    {
+        atomic_store_explicit(&feed->shared->closed, 1, memory_order_release);
+        shm_unlink(feed->name);
+        mem_tfree(feed->name);
+    }
+    munmap(feed->shared, feed->mapped);
+    mem_tfree(feed);
+}
+
+/* The frame in the slot that frame n goes in. */
+static char *slot_frame(shared_t *shared, unsigned long long n)
+{
+    return (char *)(shared + 1) + (n % FEED_SLOTS) * shared->frameSize;
+}
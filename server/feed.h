@@ -0,0 +1,103 @@
+/*
+ * feed.h - header file for 'feed' module
+ *
+ * A feed publishes the spectator's view of a game to other processes on the same host,
+ * through a POSIX shared-memory object, so local observers (a stream encoder, a recorder)
+ * need not be UDP spectators. The server writes each new spectator frame, with the nuggets
+ * left, once; any number of readers map the object read-only and copy out the newest frame,
+ * at no cost to the server whatever their number.
+ *
+ * Frames go round a ring of FEED_SLOTS slots, each guarded by a sequence number (a seqlock):
+ * it is odd while the server writes the slot, and a reader that sees it change while it copies
+ * the slot throws the copy away and tries again. A reader that falls behind skips frames;
+ * it never sees a torn one, and never slows the server down.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef FEED_H
+#define FEED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**************** constants ****************/
+#define FEED_SLOTS 4   // frames kept in the ring; a reader has three frames' time to copy one
+
+/**************** global types ****************/
+typedef struct feed feed_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/***************** feed_create *****************/
+/* Create a feed for the server to publish to.
+ *
+ * Caller provides:
+ *   the name of the shared-memory object ("/nuggets", say; see shm_open), and the
+ *   length of the longest frame it will publish, its NUL included.
+ * We guarantee:
+ *   returns the feed, or NULL (having printed why to stderr) if the object cannot be made.
+ *   an object left by an earlier server under the same name is replaced.
+ * Notes:
+ *   the object can be read by any local user; it holds what a spectator sees, nothing more.
+ *   the caller must call feed_delete, which removes the name.
+ */
+feed_t *feed_create(const char *name, size_t frameSize);
+
+/***************** feed_publish *****************/
+/* Publish a frame.
+ *
+ * Caller provides:
+ *   a feed made by feed_create, the frame (a NUL-terminated DISPLAY message at most
+ *   frameSize long), and the nuggets left in the game.
+ * We guarantee:
+ *   the frame becomes the newest one in the feed, numbered one more than the last.
+ *   costs one copy of the frame, however many readers there are.
+ */
+void feed_publish(feed_t *feed, const char *frame, int nuggets);
+
+/***************** feed_open *****************/
+/* Open a feed for reading.
+ *
+ * Caller provides:
+ *   the name the server gave feed_create.
+ * We guarantee:
+ *   returns the feed, mapped read-only, or NULL (having printed why to stderr)
+ *   if there is no such feed.
+ * Notes:
+ *   the caller must call feed_delete.
+ */
+feed_t *feed_open(const char *name);
+
+/***************** feed_frame_size *****************/
+/* Return the length of the longest frame in the feed, its NUL included;
+ * a buffer this long holds any frame feed_read copies out.
+ */
+size_t feed_frame_size(feed_t *feed);
+
+/***************** feed_read *****************/
+/* Copy out the newest frame, if it is newer than the one the reader has.
+ *
+ * Caller provides:
+ *   a feed opened with feed_open, the number of the newest frame the reader has (0 for none),
+ *   a buffer of feed_frame_size bytes, and where to put the nuggets left.
+ * We return:
+ *   the number of the frame copied into the buffer; or 0 if there is no newer frame yet;
+ *   or -1 if the server has closed the feed, or died, and there is no newer frame.
+ * Notes:
+ *   never waits for the server; frames published since the last call but the newest are skipped,
+ *   as the difference between the numbers shows.
+ */
+long feed_read(feed_t *feed, long after, char *frame, int *nuggets);
+
+/***************** feed_delete *****************/
+/* Unmap the feed and free it; NULL is ignored.
+ *
+ * Notes:
+ *   on the server's feed, first marks it closed, so readers stop, and removes its name;
+ *   readers that have it mapped keep what is there.
+ */
+void feed_delete(feed_t *feed);
+
+#endif // FEED_H
@@ -0,0 +1,89 @@
+/*
+ * feedread.c - read a server's spectator feed from shared memory
+ *
+ * Maps the feed a server started with --feed=NAME publishes (see feed.h), read-only,
+ * and prints each new frame it finds: a line "frame N: R nuggets left", then the frame
+ * itself unless --quiet. Frames published faster than the reader polls are skipped, and
+ * counted. Stops when the server closes the feed, or after --frames frames.
+ *
+ * Usage: ./feedread NAME [--frames=N] [--quiet] [--poll=MS]
+ *
+ *   --frames  stop after this many frames (default: when the server closes the feed)
+ *   --quiet   print only the line about each frame, not the frame
+ *   --poll    milliseconds to sleep when no new frame is there (default 1)
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for nanosleep
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "mem.h"
+#include "feed.h"
+
+int main(int argc, char* argv[])
+{
+    const char* name = NULL;
+    long frames = 0;
+    bool quiet = false;
+    int pollMs = 1;
+    for (int i = 1; i < argc; i++) {
+        char extra;
+        if (sscanf(argv[i], "--frames=%ld%c", &frames, &extra) == 1 && frames >= 0) {
+            continue;
+        }
+        if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+            continue;
+        }
+        if (sscanf(argv[i], "--poll=%d%c", &pollMs, &extra) == 1 && pollMs > 0) {
+            continue;
+        }
+        if (argv[i][0] != '-' && name == NULL) {
+            name = argv[i];
+            continue;
+        }
+        name = NULL;
+        break;
+    }
+    if (name == NULL) {
+        fprintf(stderr, "usage: %s NAME [--frames=N] [--quiet] [--poll=MS]\n", argv[0]);
+        return 1;
+    }
+
+    feed_t* feed = feed_open(name);
+    if (feed == NULL) {
+        return 2;
+    }
+    char* frame = mem_assert(malloc(feed_frame_size(feed)), "Error allocating frame");
+    struct timespec pause = { pollMs / 1000, (pollMs % 1000) * 1000000L };
+    long last = 0, read = 0, skipped = 0;
+    while (frames == 0 || read < frames) {
+        int nuggets;
+        long n = feed_read(feed, last, frame, &nuggets);
+        if (n < 0) {
+            break; // the server has gone
+        }
+        if (n == 0) {
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (last > 0) {
+            skipped += n - last - 1;
+        }
+        last = n;
+        read++;
+        printf("frame %ld: %d nuggets left\n", n, nuggets);
+        if (!quiet) {
+            fputs(frame, stdout);
+        }
+        fflush(stdout);
+    }
+    fprintf(stderr, "%ld frames read, %ld skipped\n", read, skipped);
+    free(frame);
+    feed_delete(feed);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * framebench.c - benchmark for DISPLAY frame compression
+ *
+ * For each map given on the command line, collects the DISPLAY frames a
+ * game would send: the spectator's frame, and the frames of a player
+ * walking at random for Steps moves, exploring the map as it goes.
+ * Each frame's map is compressed with the codec of support/codec.c and
+ * decompressed again (checking the round trip), and the benchmark prints
+ * the compression ratio, the encode and decode time per input byte, and how
+ * many frames need more than one Ethernet-sized datagram before and after.
+ *
+ * Usage: ./framebench map.txt...
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "grid.h"
+#include "player.h"
+#include "spectator.h"
+#include "codec.h"
+#include "mem.h"
+#include "message.h"
+
+static const int Steps = 200;          // moves of the walking player
+static const double MinSeconds = 0.2;  // each measurement runs at least this long
+static const int MaxPayload = 1472;    // UDP payload of a 1500-byte Ethernet frame
+
+typedef struct totals {
+    long frames;
+    long raw;        // bytes of the frames' maps
+    long packed;     // bytes once compressed
+    long bigRaw;     // frames over MaxPayload, sent raw
+    long bigPacked;  // frames over MaxPayload, compressed
+    double encodeNs; // time to encode all maps, in ns
+    double decodeNs;
+} totals_t;
+
+static int collect_frames(const char* path, char*** frames);
+static bool bench_frames(char** frames, int nframes, totals_t* totals);
+static void print_row(const char* name, const totals_t* t);
+static double now(void);
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s map.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    // collect every map's frames first, since loading a map prints to stdout
+    char*** frames = mem_assert(calloc(argc, sizeof(char**)), "Error allocating frame sets");
+    int* nframes = mem_assert(calloc(argc, sizeof(int)), "Error allocating frame counts");
+    for (int k = 1; k < argc; k++) {
+        nframes[k] = collect_frames(argv[k], &frames[k]);
+    }
+    printf("\n%-44s %6s %9s %9s %7s %9s %9s %9s\n", "map", "frames", "raw B", "packed B",
+           "ratio", "enc ns/B", "dec ns/B", ">1 dgram");
+    totals_t all = {0};
+    bool ok = true;
+    for (int k = 1; k < argc; k++) {
+        if (nframes[k] == 0) {
+            continue;
+        }
+        totals_t totals = {0};
+        ok = bench_frames(frames[k], nframes[k], &totals) && ok;
+        print_row(argv[k], &totals);
+        all.frames += totals.frames;
+        all.raw += totals.raw;
+        all.packed += totals.packed;
+        all.bigRaw += totals.bigRaw;
+        all.bigPacked += totals.bigPacked;
+        all.encodeNs += totals.encodeNs;
+        all.decodeNs += totals.decodeNs;
+        for (int i = 0; i < nframes[k]; i++) {
+            free(frames[k][i]);
+        }
+        free(frames[k]);
+    }
+    free(frames);
+    free(nframes);
+    print_row("all", &all);
+    if (!ok) {
+        printf("round trip FAILED\n");
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* the spectator's frame and a walking player's frames for one map; returns how many */
+static int collect_frames(const char* path, char*** frames) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+    grid_t* grid = grid_load(file);
+    fclose(file);
+    grid_init_gold(grid);
+    grid_spawn_spectator(grid, message_noAddr());
+    grid_spawn_player(grid, message_noAddr(), "bench");
+    player_t* player = grid_getplayers(grid)[0];
+
+    *frames = mem_assert(calloc(Steps + 2, sizeof(char*)), "Error allocating frames");
+    int n = 0;
+    (*frames)[n++] = grid_send_state_spectator(grid, false);
+    (*frames)[n++] = grid_send_state(grid, player);
+    static const int moves[8][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, 1}, {1, 1}, {-1, -1}, {1, -1}};
+    int dir = 0;
+    for (int step = 0; step < Steps; step++) {
+        // keep going one way until blocked, then pick another way
+        if (!player_move(player, grid, moves[dir][0], moves[dir][1])) {
+            dir = rand() % 8;
+        }
+        (*frames)[n++] = grid_send_state(grid, player);
+    }
+    grid_delete(grid); // the player with it
+    return n;
+}
+
+/* compress and decompress every frame's map; false if any round trip fails */
+static bool bench_frames(char** frames, int nframes, totals_t* totals) {
+    size_t header = strlen(GRID_FRAME_HEADER);
+    size_t maxLength = 0;
+    for (int i = 0; i < nframes; i++) {
+        size_t length = strlen(frames[i]) - header;
+        maxLength = length > maxLength ? length : maxLength;
+    }
+    char* packed = mem_assert(malloc(codec_bound(maxLength)), "Error allocating packed buffer");
+    char* unpacked = mem_assert(malloc(maxLength + 1), "Error allocating unpacked buffer");
+
+    bool ok = true;
+    for (int i = 0; i < nframes; i++) {
+        const char* map = frames[i] + header;
+        size_t length = strlen(map);
+        size_t n = codec_encode(map, length, packed);
+        if (n == 0 || codec_decode(packed, n, unpacked, maxLength + 1) != length
+            || memcmp(map, unpacked, length) != 0) {
+            ok = false;
+        }
+        totals->frames++;
+        totals->raw += length;
+        totals->packed += n;
+        totals->bigRaw += header + length > MaxPayload;
+        totals->bigPacked += header + 1 + n > MaxPayload;
+    }
+
+    // time the whole set of frames, repeated until MinSeconds have passed
+    long rounds = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < nframes; i++) {
+            const char* map = frames[i] + header;
+            codec_encode(map, strlen(map), packed);
+        }
+        rounds++;
+    } while ((elapsed = now() - start) < MinSeconds);
+    totals->encodeNs = elapsed * 1e9 / rounds;
+
+    rounds = 0;
+    start = now();
+    do {
+        for (int i = 0; i < nframes; i++) {
+            const char* map = frames[i] + header;
+            size_t n = codec_encode(map, strlen(map), packed);
+            codec_decode(packed, n, unpacked, maxLength + 1);
+        }
+        rounds++;
+    } while ((elapsed = now() - start) < MinSeconds);
+    totals->decodeNs = elapsed * 1e9 / rounds - totals->encodeNs;
+
+    free(packed);
+    free(unpacked);
+    return ok;
+}
+
+static void print_row(const char* name, const totals_t* t) {
+    printf("%-44s %6ld %9ld %9ld %6.1fx %9.2f %9.2f %4ld/%-4ld\n", name, t->frames, t->raw, t->packed,
+           t->packed > 0 ? (double)t->raw / t->packed : 0.0,
+           t->raw > 0 ? t->encodeNs / t->raw : 0.0, t->raw > 0 ? t->decodeNs / t->raw : 0.0,
+           t->bigRaw, t->bigPacked);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -15,30 +15,52 @@
 #include "player.h"
 #include "spectator.h"
 #include "mem.h"
+#include "hashtable.h"
 #include "message.h"
+#include "outbox.h"
 #include "log.h"
+#include "visibility.h"
+#include "tiles.h"
+#include "arena.h"
 
-static bool grid_hasplayerat(grid_t *grid, int x, int y);
+static void grid_overlay_gold(grid_t *grid, char *body, player_t *viewer, int top, int left, int rows, int cols);
+static void grid_overlay_players(grid_t *grid, char *body, player_t *viewer, int top, int left, int rows, int cols, char *legend);
+static char *grid_new_legend(grid_t *grid, bool wanted);
+static char *grid_add_legend(char *message, char *legend);
+static void grid_start_round(grid_t *grid);
+
+static const int SessionSlots = 257; // slots of the address -> player table
 
 typedef struct grid
 {
+    arena_t *arena;     // the map, what is built from it, and the spectator: kept from round to round
+    arena_t *round;     // the players, gold and occupants of the current round; grid_new_round replaces it
     char **cells;
-    int **nuggets;
+    tiles_t *nuggets;   // int per cell: the size of the pile there, or 0
     player_t **players;
-    int *rows;
-    int *columns;
-    int *playerCount;
-    int *spectatorCount;
-    int *nuggetCount;
-    spectator_t **spectator;
+    int playerCapacity; // slots allocated in players; grows as players join
+    int maxPlayers;     // players the game takes
+    tiles_t *occupants; // int per cell: index of the active player there, or -1
+    hashtable_t *sessions; // the player who joined from each address, keyed by message_stringAddr
+    int rows;
+    int columns;
+    int playerCount;
+    int spectatorCount;
+    int nuggetCount;
+    spectator_t *spectator; // reused by each new spectator; NULL until the first
+    vismap_t *vismap;
+    char *mapFrame;   // DISPLAY frame of the bare map, shared by every spectator render
+    int *piles;       // indices (row * columns + col) of the cells holding gold
+    int pileCount;
+    int pileCapacity;
+    bool spectatorDirty; // the spectator's frame may have changed since it was last sent
 } grid_t;
 
 grid_t *grid_load(FILE *file)
 {
-    grid_t *grid = (grid_t *)mem_assert(malloc(sizeof(grid_t)), "Error allocating space for grid\n");
-
-    grid->rows = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for rows\n");
-    grid->columns = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for columns\n");
+    arena_t *arena = mem_assert(arena_new(0), "Error allocating space for game arena\n");
+    grid_t *grid = (grid_t *)mem_assert(arena_alloc(arena, sizeof(grid_t)), "Error allocating space for grid\n");
+    grid->arena = arena;
 
     int rows = 0;
     int cols = 0;
@@ -74,61 +96,85 @@ grid_t *grid_load(FILE *file)
     }
 
     // Assign the determined rows and columns to the grid structure
-    *(grid->rows) = rows;
-    *(grid->columns) = max_cols;
-
-    // Allocate memory for the grid cells
-    grid->cells = (char **)mem_assert(calloc(*grid->rows, sizeof(char *)), "Error allocating space for cells");
-
-    // Allocate memory for each row of grid cells
-    for (int i = 0; i < *grid->rows; i++)
-    {
-        grid->cells[i] = (char *)mem_assert(calloc(*grid->columns, sizeof(char)), "Error allocating space for cells row\n");
-    }
-
-    // Allocate memory for the nugget counts
-    grid->nuggets = (int **)mem_assert(calloc(*grid->rows, sizeof(int *)), "Error allocating space for nuggets\n");
+    grid->rows = rows;
+    grid->columns = max_cols;
 
-    for (int i = 0; i < *grid->rows; i++)
+    // Allocate memory for the grid cells, all the rows in one block
+    grid->cells = (char **)mem_assert(arena_alloc(arena, rows * sizeof(char *)), "Error allocating space for cells");
+    char *block = (char *)mem_assert(arena_alloc(arena, (size_t)rows * max_cols), "Error allocating space for cells rows\n");
+    for (int i = 0; i < rows; i++)
     {
-        grid->nuggets[i] = (int *)mem_assert(calloc(*grid->columns, sizeof(int)), "Error allocating space for nuggets row\n");
-        for (int j = 0; j < *grid->columns; j++)
-        {
-            grid->nuggets[i][j] = 0;
-        }
+        grid->cells[i] = block + (size_t)i * max_cols;
     }
 
     rewind(file); // Reset file pointer to the beginning of the file
 
     // Read the map file line by line and parse each character to form the grid
-    for (int i = 0; i < *grid->rows; i++)
+    for (int i = 0; i < grid->rows; i++)
     {
         int j = 0;
         while ((c = fgetc(file)) != EOF && c != '\n')
         {
-            if (j < *grid->columns)
+            if (j < grid->columns)
             {
                 grid->cells[i][j] = c;
                 j++;
             }
         }
         // Fill any remaining cells in the row with the default character if the row is shorter than max_cols
-        for (; j < *grid->columns; j++)
+        for (; j < grid->columns; j++)
         {
             grid->cells[i][j] = ' ';
         }
     }
 
-    grid->playerCount = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for playerCount\n");
-    grid->nuggetCount = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for nuggetCount\n");
-    grid->spectatorCount = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for spectatorCount\n");
-    grid->players = (player_t **)mem_assert(calloc(26, sizeof(player_t *)), "Error allocating space for players\n");
-    grid->spectator = (spectator_t **)mem_assert(calloc(1, sizeof(spectator_t *)), "Error allocating space for spectator\n");
-    *grid->playerCount = 0;
-    *grid->spectatorCount = 0;
+    grid->vismap = visibility_map_new(arena, grid->cells, grid->rows, grid->columns);
+
+    // Build the static map layer once; spectator frames start as a copy of it
+    grid->mapFrame = (char *)mem_assert(arena_alloc(arena, GRID_FRAME_LENGTH(grid->rows, grid->columns)), "Error allocating space for map frame\n");
+    strcpy(grid->mapFrame, GRID_FRAME_HEADER);
+    for (int i = 0; i < grid->rows; i++)
+    {
+        memcpy(grid->mapFrame + GRID_FRAME_OFFSET(grid->columns, i, 0), grid->cells[i], grid->columns);
+        grid->mapFrame[GRID_FRAME_OFFSET(grid->columns, i, grid->columns)] = '\n';
+    }
+    grid->mapFrame[GRID_FRAME_LENGTH(grid->rows, grid->columns) - 1] = '\0';
+    grid->maxPlayers = GRID_DEFAULT_MAXPLAYERS;
+    grid->spectator = NULL;
+    grid->spectatorCount = 0;
+    grid_start_round(grid);
     return grid; // Return the grid structure
 }
 
+void grid_new_round(grid_t *grid)
+{
+    hashtable_delete(grid->sessions, NULL);
+    arena_delete(grid->round); // the last round's players, gold and occupants, all at once
+    grid_start_round(grid);
+}
+
+/* Give the grid an empty round: no players, no gold, nobody on any cell, and no spectator watching. */
+static void grid_start_round(grid_t *grid)
+{
+    grid->round = mem_assert(arena_new(0), "Error allocating space for round arena\n");
+    // The nugget counts only take memory around the piles
+    int none = 0;
+    grid->nuggets = tiles_new(grid->round, grid->rows, grid->columns, sizeof(int), &none);
+    grid->piles = NULL;
+    grid->pileCount = 0;
+    grid->pileCapacity = 0;
+
+    grid->players = NULL;
+    grid->playerCapacity = 0;
+    int nobody = -1;
+    grid->occupants = tiles_new(grid->round, grid->rows, grid->columns, sizeof(int), &nobody);
+    grid->sessions = mem_assert(hashtable_new(SessionSlots), "Error allocating space for sessions\n");
+    grid->nuggetCount = 0;
+    grid->playerCount = 0;
+    grid->spectatorCount = 0;
+    grid->spectatorDirty = false;
+}
+
 void grid_init_gold(grid_t *grid)
 {
     int GoldTotal = 250;
@@ -136,9 +182,9 @@ void grid_init_gold(grid_t *grid)
     int GoldMaxNumPiles = 30;
 
     int ndots = 0;
-    for (int i = 0; i < *grid->rows; i++)
+    for (int i = 0; i < grid->rows; i++)
     {
-        for (int j = 0; j < *grid->columns; j++)
+        for (int j = 0; j < grid->columns; j++)
         {
             if (grid->cells[i][j] == '.')
             {
@@ -151,9 +197,9 @@ void grid_init_gold(grid_t *grid)
         fprintf(stderr, "Error: too few spots to place gold\n");
         exit(1);
     }
-    if (ndots < 26)
+    if (ndots < grid->maxPlayers)
     {
-        fprintf(stderr, "Error: grid cannot fit 26 players; it can only fit %d\n", ndots);
+        fprintf(stderr, "Error: grid cannot fit %d players; it can only fit %d\n", grid->maxPlayers, ndots);
         exit(1);
     }
     int numPiles = GoldMinNumPiles + rand() % ((ndots > GoldMaxNumPiles ? (GoldMaxNumPiles) : (ndots)) - GoldMinNumPiles + 1);
@@ -173,47 +219,26 @@ void grid_init_gold(grid_t *grid)
         int x, y;
         do
         {
-            x = rand() % *grid->rows;
-            y = rand() % *grid->columns;
-            if (grid->cells[x][y] == '.' && grid->nuggets[x][y] == 0)
+            x = rand() % grid->rows;
+            y = rand() % grid->columns;
+            if (grid->cells[x][y] == '.' && grid_getnuggets(grid, x, y) == 0)
             {
                 val = piles[i];
-                grid->nuggets[x][y] = val;
+                grid_setnuggets(grid, x, y, val);
                 break;
             }
         } while (true);
     }
     printf("\n");
-    *grid->nuggetCount = numPiles;
+    grid->nuggetCount = numPiles;
 }
 
 void grid_delete(grid_t *grid)
 {
-    int i;
-    for (i = 0; i < *grid->rows; i++)
-    {
-        free(grid->cells[i]);
-    }
-    free(grid->cells);
-
-    for (i = 0; i < *grid->rows; i++)
-    {
-        free(grid->nuggets[i]);
-    }
-    free(grid->nuggets);
-
-    free(grid->nuggetCount);
-    free(grid->players);
-    if (*grid->spectatorCount == 1)
-    {
-        spectator_delete(grid->spectator[0]);
-    }
-    free(grid->playerCount);
-    free(grid->rows);    // Free the allocated memory for rows
-    free(grid->columns); // Free the allocated memory for columns
-    free(grid->spectator);
-    free(grid->spectatorCount);
-    free(grid);
+    hashtable_delete(grid->sessions, NULL);
+    // the players, gold and occupants live in the round's arena; the map, the spectator and the grid in the other
+    arena_delete(grid->round);
+    arena_delete(grid->arena);
 }
 
 void grid_spawn_player(grid_t *grid, const addr_t connection_info, char *real_name)
@@ -223,219 +248,368 @@ void grid_spawn_player(grid_t *grid, const addr_t connection_info, char *real_na
 
     while (1)
     {
-        x = rand() % *grid->rows;
-        y = rand() % *grid->columns;
-        if (grid->cells[x][y] == '.' && !(grid_hasplayerat(grid, x, y)))
+        x = rand() % grid->rows;
+        y = rand() % grid->columns;
+        if (grid->cells[x][y] == '.' && grid_getoccupant(grid, x, y) < 0)
         { // if its empty
             // ensure no existing player or gold there.
             // Place new player with new symbol
-            player_t *new_player = player_new(connection_info, real_name, x, y, *grid->rows, *grid->columns);
+            player_t *new_player = player_new(grid->round, connection_info, real_name, x, y, grid->rows, grid->columns);
             player_update_visibility(new_player, grid);
-            grid->players[*grid->playerCount] = new_player; // add the player to the player array
-            *grid->playerCount = *grid->playerCount + 1;
+            if (grid->playerCount == grid->playerCapacity)
+            {
+                int capacity = grid->playerCapacity == 0 ? 8 : 2 * grid->playerCapacity;
+                grid->players = (player_t **)mem_assert(arena_grow(grid->round, grid->players, grid->playerCapacity * sizeof(player_t *), capacity * sizeof(player_t *)), "Error allocating space for players\n");
+                grid->playerCapacity = capacity;
+            }
+            grid->players[grid->playerCount] = new_player; // add the player to the player array
+            grid_setoccupant(grid, x, y, grid->playerCount);
+            hashtable_insert(grid->sessions, message_stringAddr(connection_info), new_player); // keeps the first player from an address
+            grid->playerCount = grid->playerCount + 1;
+            grid_mark_changed(grid, x, y);
             break; // Exit the loop once a valid spot is found
         }
     }
 }
 
-void grid_spawn_spectator(grid_t *grid, spectator_t *spectator)
+void grid_spawn_spectator(grid_t *grid, const addr_t connection_info)
 {
-    if (*grid->spectatorCount == 1)
+    if (grid->spectatorCount == 1)
     {
-        spectator_quit(grid->spectator[0], grid);
+        spectator_quit(grid->spectator, grid);
     }
-    grid_setspectator(grid, spectator);
-    *grid->spectatorCount = 1;
+    if (grid->spectator == NULL)
+    {
+        grid->spectator = spectator_new(grid->arena, connection_info);
+    }
+    else
+    {
+        spectator_reset(grid->spectator, connection_info);
+    }
+    grid->spectatorCount = 1;
+    grid->spectatorDirty = true; // the new spectator needs a first frame
 }
 
 char *grid_send_state(grid_t *grid, player_t *player)
 {
-    char *message = mem_assert(malloc(((*grid->rows + 1) * (*grid->columns) + 10) * sizeof(char)), "Failed to allocate memory for message.");    strcpy(message, "DISPLAY\n");
-    char *moving_ptr = message + 8; // index to iterate through message string
-    int **visibility = player_get_visibility(player);
-    char **message_vis = (char **)mem_assert(calloc(*grid->rows, sizeof(char *)), "Error allocating space for message grid");
-    int k;
-    for (k = 0; k < *grid->rows; k++)
+    int length = GRID_FRAME_LENGTH(grid->rows, grid->columns);
+    char *message = mem_assert(mem_tmalloc("frame", length * sizeof(char)), "Failed to allocate memory for message.");
+    strcpy(message, GRID_FRAME_HEADER);
+    tiles_t *terrain = player_get_terrain(player);
+    for (int i = 0; i < grid->rows; i++)
     {
-        message_vis[k] = mem_assert(calloc(*grid->columns, sizeof(char)), "Error allocating space for player message");
+        tiles_copy_row(terrain, i, 0, grid->columns, message + GRID_FRAME_OFFSET(grid->columns, i, 0));
+        message[GRID_FRAME_OFFSET(grid->columns, i, grid->columns)] = '\n';
     }
-    int px, py;
-    for (k = 0; k < *grid->playerCount; k++)
+    message[length - 1] = '\0';
+
+    // gold is only shown where the player can currently see
+    char *body = message + GRID_FRAME_HEADER_LEN;
+    char *legend = grid_new_legend(grid, player_get_haslegend(player));
+    grid_overlay_gold(grid, body, player, 0, 0, grid->rows, grid->columns);
+    grid_overlay_players(grid, body, player, 0, 0, grid->rows, grid->columns, legend);
+    int px = player_get_x(player);
+    int py = player_get_y(player);
+    if (player_get_visibility(player, px, py) == 1)
     {
-        if (player_get_isactive(grid->players[k]))
-        {
-            px = player_get_x(grid->players[k]);
-            py = player_get_y(grid->players[k]);
-            message_vis[px][py] = (char)(65 + k);
-        }
+        message[GRID_FRAME_OFFSET(grid->columns, px, py)] = '@';
     }
-    message_vis[player_get_x(player)][player_get_y(player)] = '@';
+    return grid_add_legend(message, legend);
+}
 
-    for (int i = 0; i < *grid->rows; i++)
+char *grid_send_view(grid_t *grid, player_t *player, int rows, int cols)
+{
+    int nrows = grid->rows;
+    int ncols = grid->columns;
+    rows = rows < nrows ? rows : nrows;
+    cols = cols < ncols ? cols : ncols;
+    int px = player_get_x(player);
+    int py = player_get_y(player);
+    // centre the window on the player, but keep it inside the map
+    int top = px - rows / 2;
+    int left = py - cols / 2;
+    top = top < 0 ? 0 : (top > nrows - rows ? nrows - rows : top);
+    left = left < 0 ? 0 : (left > ncols - cols ? ncols - cols : left);
+
+    char header[64];
+    int headerLength = snprintf(header, sizeof(header), "%s %d %d\n", GRID_VIEW_HEADER, top, left);
+    char *message = mem_assert(mem_tmalloc("frame", headerLength + rows * (cols + 1) + 1), "Failed to allocate memory for message.");
+    memcpy(message, header, headerLength);
+    char *body = message + headerLength;
+    tiles_t *terrain = player_get_terrain(player);
+    for (int r = 0; r < rows; r++)
     {
-        for (int j = 0; j < *grid->columns; j++)
-        {
-            if (visibility[i][j] == 1)
-            {
-                if (message_vis[i][j] == 0)
-                {
-                    if (grid->nuggets[i][j] > 0)
-                    {
-                        message_vis[i][j] = '*';
-                    }
-                    else
-                    {
-                        message_vis[i][j] = grid->cells[i][j];
-                    }
-                }
-                *moving_ptr = message_vis[i][j];
-            }
-            else if (visibility[i][j] == 2)
-            {
-                *moving_ptr = grid->cells[i][j];
-            }
-            else
-            {
-                *moving_ptr = ' ';
-            }
-            moving_ptr++;
-        }
-        *moving_ptr = '\n';
-        moving_ptr++;
+        tiles_copy_row(terrain, top + r, left, cols, body + r * (cols + 1));
+        body[r * (cols + 1) + cols] = '\n';
     }
+    body[rows * (cols + 1)] = '\0';
 
-    *moving_ptr = '\0';
-
-    for (int k = 0; k < *grid->rows; k++)
+    char *legend = grid_new_legend(grid, player_get_haslegend(player));
+    grid_overlay_gold(grid, body, player, top, left, rows, cols);
+    grid_overlay_players(grid, body, player, top, left, rows, cols, legend);
+    if (player_get_visibility(player, px, py) == 1)
     {
-        free(message_vis[k]);
+        body[(px - top) * (cols + 1) + (py - left)] = '@';
     }
-    free(message_vis);
-    return message;
+    return grid_add_legend(message, legend);
 }
 
-char *grid_send_state_spectator(grid_t *grid)
+char *grid_send_state_spectator(grid_t *grid, bool legend)
 {
-    if (*grid->spectatorCount == 1)
-    {
-        char *message = mem_assert(malloc(((*grid->rows + 1) * (*grid->columns) + 10) * sizeof(char)), "Failed to allocate memory for message.");
-        *message = '\0';
-        strcpy(message, "DISPLAY\n");
-        char *moving_ptr = message + 8; // index to iterate through message string
-        char **message_vis = (char **)mem_assert(calloc(*grid->rows, sizeof(char *)), "Error allocating space for message grid");
-        int k;
-        for (k = 0; k < *grid->rows; k++)
-        {
-            message_vis[k] = mem_assert(calloc(*grid->columns, sizeof(char)), "Error allocating space for player message");
-        }
-        int px, py;
-        for (k = 0; k < *grid->playerCount; k++)
-        {
-            if (player_get_isactive(grid->players[k]))
-            {
-                px = player_get_x(grid->players[k]);
-                py = player_get_y(grid->players[k]);
-                message_vis[px][py] = (char)(65 + k);
-            }
-        }
-        for (int i = 0; i < *grid->rows; i++)
-        {
-            for (int j = 0; j < *grid->columns; j++)
-            {
-                if (message_vis[i][j] == 0)
-                {
-                    if (grid->nuggets[i][j] > 0)
-                    {
-                        message_vis[i][j] = '*';
-                    }
-                    else
-                    {
-                        message_vis[i][j] = grid->cells[i][j];
-                    }
-                }
-                *moving_ptr = message_vis[i][j];
-                moving_ptr++;
-            }
-            *moving_ptr = '\n';
-            moving_ptr++;
-        }
+    int length = GRID_FRAME_LENGTH(grid->rows, grid->columns);
+    char *message = mem_assert(mem_tmalloc("frame", length * sizeof(char)), "Failed to allocate memory for message.");
+    memcpy(message, grid->mapFrame, length);
+    char *body = message + GRID_FRAME_HEADER_LEN;
+    char *fields = grid_new_legend(grid, legend);
+    grid_overlay_gold(grid, body, NULL, 0, 0, grid->rows, grid->columns);
+    grid_overlay_players(grid, body, NULL, 0, 0, grid->rows, grid->columns, fields);
+    return grid_add_legend(message, fields);
+}
 
-        *moving_ptr = '\0';
-        for (int k = 0; k < *grid->rows; k++)
+void grid_mark_changed(grid_t *grid, int i, int j)
+{
+    for (int k = 0; k < grid->playerCount; k++)
+    {
+        player_t *player = grid->players[k];
+        if (player_get_isactive(player) && player_get_visibility(player, i, j) == 1)
         {
-            free(message_vis[k]);
+            player_set_isdirty(player, true);
         }
-        free(message_vis);
-        return message;
-    }
-    else
-    {
-        char *message = mem_assert(malloc(((*grid->rows + 1) * (*grid->columns) + 10) * sizeof(char)), "Failed to allocate memory for message.");
-        *message = '\0';
-        return message;
     }
+    grid->spectatorDirty = true;
 }
 
 void grid_game_over(grid_t *grid)
 {
-    char *message = mem_assert(malloc(129 * 26 * sizeof(char)), "Failed to allocate memory for large message.");
+    char *message = mem_assert(mem_tmalloc("message", 129 * (grid->playerCount + 1) * sizeof(char)), "Failed to allocate memory for large message.");
     *message = '\0';
-    char *buffer = mem_assert(malloc(129 * sizeof(char)), "Failed to allocate memory for buffer.");
+    char *buffer = mem_assert(mem_tmalloc("message", 129 * sizeof(char)), "Failed to allocate memory for buffer.");
     strcat(message, "QUIT GAME OVER:\n");
-    for (int i = 0; i < *grid->playerCount; i++)
+    char *end = message + strlen(message); // appending at the end keeps the summary linear in the number of players
+    for (int i = 0; i < grid->playerCount; i++)
     {
         int purse = player_get_purse(grid->players[i]);
         char *name = player_get_name(grid->players[i]);
+        char id[GRID_PLAYER_ID_SIZE];
+        grid_player_id(i, id);
         // Calculate the final score and create a summary containing relevant info
-        sprintf(buffer, "Player %c | Score: %.3d | Name: %s\n", 65 + i, purse, name);
-        strcat(message, buffer);
+        sprintf(buffer, "Player %s | Score: %.3d | Name: %s\n", id, purse, name);
+        strcpy(end, buffer);
+        end += strlen(buffer);
     }
-    for (int i = 0; i < *grid->playerCount; i++)
+    for (int i = 0; i < grid->playerCount; i++)
     {
         if (player_get_isactive(grid_getplayers(grid)[i]))
         {
             addr_t *playerAddress = player_get_addr(grid->players[i]);
             if (playerAddress != NULL)
             {
-                message_send(*playerAddress, message);
+                outbox_send(*playerAddress, message);
             }
         }
-        player_delete(grid_getplayers(grid)[i], grid);
     }
     if (grid_getspectatorCount(grid) == 1) {
         spectator_t* spectator = grid_getspectator(grid);
-        spectator_quit(spectator, grid); // calls delete under the hood
+        spectator_quit(spectator, grid);
+    }
+
+    mem_tfree(message);
+    mem_tfree(buffer);
+}
+
+void grid_report_memory(grid_t *grid, FILE *fp)
+{
+    int rows = grid->rows;
+    int cols = grid->columns;
+    size_t cells = (size_t)rows * cols;
+    // what each layer took when it was a matrix, for comparison
+    size_t mapBytes = rows * sizeof(char *) + cells + cells + GRID_FRAME_LENGTH(rows, cols);
+    size_t intMatrix = rows * sizeof(int *) + cells * sizeof(int);
+    size_t playerDense = intMatrix + cells * sizeof(int) + GRID_FRAME_LENGTH(rows, cols); // visibility, visible list, frame
+    size_t total = mapBytes;
+    size_t dense = mapBytes;
+    fprintf(fp, "Memory (tiles of %dx%d cells):\n", TILES_SIDE, TILES_SIDE);
+    fprintf(fp, "%-12s %15s %12s %12s\n", "layer", "tiles", "bytes", "dense bytes");
+    fprintf(fp, "%-12s %15s %12zu %12zu\n", "map", "-", mapBytes, mapBytes);
+    tiles_t *layers[] = {grid->nuggets, grid->occupants};
+    const char *names[] = {"gold", "occupants"};
+    for (int k = 0; k < 2; k++)
+    {
+        int all;
+        int used = tiles_count(layers[k], &all);
+        char counts[32];
+        snprintf(counts, sizeof(counts), "%d/%d", used, all);
+        fprintf(fp, "%-12s %15s %12zu %12zu\n", names[k], counts, tiles_bytes(layers[k]), intMatrix);
+        total += tiles_bytes(layers[k]);
+        dense += intMatrix;
     }
+    for (int k = 0; k < grid->playerCount; k++)
+    {
+        int used, all;
+        size_t bytes = player_memory(grid->players[k], &used, &all);
+        char id[GRID_PLAYER_ID_SIZE];
+        char label[GRID_PLAYER_ID_SIZE + 8];
+        char counts[32];
+        grid_player_id(k, id);
+        snprintf(label, sizeof(label), "player %s", id);
+        snprintf(counts, sizeof(counts), "%d/%d", used, all);
+        fprintf(fp, "%-12s %15s %12zu %12zu\n", label, counts, bytes, playerDense);
+        total += bytes;
+        dense += playerDense;
+    }
+    fprintf(fp, "%-12s %15s %12zu %12zu\n", "total", "", total, dense);
+    int chunks, roundChunks;
+    size_t bytes = arena_bytes(grid->arena, &chunks);
+    size_t roundBytes = arena_bytes(grid->round, &roundChunks);
+    fprintf(fp, "Game arena: %zu bytes in %d chunks (map %zu in %d, round %zu in %d)\n",
+            bytes + roundBytes, chunks + roundChunks, bytes, chunks, roundBytes, roundChunks);
+}
 
-    grid_delete(grid);
-    free(message);
-    free(buffer);
+/* Cell (i, j) of the map, in a body showing the rows x cols window whose top left corner is (top, left). */
+#define BODY_CELL(body, top, left, cols, i, j) ((body)[((i) - (top)) * ((cols) + 1) + ((j) - (left))])
+#define IN_WINDOW(top, left, rows, cols, i, j) ((i) >= (top) && (i) < (top) + (rows) && (j) >= (left) && (j) < (left) + (cols))
+
+/* Write a '*' for each pile of gold in the window, where the viewer can see it (everywhere if viewer is NULL).
+ * body holds the window's rows, each followed by a newline. */
+static void grid_overlay_gold(grid_t *grid, char *body, player_t *viewer, int top, int left, int rows, int cols)
+{
+    for (int k = 0; k < grid->pileCount; k++)
+    {
+        int i = grid->piles[k] / grid->columns;
+        int j = grid->piles[k] % grid->columns;
+        if (IN_WINDOW(top, left, rows, cols, i, j) && (viewer == NULL || player_get_visibility(viewer, i, j) == 1))
+        {
+            BODY_CELL(body, top, left, cols, i, j) = '*';
+        }
+    }
 }
 
-static bool grid_hasplayerat(grid_t *grid, int x, int y)
+/* Write each active player's symbol into the window, where the viewer can see it (everywhere if viewer is NULL),
+ * and, if legend is not NULL, append to it a " row,col,id" field for each one past the first cycle of symbols but the viewer.
+ * With many players, it is cheaper to look for occupants in the cells the viewer sees than to look at every player. */
+static void grid_overlay_players(grid_t *grid, char *body, player_t *viewer, int top, int left, int rows, int cols, char *legend)
 {
-    bool res = false;
-    player_t *p;
-    for (int i = 0; i < *grid->playerCount; i++)
+    int ncols = grid->columns;
+    char *end = legend;
+    if (viewer != NULL && player_get_nvisible(viewer) < grid->playerCount)
     {
-        p = grid->players[i];
-        if (player_get_x(p) == x && player_get_y(p) == y)
+        int *visible = player_get_visible(viewer);
+        for (int k = 0; k < player_get_nvisible(viewer); k++)
         {
-            res = true;
-            break;
+            int i = visible[k] / ncols;
+            int j = visible[k] % ncols;
+            int occupant = grid_getoccupant(grid, i, j);
+            if (occupant >= 0 && IN_WINDOW(top, left, rows, cols, i, j))
+            {
+                BODY_CELL(body, top, left, cols, i, j) = grid_player_symbol(occupant);
+                if (legend != NULL && legend_cycle(occupant) > 1 && grid->players[occupant] != viewer)
+                {
+                    char id[GRID_PLAYER_ID_SIZE];
+                    grid_player_id(occupant, id);
+                    end += sprintf(end, " %d,%d,%s", i - top, j - left, id);
+                }
+            }
+        }
+        return;
+    }
+    for (int k = 0; k < grid->playerCount; k++)
+    {
+        if (player_get_isactive(grid->players[k]))
+        {
+            int px = player_get_x(grid->players[k]);
+            int py = player_get_y(grid->players[k]);
+            if (IN_WINDOW(top, left, rows, cols, px, py) && (viewer == NULL || player_get_visibility(viewer, px, py) == 1))
+            {
+                BODY_CELL(body, top, left, cols, px, py) = grid_player_symbol(k);
+                if (legend != NULL && legend_cycle(k) > 1 && grid->players[k] != viewer)
+                {
+                    char id[GRID_PLAYER_ID_SIZE];
+                    grid_player_id(k, id);
+                    end += sprintf(end, " %d,%d,%s", px - top, py - left, id);
+                }
+            }
         }
     }
-    return res;
+}
+
+player_t *grid_findplayer(grid_t *grid, const addr_t addr)
+{
+    return hashtable_find(grid->sessions, message_stringAddr(addr));
+}
+
+int grid_getoccupant(grid_t *grid, int i, int j)
+{
+    return *(const int *)tiles_get(grid->occupants, i, j);
+}
+
+void grid_setoccupant(grid_t *grid, int i, int j, int index)
+{
+    *(int *)tiles_touch(grid->occupants, i, j) = index;
+}
+
+char grid_player_symbol(int k)
+{
+    return legend_symbol(k);
+}
+
+void grid_player_id(int k, char *id)
+{
+    legend_id(k, id);
+}
+
+/* An empty legend with room for a field for each player past the first cycle of symbols,
+ * or NULL if it is not wanted or no player is past the first cycle. */
+static char *grid_new_legend(grid_t *grid, bool wanted)
+{
+    if (!wanted || grid->playerCount <= LEGEND_NSYMBOLS)
+    {
+        return NULL;
+    }
+    size_t field = 2 * 12 + LEGEND_ID_SIZE; // " row,col,id", at most
+    char *legend = mem_assert(mem_tmalloc("frame", (grid->playerCount - LEGEND_NSYMBOLS) * field + 1), "Failed to allocate memory for legend.");
+    legend[0] = '\0';
+    return legend;
+}
+
+/* Put the legend, if there is one and it has fields, at the end of the message's first line; free the legend.
+ * Returns the message, which is a new one if the legend went into it. */
+static char *grid_add_legend(char *message, char *legend)
+{
+    if (legend == NULL || legend[0] == '\0')
+    {
+        mem_tfree(legend);
+        return message;
+    }
+    size_t header = strchr(message, '\n') - message;
+    size_t length = strlen(message);
+    size_t fields = strlen(legend);
+    char *with = mem_assert(mem_tmalloc("frame", length + fields + 1), "Failed to allocate memory for message.");
+    memcpy(with, message, header);
+    memcpy(with + header, legend, fields);
+    memcpy(with + header + fields, message + header, length - header + 1);
+    mem_tfree(message);
+    mem_tfree(legend);
+    return with;
+}
+
+int grid_getmaxplayers(grid_t *grid)
+{
+    return grid->maxPlayers;
+}
+
+void grid_setmaxplayers(grid_t *grid, int maxPlayers)
+{
+    grid->maxPlayers = maxPlayers;
 }
 
 int grid_getnrows(grid_t *grid)
 {
-    return *grid->rows;
+    return grid->rows;
 }
 
 int grid_getncols(grid_t *grid)
 {
-    return *grid->columns;
+    return grid->columns;
 }
 
 char **grid_getcells(grid_t *grid)
@@ -443,19 +617,24 @@ char **grid_getcells(grid_t *grid)
     return grid->cells;
 }
 
-int **grid_getnuggets(grid_t *grid)
+vismap_t *grid_getvismap(grid_t *grid)
+{
+    return grid->vismap;
+}
+
+int grid_getnuggets(grid_t *grid, int i, int j)
 {
-    return grid->nuggets;
+    return *(const int *)tiles_get(grid->nuggets, i, j);
 }
 
 int grid_getnuggetcount(grid_t *grid)
 {
-    return *grid->nuggetCount;
+    return grid->nuggetCount;
 }
 
 int grid_getplayercount(grid_t *grid)
 {
-    return *grid->playerCount;
+    return grid->playerCount;
 }
 
 player_t **grid_getplayers(grid_t *grid)
@@ -465,29 +644,60 @@ player_t **grid_getplayers(grid_t *grid)
 
 void grid_setnuggets(grid_t *grid, int i, int j, int n)
 {
-    grid->nuggets[i][j] = n;
+    int index = i * grid->columns + j;
+    int current = grid_getnuggets(grid, i, j);
+    if (current == 0 && n > 0)
+    {
+        // a new pile
+        if (grid->pileCount == grid->pileCapacity)
+        {
+            int capacity = grid->pileCapacity == 0 ? 32 : 2 * grid->pileCapacity;
+            grid->piles = (int *)mem_assert(arena_grow(grid->round, grid->piles, grid->pileCapacity * sizeof(int), capacity * sizeof(int)), "Error allocating space for piles\n");
+            grid->pileCapacity = capacity;
+        }
+        grid->piles[grid->pileCount++] = index;
+    }
+    else if (current > 0 && n <= 0)
+    {
+        // the pile is gone
+        for (int k = 0; k < grid->pileCount; k++)
+        {
+            if (grid->piles[k] == index)
+            {
+                grid->piles[k] = grid->piles[--grid->pileCount];
+                break;
+            }
+        }
+    }
+    *(int *)tiles_touch(grid->nuggets, i, j) = n;
 }
 
 void grid_setnuggetcount(grid_t *grid, int count)
 {
-    *grid->nuggetCount = count;
+    grid->nuggetCount = count;
 }
 
 spectator_t *grid_getspectator(grid_t *grid)
 {
-    return grid->spectator[0];
+    return grid->spectator;
 }
 
-void grid_setspectator(grid_t *grid, spectator_t *spectator)
-{
-    grid->spectator[0] = spectator;
-}
 int grid_getspectatorCount(grid_t *grid)
 {
-    return *grid->spectatorCount;
+    return grid->spectatorCount;
 }
 
 void grid_setspectatorCount(grid_t *grid, int count)
 {
-    *grid->spectatorCount = count;
+    grid->spectatorCount = count;
+}
+
+bool grid_getspectatorDirty(grid_t *grid)
+{
+    return grid->spectatorDirty;
+}
+
+void grid_setspectatorDirty(grid_t *grid, bool dirty)
+{
+    grid->spectatorDirty = dirty;
 }
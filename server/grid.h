@@ -15,6 +15,33 @@
 #include <time.h>
 #include <string.h>
 #include "message.h"
+#include "legend.h"
+#include "visibility.h"
+
+/**************** constants ****************/
+/* A DISPLAY frame is this header followed by each row of the map and a newline.
+ * Cell (i, j) of a grid with ncols columns sits at GRID_FRAME_OFFSET(ncols, i, j).
+ */
+#define GRID_FRAME_HEADER "DISPLAY\n"
+#define GRID_FRAME_HEADER_LEN 8
+#define GRID_FRAME_OFFSET(ncols, i, j) (GRID_FRAME_HEADER_LEN + (i) * ((ncols) + 1) + (j))
+#define GRID_FRAME_LENGTH(nrows, ncols) (GRID_FRAME_HEADER_LEN + (nrows) * ((ncols) + 1) + 1)
+
+/* A viewport frame (see grid_send_view) starts with this word, then the map row and column
+ * of its top left corner, a newline, and the rows of the window, each followed by a newline.
+ */
+#define GRID_VIEW_HEADER "DISPLAYV"
+
+/* A game takes GRID_DEFAULT_MAXPLAYERS players unless grid_setmaxplayers says otherwise, and at most
+ * GRID_MAX_PLAYERS. Player k is drawn with the k-th of the GRID_PLAYER_SYMBOLS, cycling through them
+ * when there are more players than symbols; a client that sent LEGEND is told, in the first line of each
+ * frame, which of the players it shows are past the first cycle (see legend.h). A player is known in OK
+ * and GAME OVER messages by its id (see grid_player_id), which is at most GRID_PLAYER_ID_SIZE bytes long with its NUL.
+ */
+#define GRID_DEFAULT_MAXPLAYERS 26
+#define GRID_PLAYER_SYMBOLS LEGEND_SYMBOLS
+#define GRID_MAX_PLAYERS LEGEND_MAX_PLAYERS
+#define GRID_PLAYER_ID_SIZE 16
 
 /**************** global types ****************/
 typedef struct grid grid_t;
@@ -34,9 +61,26 @@ typedef struct spectator spectator_t;
  * Notes:
  *   the caller is responsible for opening and closing the file.
  *   the grid is initialized with cells, players, and nuggets based on the file content.
+ *   the grid gets two arenas (see arena.h): one for itself, the map and what is built from it, and later the spectator,
+ *   which lasts as long as the grid; and one for the round, holding the gold, the occupants and every player,
+ *   which grid_new_round replaces. The sessions table is the only part outside them.
  */
 grid_t* grid_load(FILE* file);
 
+/***************** grid_new_round *****************/
+/* Clear the grid for a new round on the same map.
+ *
+ * Caller provides:
+ *   a valid grid object whose round is over (see grid_game_over).
+ * We guarantee:
+ *   the players, gold and occupants of the last round are gone, freed with the round's arena,
+ *   and the grid is as grid_load left it: no players, no gold and no spectator watching.
+ *   the map, the visibility engines' map, the spectator's bare frame and the player limit are kept.
+ * Notes:
+ *   players of the last round must not be used afterward; call grid_init_gold before the round starts.
+ */
+void grid_new_round(grid_t* grid);
+
 /***************** grid_init_gold *****************/
 /* Initialize gold nuggets randomly within the grid.
  *
@@ -56,9 +100,10 @@ void grid_init_gold(grid_t* grid);
  * Caller provides:
  *   a valid grid object.
  * We guarantee:
- *   all memory allocated for the grid and its components is freed.
+ *   all memory allocated for the grid and its components is freed, players and spectator included,
+ *   by deleting the grid's arenas.
  * Notes:
- *   assumes all players and spectators are properly deleted or handled.
+ *   players and the spectator must not be used afterward; nothing is sent to them.
  */
 void grid_delete(grid_t* grid);
 
@@ -74,17 +119,83 @@ void grid_delete(grid_t* grid);
  */
 void grid_spawn_player(grid_t* grid, const addr_t connection_info, char* real_name);
 
+/***************** grid_findplayer *****************/
+/* Find the player who joined from an address.
+ *
+ * Caller provides:
+ *   a valid grid object and an address.
+ * We guarantee:
+ *   returns the first player spawned with that address, active or not, or NULL if there is none.
+ * Notes:
+ *   takes constant time, whatever the number of players.
+ */
+player_t* grid_findplayer(grid_t* grid, const addr_t addr);
+
+/***************** grid_getoccupant *****************/
+/* Get the index of the active player standing at (i, j).
+ *
+ * Caller provides:
+ *   a valid grid object and coordinates (i, j) within the grid.
+ * We guarantee:
+ *   returns the player's index in grid_getplayers, or -1 if no active player is there.
+ */
+int grid_getoccupant(grid_t* grid, int i, int j);
+
+/***************** grid_setoccupant *****************/
+/* Record which active player stands at (i, j).
+ *
+ * Caller provides:
+ *   a valid grid object, coordinates (i, j) within the grid, and the player's index, or -1 for none.
+ * Notes:
+ *   whoever moves a player, or takes one out of the game, must keep this up to date;
+ *   grid_spawn_player records the new player itself.
+ */
+void grid_setoccupant(grid_t* grid, int i, int j, int index);
+
+/***************** grid_player_symbol *****************/
+/* Get the character that shows player k on the map.
+ *
+ * We guarantee:
+ *   returns the k-th of the GRID_PLAYER_SYMBOLS, counting cyclically.
+ */
+char grid_player_symbol(int k);
+
+/***************** grid_player_id *****************/
+/* Write the id of player k: its symbol, followed by its cycle of symbols from the second cycle on
+ * ("A", ..., "9", then "A2", ...; see legend_id).
+ *
+ * Caller provides:
+ *   a buffer of at least GRID_PLAYER_ID_SIZE bytes.
+ */
+void grid_player_id(int k, char* id);
+
+/***************** grid_getmaxplayers *****************/
+/* Get the number of players the game takes (GRID_DEFAULT_MAXPLAYERS unless set). */
+int grid_getmaxplayers(grid_t* grid);
+
+/***************** grid_setmaxplayers *****************/
+/* Set the number of players the game takes.
+ *
+ * Caller provides:
+ *   a valid grid object and a number of players from 1 to GRID_MAX_PLAYERS.
+ * Notes:
+ *   call it before grid_init_gold, which checks that the map has a spot for each of them.
+ *   the player array grows as players join, so a large limit costs nothing until they do.
+ */
+void grid_setmaxplayers(grid_t* grid, int maxPlayers);
+
 /***************** grid_spawn_spectator *****************/
 /* Add a spectator to the grid.
  *
  * Caller provides:
- *   a valid grid object and a spectator object.
+ *   a valid grid object and the spectator's address.
  * We guarantee:
- *   replaces any existing spectator with the new one.
+ *   replaces any existing spectator, who is sent a QUIT, with the new one.
  * Notes:
- *   maintains at most one spectator at a time in the grid.
+ *   maintains at most one spectator at a time in the grid; the grid makes the spectator object
+ *   in its arena the first time, and hands the same object to every later spectator.
  */
-void grid_spawn_spectator(grid_t* grid, spectator_t* spectator);
+void grid_spawn_spectator(grid_t* grid, const addr_t connection_info);
 
 /***************** grid_send_state *****************/
 /* Send the grid state to a specific player.
@@ -95,34 +206,82 @@ void grid_spawn_spectator(grid_t* grid, spectator_t* spectator);
  *   returns a string representation of the grid from the player's perspective.
  * Notes:
  *   the caller is responsible for managing the memory of the returned string.
+ *   the string is a copy of the player's base frame (see player_get_frame),
+ *   patched with the gold and players currently visible to them.
+ *   if the player's client sent LEGEND, the header carries the legend of the players it shows (see legend.h).
  */
 char* grid_send_state(grid_t* grid, player_t* player);
 
+/***************** grid_send_view *****************/
+/* Send a player the part of their view that fits their screen.
+ *
+ * Caller provides:
+ *   a valid grid object, a player object, and the size of the window, in rows and columns.
+ * We guarantee:
+ *   returns "DISPLAYV top left\n" followed by the window's rows, each ending in a newline:
+ *   what grid_send_state would show in those rows and columns. The window is centred on the player
+ *   but kept inside the map, and shrunk to the map if it is larger.
+ * Notes:
+ *   the caller is responsible for managing the memory of the returned string.
+ *   the cost depends on the size of the window, not of the map.
+ *   the header carries a legend after the corner's row and column, as grid_send_state's does.
+ */
+char* grid_send_view(grid_t* grid, player_t* player, int rows, int cols);
+
 /***************** grid_send_state_spectator *****************/
 /* Send the grid state to the spectator.
  *
  * Caller provides:
- *   a valid grid object.
+ *   a valid grid object, and whether to put a legend in the header (see legend.h).
  * We guarantee:
  *   returns a string representation of the entire grid.
  * Notes:
  *   the caller is responsible for managing the memory of the returned string.
- *   returns an empty string if no spectator is present.
+ *   the frame is made whether or not a spectator is present, for the spectator feed (see feed.h).
+ *   the string is a copy of the grid's static map frame, patched with all gold and players.
+ */
+char* grid_send_state_spectator(grid_t* grid, bool legend);
+
+/***************** grid_mark_changed *****************/
+/* Note that the gold or the occupant of cell (i, j) has changed.
+ *
+ * Caller provides:
+ *   a valid grid object and coordinates (i, j) within the grid.
+ * We guarantee:
+ *   every active player who can currently see (i, j), and the spectator, is marked dirty.
+ * Notes:
+ *   call it after updating the visibility of any player who moved;
+ *   players whose visibility changed must be marked dirty by the caller (see player_set_isdirty).
+ *   grid_spawn_player and grid_spawn_spectator mark their own changes.
  */
-char* grid_send_state_spectator(grid_t* grid);
+void grid_mark_changed(grid_t* grid, int i, int j);
 
 /***************** grid_game_over *****************/
-/* Handle the end of the game, sending final messages and cleaning up.
+/* Handle the end of the game, sending final messages.
  *
  * Caller provides:
  *   a valid grid object.
  * We guarantee:
- *   sends a game over message to all players and deletes the grid.
+ *   sends a game over message to all active players and a QUIT to the spectator.
  * Notes:
- *   assumes all players and the grid are properly deleted afterward.
+ *   the grid is left as it was; the caller then either deletes it (see grid_delete)
+ *   or starts another round on it (see grid_new_round).
  */
 void grid_game_over(grid_t* grid);
 
+/***************** grid_report_memory *****************/
+/* Print how much memory the game's map and players take, layer by layer.
+ *
+ * Caller provides:
+ *   a valid grid object, and an open file to print to.
+ * Notes:
+ *   the map's cells, the visibility engines' floor layer and the spectator's frame are dense;
+ *   gold, occupants, and each player's sight and terrain are tiled (see tiles.h), so the report
+ *   also gives how many of their tiles are allocated, out of how many the map spans, and what the
+ *   layer would take stored as a dense matrix.
+ */
+void grid_report_memory(grid_t* grid, FILE* fp);
+
 /***************** grid_getnrows *****************/
 /* Get the number of rows in the grid.
  *
@@ -159,17 +318,29 @@ int grid_getncols(grid_t* grid);
  */
 char** grid_getcells(grid_t* grid);
 
-/***************** grid_getnuggets *****************/
-/* Get the grid's nuggets matrix.
+/***************** grid_getvismap *****************/
+/* Get the grid's map as prepared for the visibility engines.
  *
  * Caller provides:
  *   a valid grid object.
  * We guarantee:
- *   returns a pointer to the grid's nuggets matrix.
+ *   returns the vismap built from the grid's cells when the grid was loaded.
  * Notes:
- *   the caller must not modify or free the returned matrix.
+ *   the caller must not free the returned vismap.
  */
-int** grid_getnuggets(grid_t* grid);
+vismap_t* grid_getvismap(grid_t* grid);
+
+/***************** grid_getnuggets *****************/
+/* Get the number of nuggets at (i, j).
+ *
+ * Caller provides:
+ *   a valid grid object and coordinates (i, j) within the grid.
+ * We guarantee:
+ *   returns the size of the pile at (i, j), or 0 if there is none.
+ * Notes:
+ *   use grid_setnuggets to change it.
+ */
+int grid_getnuggets(grid_t* grid, int i, int j);
 
 /***************** grid_getnuggetcount *****************/
 /* Get the total count of nuggets in the grid.
@@ -204,6 +375,7 @@ int grid_getplayercount(grid_t* grid);
  *   returns a pointer to the array of player objects.
   * Notes:
  *   the caller must not modify or free the returned array.
+ *   the array may move when a player joins; fetch it again after grid_spawn_player.
  */
 player_t** grid_getplayers(grid_t* grid);
 
@@ -216,6 +388,8 @@ player_t** grid_getplayers(grid_t* grid);
  *   updates the nugget count at the specified location in the grid.
  * Notes:
  *   can be used to add or remove nuggets from a location.
+ *   callers must use this function, rather than writing the nuggets matrix directly,
+ *   so the grid's list of piles stays up to date.
  */
 void grid_setnuggets(grid_t* grid, int i, int j, int n);
 
@@ -239,22 +413,11 @@ void grid_setnuggetcount(grid_t* grid, int count);
  * We guarantee:
  *   returns the spectator object if present.
  * Notes:
- *   returns NULL if no spectator is currently associated with the grid.
+ *   returns NULL if no spectator has joined yet; after a spectator quits the object stays,
+ *   so check grid_getspectatorCount first.
  */
 spectator_t* grid_getspectator(grid_t* grid);
 
-/***************** grid_setspectator *****************/
-/* Set the spectator for the grid.
- *
- * Caller provides:
- *   a valid grid object and a spectator object to set as the grid's spectator.
- * We guarantee:
- *   updates the grid's spectator to the provided spectator object.
- * Notes:
- *   replaces any existing spectator with the new one.
- */
-void grid_setspectator(grid_t* grid, spectator_t* spectator);
-
 /***************** grid_getspectatorCount *****************/
 /* Get the count of spectators in the grid.
  *
@@ -279,5 +442,24 @@ int grid_getspectatorCount(grid_t* grid);
  */
 void grid_setspectatorCount(grid_t* grid, int count);
 
+/***************** grid_getspectatorDirty *****************/
+/* Check if the spectator's DISPLAY frame may have changed since it was last sent.
+ *
+ * Caller provides:
+ *   a valid grid object.
+ * We guarantee:
+ *   returns true if a spectator joined, or any gold or player changed, since the
+ *   last grid_setspectatorDirty(grid, false).
+ */
+bool grid_getspectatorDirty(grid_t* grid);
+
+/***************** grid_setspectatorDirty *****************/
+/* Set or clear the spectator's dirty flag; the server clears it after sending a frame.
+ *
+ * Caller provides:
+ *   a valid grid object.
+ */
+void grid_setspectatorDirty(grid_t* grid, bool dirty);
+
 
 #endif //__GRID_H
\ No newline at end of file
@@ -50,7 +50,7 @@ int main(int argc, char* argv[]) {
     printf("Grid state after placing gold:\n");
     for (int i = 0; i < grid_getnrows(grid); i++) {
         for (int j = 0; j < grid_getncols(grid); j++) {
-            if (grid_getnuggets(grid)[i][j] > 0) {
+            if (grid_getnuggets(grid, i, j) > 0) {
                 putchar('*');
             } else {
                 putchar(grid_getcells(grid)[i][j]);
@@ -67,14 +67,22 @@ int main(int argc, char* argv[]) {
     char* testName = "player one"  ; 
     grid_spawn_player(grid, test_connection_info, testName);
 
-    spectator_t* test_spectator = spectator_new(test_connection_info);
     // Test spawning a spectator
     printf("\nTesting spawning a spectator...\n");
-    grid_spawn_spectator(grid, test_spectator);
+    grid_spawn_spectator(grid, test_connection_info);
 
     // Test game quit scenario
     printf("\nTesting game quit scenario...\n");
     grid_game_over(grid);
+
+    // Test a second round on the same map
+    printf("\nTesting a new round...\n");
+    grid_new_round(grid);
+    grid_init_gold(grid);
+    grid_spawn_player(grid, test_connection_info, testName);
+    printf("players: %d | piles placed: %d\n", grid_getplayercount(grid), grid_getnuggetcount(grid));
+    grid_game_over(grid);
+    grid_delete(grid);
     
      // Clean up and close the file
     fclose(file);
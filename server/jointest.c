@@ -0,0 +1,156 @@
+/*
+ * jointest.c - test that every player who joins gets a frame
+ *
+ * Starts ./server on the given map, joins it with reliable clients, each on a socket of its own
+ * (see message_ctx_new), and checks that each of them gets a DISPLAY. First one client joins alone,
+ * Runs times, each time with a new server; then Burst clients join at once, Runs times. The server
+ * holds back the frames of players who join in a burst until the burst is over (see server.c);
+ * this checks that they are sent however the burst ends, including by an acknowledgement or a
+ * retransmission, which the server never sees as a message.
+ *
+ * Usage: ./jointest map.txt
+ * Exit status 0 if every client got a frame.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for kill
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "message.h"
+
+enum { Runs = 10, Burst = 10 };
+static const float Wait = 1; // seconds of silence after which a client gives up on its frame
+
+/**************** local functions ****************/
+static int run(const char* map, int clients);
+static pid_t startServer(const char* map, int* port);
+static bool handleMessage(void* arg, const addr_t from, const char* message);
+static bool giveUp(void* arg);
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s map.txt\n", argv[0]);
+        return 1;
+    }
+    int failures = 0;
+    for (int clients = 1; clients <= Burst; clients += Burst - 1) {
+        int missed = 0;
+        for (int r = 0; r < Runs; r++) {
+            int n = run(argv[1], clients);
+            if (n < 0) {
+                return 2;
+            }
+            missed += n;
+        }
+        printf("%d client%s joining at once, %d runs: %d without a frame\n",
+               clients, clients == 1 ? "" : "s", Runs, missed);
+        failures += missed;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+/* Start a server, join it with this many clients at once, and return how many got no frame; -1 on error. */
+static int run(const char* map, int clients)
+{
+    int port;
+    pid_t server = startServer(map, &port);
+    if (server < 0) {
+        return -1;
+    }
+    addr_t to;
+    char portStr[16];
+    snprintf(portStr, sizeof(portStr), "%d", port);
+    message_ctx_t* ctx[Burst];
+    for (int c = 0; c < clients; c++) {
+        ctx[c] = message_ctx_new(NULL, 0, false);
+        if (ctx[c] == NULL || !message_setAddr("localhost", portStr, &to)) {
+            fprintf(stderr, "cannot make client %d\n", c);
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+            return -1;
+        }
+        message_ctx_setReliable(ctx[c], true);
+    }
+    for (int c = 0; c < clients; c++) {
+        char play[32];
+        snprintf(play, sizeof(play), "PLAY client%d", c);
+        message_ctx_sendReliable(ctx[c], to, play);
+    }
+    int missed = 0;
+    for (int c = 0; c < clients; c++) {
+        bool framed = false;
+        message_ctx_loop(ctx[c], &framed, Wait, giveUp, NULL, handleMessage);
+        if (!framed) {
+            missed++;
+        }
+    }
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    for (int c = 0; c < clients; c++) {
+        message_ctx_delete(ctx[c]);
+    }
+    return missed;
+}
+
+/* Start ./server on the map, for up to Burst players; return its pid, and its port through 'port', or -1. */
+static pid_t startServer(const char* map, int* port)
+{
+    int out[2];
+    if (pipe(out) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        char maxPlayers[32];
+        snprintf(maxPlayers, sizeof(maxPlayers), "--maxplayers=%d", Burst);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        freopen("/dev/null", "w", stderr);
+        execl("./server", "./server", map, "1", "--inputrate=0", maxPlayers, (char*)NULL);
+        perror("./server");
+        exit(127);
+    }
+    close(out[1]);
+    // the server prints "Server port is: N", and flushes it, in one write
+    char line[64];
+    ssize_t n = read(out[0], line, sizeof(line) - 1);
+    close(out[0]);
+    line[n > 0 ? n : 0] = '\0';
+    char* colon = strchr(line, ':');
+    if (colon == NULL || sscanf(colon + 1, "%d", port) != 1) {
+        fprintf(stderr, "server did not give its port\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/* A message for a client: stop once it is a frame. */
+static bool handleMessage(void* arg, const addr_t from, const char* message)
+{
+    if (strncmp(message, "DISPLAY", strlen("DISPLAY")) == 0) {
+        *(bool*)arg = true;
+        return true;
+    }
+    return false;
+}
+
+/* No more messages for a client. */
+static bool giveUp(void* arg)
+{
+    return true;
+}
@@ -0,0 +1,304 @@
+/*
+ * mapgen.c - procedural map generator, for stress and scaling tests
+ *
+ * Writes a valid map (see REQUIREMENTS.md) of the requested size to stdout.
+ * The map is cut into a lattice of equal cells, each big enough for the largest
+ * room plus a margin. A cell holds a room, or just a junction where passages meet;
+ * with --open, some 2x2 blocks of cells hold one open field instead, a room filling
+ * the block. Every region is joined to the rest by a random spanning tree of
+ * passages between neighbouring cells, and every other pair of neighbours is joined
+ * with probability --passages. A passage leaves one region straight through its
+ * boundary, turns once on the gutter between the two cells, and enters the other,
+ * so passages never cross rooms or each other, and the map is one connected component.
+ * The same options and seed always give the same map.
+ *
+ * Usage: ./mapgen [--seed=N] [--rows=NR] [--cols=NC] [--rooms=N] [--roomsize=MIN-MAX]
+ *                 [--passages=P] [--open=F] > map.txt
+ *
+ *   --rows, --cols  size of the map (default 40 x 120), up to MaxSide each;
+ *                   the lattice leaves any remainder as solid rock
+ *   --rooms         rooms, among the cells not taken by open fields (default 3 in 4 of them);
+ *                   the other cells are junctions
+ *   --roomsize      interior width and height of a room, drawn uniformly (default 3-12)
+ *   --passages      chance that two neighbouring cells not joined by the spanning tree
+ *                   get a passage anyway (default 0.25)
+ *   --open          chance that a 2x2 block of cells becomes an open field (default 0)
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "mem.h"
+
+static const int MaxSide = 10000;    // rows or columns
+static const int Margin = 2;         // rock between a room's boundary and the edge of its cell
+
+typedef struct region {
+    int top, left, bottom, right;    // boundary of the room, inclusive; a junction is one spot
+    bool room;
+} region_t;
+
+typedef struct options {
+    unsigned seed;
+    int rows, cols;
+    int rooms;                       // -1 for the default
+    int minSize, maxSize;
+    double passages;
+    double open;
+} options_t;
+
+static bool parse_options(int argc, char* argv[], options_t* opt);
+static int find(int* parent, int k);
+static int between(int lo, int hi);
+static void door_across(const region_t* r, int lo, int hi, int* at);
+static void connect(char** map, const region_t* a, const region_t* b, bool across,
+                    int gutter, int lo, int hi);
+static void dig(char** map, int i, int j);
+
+int main(int argc, char* argv[]) {
+    options_t opt = {1, 40, 120, -1, 3, 12, 0.25, 0};
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "Usage: %s [--seed=N] [--rows=NR] [--cols=NC] [--rooms=N] [--roomsize=MIN-MAX] "
+                        "[--passages=P] [--open=F]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    srand(opt.seed);
+
+    // a cell fits the largest room, its boundary, and a margin of rock on each side
+    int cellRows = opt.maxSize + 2 + 2 * Margin;
+    int cellCols = opt.maxSize + 2 + 2 * Margin;
+    int latRows = opt.rows / cellRows;
+    int latCols = opt.cols / cellCols;
+    if (latRows * latCols < 2) {
+        fprintf(stderr, "%s: a %dx%d map fits fewer than two cells of %dx%d; make it bigger or the rooms smaller\n",
+                argv[0], opt.rows, opt.cols, cellRows, cellCols);
+        return EXIT_FAILURE;
+    }
+    int ncells = latRows * latCols;
+
+    // assign cells to regions: open fields first, then rooms and junctions
+    int* regionOf = mem_assert(malloc(ncells * sizeof(int)), "Error allocating lattice");
+    region_t* regions = mem_assert(malloc(ncells * sizeof(region_t)), "Error allocating regions");
+    int nregions = 0;
+    for (int k = 0; k < ncells; k++) {
+        regionOf[k] = -1;
+    }
+    for (int r = 0; r + 1 < latRows; r += 2) {
+        for (int c = 0; c + 1 < latCols; c += 2) {
+            if (rand() < opt.open * ((double)RAND_MAX + 1)) {
+                // the whole block but its margin, so every passage to it can find a door
+                int top = r * cellRows + Margin, left = c * cellCols + Margin;
+                int bottom = (r + 2) * cellRows - 1 - Margin, right = (c + 2) * cellCols - 1 - Margin;
+                regions[nregions] = (region_t){top, left, bottom, right, true};
+                regionOf[r * latCols + c] = regionOf[r * latCols + c + 1] = nregions;
+                regionOf[(r + 1) * latCols + c] = regionOf[(r + 1) * latCols + c + 1] = nregions;
+                nregions++;
+            }
+        }
+    }
+    int spare = 0; // cells not in a field, yet to be assigned
+    for (int k = 0; k < ncells; k++) {
+        spare += regionOf[k] < 0;
+    }
+    int rooms = opt.rooms >= 0 ? opt.rooms : (3 * spare + 3) / 4;
+    rooms = rooms < spare ? rooms : spare;
+    for (int k = 0; k < ncells; k++) {
+        if (regionOf[k] >= 0) {
+            continue;
+        }
+        int top = (k / latCols) * cellRows, left = (k % latCols) * cellCols;
+        // each spare cell is a room with probability rooms / spare, so exactly `rooms` of them are
+        if (between(0, spare - 1) < rooms) {
+            int height = between(opt.minSize, opt.maxSize) + 2;
+            int width = between(opt.minSize, opt.maxSize) + 2;
+            top += Margin + between(0, cellRows - 2 * Margin - height);
+            left += Margin + between(0, cellCols - 2 * Margin - width);
+            regions[nregions] = (region_t){top, left, top + height - 1, left + width - 1, true};
+            rooms--;
+        } else {
+            int i = top + cellRows / 2, j = left + cellCols / 2;
+            regions[nregions] = (region_t){i, j, i, j, false};
+        }
+        regionOf[k] = nregions++;
+        spare--;
+    }
+
+    char** map = mem_assert(malloc(opt.rows * sizeof(char*)), "Error allocating map");
+    for (int i = 0; i < opt.rows; i++) {
+        map[i] = mem_assert(malloc(opt.cols + 1), "Error allocating map row");
+        memset(map[i], ' ', opt.cols);
+        map[i][opt.cols] = '\0';
+    }
+    for (int k = 0; k < nregions; k++) {
+        region_t* g = &regions[k];
+        for (int i = g->top; i <= g->bottom; i++) {
+            for (int j = g->left; j <= g->right; j++) {
+                bool edgeRow = g->room && (i == g->top || i == g->bottom);
+                bool edgeCol = g->room && (j == g->left || j == g->right);
+                map[i][j] = edgeRow && edgeCol ? '+' : edgeRow ? '-' : edgeCol ? '|' : g->room ? '.' : '#';
+            }
+        }
+    }
+
+    // every edge between neighbouring cells of different regions, in random order
+    int nedges = 0;
+    int* edges = mem_assert(malloc(2 * ncells * sizeof(int)), "Error allocating edges");
+    for (int k = 0; k < ncells; k++) {
+        if (k % latCols + 1 < latCols && regionOf[k] != regionOf[k + 1]) {
+            edges[nedges++] = 2 * k;      // k and the cell to its right
+        }
+        if (k / latCols + 1 < latRows && regionOf[k] != regionOf[k + latCols]) {
+            edges[nedges++] = 2 * k + 1;  // k and the cell below it
+        }
+    }
+    for (int e = nedges - 1; e > 0; e--) {
+        int f = between(0, e);
+        int t = edges[e];
+        edges[e] = edges[f];
+        edges[f] = t;
+    }
+    // Kruskal's algorithm: an edge joining two parts not yet connected is in the tree
+    int* parent = mem_assert(malloc(nregions * sizeof(int)), "Error allocating union-find");
+    for (int k = 0; k < nregions; k++) {
+        parent[k] = k;
+    }
+    for (int e = 0; e < nedges; e++) {
+        int k = edges[e] / 2;
+        bool across = edges[e] % 2 == 0;
+        int n = across ? k + 1 : k + latCols;
+        int a = find(parent, regionOf[k]), b = find(parent, regionOf[n]);
+        bool tree = a != b;
+        if (!tree && rand() >= opt.passages * ((double)RAND_MAX + 1)) {
+            continue;
+        }
+        parent[a] = b;
+        if (across) {
+            // the gutter is n's first column; doors stay within k's row of cells
+            int lo = (k / latCols) * cellRows + Margin + 1;
+            connect(map, &regions[regionOf[k]], &regions[regionOf[n]], true,
+                    (n % latCols) * cellCols, lo, lo + cellRows - 2 * Margin - 3);
+        } else {
+            int lo = (k % latCols) * cellCols + Margin + 1;
+            connect(map, &regions[regionOf[k]], &regions[regionOf[n]], false,
+                    (n / latCols) * cellRows, lo, lo + cellCols - 2 * Margin - 3);
+        }
+    }
+
+    for (int i = 0; i < opt.rows; i++) {
+        printf("%s\n", map[i]);
+        free(map[i]);
+    }
+    free(map);
+    free(parent);
+    free(edges);
+    free(regions);
+    free(regionOf);
+    return EXIT_SUCCESS;
+}
+
+/* parse the --name=value options; false on anything unknown or out of range */
+static bool parse_options(int argc, char* argv[], options_t* opt) {
+    for (int k = 1; k < argc; k++) {
+        const char* value = strchr(argv[k], '=');
+        if (strncmp(argv[k], "--", 2) != 0 || value == NULL) {
+            return false;
+        }
+        value++;
+        char extra;
+        bool ok;
+        if (strncmp(argv[k], "--seed=", 7) == 0) {
+            ok = sscanf(value, "%u%c", &opt->seed, &extra) == 1;
+        } else if (strncmp(argv[k], "--rows=", 7) == 0) {
+            ok = sscanf(value, "%d%c", &opt->rows, &extra) == 1 && opt->rows > 0 && opt->rows <= MaxSide;
+        } else if (strncmp(argv[k], "--cols=", 7) == 0) {
+            ok = sscanf(value, "%d%c", &opt->cols, &extra) == 1 && opt->cols > 0 && opt->cols <= MaxSide;
+        } else if (strncmp(argv[k], "--rooms=", 8) == 0) {
+            ok = sscanf(value, "%d%c", &opt->rooms, &extra) == 1 && opt->rooms >= 0;
+        } else if (strncmp(argv[k], "--roomsize=", 11) == 0) {
+            ok = sscanf(value, "%d-%d%c", &opt->minSize, &opt->maxSize, &extra) == 2
+                 && opt->minSize >= 1 && opt->minSize <= opt->maxSize;
+        } else if (strncmp(argv[k], "--passages=", 11) == 0) {
+            ok = sscanf(value, "%lf%c", &opt->passages, &extra) == 1 && opt->passages >= 0 && opt->passages <= 1;
+        } else if (strncmp(argv[k], "--open=", 7) == 0) {
+            ok = sscanf(value, "%lf%c", &opt->open, &extra) == 1 && opt->open >= 0 && opt->open <= 1;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the representative of region k's connected part */
+static int find(int* parent, int k) {
+    while (parent[k] != k) {
+        parent[k] = parent[parent[k]];
+        k = parent[k];
+    }
+    return k;
+}
+
+/* a random integer from lo to hi, inclusive */
+static int between(int lo, int hi) {
+    return lo + rand() % (hi - lo + 1);
+}
+
+/* where a passage along the gutter's direction leaves region r: a row (or column) inside
+ * the room, not a corner, and within lo..hi; a junction's own row (or column) */
+static void door_across(const region_t* r, int lo, int hi, int* at) {
+    if (lo < r->top + 1) {
+        lo = r->top + 1;
+    }
+    if (hi > r->bottom - 1) {
+        hi = r->bottom - 1;
+    }
+    *at = r->room ? between(lo, hi) : r->top;
+}
+
+/* Join region a to its neighbour b, to its right (across) or below it, with a passage
+ * that turns on the gutter line; doors are chosen within lo..hi across the passage. */
+static void connect(char** map, const region_t* a, const region_t* b, bool across,
+                    int gutter, int lo, int hi) {
+    if (across) {
+        int ra, rb;
+        door_across(a, lo, hi, &ra);
+        door_across(b, lo, hi, &rb);
+        for (int j = a->right; j <= gutter; j++) {
+            dig(map, ra, j);
+        }
+        for (int i = ra < rb ? ra : rb; i <= (ra < rb ? rb : ra); i++) {
+            dig(map, i, gutter);
+        }
+        for (int j = gutter; j <= b->left; j++) {
+            dig(map, rb, j);
+        }
+    } else {
+        // the same, with rows and columns swapped
+        region_t ta = {a->left, a->top, a->right, a->bottom, a->room};
+        region_t tb = {b->left, b->top, b->right, b->bottom, b->room};
+        int ca, cb;
+        door_across(&ta, lo, hi, &ca);
+        door_across(&tb, lo, hi, &cb);
+        for (int i = a->bottom; i <= gutter; i++) {
+            dig(map, i, ca);
+        }
+        for (int j = ca < cb ? ca : cb; j <= (ca < cb ? cb : ca); j++) {
+            dig(map, gutter, j);
+        }
+        for (int i = gutter; i <= b->top; i++) {
+            dig(map, i, cb);
+        }
+    }
+}
+
+/* turn rock, or a room's boundary, into passage */
+static void dig(char** map, int i, int j) {
+    if (map[i][j] != '.') {
+        map[i][j] = '#';
+    }
+}
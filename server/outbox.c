@@ -0,0 +1,344 @@
+/*
+ * outbox.c - 'outbox' module
+ *
+ * See outbox.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mem.h"
+#include "message.h"
+#include "outbox.h"
+
+/**************** file-local constants ****************/
+static const double BurstSeconds = 0.05; // a client's allowance may build up to this many seconds' worth
+
+/**************** file-local types ****************/
+typedef enum priority
+{
+    CONTROL, // QUIT, OK, GRID, ERROR, and anything else
+    STATUS,  // GOLD
+    FRAME,   // DISPLAY, DISPLAYZ
+    NumPriorities
+} priority_t;
+
+typedef struct queued
+{
+    char *message;
+    struct queued *next;
+} queued_t;
+
+typedef struct client
+{
+    addr_t addr;
+    queued_t *head[FRAME]; // a queue for each class but frames, oldest first
+    queued_t *tail[FRAME];
+    char *frame;           // the frame waiting to be sent, or NULL
+    int depth;             // messages waiting, frame included
+    double allowance;      // bytes it may send now; negative after a large message
+    double refilled;       // when the allowance was last topped up
+    long sent[NumPriorities];
+    long bytes;
+    int maxDepth;
+    long framesDropped;    // frames replaced by newer ones before they were sent
+    long held;             // messages queued behind the rate cap instead of sent at once
+    bool forgotten;        // drop the queue once it is empty
+} client_t;
+
+/**************** global variables ****************/
+static int rate = 0; // bytes per second per client; 0 for no cap
+static client_t *clients = NULL;
+static int nclients = 0;
+static int clientsSize = 0;
+static client_t gone;     // the counts of clients whose queues were dropped
+static int ngone = 0;
+
+/**************** local functions ****************/
+static client_t *find_client(const addr_t addr);
+static bool drop_if_done(int i);
+static priority_t classify(const char *message);
+static bool pump_client(client_t *client, double when, bool force);
+static void send_one(client_t *client, priority_t priority, char *message);
+static double now(void);
+
+void outbox_set_rate(int bytesPerSecond)
+{
+    rate = bytesPerSecond;
+}
+
+int outbox_get_rate(void)
+{
+    return rate;
+}
+
+void outbox_send(const addr_t to, const char *message)
+{
+    client_t *client = find_client(to);
+    priority_t priority = classify(message);
+    char *copy = mem_assert(mem_tmalloc("outbox", strlen(message) + 1), "Failed to allocate memory for queued message.");
+    strcpy(copy, message);
+    if (priority == FRAME)
+    {
+        if (client->frame != NULL)
+        {
+            mem_tfree(client->frame);
+            client->framesDropped++;
+            client->depth--;
+        }
+        client->frame = copy;
+    }
+    else
+    {
+        queued_t *node = mem_assert(mem_tmalloc("outbox", sizeof(queued_t)), "Failed to allocate memory for queue node.");
+        node->message = copy;
+        node->next = NULL;
+        if (client->tail[priority] == NULL)
+        {
+            client->head[priority] = node;
+        }
+        else
+        {
+            client->tail[priority]->next = node;
+        }
+        client->tail[priority] = node;
+    }
+    client->depth++;
+    if (client->depth > client->maxDepth)
+    {
+        client->maxDepth = client->depth;
+    }
+    if (pump_client(client, rate > 0 ? now() : 0, false))
+    {
+        client->held++;
+    }
+    drop_if_done(client - clients);
+}
+
+void outbox_reply(const addr_t to, const char *message)
+{
+    message_send(to, message);
+}
+
+void outbox_forget(const addr_t to)
+{
+    for (int i = 0; i < nclients; i++)
+    {
+        if (message_eqAddr(clients[i].addr, to))
+        {
+            clients[i].forgotten = true;
+            drop_if_done(i);
+            break;
+        }
+    }
+    message_forget(to);
+}
+
+bool outbox_pump(void)
+{
+    bool waiting = false;
+    double when = now();
+    for (int i = 0; i < nclients; i++)
+    {
+        waiting = pump_client(&clients[i], when, false) || waiting;
+        if (drop_if_done(i))
+        {
+            i--; // the last client took its place
+        }
+    }
+    return waiting;
+}
+
+void outbox_drain(void)
+{
+    for (int i = 0; i < nclients; i++)
+    {
+        pump_client(&clients[i], 0, true);
+    }
+}
+
+void outbox_report(FILE *fp)
+{
+    if (rate > 0)
+    {
+        fprintf(fp, "Outbox: rate cap %d bytes/s per client\n", rate);
+    }
+    else
+    {
+        fprintf(fp, "Outbox: no rate cap\n");
+    }
+    fprintf(fp, "%-22s %8s %8s %8s %10s %9s %9s %8s\n", "client", "control", "status", "frames",
+            "bytes", "max depth", "dropped", "held");
+    for (int i = 0; i < nclients; i++)
+    {
+        client_t *c = &clients[i];
+        fprintf(fp, "%-22s %8ld %8ld %8ld %10ld %9d %9ld %8ld\n", message_stringAddr(c->addr),
+                c->sent[CONTROL], c->sent[STATUS], c->sent[FRAME], c->bytes, c->maxDepth,
+                c->framesDropped, c->held);
+    }
+    if (ngone > 0)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "(gone: %d)", ngone);
+        fprintf(fp, "%-22s %8ld %8ld %8ld %10ld %9d %9ld %8ld\n", label,
+                gone.sent[CONTROL], gone.sent[STATUS], gone.sent[FRAME], gone.bytes, gone.maxDepth,
+                gone.framesDropped, gone.held);
+    }
+}
+
+void outbox_delete(void)
+{
+    for (int i = 0; i < nclients; i++)
+    {
+        for (int p = 0; p < FRAME; p++)
+        {
+            while (clients[i].head[p] != NULL)
+            {
+                queued_t *node = clients[i].head[p];
+                clients[i].head[p] = node->next;
+                mem_tfree(node->message);
+                mem_tfree(node);
+            }
+        }
+        mem_tfree(clients[i].frame);
+    }
+    mem_tfree(clients);
+    clients = NULL;
+    nclients = clientsSize = 0;
+    memset(&gone, 0, sizeof(gone));
+    ngone = 0;
+}
+
+/* The queue for a client, created on first use. */
+static client_t *find_client(const addr_t addr)
+{
+    for (int i = 0; i < nclients; i++)
+    {
+        if (message_eqAddr(clients[i].addr, addr))
+        {
+            return &clients[i];
+        }
+    }
+    if (nclients == clientsSize)
+    {
+        clientsSize = clientsSize == 0 ? 8 : 2 * clientsSize;
+        clients = mem_assert(mem_trealloc("outbox", clients, clientsSize * sizeof(client_t)), "Failed to allocate memory for outbox clients.");
+    }
+    client_t *client = &clients[nclients++];
+    memset(client, 0, sizeof(client_t));
+    client->addr = addr;
+    client->allowance = rate * BurstSeconds;
+    client->refilled = rate > 0 ? now() : 0;
+    return client;
+}
+
+/* Drop the i'th client if it is forgotten and its queue is empty, moving the last client into its place.
+ * Returns true if it was dropped. */
+static bool drop_if_done(int i)
+{
+    client_t *client = &clients[i];
+    if (!client->forgotten || client->depth > 0)
+    {
+        return false;
+    }
+    for (int p = 0; p < NumPriorities; p++)
+    {
+        gone.sent[p] += client->sent[p];
+    }
+    gone.bytes += client->bytes;
+    if (client->maxDepth > gone.maxDepth)
+    {
+        gone.maxDepth = client->maxDepth;
+    }
+    gone.framesDropped += client->framesDropped;
+    gone.held += client->held;
+    ngone++;
+    *client = clients[--nclients];
+    return true;
+}
+
+/* The class of a message, from its first word. */
+static priority_t classify(const char *message)
+{
+    if (strncmp(message, "DISPLAY", strlen("DISPLAY")) == 0)
+    {
+        return FRAME;
+    }
+    if (strncmp(message, "GOLD ", strlen("GOLD ")) == 0)
+    {
+        return STATUS;
+    }
+    return CONTROL;
+}
+
+/* Send from one client's queue, highest class first, while its allowance lasts (or all of it, if forced).
+ * Returns true if messages are still waiting. */
+static bool pump_client(client_t *client, double when, bool force)
+{
+    bool capped = rate > 0 && !force;
+    if (capped)
+    {
+        client->allowance += (when - client->refilled) * rate;
+        if (client->allowance > rate * BurstSeconds)
+        {
+            client->allowance = rate * BurstSeconds;
+        }
+        client->refilled = when;
+    }
+    while (client->depth > 0)
+    {
+        if (capped && client->allowance <= 0)
+        {
+            return true;
+        }
+        if (client->head[CONTROL] != NULL || client->head[STATUS] != NULL)
+        {
+            priority_t priority = client->head[CONTROL] != NULL ? CONTROL : STATUS;
+            queued_t *node = client->head[priority];
+            client->head[priority] = node->next;
+            if (client->head[priority] == NULL)
+            {
+                client->tail[priority] = NULL;
+            }
+            send_one(client, priority, node->message);
+            mem_tfree(node);
+        }
+        else
+        {
+            char *frame = client->frame;
+            client->frame = NULL;
+            send_one(client, FRAME, frame);
+        }
+    }
+    return false;
+}
+
+/* Send one message taken off a client's queue, and free it. */
+static void send_one(client_t *client, priority_t priority, char *message)
+{
+    size_t length = strlen(message);
+    if (priority == FRAME)
+    {
+        message_sendLatest(client->addr, message);
+    }
+    else
+    {
+        message_sendReliable(client->addr, message);
+    }
+    client->depth--;
+    client->allowance -= length;
+    client->sent[priority]++;
+    client->bytes += length;
+    mem_tfree(message);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,101 @@
+/*
+ * outbox.h - header file for 'outbox' module
+ *
+ * The outbox holds the server's outgoing messages, one queue per client, and sends
+ * them in order of priority: control messages (QUIT, OK, GRID, ERROR) first, then
+ * status (GOLD), then frames (DISPLAY, DISPLAYZ). A client has at most one frame
+ * waiting; a newer frame replaces it, since only the latest view matters.
+ * Optionally, each client's queue is drained no faster than a rate cap, in bytes per
+ * second, so a slow client gets fewer, fresher frames instead of a backlog of stale ones.
+ * Without a cap, every message is sent as soon as it is queued.
+ * A client's queue lasts until the server forgets the client and the queue is empty;
+ * replies to addresses that are no client at all bypass the queues.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "message.h"
+
+/**************** functions ****************/
+
+/***************** outbox_set_rate *****************/
+/* Cap the rate at which each client's queue is sent.
+ *
+ * Caller provides:
+ *   bytes per second for each client; 0 for no cap (the default).
+ * Notes:
+ *   meant to be called once, at startup, before anything is queued.
+ */
+void outbox_set_rate(int bytesPerSecond);
+
+/***************** outbox_get_rate *****************/
+/* Return the rate cap in bytes per second per client, or 0 if there is none. */
+int outbox_get_rate(void);
+
+/***************** outbox_send *****************/
+/* Queue a message for a client, and send what its rate cap allows right away.
+ *
+ * Caller provides:
+ *   the client's address and the message.
+ * We guarantee:
+ *   the message is copied; its priority is taken from its first word.
+ *   control and status messages are sent reliably and in order within their class;
+ *   frames are sent latest-wins, and an unsent frame is dropped for a newer one.
+ */
+void outbox_send(const addr_t to, const char *message);
+
+/***************** outbox_reply *****************/
+/* Send a message to an address that is neither a player nor the spectator.
+ *
+ * Caller provides:
+ *   the sender's address and the reply.
+ * We guarantee:
+ *   the reply is sent once, unreliably, at once; no queue or reliable-send state is kept for it.
+ */
+void outbox_reply(const addr_t to, const char *message);
+
+/***************** outbox_forget *****************/
+/* Drop a client's queue once everything in it has been sent.
+ *
+ * Caller provides:
+ *   the address of a client that is no longer a player nor the spectator.
+ * We guarantee:
+ *   what is queued for it is still sent; then its queue is freed, and its counts go to
+ *   the "(gone)" row of the report. A later outbox_send to it starts a new queue.
+ *   the message module forgets it too, once what was sent to it has landed (see message_forget).
+ */
+void outbox_forget(const addr_t to);
+
+/***************** outbox_pump *****************/
+/* Send from every client's queue as much as the rate caps allow by now.
+ *
+ * We guarantee:
+ *   returns true if some messages are still waiting.
+ * Notes:
+ *   the caller should call this every few milliseconds while messages are waiting.
+ */
+bool outbox_pump(void);
+
+/***************** outbox_drain *****************/
+/* Send everything still queued, ignoring the rate caps; for use at exit. */
+void outbox_drain(void);
+
+/***************** outbox_report *****************/
+/* Print, for each client (and, together, those forgotten), what was sent, the deepest its queue got, and how many frames were dropped.
+ *
+ * Caller provides:
+ *   an open file to print to.
+ */
+void outbox_report(FILE *fp);
+
+/***************** outbox_delete *****************/
+/* Free every queue and anything still in them. */
+void outbox_delete(void);
+
+#endif // OUTBOX_H
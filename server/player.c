@@ -15,232 +15,106 @@
 #include "grid.h"
 #include "mem.h"
 #include "message.h"
+#include "outbox.h"
+#include "throttle.h"
+#include "tiles.h"
+#include "visibility.h"
+#include "arena.h"
 
 static void player_update_purse(player_t *player, int d_gold);
 
 int MaxNameLength = 50;
 
-static int min(int a, int b);
-static int max(int a, int b);
-
 typedef struct player
 {
+	arena_t *arena; // where the player and everything they hold live; NULL for malloc
 	char *real_name;
-	addr_t *connection_info;
-	int *purse;
-	int *x;
-	int *y;
-	int **visibility;
-	bool *isactive;
-	bool *isInvincible;
+	addr_t connection_info;
+	int purse;
+	int x;
+	int y;
+	tiles_t *visibility; // unsigned char per cell: 0 never seen, 1 visible now, 2 seen before
+	int *visible; // indices (row * ncols + col) of the cells currently visible
+	int nvisible;
+	int visibleSize; // ints allocated in visible
+	tiles_t *terrain; // char per cell: the terrain this player has seen, blank elsewhere
+	bool isactive;
+	bool isInvincible;
+	bool isDirty; // what this player would be shown has changed since their last DISPLAY
+	bool isCompressed; // the client asked for compressed DISPLAY frames
+	bool hasLegend; // the client asked for a legend of the players past the first cycle of symbols
+	throttle_t *input; // limits how fast the client's input is accepted
+	int viewRows; // size of the client's screen, for viewport frames; 0 if it takes whole maps
+	int viewCols;
 } player_t;
 
-player_t *player_new(const addr_t connection_info, char *real_name, int x, int y, int nrows, int ncols)
+player_t *player_new(arena_t *arena, const addr_t connection_info, char *real_name, int x, int y, int nrows, int ncols)
 {
-	player_t *player = (player_t *)mem_assert(malloc(sizeof(player_t)), "Error allocating memory for player\n");
-	char *copied_name = (char *)mem_assert(malloc(sizeof(char) * (MaxNameLength + 1)), "Error allocating memory for copied_name\n"); // truncate is handled by message processing
-	strcpy(copied_name, real_name);																									 // grid is allowed to free "REAL NAME" once sent
-	player->real_name = copied_name;
-	player->visibility = (int **)mem_assert(calloc(nrows, sizeof(int *)), "Error allocating visibility array\n");
-	for (int i = 0; i < nrows; i++)
-	{
-		player->visibility[i] = (int *)mem_assert(calloc(ncols, sizeof(int)), "Error allocating row in visibility array\n");
-	}
-	player->connection_info = (addr_t *)mem_assert(malloc(sizeof(addr_t)), "Error allocating space for x");
-	*(player->connection_info) = connection_info;
-	player->x = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for x");
-	player->y = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for y");
-	player->isactive = (bool *)mem_assert(malloc(sizeof(bool)), "Error allocating space for isactive");
-	player->purse = (int *)mem_assert(malloc(sizeof(int)), "Error allocating space for purse");
-	player->isInvincible = (bool *)mem_assert(malloc(sizeof(bool)), "Error allocating space for isInvincible");
-	*(player->x) = x;
-	*(player->y) = y;
-	*(player->purse) = 0;
-	*(player->isactive) = true;
-	*(player->isInvincible) = true;
+	player_t *player = (player_t *)mem_assert(arena_alloc(arena, sizeof(player_t)), "Error allocating memory for player\n");
+	player->arena = arena;
+	player->real_name = mem_assert(arena_strdup(arena, real_name), "Error allocating memory for copied_name\n"); // truncate is handled by message processing; grid is allowed to free "REAL NAME" once sent
+	// both layers only take memory where the player has looked
+	unsigned char unseen = 0;
+	player->visibility = tiles_new(arena, nrows, ncols, sizeof(unsigned char), &unseen);
+	player->visible = NULL; // grown by visibility_compute
+	player->nvisible = 0;
+	player->visibleSize = 0;
+	char blank = ' ';
+	player->terrain = tiles_new(arena, nrows, ncols, sizeof(char), &blank);
+	player->connection_info = connection_info;
+	player->x = x;
+	player->y = y;
+	player->purse = 0;
+	player->isactive = true;
+	player->isInvincible = true;
+	player->isDirty = true; // a new player has not been sent anything yet
+	player->isCompressed = false; // until the client asks
+	player->hasLegend = false;
+	player->input = throttle_new(arena);
+	player->viewRows = player->viewCols = 0; // until the client says otherwise
 	return player;
 }
 
 void player_update_visibility(player_t *player, grid_t *grid)
 {
-	int x = *(player->x);
-	int y = *(player->y);
-	char **map = grid_getcells(grid);
-	double cx;
-	double cy;
-	int cx_floor;
-	int cx_ceil;
-	int cy_floor;
-	int cy_ceil;
-	for (int i = 0; i < grid_getnrows(grid); i++)
+	int ncols = grid_getncols(grid);
+	for (int k = 0; k < player->nvisible; k++)
 	{
-		for (int j = 0; j < grid_getncols(grid); j++)
-		{
-			if (player->visibility[i][j] == 1)
-			{
-				player_set_visibility(player, i, j, 2); // set previously visible squares from "active" to "seen"
-			}
-		}
+		int idx = player->visible[k];
+		*(unsigned char *)tiles_touch(player->visibility, idx / ncols, idx % ncols) = 2; // set previously visible squares from "active" to "seen"
 	}
-	if (map[x][y] != '.')
-	{
-		if (map[x][y] == '#')
-		{
-			int count = 0;
-			for (int dx = -1; dx <= 1; dx = dx + 2)
-			{
-				if (0 <= x + dx && x + dx < grid_getnrows(grid))
-				{
-					if (map[x + dx][y] == '#')
-					{
-						count++;
-					}
-				}
-			}
-			for (int dy = -1; dy <= 1; dy = dy + 2)
-			{
-				if (0 <= y + dy && y + dy < grid_getncols(grid))
-				{
-					if (map[x][y + dy] == '#')
-					{
-						count++;
-					}
-				}
-			}
-			if (count == 1)
-			{
-				for (int i = 0; i < grid_getnrows(grid); i++)
-				{
-					for (int j = 0; j < grid_getncols(grid); j++)
-					{
-						bool visible = true;
-						if (map[i][j] == '#')
-						{
-							visible = (abs(x - i) + abs(y - j) <= 1); // only adjacent hashes are shown
-						}
-						else
-						{
-							for (int dx = min(x, i) + 1; dx < max(x, i); dx++)
-							{
-								cy = y + (y - j) / (x - i) * (dx - x);
-								cy_floor = floor(cy);
-								cy_ceil = ceil(cy);
-								if (map[dx][cy_floor] != '.' || map[dx][cy_ceil] != '.')
-								{
-									visible = false;
-									break;
-								}
-							}
-							for (int dy = min(y, j) + 1; dy < max(y, j); dy++)
-							{
-								cx = x + (x - i) / (y - j) * (dy - y);
-								cx_floor = floor(cx);
-								cx_ceil = ceil(cx);
-								if (map[cx_floor][dy] != '.' || map[cx_ceil][dy] != '.')
-								{
-									visible = false;
-									break;
-								}
-							}
-						}
-						if (visible)
-						{
-							player_set_visibility(player, i, j, 1);
-						}
-					}
-				}
-			}
-			else
-			{
-				player_set_visibility(player, x, y, 1);
-				for (int dx = -1; dx <= 1; dx = dx + 2)
-				{
-					if (0 <= x + dx && x + dx < grid_getnrows(grid))
-					{
-						if (map[x + dx][y] == '#')
-						{
-							player_set_visibility(player, x + dx, y, 1);
-						}
-					}
-				}
-				for (int dy = -1; dy <= 1; dy = dy + 2)
-				{
-					if (0 <= y + dy && y + dy < grid_getncols(grid))
-					{
-						if (map[x][y + dy] == '#')
-						{
-							player_set_visibility(player, x, y + dy, 1);
-						}
-					}
-				}
-			}
-		}
-	}
-	else
+	player->nvisible = visibility_compute(visibility_get_engine(), visibility_get_radius(), grid_getvismap(grid),
+										  player->x, player->y, player->visibility, player->arena, &player->visible, &player->visibleSize);
+	// visible and seen cells both show their terrain, so it only changes where a cell is seen for the first time
+	char **map = grid_getcells(grid);
+	for (int k = 0; k < player->nvisible; k++)
 	{
-		for (int i = 0; i < grid_getnrows(grid); i++)
-		{
-			for (int j = 0; j < grid_getncols(grid); j++)
-			{
-				bool visible = true;
-				for (int dx = min(x, i) + 1; dx < max(x, i); dx++)
-				{
-					cy = y + ((float)(y - j)) / ((float)(x - i)) * (dx - x);
-					cy_floor = floor(cy);
-					cy_ceil = ceil(cy);
-					if (map[dx][cy_floor] != '.' && map[dx][cy_ceil] != '.')
-					{
-						visible = false;
-						break;
-					}
-				}
-				for (int dy = min(y, j) + 1; dy < max(y, j); dy++)
-				{
-					cx = x + ((float)(x - i)) / ((float)(y - j)) * (dy - y);
-					cx_floor = floor(cx);
-					cx_ceil = ceil(cx);
-					if (map[cx_floor][dy] != '.' && map[cx_ceil][dy] != '.')
-					{
-						visible = false;
-						break;
-					}
-				}
-				if (visible)
-				{
-					player_set_visibility(player, i, j, 1);
-				}
-			}
-		}
+		int i = player->visible[k] / ncols;
+		int j = player->visible[k] % ncols;
+		*(char *)tiles_touch(player->terrain, i, j) = map[i][j];
 	}
 }
 
 void player_moveto(player_t *player, int x, int y)
 {
-	*(player->x) = x;
-	*(player->y) = y;
+	player->x = x;
+	player->y = y;
 }
 
 void player_delete(player_t *player, grid_t *grid)
 {
-	free(player->real_name);
-	free(player->x);
-	free(player->y);
-	free(player->purse);
-	free(player->isactive);
-	free(player->connection_info);
-	int nr = grid_getnrows(grid);
-	for (int i = 0; i < nr; i++)
-	{
-		free(player->visibility[i]);
-	}
-	free(player->visibility);
-	free(player);
+	// in an arena all of these are no-ops: the player goes with the arena
+	arena_free(player->arena, player->real_name);
+	tiles_delete(player->visibility);
+	arena_free(player->arena, player->visible);
+	tiles_delete(player->terrain);
+	throttle_delete(player->input);
+	arena_free(player->arena, player);
 }
 
 void player_collect_gold(player_t *player, grid_t *grid, int gold_x, int gold_y)
 {
-	int **nuggets = grid_getnuggets(grid);
-	int gold_obtained = nuggets[gold_x][gold_y];
+	int gold_obtained = grid_getnuggets(grid, gold_x, gold_y);
 	if (gold_obtained != 0)
 	{
 		player_update_purse(player, gold_obtained);
@@ -250,27 +124,20 @@ void player_collect_gold(player_t *player, grid_t *grid, int gold_x, int gold_y)
 		int num_players = grid_getplayercount(grid);
 		for (int i = 0; i < num_players; i++)
 		{
-			if (*(players[i]->isactive))
+			if (players[i]->isactive)
 			{
-				char *message = (char *)mem_assert(malloc(sizeof(char) * 50), "Error allocating memory for gold message string\n"); // GOLD N P R
+				char *message = (char *)mem_assert(mem_tmalloc("message", sizeof(char) * 50), "Error allocating memory for gold message string\n"); // GOLD N P R
 				sprintf(message, "GOLD %d %d %d", (players[i] == player ? gold_obtained : 0), player_get_purse(players[i]), grid_getnuggetcount(grid));
-				if (player_get_addr((players[i])) != NULL)
-				{
-					message_send(*player_get_addr(players[i]), message);
-				}
-				else
-				{
-					printf("Message: %s\n", message);
-				}
-				free(message);
+				outbox_send(*player_get_addr(players[i]), message);
+				mem_tfree(message);
 			}
 		}
 		if (grid_getspectatorCount(grid) == 1)
 		{
-			char *message = (char *)mem_assert(malloc(sizeof(char) * 50), "Error allocating memory for gold message string\n"); // GOLD N P R
+			char *message = (char *)mem_assert(mem_tmalloc("message", sizeof(char) * 50), "Error allocating memory for gold message string\n"); // GOLD N P R
 			sprintf(message, "GOLD 0 0 %d", grid_getnuggetcount(grid));
-			message_send(*spectator_get_addr(grid_getspectator(grid)), message);
-			free(message);
+			outbox_send(*spectator_get_addr(grid_getspectator(grid)), message);
+			mem_tfree(message);
 		}
 	}
 }
@@ -281,55 +148,57 @@ bool player_move(player_t *player, grid_t *grid, int dx, int dy)
 	if (player_get_isinvincible(player)) {
 		player_set_isinvincible(player, false);
 	}
-	int x = *player->x;
-	int y = *player->y;
+	int x = player->x;
+	int y = player->y;
 	if (0 <= x + dx && x + dx < grid_getnrows(grid) && 0 <= y + dy && y + dy < grid_getncols(grid))
 	{
 		if (grid_getcells(grid)[x + dx][y + dy] == '.' || grid_getcells(grid)[x + dx][y + dy] == '#')
 		{
 			player_t **players = grid_getplayers(grid);
-			for (int i = 0; i < grid_getplayercount(grid); i++)
+			int mover = grid_getoccupant(grid, x, y);
+			int i = grid_getoccupant(grid, x + dx, y + dy); // the active player already on the spot, if any
+			grid_setoccupant(grid, x, y, -1);
+			//if moving to spot with player already, steal gold if possible
+			if (i >= 0)
 			{
-				if (players[i]->isactive)
-				{
-					//if moving to spot with player already, steal gold if possible
-					if (player_get_x(players[i]) == x + dx && player_get_y(players[i]) == y + dy)
-					{
-						//if player on spot not invincible
-						if (!(player_get_isinvincible(players[i]))) {
-							//add victim's purse to moving player's purse
-							player_update_purse(player, player_get_purse(players[i]));
-							//send GOLD message for new moving player's purse
-							char* message = mem_assert(malloc(128), "Error allocating space for message");
-							sprintf(message, "GOLD %d %d %d", player_get_purse(players[i]), player_get_purse(player), grid_getnuggetcount(grid));
-							message_send(*player_get_addr(player), message);
-							free(message);
-							//send GOLD message for new victim's purse
-							message = mem_assert(malloc(128), "Error allocating space for message");
-							sprintf(message, "GOLD %d %d %d", -1 * player_get_purse(players[i]), 0, grid_getnuggetcount(grid));
-							message_send(*player_get_addr(players[i]), message);
-							free(message);
-							//make victim's purse 0
-							player_update_purse(players[i], -1 * player_get_purse(players[i]));
-						}
-						player_moveto(players[i], x, y);
-						//make victim invincible for one move
-						player_set_isinvincible(players[i], true);
-						//make stealer invincible for one move
-						player_set_isinvincible(player, true);
-						break;
-					}
+				//if player on spot not invincible
+				if (!(player_get_isinvincible(players[i]))) {
+					//add victim's purse to moving player's purse
+					player_update_purse(player, player_get_purse(players[i]));
+					//send GOLD message for new moving player's purse
+					char* message = mem_assert(mem_tmalloc("message", 128), "Error allocating space for message");
+					sprintf(message, "GOLD %d %d %d", player_get_purse(players[i]), player_get_purse(player), grid_getnuggetcount(grid));
+					outbox_send(*player_get_addr(player), message);
+					mem_tfree(message);
+					//send GOLD message for new victim's purse
+					message = mem_assert(mem_tmalloc("message", 128), "Error allocating space for message");
+					sprintf(message, "GOLD %d %d %d", -1 * player_get_purse(players[i]), 0, grid_getnuggetcount(grid));
+					outbox_send(*player_get_addr(players[i]), message);
+					mem_tfree(message);
+					//make victim's purse 0
+					player_update_purse(players[i], -1 * player_get_purse(players[i]));
 				}
+				player_moveto(players[i], x, y);
+				grid_setoccupant(grid, x, y, i);
+				player_set_isdirty(players[i], true);
+				//make victim invincible for one move
+				player_set_isinvincible(players[i], true);
+				//make stealer invincible for one move
+				player_set_isinvincible(player, true);
 			}
 			player_moveto(player, x + dx, y + dy);
+			grid_setoccupant(grid, x + dx, y + dy, mover);
 			player_collect_gold(player, grid, x + dx, y + dy);
-			for (int i = 0; i < grid_getplayercount(grid); i++)
+			// sight depends only on the map, so only the players who moved see anything new
+			player_update_visibility(player, grid);
+			if (i >= 0 && players[i] != player)
 			{
-				if (players[i]->isactive)
-				{
-					player_update_visibility(players[i], grid);
-				}
+				player_update_visibility(players[i], grid);
 			}
+			// the mover sees from a new spot; anyone who can see either end sees an occupant change
+			player_set_isdirty(player, true);
+			grid_mark_changed(grid, x, y);
+			grid_mark_changed(grid, x + dx, y + dy);
 			return true;
 		}
 		else
@@ -356,38 +225,33 @@ void player_quit(player_t *player, grid_t *grid)
 	//update nugget count of player
 	player_update_purse(player, -player_get_purse(player));
 
-	//send updated messages to players
+	//send updated GOLD messages to players
 	player_t** players = grid_getplayers(grid);
 	for (int i = 0; i < grid_getplayercount(grid); i++) {
+		if (!player_get_isactive(players[i])) {
+			continue; // they have had their QUIT
+		}
 		addr_t currentAddress = *player_get_addr(players[i]);
 		//construct GOLD message with recipient's purse and updated total nuggets in game
-		char* message = mem_assert(malloc(128), "Error allocating space for message");
+		char* message = mem_assert(mem_tmalloc("message", 128), "Error allocating space for message");
 		sprintf(message, "GOLD 0 %d %d", player_get_purse(players[i]), grid_getnuggetcount(grid) + player_get_purse(player));
-		message_send(currentAddress, message);
-		free(message);
-		
-		//send updated DISPLAY message
-		message = grid_send_state(grid, players[i]);
-		message_send(currentAddress, message);
-		free(message);
+		outbox_send(currentAddress, message);
+		mem_tfree(message);
 	}
-	//send updated messages to spectator
+	//send updated GOLD message to spectator
 	if (grid_getspectatorCount(grid) == 1) {
 		addr_t currentAddress = *spectator_get_addr(grid_getspectator(grid));
 		//construct GOLD message with updated total nuggets in game
-		char* message = mem_assert(malloc(128), "Error allocating space for message");
+		char* message = mem_assert(mem_tmalloc("message", 128), "Error allocating space for message");
 		sprintf(message, "GOLD 0 0 %d", grid_getnuggetcount(grid) + player_get_purse(player));
-		message_send(currentAddress, message);
-		free(message);
-		
-		//send updated DISPLAY message
-		message = grid_send_state_spectator(grid);
-		message_send(currentAddress, message);
-		free(message);
+		outbox_send(currentAddress, message);
+		mem_tfree(message);
 	}
 
-	//quit player
-	*player->isactive = false;
+	//quit player; whoever sees the spot now sees the dropped gold instead of the player
+	player->isactive = false;
+	grid_setoccupant(grid, x, y, -1);
+	grid_mark_changed(grid, x, y);
 }
 
 char *player_get_name(player_t *player)
@@ -397,60 +261,124 @@ char *player_get_name(player_t *player)
 
 addr_t *player_get_addr(player_t *player)
 {
-	return player->connection_info;
+	return &player->connection_info;
 }
 
 int player_get_x(player_t *player)
 {
-	return *(player->x);
+	return player->x;
 }
 
 int player_get_y(player_t *player)
 {
-	return *(player->y);
+	return player->y;
 }
 
 int player_get_purse(player_t *player)
 {
-	return *(player->purse);
+	return player->purse;
+}
+
+int player_get_visibility(player_t *player, int x, int y)
+{
+	return *(const unsigned char *)tiles_get(player->visibility, x, y);
+}
+
+int *player_get_visible(player_t *player)
+{
+	return player->visible;
+}
+
+int player_get_nvisible(player_t *player)
+{
+	return player->nvisible;
 }
 
-int **player_get_visibility(player_t *player)
+tiles_t *player_get_terrain(player_t *player)
 {
-	return player->visibility;
+	return player->terrain;
 }
 
 void player_set_visibility(player_t *player, int x, int y, int val)
 {
-	player->visibility[x][y] = val;
+	*(unsigned char *)tiles_touch(player->visibility, x, y) = val;
+}
+
+size_t player_memory(player_t *player, int *tiles, int *total)
+{
+	int visibilityTotal, terrainTotal;
+	*tiles = tiles_count(player->visibility, &visibilityTotal) + tiles_count(player->terrain, &terrainTotal);
+	*total = visibilityTotal + terrainTotal;
+	return sizeof(player_t) + tiles_bytes(player->visibility) + tiles_bytes(player->terrain) + player->visibleSize * sizeof(int);
 }
 
 bool player_get_isactive(player_t *player)
 {
-	return *player->isactive;
+	return player->isactive;
 }
 
 bool player_get_isinvincible(player_t *player)
 {
-	return *player->isInvincible;
+	return player->isInvincible;
 }
 
 void player_set_isinvincible(player_t *player, bool invincible)
 {
-	*player->isInvincible = invincible;
+	player->isInvincible = invincible;
+}
+
+bool player_get_isdirty(player_t *player)
+{
+	return player->isDirty;
+}
+
+void player_set_isdirty(player_t *player, bool dirty)
+{
+	player->isDirty = dirty;
 }
 
-static int min(int a, int b)
+bool player_get_iscompressed(player_t *player)
 {
-	return a > b ? b : a;
+	return player->isCompressed;
 }
 
-static int max(int a, int b)
+void player_set_iscompressed(player_t *player, bool compressed)
 {
-	return a > b ? a : b;
+	player->isCompressed = compressed;
+}
+
+bool player_get_haslegend(player_t *player)
+{
+	return player->hasLegend;
+}
+
+void player_set_haslegend(player_t *player, bool legend)
+{
+	player->hasLegend = legend;
 }
 
 static void player_update_purse(player_t *player, int d_gold)
 {
-	*player->purse = *player->purse + d_gold;
-}
\ No newline at end of file
+	player->purse = player->purse + d_gold;
+}
+
+throttle_t *player_get_throttle(player_t *player)
+{
+	return player->input;
+}
+
+int player_get_viewrows(player_t *player)
+{
+	return player->viewRows;
+}
+
+int player_get_viewcols(player_t *player)
+{
+	return player->viewCols;
+}
+
+void player_set_view(player_t *player, int rows, int cols)
+{
+	player->viewRows = rows;
+	player->viewCols = cols;
+}
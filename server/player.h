@@ -17,6 +17,9 @@
 #include "grid.h"
 #include "mem.h"
 #include "message.h"
+#include "throttle.h"
+#include "tiles.h"
+#include "arena.h"
 /**************** global types ****************/
 typedef struct player player_t;
 
@@ -26,18 +29,21 @@ typedef struct player player_t;
 /* Create a new player object with initial position and visibility setup.
  *
  * Caller provides:
+ *   the arena to allocate the player in, or NULL for malloc;
  *   valid connection information, real name, initial coordinates (x, y), 
  *   and grid dimensions (nrows, ncols).
  * We guarantee:
  *   a new player object is returned if memory allocation is successful.
  *   returns NULL if any memory allocation fails.
  * Notes:
- *   the caller is responsible for managing the memory of the addr_t* passed in.
- *   the real_name is copied, and the copy is managed internally.
- *   visibility matrix is initialized based on grid dimensions.
- *   the caller must call player_delete to free the player object's memory.
+ *   the connection information and the real_name are copied into the player.
+ *   the visibility and terrain layers are sized to the grid dimensions, but hold no tiles
+ *   until the player sees into them (see tiles.h); like everything else the player holds,
+ *   they live in the player's arena.
+ *   the caller must call player_delete to free a player made with malloc; one made in an arena
+ *   (as grid_spawn_player does, in the game's) goes with it.
  */
-player_t* player_new(const addr_t connection_info, char* real_name, int x, int y, int nrows, int ncols);
+player_t* player_new(arena_t* arena, const addr_t connection_info, char* real_name, int x, int y, int nrows, int ncols);
 
 /***************** player_update_visibility *****************/
 /* Update the visibility matrix for a player based on their current position.
@@ -73,8 +79,7 @@ void player_moveto(player_t* player, int x, int y);
  * We guarantee:
  *   player's associated memory is freed, including visibility matrix.
  * Notes:
- *   does not free the memory of connection_info inside the player.
- *   grid object is used to determine dimensions for freeing visibility matrix.
+ *   does nothing for a player made in an arena, which is freed along with the arena.
  */
 void player_delete(player_t* player, grid_t* grid);
 
@@ -104,6 +109,7 @@ void player_collect_gold(player_t* player, grid_t* grid, int gold_x, int gold_y)
  *   checks for collisions with other players and grid boundaries.
  *   automatically collects gold if moved to a gold location.
  *   updates visibility for all players after move.
+ *   marks the mover (and any player it swapped with) dirty, and both cells changed (see grid_mark_changed).
  */
 bool player_move(player_t* player, grid_t* grid, int dx, int dy);
 
@@ -116,6 +122,8 @@ bool player_move(player_t* player, grid_t* grid, int dx, int dy);
  *   player is marked as inactive.
  * Notes:
  *   does not delete the player object; memory cleanup must be done separately.
+ *   sends the updated GOLD messages; the DISPLAY frames are left to the caller,
+ *   which sees the player's last spot marked changed (see grid_mark_changed).
  */
 void player_quit(player_t* player, grid_t* grid);
 
@@ -181,17 +189,47 @@ int player_get_y(player_t* player);
 int player_get_purse(player_t* player);
 
 /***************** player_get_visibility *****************/
-/* Get the player's visibility matrix.
+/* Get the player's visibility of one cell.
+ *
+ * Caller provides:
+ *   valid player object and cell coordinates (x, y) within the grid.
+ * We guarantee:
+ *   returns 1 if the player can see the cell now, 2 if they have seen it before, and 0 otherwise.
+ * Notes:
+ *   visibility is determined by player position.
+ */
+int player_get_visibility(player_t* player, int x, int y);
+
+/***************** player_get_visible *****************/
+/* Get the cells the player can currently see.
  *
  * Caller provides:
  *   valid player object.
  * We guarantee:
- *   returns the visibility matrix of the player.
+ *   returns the indices (row * ncols + col) of the cells marked visible in the visibility layer;
+ *   there are player_get_nvisible(player) of them.
  * Notes:
- *   matrix structure and content are determined by player position
+ *   the list is internal to the player object and changes with player_update_visibility.
  */
-int** player_get_visibility(player_t* player);
+int* player_get_visible(player_t* player);
+
+/***************** player_get_nvisible *****************/
+/* Get the number of cells the player can currently see (see player_get_visible). */
+int player_get_nvisible(player_t* player);
 
+/***************** player_get_terrain *****************/
+/* Get the terrain the player has seen, the base of their DISPLAY frames.
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns a tiled layer of char holding the terrain of every cell the player
+ *   has ever seen, and blanks elsewhere; it holds no gold or players.
+ * Notes:
+ *   the layer is maintained by player_update_visibility, which only rewrites the cells it marks visible.
+ *   the layer is internal to the player object; caller must only read it (tiles_get, tiles_copy_row).
+ */
+tiles_t* player_get_terrain(player_t* player);
 
 /***************** player_set_visibility *****************/
 /* Set visibility for a specific cell in the player's visibility map.
@@ -202,9 +240,21 @@ int** player_get_visibility(player_t* player);
  *   updates the visibility value for the specified cell in the player's visibility map.
  * Notes:
  *   ensures that the visibility map accurately reflects changes based on player actions or grid updates.
+ *   does not update the player's terrain or list of visible cells; player_update_visibility does that.
  */
 void player_set_visibility(player_t* player, int x, int y, int val);
 
+/***************** player_memory *****************/
+/* Report the memory the player's view of the map takes.
+ *
+ * Caller provides:
+ *   valid player object, and where to put the tile counts.
+ * We guarantee:
+ *   returns the bytes held by the player, its visibility and terrain layers, and its list of visible cells;
+ *   *tiles is set to the tiles its layers have allocated, and *total to the tiles they would take if dense.
+ */
+size_t player_memory(player_t* player, int* tiles, int* total);
+
 
 /***************** player_get_isactive *****************/
 /* Check if the player is currently active.
@@ -238,5 +288,96 @@ bool player_get_isinvincible(player_t *player);
  */
 void player_set_isinvincible(player_t *player, bool invincible);
 
+/***************** player_get_isdirty *****************/
+/* Check if the player's DISPLAY frame may have changed since it was last sent.
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns true if the player moved, or if gold or a player appeared or disappeared
+ *   on a cell they can see, since the last player_set_isdirty(player, false).
+ * Notes:
+ *   a new player starts dirty, so their first frame is always sent.
+ */
+bool player_get_isdirty(player_t *player);
+
+/***************** player_set_isdirty *****************/
+/* Set or clear the player's dirty flag; the server clears it after sending a frame.
+ *
+ * Caller provides:
+ *   valid player object.
+ */
+void player_set_isdirty(player_t *player, bool dirty);
+
+/***************** player_get_iscompressed *****************/
+/* Check if the player's client takes compressed DISPLAY frames.
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns true once player_set_iscompressed(player, true) has been called;
+ *   a new player starts uncompressed.
+ */
+bool player_get_iscompressed(player_t *player);
+
+/***************** player_set_iscompressed *****************/
+/* Record whether the player's client takes compressed DISPLAY frames (see the COMPRESS message).
+ *
+ * Caller provides:
+ *   valid player object.
+ */
+void player_set_iscompressed(player_t *player, bool compressed);
+
+/***************** player_get_haslegend *****************/
+/* Check if the player's client takes a legend in its DISPLAY frames (see legend.h).
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns true once player_set_haslegend(player, true) has been called;
+ *   a new player starts without one.
+ */
+bool player_get_haslegend(player_t *player);
+
+/***************** player_set_haslegend *****************/
+/* Record whether the player's client takes a legend in its DISPLAY frames (see the LEGEND message).
+ *
+ * Caller provides:
+ *   valid player object.
+ */
+void player_set_haslegend(player_t *player, bool legend);
+
+/***************** player_get_throttle *****************/
+/* Get the throttle that limits how fast the player's input is accepted.
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns the player's throttle, which belongs to the player and is freed by player_delete.
+ */
+throttle_t *player_get_throttle(player_t *player);
+
+/***************** player_get_viewrows *****************/
+/* Get the number of map rows the player's screen shows (see the VIEW message).
+ *
+ * Caller provides:
+ *   valid player object.
+ * We guarantee:
+ *   returns the rows given to player_set_view, or 0 if the client takes whole maps (the default).
+ */
+int player_get_viewrows(player_t *player);
+
+/***************** player_get_viewcols *****************/
+/* Get the number of map columns the player's screen shows; 0 if the client takes whole maps. */
+int player_get_viewcols(player_t *player);
+
+/***************** player_set_view *****************/
+/* Record the size of the player's screen, so they are sent viewport frames (see grid_send_view).
+ *
+ * Caller provides:
+ *   valid player object, and positive numbers of rows and columns.
+ */
+void player_set_view(player_t *player, int rows, int cols);
+
 #endif //__PLAYER_H
 
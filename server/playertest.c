@@ -14,8 +14,8 @@
 #include "file.h"
 #include "sys/types.h"
 
-static void print_curr_state(int** res, char** map, int nr, int nc, player_t* player, grid_t* grid);
-static void print_map(char** map, int nr, int nc, int** nuggets);
+static void print_curr_state(char** map, int nr, int nc, player_t* player, grid_t* grid);
+static void print_map(char** map, int nr, int nc, grid_t* grid);
 
 int main(int argc, char* argv[]) {
     srand(getpid());
@@ -43,23 +43,23 @@ int main(int argc, char* argv[]) {
     
     grid_spawn_player(grid, message_noAddr(), "tester");
     player_t* player = grid_getplayers(grid)[0];
-    int** res =  player_get_visibility(player);
     char** map = grid_getcells(grid);
-    print_map(map, nr, nc, grid_getnuggets(grid));
+    print_map(map, nr, nc, grid);
     int int1;
     int int2;
     printf("Enter move coords\n");
     while (scanf("%d %d", &int1, &int2) == 2) {
         player_move(player, grid, int1, int2);
-        print_curr_state(res, map, nr, nc, player, grid);
+        print_curr_state(map, nr, nc, player, grid);
         printf("Enter move coords\n");
     }
     grid_game_over(grid);
+    grid_delete(grid);
     fclose(file);
     return EXIT_SUCCESS;
 }
 
-static void print_curr_state(int** res, char** map, int nr, int nc, player_t* player, grid_t* grid) {
+static void print_curr_state(char** map, int nr, int nc, player_t* player, grid_t* grid) {
     int flag;
     player_t** players = grid_getplayers(grid);
     for (int i = 0; i < nr; i++) {
@@ -67,9 +67,10 @@ static void print_curr_state(int** res, char** map, int nr, int nc, player_t* pl
             if (i == player_get_x(player) && j == player_get_y(player)) {
                 printf("@");
             } else {
-                if (res[i][j] == 0) {
+                int seen = player_get_visibility(player, i, j);
+                if (seen == 0) {
                     printf(" ");
-                } else if (res[i][j] == 1) {
+                } else if (seen == 1) {
                     flag = -1;
                     for (int k = 0; k < grid_getplayercount(grid); k++) {
                         if (player_get_isactive(players[k])) {
@@ -80,8 +81,8 @@ static void print_curr_state(int** res, char** map, int nr, int nc, player_t* pl
                         }
                     }
                     if (flag > -1) {
-                        printf("\e[0;33m%c\e[0m", 65+flag);
-                    } else if (grid_getnuggets(grid)[i][j] > 0) {
+                        printf("\e[0;33m%c\e[0m", grid_player_symbol(flag));
+                    } else if (grid_getnuggets(grid, i, j) > 0) {
                         printf("\e[0;31m*\e[0m");
                     } else {
                         printf("\e[0;31m%c\e[0m", map[i][j]);
@@ -96,10 +97,10 @@ static void print_curr_state(int** res, char** map, int nr, int nc, player_t* pl
     printf("-------------------------------------------------------------------\n");
 }
 
-static void print_map(char** map, int nr, int nc, int** nuggets) {
+static void print_map(char** map, int nr, int nc, grid_t* grid) {
     for (int i = 0; i < nr; i++) {
         for (int j = 0; j < nc; j++) {
-            if (nuggets[i][j] > 0) {
+            if (grid_getnuggets(grid, i, j) > 0) {
                 printf("*");
             } else {
                 printf("%c", map[i][j]);
@@ -0,0 +1,155 @@
+/*
+ * pool.c - 'pool' module
+ *
+ * See pool.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "mem.h"
+#include "pool.h"
+
+/**************** file-local types ****************/
+typedef struct pool
+{
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;     // a new batch is ready, or the pool is stopping
+    pthread_cond_t done;      // the last worker has finished the batch
+    long batch;               // number of the current batch; a worker waits for it to change
+    void (*job)(void *arg, int k);
+    void *arg;
+    int njobs;
+    atomic_int next;          // the next job to hand out
+    int working;              // workers not yet finished with the current batch
+    bool stopping;
+} pool_t;
+
+/**************** local functions ****************/
+static void *worker(void *arg);
+static void run_jobs(pool_t *pool);
+
+pool_t *pool_new(int nthreads)
+{
+    pool_t *pool = mem_assert(mem_tmalloc("pool", sizeof(pool_t)), "Failed to allocate memory for thread pool.");
+    pool->threads = mem_assert(mem_tcalloc("pool", nthreads > 0 ? nthreads : 1, sizeof(pthread_t)), "Failed to allocate memory for threads.");
+    pool->nthreads = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->batch = 0;
+    pool->job = NULL;
+    pool->arg = NULL;
+    pool->njobs = 0;
+    atomic_init(&pool->next, 0);
+    pool->working = 0;
+    pool->stopping = false;
+    for (int t = 0; t < nthreads; t++)
+    {
+        if (pthread_create(&pool->threads[t], NULL, worker, pool) != 0)
+        {
+            pool_delete(pool); // stops the threads started so far
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+void pool_run(pool_t *pool, int njobs, void (*job)(void *arg, int k), void *arg)
+{
+    if (pool == NULL || pool->nthreads == 0 || njobs <= 1)
+    {
+        for (int k = 0; k < njobs; k++)
+        {
+            job(arg, k);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->arg = arg;
+    pool->njobs = njobs;
+    atomic_store(&pool->next, 0);
+    pool->working = pool->nthreads;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_jobs(pool); // our share
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->working > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_delete(pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->nthreads; t++)
+    {
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    mem_tfree(pool->threads);
+    mem_tfree(pool);
+}
+
+/* A worker: wait for each batch, take jobs until there are none left, and report back. */
+static void *worker(void *arg)
+{
+    pool_t *pool = arg;
+    long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (pool->batch == seen && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stopping)
+        {
+            break;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_jobs(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->working == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Take jobs of the current batch, one at a time, until all have been handed out. */
+static void run_jobs(pool_t *pool)
+{
+    int k;
+    while ((k = atomic_fetch_add(&pool->next, 1)) < pool->njobs)
+    {
+        pool->job(pool->arg, k);
+    }
+}
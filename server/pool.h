@@ -0,0 +1,57 @@
+/*
+ * pool.h - header file for 'pool' module
+ *
+ * A pool is a fixed set of worker threads that runs a batch of independent jobs,
+ * numbered 0 to njobs-1, and returns when all of them are done. The calling thread
+ * takes jobs too, so a pool of N threads runs N+1 jobs at once. Jobs are handed out
+ * one at a time, in order, to whichever thread is free, so uneven jobs balance out.
+ *
+ * The server uses it to render and compress the frames of many clients at once;
+ * a job may read anything the batch does not change, but must write only its own results.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**************** global types ****************/
+typedef struct pool pool_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/***************** pool_new *****************/
+/* Start a pool of worker threads.
+ *
+ * Caller provides:
+ *   the number of worker threads, besides the caller's own; 0 for none.
+ * We guarantee:
+ *   returns the pool, with its threads waiting for work, or NULL if a thread cannot be started.
+ * Notes:
+ *   the caller must call pool_delete.
+ */
+pool_t *pool_new(int nthreads);
+
+/***************** pool_run *****************/
+/* Run jobs 0 to njobs-1, calling job(arg, k) for each k, and wait until all are done.
+ *
+ * Caller provides:
+ *   a pool, or NULL to run the jobs one after another on the calling thread; the number of jobs;
+ *   and the function and argument to run them with.
+ * We guarantee:
+ *   every job has run, exactly once, when we return; with no pool, or a single job,
+ *   they run on the calling thread, in order, without touching any other thread.
+ * Notes:
+ *   jobs run concurrently and in no particular order; one must not depend on another.
+ *   call it from one thread at a time.
+ */
+void pool_run(pool_t *pool, int njobs, void (*job)(void *arg, int k), void *arg);
+
+/***************** pool_delete *****************/
+/* Stop the pool's threads, once they finish what they are doing, and free the pool; NULL is ignored. */
+void pool_delete(pool_t *pool);
+
+#endif // POOL_H
@@ -0,0 +1,320 @@
+/*
+ * raykernel.c - 'raykernel' module
+ *
+ * see raykernel.h for more information.
+ *
+ * Both kernels step a line of sight the same way. Seen from (x, y), the line to
+ * target (i, j) crosses row x + t*s (s the sign of i - x) at column
+ *   y + (j - y) * t / |i - x|
+ * so we keep that column as an integer quotient q and remainder r, and add the
+ * per-row quotient and remainder of (j - y) / |i - x| at every step. The line passes
+ * between columns y + q and y + q + (r != 0). Columns are stepped the same way.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raykernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RAYKERNEL_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define RAYKERNEL_HAVE_AVX2 0
+#endif
+
+/**************** file-local global variables ****************/
+static raykernel_t selected = RAYKERNEL_AUTO;
+static raykernel_t resolved = RAYKERNEL_AUTO; // what selected means on this CPU; AUTO until known
+
+static bool avx2_supported(void);
+static unsigned scalar_batch(const unsigned char *floor, int ncols, int x, int y, int i, int j, int n);
+static bool scalar_line(const unsigned char *floor, int ncols, int x, int y, int i, int j);
+#if RAYKERNEL_HAVE_AVX2
+static unsigned avx2_batch(const unsigned char *floor, int ncols, int x, int y, int i, int j, int n);
+#endif
+static int floor_div(int a, int b);
+
+bool raykernel_select(raykernel_t kernel)
+{
+	if (kernel == RAYKERNEL_AVX2 && !avx2_supported())
+	{
+		return false;
+	}
+	selected = kernel;
+	resolved = RAYKERNEL_AUTO;
+	return true;
+}
+
+raykernel_t raykernel_current(void)
+{
+	if (resolved == RAYKERNEL_AUTO)
+	{
+		if (selected == RAYKERNEL_AUTO)
+		{
+			resolved = avx2_supported() ? RAYKERNEL_AVX2 : RAYKERNEL_SCALAR;
+		}
+		else
+		{
+			resolved = selected;
+		}
+	}
+	return resolved;
+}
+
+bool raykernel_parse(const char *name, raykernel_t *kernel)
+{
+	if (name == NULL || kernel == NULL)
+	{
+		return false;
+	}
+	if (strcmp(name, "auto") == 0)
+	{
+		*kernel = RAYKERNEL_AUTO;
+	}
+	else if (strcmp(name, "scalar") == 0)
+	{
+		*kernel = RAYKERNEL_SCALAR;
+	}
+	else if (strcmp(name, "avx2") == 0)
+	{
+		*kernel = RAYKERNEL_AVX2;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+const char *raykernel_name(raykernel_t kernel)
+{
+	switch (kernel)
+	{
+	case RAYKERNEL_SCALAR:
+		return "scalar";
+	case RAYKERNEL_AVX2:
+		return "avx2";
+	default:
+		return "auto";
+	}
+}
+
+unsigned raykernel_batch(const unsigned char *floor, int ncols, int x, int y, int i, int j, int n)
+{
+	return raykernel_batch_with(raykernel_current(), floor, ncols, x, y, i, j, n);
+}
+
+unsigned raykernel_batch_with(raykernel_t kernel, const unsigned char *floor, int ncols,
+							  int x, int y, int i, int j, int n)
+{
+#if RAYKERNEL_HAVE_AVX2
+	if (kernel == RAYKERNEL_AUTO)
+	{
+		kernel = avx2_supported() ? RAYKERNEL_AVX2 : RAYKERNEL_SCALAR;
+	}
+	if (kernel == RAYKERNEL_AVX2 && avx2_supported())
+	{
+		return avx2_batch(floor, ncols, x, y, i, j, n);
+	}
+#endif
+	return scalar_batch(floor, ncols, x, y, i, j, n);
+}
+
+static bool avx2_supported(void)
+{
+#if RAYKERNEL_HAVE_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+/**************** scalar_batch ****************/
+/* The reference kernel: one line at a time. */
+static unsigned scalar_batch(const unsigned char *floor, int ncols, int x, int y, int i, int j, int n)
+{
+	unsigned mask = 0;
+	for (int k = 0; k < n; k++)
+	{
+		if (scalar_line(floor, ncols, x, y, i, j + k))
+		{
+			mask |= 1u << k;
+		}
+	}
+	return mask;
+}
+
+static bool scalar_line(const unsigned char *floor, int ncols, int x, int y, int i, int j)
+{
+	// rows strictly between x and i
+	int den = abs(i - x);
+	if (den >= 2)
+	{
+		int s = i > x ? 1 : -1;
+		int sq = floor_div(j - y, den);
+		int sr = (j - y) - sq * den;
+		int q = 0;
+		int r = 0;
+		for (int t = 1; t < den; t++)
+		{
+			q += sq;
+			r += sr;
+			if (r >= den)
+			{
+				q++;
+				r -= den;
+			}
+			int cell = (x + t * s) * ncols + y + q;
+			if (!floor[cell] && !floor[cell + (r != 0)])
+			{
+				return false;
+			}
+		}
+	}
+	// columns strictly between y and j
+	den = abs(j - y);
+	if (den >= 2)
+	{
+		int s = j > y ? 1 : -1;
+		int sq = floor_div(i - x, den);
+		int sr = (i - x) - sq * den;
+		int q = 0;
+		int r = 0;
+		for (int t = 1; t < den; t++)
+		{
+			q += sq;
+			r += sr;
+			if (r >= den)
+			{
+				q++;
+				r -= den;
+			}
+			int cell = (x + q) * ncols + y + t * s;
+			if (!floor[cell] && !floor[cell + (r != 0 ? ncols : 0)])
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+#if RAYKERNEL_HAVE_AVX2
+/**************** avx2_batch ****************/
+/* Eight lines at once, one per 32-bit lane. The row pass is uniform across lanes,
+ * since all targets share row i; in the column pass each lane has its own length,
+ * and lanes that have finished are masked out of the gathers.
+ */
+__attribute__((target("avx2"))) static unsigned avx2_batch(const unsigned char *floor, int ncols,
+															 int x, int y, int i, int j, int n)
+{
+	int col[RAYKERNEL_LANES];
+	int sq[RAYKERNEL_LANES];
+	int sr[RAYKERNEL_LANES];
+	int dens[RAYKERNEL_LANES];
+	int signs[RAYKERNEL_LANES];
+	for (int k = 0; k < RAYKERNEL_LANES; k++)
+	{
+		col[k] = j + (k < n ? k : n - 1); // unused lanes repeat the last target
+	}
+	const int *base = (const int *)floor;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i bytes = _mm256_set1_epi32(0xff);
+	__m256i blocked = zero;
+
+	// rows strictly between x and i
+	int den = abs(i - x);
+	if (den >= 2)
+	{
+		int s = i > x ? 1 : -1;
+		for (int k = 0; k < RAYKERNEL_LANES; k++)
+		{
+			sq[k] = floor_div(col[k] - y, den);
+			sr[k] = (col[k] - y) - sq[k] * den;
+		}
+		__m256i vsq = _mm256_loadu_si256((const __m256i *)sq);
+		__m256i vsr = _mm256_loadu_si256((const __m256i *)sr);
+		__m256i vden = _mm256_set1_epi32(den);
+		__m256i vlast = _mm256_set1_epi32(den - 1);
+		__m256i q = zero;
+		__m256i r = zero;
+		for (int t = 1; t < den; t++)
+		{
+			q = _mm256_add_epi32(q, vsq);
+			r = _mm256_add_epi32(r, vsr);
+			__m256i carry = _mm256_cmpgt_epi32(r, vlast); // r >= den
+			q = _mm256_sub_epi32(q, carry);
+			r = _mm256_sub_epi32(r, _mm256_and_si256(carry, vden));
+			__m256i near = _mm256_add_epi32(_mm256_set1_epi32((x + t * s) * ncols + y), q);
+			__m256i far = _mm256_add_epi32(near, _mm256_andnot_si256(_mm256_cmpeq_epi32(r, zero), one));
+			__m256i a = _mm256_and_si256(_mm256_i32gather_epi32(base, near, 1), bytes);
+			__m256i b = _mm256_and_si256(_mm256_i32gather_epi32(base, far, 1), bytes);
+			blocked = _mm256_or_si256(blocked, _mm256_and_si256(_mm256_cmpeq_epi32(a, zero), _mm256_cmpeq_epi32(b, zero)));
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(blocked)) == 0xff)
+			{
+				return 0;
+			}
+		}
+	}
+
+	// columns strictly between y and each target's column
+	int maxden = 0;
+	for (int k = 0; k < RAYKERNEL_LANES; k++)
+	{
+		dens[k] = abs(col[k] - y);
+		signs[k] = col[k] > y ? 1 : -1;
+		int d = dens[k] > 0 ? dens[k] : 1;
+		sq[k] = floor_div(i - x, d);
+		sr[k] = (i - x) - sq[k] * d;
+		if (dens[k] > maxden)
+		{
+			maxden = dens[k];
+		}
+	}
+	if (maxden >= 2)
+	{
+		__m256i vsq = _mm256_loadu_si256((const __m256i *)sq);
+		__m256i vsr = _mm256_loadu_si256((const __m256i *)sr);
+		__m256i vden = _mm256_loadu_si256((const __m256i *)dens);
+		__m256i vlast = _mm256_sub_epi32(vden, one);
+		__m256i vsign = _mm256_loadu_si256((const __m256i *)signs);
+		__m256i vncols = _mm256_set1_epi32(ncols);
+		__m256i vx = _mm256_set1_epi32(x);
+		__m256i c = _mm256_set1_epi32(y);
+		__m256i q = zero;
+		__m256i r = zero;
+		for (int t = 1; t < maxden; t++)
+		{
+			__m256i active = _mm256_andnot_si256(blocked, _mm256_cmpgt_epi32(vden, _mm256_set1_epi32(t)));
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(active)) == 0)
+			{
+				break;
+			}
+			q = _mm256_add_epi32(q, vsq);
+			r = _mm256_add_epi32(r, vsr);
+			__m256i carry = _mm256_cmpgt_epi32(r, vlast); // r >= den
+			q = _mm256_sub_epi32(q, carry);
+			r = _mm256_sub_epi32(r, _mm256_and_si256(carry, vden));
+			c = _mm256_add_epi32(c, vsign);
+			__m256i near = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(vx, q), vncols), c);
+			__m256i far = _mm256_add_epi32(near, _mm256_andnot_si256(_mm256_cmpeq_epi32(r, zero), vncols));
+			__m256i a = _mm256_and_si256(_mm256_mask_i32gather_epi32(zero, base, near, active, 1), bytes);
+			__m256i b = _mm256_and_si256(_mm256_mask_i32gather_epi32(zero, base, far, active, 1), bytes);
+			__m256i wall = _mm256_and_si256(_mm256_cmpeq_epi32(a, zero), _mm256_cmpeq_epi32(b, zero));
+			blocked = _mm256_or_si256(blocked, _mm256_and_si256(wall, active));
+		}
+	}
+
+	unsigned visible = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(blocked));
+	return visible & ((1u << n) - 1);
+}
+#endif
+
+static int floor_div(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
@@ -0,0 +1,94 @@
+/*
+ * raykernel.h - header file for 'raykernel' module
+ *
+ * The raykernel module tests the raycast engine's lines of sight in batches.
+ * One call tests up to RAYKERNEL_LANES target cells on the same map row, all seen
+ * from the same spot, and returns a bitmask of the targets that are visible.
+ *
+ * Lines are stepped with exact integer arithmetic (a quotient and remainder that are
+ * advanced one row or column at a time) instead of floating-point division and floor/ceil.
+ * Two implementations are provided: a portable scalar one, which is the reference, and
+ * an AVX2 one that tests all eight lanes at once. The AVX2 kernel is chosen at runtime
+ * when the CPU supports it, and must return exactly the same bits as the scalar kernel.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef RAYKERNEL_H
+#define RAYKERNEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**************** constants ****************/
+#define RAYKERNEL_LANES 8
+
+/* bytes of padding the kernels may read past the end of the floor layer */
+#define RAYKERNEL_PADDING 4
+
+/**************** global types ****************/
+typedef enum raykernel {
+    RAYKERNEL_AUTO,   // AVX2 if the CPU supports it, otherwise scalar
+    RAYKERNEL_SCALAR, // portable reference kernel
+    RAYKERNEL_AVX2    // eight lanes per instruction
+} raykernel_t;
+
+/**************** functions ****************/
+
+/***************** raykernel_select *****************/
+/* Choose the kernel used by raykernel_batch.
+ *
+ * Caller provides:
+ *   one of the raykernel_t values.
+ * We guarantee:
+ *   returns true if that kernel is now in use.
+ *   returns false, and keeps the current kernel, if the CPU (or the compiler) cannot run it.
+ * Notes:
+ *   RAYKERNEL_AUTO is always accepted; it is also the default.
+ */
+bool raykernel_select(raykernel_t kernel);
+
+/***************** raykernel_current *****************/
+/* Return the kernel actually in use: RAYKERNEL_SCALAR or RAYKERNEL_AVX2, never RAYKERNEL_AUTO.
+ */
+raykernel_t raykernel_current(void);
+
+/***************** raykernel_parse *****************/
+/* Translate "auto", "scalar" or "avx2" into a raykernel_t.
+ *
+ * We guarantee:
+ *   returns true and fills in *kernel if the name is known, false otherwise.
+ */
+bool raykernel_parse(const char* name, raykernel_t* kernel);
+
+/***************** raykernel_name *****************/
+/* Return the printable name of a kernel.
+ */
+const char* raykernel_name(raykernel_t kernel);
+
+/***************** raykernel_batch *****************/
+/* Test the lines of sight from spot (x, y) to cells (i, j), (i, j+1), ... (i, j+n-1).
+ *
+ * Caller provides:
+ *   a floor layer of nrows * ncols bytes (followed by RAYKERNEL_PADDING readable bytes),
+ *   non-zero exactly where the map has room floor ('.'); the number of columns;
+ *   the spot (x, y); the row i and first column j of the targets; and 1 <= n <= RAYKERNEL_LANES.
+ *   all targets must lie within the map.
+ * We guarantee:
+ *   returns a mask whose bit k is set iff target (i, j+k) is visible from (x, y):
+ *   a line is blocked when, at some row (column) strictly between its two ends,
+ *   neither of the cells it passes between is room floor.
+ */
+unsigned raykernel_batch(const unsigned char* floor, int ncols, int x, int y, int i, int j, int n);
+
+/***************** raykernel_batch_with *****************/
+/* Like raykernel_batch, but with an explicit kernel; used by tests and benchmarks.
+ *
+ * Notes:
+ *   falls back to the scalar kernel if the requested one cannot run here.
+ */
+unsigned raykernel_batch_with(raykernel_t kernel, const unsigned char* floor, int ncols,
+                              int x, int y, int i, int j, int n);
+
+#endif //__RAYKERNEL_H
@@ -15,15 +15,84 @@
 #include "log.h"
 #include "mem.h"
 #include "message.h"
+#include "outbox.h"
+#include "throttle.h"
+#include "feed.h"
+#include "pool.h"
+#include "codec.h"
+#include "legend.h"
 #include "file.h"
 #include "grid.h"
 #include "player.h"
 #include "spectator.h"
+#include "visibility.h"
+#include "raykernel.h"
 
 static bool parseArgs(const int argc, const char **argv);
+static bool parseOption(const char *option);
 static bool handleMessage(void *arg, const addr_t from, const char *message);
+static bool receive(void *arg, const addr_t from, const char *message);
+static bool admitMessage(void *arg, const addr_t from, const char *message);
+static bool pump(void *arg);
+static throttle_t *findThrottle(grid_t *grid, const addr_t from);
+static bool isStranger(grid_t *grid, const addr_t from);
+static throttle_t *strangerThrottle(const addr_t from);
+static void reportStrangers(void);
+static void forgetStrangers(void);
+static int inputCost(const char *message);
+static bool handleKey(grid_t *grid, player_t *player, const addr_t from, const char key);
 static bool updateall(grid_t *grid);
+static void nextRound(grid_t *grid);
+static bool flushJoins(void *arg);
+static void publishFeed(grid_t *grid);
+static void renderFrame(void *arg, int k);
+static char *packFrame(const char *frame, size_t *length);
+static void sendFrame(const addr_t to, const char *frame, const char *packed, size_t packedLength);
+
+/* A client's frame to be made by updateall: rendered, and compressed if the client wants it, possibly on a pool thread. */
+typedef struct frameJob
+{
+	grid_t *grid;
+	player_t *player;     // the recipient, or NULL for the spectator
+	bool compressed;      // the client takes DISPLAYZ frames
+	char *frame;          // the DISPLAY (or DISPLAYV) frame
+	char *packed;         // its DISPLAYZ form, or NULL if that is not shorter
+	size_t packedLength;
+} frameJob_t;
+
+/* The throttle of an address that is neither a player nor the spectator, such as one about to join. */
+typedef struct stranger
+{
+	addr_t addr;
+	throttle_t *throttle; // NULL until the slot is first used
+	long lastUsed;        // the input from strangers it last took, counting from 1; 0 while the slot is free
+} stranger_t;
+enum { MaxStrangers = 64 }; // strangers with a bucket of their own; the one heard from longest ago gives up its bucket
 // grid_t* gameGrid;
+static const char *mapPath = NULL; // map file named on the command line
+static const float FlushSeconds = 2; // longest we wait at exit for reliable messages to be acknowledged
+static float lossRate = 0;         // fraction of outgoing datagrams to drop, for testing (--loss)
+static const float PumpSeconds = 0.01; // how often, when idle, we send what the outbox rate cap held back
+static const int DefaultInputRate = 60; // keystrokes per second accepted from each client, unless --inputrate says otherwise
+static int maxPlayers = GRID_DEFAULT_MAXPLAYERS; // players the game takes (--maxplayers)
+static const char *memProfilePath = NULL; // where to print the allocation profile (--memprofile), or NULL
+static int rounds = 1;            // rounds to play on the map (--rounds), or 0 for no end
+static int roundNumber = 1;       // the round being played
+static unsigned int seed;         // seeds the first round; round r is seeded with seed + r - 1
+static const char *feedName = NULL; // shared-memory name of the spectator feed (--feed), or NULL for none
+static feed_t *feed = NULL;
+static stranger_t strangers[MaxStrangers]; // limit input from addresses that are neither a player nor the spectator, each its own
+static long strangerInputs = 0;   // inputs from strangers so far
+static throttle_t *strangersGone = NULL; // the counts of strangers whose buckets were given to others
+static long framesSent = 0;       // DISPLAY frames sent by updateall
+static long framesSuppressed = 0; // DISPLAY frames updateall skipped because nothing the client sees changed
+static long frameBytesRaw = 0;    // bytes of the DISPLAY frames sent, before compression
+static long frameBytesSent = 0;   // bytes of the DISPLAY frames sent, as handed to the outbox
+static bool joinsPending = false; // players joined in a burst that is not over yet; their frames wait for its end
+static int poolThreads = 0;       // threads besides ours to make frames on (--threads)
+static pool_t *pool = NULL;       // those threads, or NULL to make every frame on ours
+static frameJob_t *frameJobs = NULL; // the frames updateall is making; grows to the most it has made at once
+static int frameJobsSize = 0;
 
 int main(const int argc, const char **argv)
 {
@@ -32,6 +101,15 @@ int main(const int argc, const char **argv)
 	{
 		return 1;
 	}
+	if (memProfilePath != NULL)
+	{
+		FILE *profileFP = strcmp(memProfilePath, "-") == 0 ? stdout : fopen(memProfilePath, "w");
+		if (profileFP == NULL || !mem_profile_start(profileFP))
+		{
+			fprintf(stderr, "cannot write an allocation profile to %s\n", memProfilePath);
+			return 1;
+		}
+	}
 
 	// initialize message module
 	int serverPort;
@@ -40,12 +118,55 @@ int main(const int argc, const char **argv)
 	{
 		return 1;
 	}
+	if (lossRate > 0)
+	{
+		message_setLoss(lossRate, getpid());
+	}
 	fprintf(stdout, "Server port is: %d", serverPort);
-	FILE *fp = fopen(argv[1], "r");
+	fflush(stdout); // for whoever started us to read the port
+	FILE *fp = fopen(mapPath, "r");
 	grid_t *gameGrid = grid_load(fp);
 	fclose(fp);
+	grid_setmaxplayers(gameGrid, maxPlayers);
 	grid_init_gold(gameGrid);
-	message_loop(gameGrid, 0, NULL, NULL, handleMessage);
+	if (feedName != NULL)
+	{
+		feed = feed_create(feedName, GRID_FRAME_LENGTH(grid_getnrows(gameGrid), grid_getncols(gameGrid)));
+		if (feed == NULL)
+		{
+			return 1;
+		}
+		publishFeed(gameGrid); // the bare map and its gold, before anyone joins
+	}
+	strangersGone = throttle_new(NULL);
+	if (poolThreads > 0 && (pool = pool_new(poolThreads)) == NULL)
+	{
+		fprintf(stderr, "cannot start %d threads\n", poolThreads);
+		return 1;
+	}
+	message_setAdmit(admitMessage);
+	message_setAfterDatagram(flushJoins);
+	if (outbox_get_rate() > 0)
+	{
+		message_loop(gameGrid, PumpSeconds, pump, NULL, receive);
+	}
+	else
+	{
+		message_loop(gameGrid, 0, NULL, NULL, receive);
+	}
+	outbox_drain();
+	message_flush(FlushSeconds); // let the last QUIT messages reach reliable clients
+	outbox_report(stdout);
+	outbox_delete();
+	for (int i = 0; i < MaxStrangers; i++)
+	{
+		throttle_delete(strangers[i].throttle);
+	}
+	throttle_delete(strangersGone);
+	pool_delete(pool);
+	mem_tfree(frameJobs);
+	grid_delete(gameGrid);
+	feed_delete(feed);
 	message_done();
 	fclose(logFP);
 	return 0;
@@ -53,12 +174,35 @@ int main(const int argc, const char **argv)
 
 static bool parseArgs(const int argc, const char **argv)
 {
-	if (argc < 2 || argc > 3) {
+	throttle_set_rate(DefaultInputRate);
+	const char *positional[2];
+	int npositional = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--", 2) == 0)
+		{
+			if (!parseOption(argv[i]))
+			{
+				fprintf(stderr, "Usage : %s map.txt [seed] [--visibility=raycast|shadowcast] [--radius=N] [--kernel=auto|scalar|avx2] [--loss=P] [--rate=BYTES] [--mtu=BYTES] [--inputrate=N] [--maxplayers=N] [--rounds=N] [--feed=NAME] [--threads=N] [--memprofile=FILE]\n", argv[0]);
+				return false;
+			}
+		}
+		else if (npositional < 2)
+		{
+			positional[npositional++] = argv[i];
+		}
+		else
+		{
+			npositional++;
+		}
+	}
+	if (npositional < 1 || npositional > 2) {
 		fprintf(stderr, "Usage : %s map.txt [seed], your command must have either 1 or two arguments\n", argv[0]);
 		return false;
 	}
+	mapPath = positional[0];
 
-	FILE *fp = fopen(argv[1], "r");
+	FILE *fp = fopen(mapPath, "r");
 	if (fp == NULL)
 	{
 		fprintf(stderr, "map file could not be opened");
@@ -67,61 +211,335 @@ static bool parseArgs(const int argc, const char **argv)
 	fclose(fp);
 
 	// assumes seed will be integer
-	if (argc == 3)
+	if (npositional == 2)
 	{
 		// convert to int type
-		int seed = atoi(argv[2]);
-		if (seed < 0)
+		int given = atoi(positional[1]);
+		if (given < 0)
 		{
 			fprintf(stderr, "seed must be positive integer");
 			return false;
 		}
-		srand(seed);
+		seed = given;
 	}
 	else
 	{
-		srand(getpid());
+		seed = getpid();
 	}
+	srand(seed);
 
 	return true;
 }
 
+/* Parse one "--name=value" option; return false if it is not understood. */
+static bool parseOption(const char *option)
+{
+	const char *value = strchr(option, '=');
+	if (value == NULL)
+	{
+		fprintf(stderr, "option %s needs a value\n", option);
+		return false;
+	}
+	value++;
+	if (strncmp(option, "--visibility=", strlen("--visibility=")) == 0)
+	{
+		visengine_t engine;
+		if (!visibility_parse_engine(value, &engine))
+		{
+			fprintf(stderr, "unknown visibility engine '%s'\n", value);
+			return false;
+		}
+		visibility_set_engine(engine);
+		return true;
+	}
+	if (strncmp(option, "--kernel=", strlen("--kernel=")) == 0)
+	{
+		raykernel_t kernel;
+		if (!raykernel_parse(value, &kernel))
+		{
+			fprintf(stderr, "unknown ray kernel '%s'\n", value);
+			return false;
+		}
+		if (!raykernel_select(kernel))
+		{
+			fprintf(stderr, "ray kernel '%s' is not supported on this machine\n", value);
+			return false;
+		}
+		return true;
+	}
+	if (strncmp(option, "--radius=", strlen("--radius=")) == 0)
+	{
+		char extra;
+		int radius;
+		if (sscanf(value, "%d%c", &radius, &extra) != 1 || radius < 0)
+		{
+			fprintf(stderr, "radius must be a non-negative integer\n");
+			return false;
+		}
+		visibility_set_radius(radius);
+		return true;
+	}
+	if (strncmp(option, "--loss=", strlen("--loss=")) == 0)
+	{
+		char extra;
+		if (sscanf(value, "%f%c", &lossRate, &extra) != 1 || lossRate < 0 || lossRate >= 1)
+		{
+			fprintf(stderr, "loss must be a fraction from 0 up to 1\n");
+			return false;
+		}
+		return true;
+	}
+	if (strncmp(option, "--rate=", strlen("--rate=")) == 0)
+	{
+		char extra;
+		int bytesPerSecond;
+		if (sscanf(value, "%d%c", &bytesPerSecond, &extra) != 1 || bytesPerSecond < 0)
+		{
+			fprintf(stderr, "rate must be a non-negative number of bytes per second\n");
+			return false;
+		}
+		outbox_set_rate(bytesPerSecond);
+		message_setPace(bytesPerSecond); // and spread each message's fragments over the same rate
+		return true;
+	}
+	if (strncmp(option, "--mtu=", strlen("--mtu=")) == 0)
+	{
+		char extra;
+		int mtu;
+		if (sscanf(value, "%d%c", &mtu, &extra) != 1 || mtu < 576 || mtu > 65535)
+		{
+			fprintf(stderr, "mtu must be a packet size in bytes, from 576 to 65535\n");
+			return false;
+		}
+		message_setPathMTU(mtu);
+		return true;
+	}
+	if (strncmp(option, "--inputrate=", strlen("--inputrate=")) == 0)
+	{
+		char extra;
+		int perSecond;
+		if (sscanf(value, "%d%c", &perSecond, &extra) != 1 || perSecond < 0)
+		{
+			fprintf(stderr, "input rate must be a non-negative number of keystrokes per second\n");
+			return false;
+		}
+		throttle_set_rate(perSecond);
+		return true;
+	}
+	if (strncmp(option, "--maxplayers=", strlen("--maxplayers=")) == 0)
+	{
+		char extra;
+		if (sscanf(value, "%d%c", &maxPlayers, &extra) != 1 || maxPlayers < 1 || maxPlayers > GRID_MAX_PLAYERS)
+		{
+			fprintf(stderr, "maxplayers must be an integer from 1 to %d, the players a client can tell apart\n", GRID_MAX_PLAYERS);
+			return false;
+		}
+		return true;
+	}
+	if (strncmp(option, "--rounds=", strlen("--rounds=")) == 0)
+	{
+		char extra;
+		if (sscanf(value, "%d%c", &rounds, &extra) != 1 || rounds < 0)
+		{
+			fprintf(stderr, "rounds must be a non-negative integer\n");
+			return false;
+		}
+		return true;
+	}
+	if (strncmp(option, "--feed=", strlen("--feed=")) == 0)
+	{
+		if (value[0] != '/' || value[1] == '\0' || strchr(value + 1, '/') != NULL)
+		{
+			fprintf(stderr, "feed must be a shared-memory name like /nuggets\n");
+			return false;
+		}
+		feedName = value;
+		return true;
+	}
+	if (strncmp(option, "--threads=", strlen("--threads=")) == 0)
+	{
+		char extra;
+		if (sscanf(value, "%d%c", &poolThreads, &extra) != 1 || poolThreads < 0 || poolThreads > 256)
+		{
+			fprintf(stderr, "threads must be an integer from 0 to 256\n");
+			return false;
+		}
+		return true;
+	}
+	if (strncmp(option, "--memprofile=", strlen("--memprofile=")) == 0)
+	{
+		memProfilePath = value;
+		return true;
+	}
+	fprintf(stderr, "unknown option %s\n", option);
+	return false;
+}
+
+/* Handle a message, then send whatever the outbox rate cap now allows to any client. */
+static bool receive(void *arg, const addr_t from, const char *message)
+{
+	bool done = handleMessage(arg, from, message);
+	outbox_pump();
+	return done;
+}
+
+/* Take a message only if its sender is within their input rate. The message loop asks before it acknowledges
+ * a reliable message, so one we drop is sent again later, by when the sender's bucket has refilled. */
+static bool admitMessage(void *arg, const addr_t from, const char *message)
+{
+	return throttle_allow(findThrottle((grid_t *)arg, from), inputCost(message));
+}
+
+/* Nothing arrived for a while: send what the outbox held back since. */
+static bool pump(void *arg)
+{
+	outbox_pump();
+	return false;
+}
+
+/* The throttle for input from an address: its player's, the spectator's, or its own as a stranger. */
+static throttle_t *findThrottle(grid_t *grid, const addr_t from)
+{
+	player_t *player = grid_findplayer(grid, from);
+	if (player != NULL)
+	{
+		return player_get_throttle(player);
+	}
+	if (grid_getspectatorCount(grid) == 1 && message_eqAddr(from, *spectator_get_addr(grid_getspectator(grid))))
+	{
+		return spectator_get_throttle(grid_getspectator(grid));
+	}
+	return strangerThrottle(from);
+}
+
+/* Whether an address is neither an active player nor the spectator. */
+static bool isStranger(grid_t *grid, const addr_t from)
+{
+	player_t *player = grid_findplayer(grid, from);
+	if (player != NULL && player_get_isactive(player))
+	{
+		return false;
+	}
+	return grid_getspectatorCount(grid) == 0 || !message_eqAddr(from, *spectator_get_addr(grid_getspectator(grid)));
+}
+
+/* The throttle of a stranger: the one it had, or else the one in the slot heard from longest ago,
+ * so a stranger that floods us spends only its own bucket, and the table never grows. A slot taken
+ * from another stranger keeps its bucket, so addresses that take turns evicting each other share the slots' buckets. */
+static throttle_t *strangerThrottle(const addr_t from)
+{
+	stranger_t *slot = &strangers[0];
+	for (int i = 0; i < MaxStrangers; i++)
+	{
+		if (strangers[i].lastUsed > 0 && message_eqAddr(strangers[i].addr, from))
+		{
+			slot = &strangers[i];
+			break;
+		}
+		if (strangers[i].lastUsed < slot->lastUsed)
+		{
+			slot = &strangers[i];
+		}
+	}
+	if (slot->throttle == NULL)
+	{
+		slot->throttle = throttle_new(NULL);
+	}
+	else if (slot->lastUsed == 0)
+	{
+		throttle_reset(slot->throttle); // left from an earlier round
+	}
+	else if (!message_eqAddr(slot->addr, from))
+	{
+		throttle_merge(strangersGone, slot->throttle); // keep the counts of the stranger it served
+		throttle_hand_over(slot->throttle);
+	}
+	slot->addr = from;
+	slot->lastUsed = ++strangerInputs;
+	return slot->throttle;
+}
+
+/* Report the input of every stranger, those still in the table and those gone from it, as one. */
+static void reportStrangers(void)
+{
+	throttle_t *others = throttle_new(NULL);
+	throttle_merge(others, strangersGone);
+	for (int i = 0; i < MaxStrangers; i++)
+	{
+		if (strangers[i].lastUsed > 0)
+		{
+			throttle_merge(others, strangers[i].throttle);
+		}
+	}
+	throttle_report(others, stdout, "others");
+	throttle_delete(others);
+}
+
+/* Empty the table of strangers, and their counts, for a new round. */
+static void forgetStrangers(void)
+{
+	for (int i = 0; i < MaxStrangers; i++)
+	{
+		strangers[i].lastUsed = 0;
+	}
+	strangerInputs = 0;
+	throttle_reset(strangersGone);
+}
+
+/* The cost of a message to the throttles: the keystrokes in a KEYS batch, or 1. */
+static int inputCost(const char *message)
+{
+	if (strncmp(message, "KEYS ", strlen("KEYS ")) == 0 && strlen(message) > strlen("KEYS "))
+	{
+		return strlen(message) - strlen("KEYS ");
+	}
+	return 1;
+}
+
 static bool handleMessage(void *arg, const addr_t from, const char *message)
 {
 	// set max name length to 50 chars
 	int MaxNameLength = 50;
-	int MaxPlayers = 26;
 	grid_t *gameGrid = (grid_t *)arg;
-	player_t **playerList = grid_getplayers(gameGrid);
 	int playerCount = grid_getplayercount(gameGrid);
 	// get first word from message
 	char *firstWord;
 	int firstSpace = 0;
-	while (!isspace(message[firstSpace]))
+	while (message[firstSpace] != '\0' && !isspace(message[firstSpace]))
 	{
 		firstSpace++;
 	}
 	// amount of bytes needed for first word of message + 1 for null terminating
-	firstWord = mem_assert(malloc(firstSpace + 1), "Failed to allocate memory for firstWord.");
+	firstWord = mem_assert(mem_tmalloc("message", firstSpace + 1), "Failed to allocate memory for firstWord.");
 	strncpy(firstWord, message, firstSpace);
 	firstWord[firstSpace] = '\0';
 
 	// if first word is PLAY
 	if (strcmp(firstWord, "PLAY") == 0)
 	{
-		if (playerCount == MaxPlayers)
+		if (playerCount == grid_getmaxplayers(gameGrid))
 		{
-			message_send(from, "QUIT Game is full: no more players can join.");
+			outbox_send(from, "QUIT Game is full: no more players can join.");
+			if (isStranger(gameGrid, from))
+			{
+				outbox_forget(from);
+			}
+			mem_tfree(firstWord);
+			return false;
 		}
-		char *real_name = mem_assert(malloc(128), "Error allocating space for real name");
+		char *real_name = mem_assert(mem_tmalloc("message", 128), "Error allocating space for real name");
 		strcpy(real_name, message + 5);
 		if (strcmp(real_name, "") == 0)
 		{
-			message_send(from, "QUIT Sorry - you must provide player's name.");
+			outbox_send(from, "QUIT Sorry - you must provide player's name.");
+			if (isStranger(gameGrid, from))
+			{
+				outbox_forget(from);
+			}
 			return false;
 		}
 		// truncate to MaxNameLength and replace characters that are both isgraph() and isblank()
-		char *real_name_truncated = mem_assert(malloc((MaxNameLength + 1) * sizeof(char)), "Failed to allocate memory for real_name_truncated.");
+		char *real_name_truncated = mem_assert(mem_tmalloc("message", (MaxNameLength + 1) * sizeof(char)), "Failed to allocate memory for real_name_truncated.");
 		strncpy(real_name_truncated, real_name, MaxNameLength);
 		real_name_truncated[50] = '\0';
 		for (int i = 0; i < 50; i++)
@@ -132,177 +550,437 @@ static bool handleMessage(void *arg, const addr_t from, const char *message)
 			}
 		}
 		grid_spawn_player(gameGrid, from, real_name_truncated);
-		free(real_name);
-		free(real_name_truncated);
+		mem_tfree(real_name);
+		mem_tfree(real_name_truncated);
 		int playerCount = grid_getplayercount(gameGrid);
-		char *messageToSend = mem_assert(malloc(128), "Failed to allocate memory for messageToSend.");
-		char playerCharacter = (char)(64 + playerCount);
-		sprintf(messageToSend, "OK %c", playerCharacter);
-		message_send(from, messageToSend);
+		char *messageToSend = mem_assert(mem_tmalloc("message", 128), "Failed to allocate memory for messageToSend.");
+		char playerId[GRID_PLAYER_ID_SIZE];
+		grid_player_id(playerCount - 1, playerId);
+		sprintf(messageToSend, "OK %s", playerId);
+		outbox_send(from, messageToSend);
 		sprintf(messageToSend, "GRID %d %d", grid_getnrows(gameGrid), grid_getncols(gameGrid));
-		message_send(from, messageToSend);
+		outbox_send(from, messageToSend);
 		sprintf(messageToSend, "GOLD 0 0 %d", grid_getnuggetcount(gameGrid));
-		message_send(from, messageToSend);
-		player_move(playerList[grid_getplayercount(gameGrid) - 1], gameGrid, 0, 0); // make sure they get gold if they are standing there
-		free(messageToSend);
-		free(firstWord);
+		outbox_send(from, messageToSend);
+		// the spawn computed the newcomer's sight, and marked dirty whoever can see their spot; only gold underfoot is left
+		player_t *newcomer = grid_getplayers(gameGrid)[playerCount - 1];
+		player_collect_gold(newcomer, gameGrid, player_get_x(newcomer), player_get_y(newcomer));
+		mem_tfree(messageToSend);
+		mem_tfree(firstWord);
+		if (message_pending() && grid_getnuggetcount(gameGrid) > 0)
+		{
+			joinsPending = true; // more are arriving: send everyone's frames once, when the burst is over
+			return false;
+		}
 		return updateall(gameGrid);
 	}
-	else if (strcmp(firstWord, "KEY") == 0)
+	else if (strcmp(firstWord, "KEY") == 0 || strcmp(firstWord, "KEYS") == 0)
 	{
+		// KEY carries one keystroke; KEYS a sequence of them, applied in order before a single update
+		const char *keys = message + firstSpace + (message[firstSpace] != '\0');
+		bool batch = strcmp(firstWord, "KEYS") == 0;
 		// find matching player in list of players to find out which player to move
-		player_t *matchingPlayer = NULL;
-		for (int i = 0; i < playerCount; i++)
-		{
-			const addr_t playerAddr = *player_get_addr(playerList[i]);
-			if (message_eqAddr(from, playerAddr))
-			{
-				matchingPlayer = playerList[i];
-				break;
-			}
-		}
-		char *keyStroke = mem_assert(malloc(128), "Failed to allocate memory for keyStroke.");
-		strcpy(keyStroke, message + 4);
+		player_t *matchingPlayer = grid_findplayer(gameGrid, from);
 		// special case: check spectator
-		if (strcmp(keyStroke, "Q") == 0 && matchingPlayer == NULL) {
+		if (matchingPlayer == NULL && (batch ? strchr(keys, 'Q') != NULL : strcmp(keys, "Q") == 0)) {
 			if (grid_getspectatorCount(gameGrid) == 1) 
 			{
 				spectator_t* spectator = grid_getspectator(gameGrid);
 				if (message_eqAddr(*spectator_get_addr(spectator), from)) {
 					spectator_quit(spectator, gameGrid);
-					message_send(from, "QUIT Thanks for playing!");
+					outbox_send(from, "QUIT Thanks for playing!");
+					outbox_forget(from);
 				}
 			}
-			free(keyStroke);
-			free(firstWord);
+			mem_tfree(firstWord);
 			return updateall(gameGrid);
 		}
 		if (matchingPlayer == NULL || player_get_isactive(matchingPlayer) == false) {
-			free(keyStroke);
-			free(firstWord);
+			mem_tfree(firstWord);
 			return updateall(gameGrid);
 		}
 
-		if (strcmp(keyStroke, "h") == 0)
-		{ // CAPITAL CHARACTER FIX, CHECK IF SPECTATOR
-			player_move(matchingPlayer, gameGrid, -1, 0);
-		}
-		else if (strcmp(keyStroke, "l") == 0)
+		if (!batch)
 		{
-			player_move(matchingPlayer, gameGrid, 1, 0);
-		}
-		else if (strcmp(keyStroke, "j") == 0)
-		{
-			player_move(matchingPlayer, gameGrid, 0, -1);
+			if (strlen(keys) == 1)
+			{
+				handleKey(gameGrid, matchingPlayer, from, keys[0]);
+			}
+			else
+			{
+				outbox_send(from, "ERROR unknown keystroke");
+			}
 		}
-		else if (strcmp(keyStroke, "k") == 0)
+		else
 		{
-			player_move(matchingPlayer, gameGrid, 0, 1);
+			// stop at a quit, or as soon as the last nugget is taken, as separate KEY messages would
+			for (const char *k = keys; *k != '\0' && grid_getnuggetcount(gameGrid) > 0; k++)
+			{
+				if (!handleKey(gameGrid, matchingPlayer, from, *k))
+				{
+					break;
+				}
+			}
 		}
-		else if (strcmp(keyStroke, "y") == 0)
+		mem_tfree(firstWord);
+		return updateall(gameGrid);
+	}
+	else if (strcmp(firstWord, "SPECTATE") == 0)
+	{
+		grid_spawn_spectator(gameGrid, from);
+		char* messageToSend = mem_assert(mem_tmalloc("message", 128), "Failed to allocate memory for messageToSend (re-allocation).");
+		sprintf(messageToSend, "GRID %d %d", grid_getnrows(gameGrid), grid_getncols(gameGrid));
+		outbox_send(from, messageToSend);
+		sprintf(messageToSend, "GOLD 0 0 %d", grid_getnuggetcount(gameGrid));
+		outbox_send(from, messageToSend);
+		mem_tfree(messageToSend);
+		mem_tfree(firstWord);
+		return updateall(gameGrid);
+	}
+	else if (strcmp(firstWord, "COMPRESS") == 0)
+	{
+		// the client can decode DISPLAYZ frames from now on
+		player_t *player = grid_findplayer(gameGrid, from);
+		if (player != NULL)
 		{
-			player_move(matchingPlayer, gameGrid, -1, 1);
+			player_set_iscompressed(player, true);
 		}
-		else if (strcmp(keyStroke, "u") == 0)
+		if (grid_getspectatorCount(gameGrid) == 1 && message_eqAddr(from, *spectator_get_addr(grid_getspectator(gameGrid))))
 		{
-			player_move(matchingPlayer, gameGrid, 1, 1);
+			spectator_set_iscompressed(grid_getspectator(gameGrid), true);
 		}
-		else if (strcmp(keyStroke, "b") == 0)
+		mem_tfree(firstWord);
+		return false;
+	}
+	else if (strcmp(firstWord, "LEGEND") == 0)
+	{
+		// the client can tell apart players who share a symbol from now on (see legend.h); if some do, show it who is who
+		bool shared = grid_getplayercount(gameGrid) > LEGEND_NSYMBOLS;
+		player_t *player = grid_findplayer(gameGrid, from);
+		if (player != NULL)
 		{
-			player_move(matchingPlayer, gameGrid, -1, -1);
+			player_set_haslegend(player, true);
+			if (shared)
+			{
+				player_set_isdirty(player, true);
+			}
 		}
-		else if (strcmp(keyStroke, "n") == 0)
+		if (grid_getspectatorCount(gameGrid) == 1 && message_eqAddr(from, *spectator_get_addr(grid_getspectator(gameGrid))))
 		{
-			player_move(matchingPlayer, gameGrid, 1, -1);
+			spectator_set_haslegend(grid_getspectator(gameGrid), true);
+			if (shared)
+			{
+				grid_setspectatorDirty(gameGrid, true);
+			}
 		}
-		else if (strcmp(keyStroke, "Q") == 0)
+		mem_tfree(firstWord);
+		return shared ? updateall(gameGrid) : false;
+	}
+	else if (strcmp(firstWord, "VIEW") == 0)
+	{
+		// the player's screen shows this many rows and columns of the map; send them only that much
+		player_t *player = grid_findplayer(gameGrid, from);
+		int rows, cols;
+		if (player == NULL || sscanf(message, "VIEW %d %d", &rows, &cols) != 2 || rows < 1 || cols < 1)
 		{
-			player_quit(matchingPlayer, gameGrid);
-			message_send(from, "QUIT Thanks for playing!");
+			if (player == NULL)
+			{
+				outbox_reply(from, "ERROR malformed VIEW");
+			}
+			else
+			{
+				outbox_send(from, "ERROR malformed VIEW");
+			}
+			mem_tfree(firstWord);
+			return false;
 		}
-		else if (strcmp(keyStroke, "H") == 0)
+		player_set_view(player, rows, cols);
+		player_set_isdirty(player, true);
+		mem_tfree(firstWord);
+		return updateall(gameGrid);
+	}
+	else
+	{
+		if (isStranger(gameGrid, from))
 		{
-			while (player_move(matchingPlayer, gameGrid, -1, 0)) {} // fancy way of doing till returns false!
+			outbox_reply(from, "invalid message"); // junk from anyone must not grow the outbox or the reliable-send state
 		}
-		else if (strcmp(keyStroke, "L") == 0)
+		else
 		{
-			while (player_move(matchingPlayer, gameGrid, 1, 0)) {}
+			outbox_send(from, "invalid message");
 		}
-		else if (strcmp(keyStroke, "J") == 0)
+		mem_tfree(firstWord);
+		return false; // SHOULD KEEP GOING?
+	}
+}
+
+/* Apply one keystroke from an active player; return false if they quit. */
+static bool handleKey(grid_t *grid, player_t *player, const addr_t from, const char key)
+{
+	switch (key)
+	{
+	case 'h':
+		player_move(player, grid, -1, 0);
+		break;
+	case 'l':
+		player_move(player, grid, 1, 0);
+		break;
+	case 'j':
+		player_move(player, grid, 0, -1);
+		break;
+	case 'k':
+		player_move(player, grid, 0, 1);
+		break;
+	case 'y':
+		player_move(player, grid, -1, 1);
+		break;
+	case 'u':
+		player_move(player, grid, 1, 1);
+		break;
+	case 'b':
+		player_move(player, grid, -1, -1);
+		break;
+	case 'n':
+		player_move(player, grid, 1, -1);
+		break;
+	case 'Q':
+		player_quit(player, grid);
+		outbox_send(from, "QUIT Thanks for playing!");
+		outbox_forget(from);
+		return false;
+	case 'H':
+		while (player_move(player, grid, -1, 0)) {} // fancy way of doing till returns false!
+		break;
+	case 'L':
+		while (player_move(player, grid, 1, 0)) {}
+		break;
+	case 'J':
+		while (player_move(player, grid, 0, -1)) {}
+		break;
+	case 'K':
+		while (player_move(player, grid, 0, 1)) {}
+		break;
+	case 'Y':
+		while (player_move(player, grid, -1, 1)) {}
+		break;
+	case 'U':
+		while (player_move(player, grid, 1, 1)) {}
+		break;
+	case 'B':
+		while (player_move(player, grid, -1, -1)) {}
+		break;
+	case 'N':
+		while (player_move(player, grid, 1, -1)) {}
+		break;
+	default:
+		outbox_send(from, "ERROR unknown keystroke");
+		break;
+	}
+	return true;
+}
+
+/* Send a DISPLAY to every client whose frame may have changed, and skip the rest.
+ * The frames are made first, all at once on the pool if there is one, as nothing changes the grid meanwhile;
+ * then they are sent from this thread, in the order of the clients. */
+static bool updateall(grid_t *grid)
+{
+	joinsPending = false;
+	int playerCount = grid_getplayercount(grid);
+	player_t **playerList = grid_getplayers(grid);
+	if (frameJobsSize < playerCount + 1)
+	{
+		frameJobsSize = playerCount + 1;
+		frameJobs = mem_assert(mem_trealloc("frame", frameJobs, frameJobsSize * sizeof(frameJob_t)), "Failed to allocate memory for frame jobs.");
+	}
+	int njobs = 0;
+	for (int i = 0; i < playerCount; i++)
+	{
+		if (player_get_isactive(playerList[i]))
 		{
-			while (player_move(matchingPlayer, gameGrid, 0, -1)) {}
+			if (!player_get_isdirty(playerList[i]))
+			{
+				framesSuppressed++;
+				continue;
+			}
+			frameJobs[njobs++] = (frameJob_t){grid, playerList[i], player_get_iscompressed(playerList[i]), NULL, NULL, 0};
 		}
-		else if (strcmp(keyStroke, "K") == 0)
+	}
+	bool spectating = grid_getspectatorCount(grid) == 1;
+	if (grid_getspectatorDirty(grid) && (spectating || feed != NULL))
+	{
+		frameJobs[njobs++] = (frameJob_t){grid, NULL, spectating && spectator_get_iscompressed(grid_getspectator(grid)), NULL, NULL, 0};
+	}
+	else if (spectating)
+	{
+		framesSuppressed++;
+	}
+	pool_run(pool, njobs, renderFrame, frameJobs);
+	for (int k = 0; k < njobs; k++)
+	{
+		frameJob_t *job = &frameJobs[k];
+		if (job->player != NULL)
 		{
-			while (player_move(matchingPlayer, gameGrid, 0, 1)) {}
+			sendFrame(*player_get_addr(job->player), job->frame, job->packed, job->packedLength);
+			player_set_isdirty(job->player, false);
+			framesSent++;
 		}
-		else if (strcmp(keyStroke, "Y") == 0)
+		else
 		{
-			while (player_move(matchingPlayer, gameGrid, -1, 1)) {}
+			if (spectating)
+			{
+				sendFrame(*spectator_get_addr(grid_getspectator(grid)), job->frame, job->packed, job->packedLength);
+				framesSent++;
+			}
+			if (feed != NULL)
+			{
+				feed_publish(feed, job->frame, grid_getnuggetcount(grid)); // the same frame, to local readers
+			}
+			grid_setspectatorDirty(grid, false);
 		}
-		else if (strcmp(keyStroke, "U") == 0)
+		mem_tfree(job->frame);
+		mem_tfree(job->packed);
+	}
+	if (grid_getnuggetcount(grid) == 0)
+	{
+		if (rounds != 1)
 		{
-			while (player_move(matchingPlayer, gameGrid, 1, 1)) {}
+			printf("\nRound %d over", roundNumber);
 		}
-		else if (strcmp(keyStroke, "B") == 0)
+		printf("\nDISPLAY frames sent: %ld, suppressed as unchanged: %ld\n", framesSent, framesSuppressed);
+		printf("DISPLAY bytes: %ld raw, %ld sent (%.1f%%)\n", frameBytesRaw, frameBytesSent,
+			   frameBytesRaw > 0 ? 100.0 * frameBytesSent / frameBytesRaw : 100.0);
+		printf("Input per client (limit %d keystrokes/s):\n", throttle_get_rate());
+		for (int i = 0; i < playerCount; i++)
 		{
-			while (player_move(matchingPlayer, gameGrid, -1, -1)) {}
+			char id[GRID_PLAYER_ID_SIZE];
+			char label[GRID_PLAYER_ID_SIZE + 8];
+			grid_player_id(i, id);
+			snprintf(label, sizeof(label), "player %s", id);
+			throttle_report(player_get_throttle(playerList[i]), stdout, label);
 		}
-		else if (strcmp(keyStroke, "N") == 0)
+		if (grid_getspectatorCount(grid) == 1)
 		{
-			while (player_move(matchingPlayer, gameGrid, 1, -1)) {} 
+			throttle_report(spectator_get_throttle(grid_getspectator(grid)), stdout, "spectator");
 		}
-		else
+		reportStrangers();
+		grid_report_memory(grid, stdout);
+		grid_game_over(grid);
+		if (rounds == 0 || roundNumber < rounds)
 		{
-			message_send(from, "ERROR unknown keystroke");
+			nextRound(grid);
+			return false; // keep serving on the same port
 		}
-		free(keyStroke);
-		free(firstWord);
-		return updateall(gameGrid);
+		return true;
 	}
-	else if (strcmp(firstWord, "SPECTATE") == 0)
+	return false;
+}
+
+/* Called after every datagram, whether or not it carried a message, as an acknowledgement or a retransmission
+ * may be the last of a burst of joins: once the burst is over, send the frames it held back.
+ * Return true if that ends the game. */
+static bool flushJoins(void *arg)
+{
+	if (joinsPending && !message_pending())
 	{
-		grid_spawn_spectator(gameGrid, spectator_new(from));
-		char* messageToSend = mem_assert(malloc(128), "Failed to allocate memory for messageToSend (re-allocation).");
-		sprintf(messageToSend, "GRID %d %d", grid_getnrows(gameGrid), grid_getncols(gameGrid));
-		message_send(from, messageToSend);
-		sprintf(messageToSend, "GOLD 0 0 %d", grid_getnuggetcount(gameGrid));
-		message_send(from, messageToSend);
-		free(messageToSend);
-		free(firstWord);
-		return updateall(gameGrid);
+		bool done = updateall((grid_t *)arg);
+		outbox_pump();
+		return done;
 	}
-	else
+	return false;
+}
+
+/* Publish the spectator's frame to the feed, whether or not a spectator is watching. */
+static void publishFeed(grid_t *grid)
+{
+	char *frame = grid_send_state_spectator(grid, false); // the feed's slots hold a frame without a legend
+	feed_publish(feed, frame, grid_getnuggetcount(grid));
+	mem_tfree(frame);
+	grid_setspectatorDirty(grid, false);
+}
+
+/* Start the next round on the map the server already has: the parsed map and everything built from it stay,
+ * the players, gold and statistics of the last round go, and the players rejoin with PLAY as they did the first time. */
+static void nextRound(grid_t *grid)
+{
+	roundNumber++;
+	srand(seed + roundNumber - 1);
+	// nobody is a player until they rejoin: let go of what the outbox and the message module keep for each
+	// (the spectator was forgotten when the game-over sent them off)
+	player_t **players = grid_getplayers(grid);
+	for (int i = 0; i < grid_getplayercount(grid); i++)
 	{
-		message_send(from, "invalid message");
-		free(firstWord);
-		return false; // SHOULD KEEP GOING?
+		outbox_forget(*player_get_addr(players[i]));
+	}
+	grid_new_round(grid);
+	grid_init_gold(grid);
+	if (feed != NULL)
+	{
+		publishFeed(grid);
 	}
+	forgetStrangers();
+	framesSent = 0;
+	framesSuppressed = 0;
+	frameBytesRaw = 0;
+	frameBytesSent = 0;
+	printf("Round %d started\n", roundNumber);
+	fflush(stdout);
 }
 
-static bool updateall(grid_t *grid)
+/* Send a DISPLAY (or DISPLAYV) frame, or instead its compressed form, if packFrame made one, and count the bytes. */
+static void sendFrame(const addr_t to, const char *frame, const char *packed, size_t packedLength)
 {
-	int playerCount = grid_getplayercount(grid);
-	player_t **playerList = grid_getplayers(grid);
-	for (int i = 0; i < playerCount; i++)
+	size_t length = strlen(frame);
+	frameBytesRaw += length;
+	if (packed != NULL)
 	{
-		if (player_get_isactive(playerList[i]))
-		{
-			char *messageToSend = grid_send_state(grid, playerList[i]);
-			message_send(*player_get_addr(playerList[i]), messageToSend);
-			free(messageToSend);
-		}
+		outbox_send(to, packed);
+		frameBytesSent += packedLength;
+		return;
 	}
-	if (grid_getspectatorCount(grid) == 1)
+	outbox_send(to, frame);
+	frameBytesSent += length;
+}
+
+/* Make frame job k: render the recipient's frame, and compress it if they want that.
+ * Runs on any thread of the pool, so it only reads the grid and writes its own job. */
+static void renderFrame(void *arg, int k)
+{
+	frameJob_t *job = &((frameJob_t *)arg)[k];
+	grid_t *grid = job->grid;
+	player_t *player = job->player;
+	if (player == NULL)
 	{
-		char *messageToSend = grid_send_state_spectator(grid);
-		message_send(*spectator_get_addr(grid_getspectator(grid)), messageToSend);
-		free(messageToSend);
+		job->frame = grid_send_state_spectator(grid, spectator_get_haslegend(grid_getspectator(grid)));
 	}
-	if (grid_getnuggetcount(grid) == 0)
+	else if (player_get_viewrows(player) > 0
+		&& (player_get_viewrows(player) < grid_getnrows(grid) || player_get_viewcols(player) < grid_getncols(grid)))
 	{
-		grid_game_over(grid);
-		return true;
+		job->frame = grid_send_view(grid, player, player_get_viewrows(player), player_get_viewcols(player));
 	}
-	return false;
+	else
+	{
+		job->frame = grid_send_state(grid, player);
+	}
+	job->packed = job->compressed ? packFrame(job->frame, &job->packedLength) : NULL;
+}
+
+/* Compress a DISPLAY (or DISPLAYV) frame as a DISPLAYZ (or DISPLAYVZ) frame: the first word gets a 'Z', the rest of
+ * the first line stays, and the map is compressed. Return it, and put its length in *length, if it is smaller; else NULL. */
+static char *packFrame(const char *frame, size_t *length)
+{
+	size_t original = strlen(frame);
+	size_t word = strcspn(frame, " \n");
+	size_t header = strchr(frame, '\n') - frame + 1;
+	char *packed = mem_assert(mem_tmalloc("frame", header + 1 + codec_bound(original - header)), "Failed to allocate memory for compressed frame.");
+	memcpy(packed, frame, word);
+	packed[word] = 'Z';
+	memcpy(packed + word + 1, frame + word, header - word);
+	size_t n = codec_encode(frame + header, original - header, packed + header + 1);
+	if (n > 0 && header + 1 + n < original)
+	{
+		*length = header + 1 + n;
+		return packed;
+	}
+	mem_tfree(packed);
+	return NULL;
 }
@@ -11,39 +11,78 @@
 #include <string.h>
 #include <math.h>
 #include "grid.h"
+#include "spectator.h"
 #include "message.h"
+#include "outbox.h"
+#include "throttle.h"
 #include "mem.h"
+#include "arena.h"
 
 typedef struct spectator
 {
-    addr_t *connection_info;
+    arena_t *arena; // where the spectator lives; NULL for malloc
+    addr_t connection_info;
+    bool isCompressed; // the client asked for compressed DISPLAY frames
+    bool hasLegend; // the client asked for a legend of the players past the first cycle of symbols
+    throttle_t *input; // limits how fast the client's input is accepted
 } spectator_t;
 
-spectator_t *spectator_new(const addr_t connection_info)
+spectator_t *spectator_new(arena_t *arena, const addr_t connection_info)
 {
-    spectator_t *spectator = (spectator_t *)mem_assert(malloc(sizeof(spectator_t)), "Error allocating space for spectator");
-    spectator->connection_info = (addr_t *)mem_assert(malloc(sizeof(addr_t)), "Error allocating space for x");
-    *(spectator->connection_info) = connection_info;
+    spectator_t *spectator = (spectator_t *)mem_assert(arena_alloc(arena, sizeof(spectator_t)), "Error allocating space for spectator");
+    spectator->arena = arena;
+    spectator->input = throttle_new(arena);
+    spectator_reset(spectator, connection_info);
     return spectator;
 }
 
+void spectator_reset(spectator_t *spectator, const addr_t connection_info)
+{
+    spectator->connection_info = connection_info;
+    spectator->isCompressed = false;
+    spectator->hasLegend = false;
+    throttle_reset(spectator->input);
+}
+
 void spectator_delete(spectator_t *spectator)
 {
-    free(spectator->connection_info);
-    free(spectator);
+    throttle_delete(spectator->input);
+    arena_free(spectator->arena, spectator);
 }
 
 void spectator_quit(spectator_t *spectator, grid_t *grid) // assumes spectator is actually there.
 {
-    if (spectator->connection_info != NULL)
-    {
-        message_send(*spectator->connection_info, "QUIT Thanks for watching!\n");
-    }
+    outbox_send(spectator->connection_info, "QUIT Thanks for watching!\n");
+    outbox_forget(spectator->connection_info);
     grid_setspectatorCount(grid, 0);
-    spectator_delete(spectator);
 }
 
 addr_t *spectator_get_addr(spectator_t *spectator)
 {
-    return spectator->connection_info;
-}
\ No newline at end of file
+    return &spectator->connection_info;
+}
+
+bool spectator_get_iscompressed(spectator_t *spectator)
+{
+    return spectator->isCompressed;
+}
+
+void spectator_set_iscompressed(spectator_t *spectator, bool compressed)
+{
+    spectator->isCompressed = compressed;
+}
+
+bool spectator_get_haslegend(spectator_t *spectator)
+{
+    return spectator->hasLegend;
+}
+
+void spectator_set_haslegend(spectator_t *spectator, bool legend)
+{
+    spectator->hasLegend = legend;
+}
+
+throttle_t *spectator_get_throttle(spectator_t *spectator)
+{
+    return spectator->input;
+}
@@ -17,6 +17,8 @@
 #include <math.h>
 #include "grid.h"
 #include "message.h"
+#include "throttle.h"
+#include "arena.h"
 
 /**************** global types ****************/
 typedef struct spectator spectator_t;
@@ -27,15 +29,24 @@ typedef struct spectator spectator_t;
 /* Create a new spectator object.
  *
  * Caller provides:
- *   a valid address struct with connection information.
+ *   the arena to allocate it in, or NULL for malloc, and a valid address struct with connection information.
  * We guarantee:
- *   a new spectator object is returned if memory allocation is successful.
- *   returns NULL if memory allocation fails.
+ *   a new spectator object is returned; we exit with an error if memory allocation fails.
  * Notes:
- *   the caller is responsible for managing the memory of the addr_t* passed in.
- *   the caller must call spectator_delete to free the spectator object's memory.
+ *   the address is copied into the spectator.
+ *   the caller must call spectator_delete to free a spectator made with malloc; one made in an arena goes with it.
  */
-spectator_t* spectator_new(const addr_t connection_info);
+spectator_t* spectator_new(arena_t* arena, const addr_t connection_info);
+
+/***************** spectator_reset *****************/
+/* Hand a spectator object to a new spectator.
+ *
+ * Caller provides:
+ *   a valid spectator object and the new spectator's address.
+ * We guarantee:
+ *   the spectator is as spectator_new would make it: uncompressed, without a legend, with a fresh throttle.
+ */
+void spectator_reset(spectator_t* spectator, const addr_t connection_info);
 
 /***************** spectator_delete *****************/
 /* Delete a spectator object.
@@ -43,10 +54,7 @@ spectator_t* spectator_new(const addr_t connection_info);
  * Caller provides:
  *   a valid spectator object.
  * We guarantee:
- *   the spectator's memory is freed.
- * Notes:
- *   does not free the memory of the connection_info inside the spectator; 
- *   this is the caller's responsibility.
+ *   the spectator's memory is freed, unless it lives in an arena.
  */
 void spectator_delete(spectator_t* spectator);
 
@@ -56,11 +64,11 @@ void spectator_delete(spectator_t* spectator);
  * Caller provides:
  *   valid spectator object and grid object.
  * We guarantee:
- *   spectator count in the grid is updated.
- *   the spectator's memory is freed.
+ *   the spectator is sent a QUIT, and the spectator count in the grid is updated.
  * Notes:
  *   assumes the spectator is present in the grid.
- *   does not modify the grid beyond updating the spectator count.
+ *   does not modify the grid beyond updating the spectator count; the spectator object stays
+ *   with the grid, for the next spectator (see grid_spawn_spectator).
  */
 void spectator_quit(spectator_t* spectator, grid_t* grid);
 
@@ -77,4 +85,52 @@ void spectator_quit(spectator_t* spectator, grid_t* grid);
  */
 addr_t* spectator_get_addr(spectator_t* spectator);
 
+/***************** spectator_get_iscompressed *****************/
+/* Check if the spectator's client takes compressed DISPLAY frames.
+ *
+ * Caller provides:
+ *   a valid spectator object.
+ * We guarantee:
+ *   returns true once spectator_set_iscompressed(spectator, true) has been called;
+ *   a new spectator starts uncompressed.
+ */
+bool spectator_get_iscompressed(spectator_t* spectator);
+
+/***************** spectator_set_iscompressed *****************/
+/* Record whether the spectator's client takes compressed DISPLAY frames.
+ *
+ * Caller provides:
+ *   a valid spectator object.
+ */
+void spectator_set_iscompressed(spectator_t* spectator, bool compressed);
+
+/***************** spectator_get_haslegend *****************/
+/* Check if the spectator's client takes a legend in its DISPLAY frames (see legend.h).
+ *
+ * Caller provides:
+ *   a valid spectator object.
+ * We guarantee:
+ *   returns true once spectator_set_haslegend(spectator, true) has been called;
+ *   a new spectator starts without one.
+ */
+bool spectator_get_haslegend(spectator_t* spectator);
+
+/***************** spectator_set_haslegend *****************/
+/* Record whether the spectator's client takes a legend in its DISPLAY frames.
+ *
+ * Caller provides:
+ *   a valid spectator object.
+ */
+void spectator_set_haslegend(spectator_t* spectator, bool legend);
+
+/***************** spectator_get_throttle *****************/
+/* Get the throttle that limits how fast the spectator's input is accepted.
+ *
+ * Caller provides:
+ *   a valid spectator object.
+ * We guarantee:
+ *   returns the spectator's throttle, which is freed along with the spectator, and reset with it.
+ */
+throttle_t* spectator_get_throttle(spectator_t* spectator);
+
 #endif //__SPECTATOR_H
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*
+ * strangertest.c - test that input from many addresses in turn is throttled
+ *
+ * Starts ./server on the given map with a low input rate, and sends junk from Addresses sockets,
+ * one message from each in turn, Turns times over. None of them is a player, so each has a bucket
+ * in the server's table of strangers, which holds fewer than Addresses; every message evicts the
+ * bucket of the address heard from longest ago. The server answers a junk message it accepts with
+ * "invalid message", and drops one it refuses silently, so the replies count what got through.
+ * A table that gave each newcomer a full bucket would answer every message; one that hands over
+ * the bucket as it is answers about two per slot: one on its full bucket, and one more on the
+ * sliver it earns just after, which puts it in debt until it refills at one input a second.
+ *
+ * Usage: ./strangertest map.txt
+ * Exit status 0 if at most MaxAnswered of the messages got a reply.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for kill and nanosleep
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "message.h"
+
+enum { Addresses = 100, Turns = 5, MaxAnswered = 150 }; // the table holds 64
+static const float Wait = 0.05; // seconds of silence after which a socket has no more replies
+static const struct timespec Pause = { .tv_nsec = 20000000 }; // between turns
+
+/**************** local functions ****************/
+static pid_t startServer(const char* map, int* port);
+static bool handleMessage(void* arg, const addr_t from, const char* message);
+static bool giveUp(void* arg);
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s map.txt\n", argv[0]);
+        return 1;
+    }
+    int port;
+    pid_t server = startServer(argv[1], &port);
+    if (server < 0) {
+        return 2;
+    }
+    addr_t to;
+    char portStr[16];
+    snprintf(portStr, sizeof(portStr), "%d", port);
+    message_ctx_t* ctx[Addresses];
+    for (int a = 0; a < Addresses; a++) {
+        ctx[a] = message_ctx_new(NULL, 0, false);
+        if (ctx[a] == NULL || !message_setAddr("localhost", portStr, &to)) {
+            fprintf(stderr, "cannot make socket %d\n", a);
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+            return 2;
+        }
+    }
+    for (int t = 0; t < Turns; t++) {
+        for (int a = 0; a < Addresses; a++) {
+            message_ctx_send(ctx[a], to, "JUNK");
+        }
+        nanosleep(&Pause, NULL); // so the server's socket buffer holds each turn whole
+    }
+    nanosleep(&(struct timespec){ .tv_nsec = 200000000 }, NULL); // let the server get through them
+    int answered = 0;
+    for (int a = 0; a < Addresses; a++) {
+        message_ctx_loop(ctx[a], &answered, Wait, giveUp, NULL, handleMessage);
+    }
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    for (int a = 0; a < Addresses; a++) {
+        message_ctx_delete(ctx[a]);
+    }
+    printf("%d addresses in turn, %d messages: %d answered\n", Addresses, Addresses * Turns, answered);
+    return answered <= MaxAnswered ? 0 : 1;
+}
+
+/* Start ./server on the map, taking one input a second from each client; return its pid, and its port through 'port', or -1. */
+static pid_t startServer(const char* map, int* port)
+{
+    int out[2];
+    if (pipe(out) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        freopen("/dev/null", "w", stderr);
+        execl("./server", "./server", map, "1", "--inputrate=1", (char*)NULL);
+        perror("./server");
+        exit(127);
+    }
+    close(out[1]);
+    // the server prints "Server port is: N", and flushes it, in one write
+    char line[64];
+    ssize_t n = read(out[0], line, sizeof(line) - 1);
+    close(out[0]);
+    line[n > 0 ? n : 0] = '\0';
+    char* colon = strchr(line, ':');
+    if (colon == NULL || sscanf(colon + 1, "%d", port) != 1) {
+        fprintf(stderr, "server did not give its port\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/* A reply to one of our sockets: count it, and keep reading. */
+static bool handleMessage(void* arg, const addr_t from, const char* message)
+{
+    (*(int*)arg)++;
+    return false;
+}
+
+/* No more replies on a socket. */
+static bool giveUp(void* arg)
+{
+    return true;
+}
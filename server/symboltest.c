@@ -0,0 +1,202 @@
+/*
+ * symboltest.c - test that more players than symbols can be told apart
+ *
+ * Starts ./server on the given map for Players players, more than the LEGEND_NSYMBOLS symbols
+ * a frame draws them with, and joins them one at a time, each on a socket of its own (see
+ * message_ctx_new), noting the id each is given in its OK. Then a spectator joins and sends
+ * LEGEND, and reads its frames as the client does: the latest one, with its legend applied
+ * (see legend.h). Every player must then show on exactly one cell, and every cell that shows
+ * a player must show one that joined, by the id it was given.
+ *
+ * Usage: ./symboltest map.txt
+ * Exit status 0 if every player was told apart from the others.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for kill
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "message.h"
+#include "legend.h"
+
+enum { Players = 100 };
+static const float Wait = 1; // seconds of silence after which a client has no more messages
+
+/**************** local types ****************/
+typedef struct reader {
+    int player;   // the player the OK named; -1 until then
+    char* frame;  // the latest DISPLAY, for the spectator; NULL until then
+} reader_t;
+
+/**************** local functions ****************/
+static int check(reader_t* readers, const char* frame);
+static pid_t startServer(const char* map, int* port);
+static bool handleOK(void* arg, const addr_t from, const char* message);
+static bool handleFrame(void* arg, const addr_t from, const char* message);
+static bool giveUp(void* arg);
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s map.txt\n", argv[0]);
+        return 1;
+    }
+    int port;
+    pid_t server = startServer(argv[1], &port);
+    if (server < 0) {
+        return 2;
+    }
+    addr_t to;
+    char portStr[16];
+    snprintf(portStr, sizeof(portStr), "%d", port);
+    message_ctx_t* ctx[Players + 1]; // the players, then the spectator
+    reader_t readers[Players + 1];
+    for (int c = 0; c <= Players; c++) {
+        ctx[c] = message_ctx_new(NULL, 0, false);
+        if (ctx[c] == NULL || !message_setAddr("localhost", portStr, &to)) {
+            fprintf(stderr, "cannot make client %d\n", c);
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+            return 2;
+        }
+        readers[c] = (reader_t){ -1, NULL };
+    }
+    // one at a time, so that each OK is read before frames for later joiners pile up behind it
+    for (int c = 0; c < Players; c++) {
+        char play[32];
+        snprintf(play, sizeof(play), "PLAY player%d", c);
+        message_ctx_send(ctx[c], to, play);
+        message_ctx_loop(ctx[c], &readers[c], Wait, giveUp, NULL, handleOK);
+    }
+    message_ctx_send(ctx[Players], to, "SPECTATE");
+    message_ctx_send(ctx[Players], to, "LEGEND");
+    message_ctx_loop(ctx[Players], &readers[Players], Wait, giveUp, NULL, handleFrame);
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    int failures = check(readers, readers[Players].frame);
+    free(readers[Players].frame);
+    for (int c = 0; c <= Players; c++) {
+        message_ctx_delete(ctx[c]);
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+/* Check the spectator's frame against the players' ids; print what was found, and return the number of failures. */
+static int check(reader_t* readers, const char* frame)
+{
+    if (frame == NULL) {
+        printf("the spectator got no frame\n");
+        return 1;
+    }
+    int failures = 0;
+    bool joined[LEGEND_MAX_PLAYERS] = { false };
+    for (int c = 0; c < Players; c++) {
+        if (readers[c].player < 0 || joined[readers[c].player]) {
+            printf("player%d got no OK, or one with an id taken already\n", c);
+            failures++;
+        } else {
+            joined[readers[c].player] = true;
+        }
+    }
+    char* body = strchr(frame, '\n') + 1;
+    int marked = legend_apply(frame + strlen("DISPLAY"), body);
+    int cells[LEGEND_MAX_PLAYERS] = { 0 };
+    for (const char* p = body; *p != '\0'; p++) {
+        int k = legend_cellPlayer(*p);
+        if (k >= 0) {
+            cells[k]++;
+        }
+    }
+    int shown = 0;
+    for (int k = 0; k < LEGEND_MAX_PLAYERS; k++) {
+        if (cells[k] > 0) {
+            shown++;
+        }
+        if (joined[k] ? cells[k] != 1 : cells[k] != 0) {
+            char id[LEGEND_ID_SIZE];
+            legend_id(k, id);
+            printf("player %s is on %d cells\n", id, cells[k]);
+            failures++;
+        }
+    }
+    printf("%d players, %d marked by the legend: %d told apart, %d failures\n", Players, marked, shown, failures);
+    return marked < 0 ? failures + 1 : failures;
+}
+
+/* Start ./server on the map, for Players players; return its pid, and its port through 'port', or -1. */
+static pid_t startServer(const char* map, int* port)
+{
+    int out[2];
+    if (pipe(out) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        char maxPlayers[32];
+        snprintf(maxPlayers, sizeof(maxPlayers), "--maxplayers=%d", Players);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        freopen("/dev/null", "w", stderr);
+        execl("./server", "./server", map, "1", "--inputrate=0", maxPlayers, (char*)NULL);
+        perror("./server");
+        exit(127);
+    }
+    close(out[1]);
+    // the server prints "Server port is: N", and flushes it, in one write
+    char line[64];
+    ssize_t n = read(out[0], line, sizeof(line) - 1);
+    close(out[0]);
+    line[n > 0 ? n : 0] = '\0';
+    char* colon = strchr(line, ':');
+    if (colon == NULL || sscanf(colon + 1, "%d", port) != 1) {
+        fprintf(stderr, "server did not give its port\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/* A message for a player: stop once it is the OK, noting the player it names. */
+static bool handleOK(void* arg, const addr_t from, const char* message)
+{
+    char id[LEGEND_ID_SIZE];
+    if (sscanf(message, "OK %7s", id) == 1) {
+        ((reader_t*)arg)->player = legend_player(id);
+        return true;
+    }
+    return false;
+}
+
+/* A message for the spectator: keep the latest frame, and keep reading. */
+static bool handleFrame(void* arg, const addr_t from, const char* message)
+{
+    reader_t* reader = arg;
+    if (strncmp(message, "DISPLAY ", strlen("DISPLAY ")) == 0
+        || strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+        free(reader->frame);
+        reader->frame = malloc(strlen(message) + 1);
+        if (reader->frame != NULL) {
+            strcpy(reader->frame, message);
+        }
+    }
+    return false;
+}
+
+/* No more messages for a client. */
+static bool giveUp(void* arg)
+{
+    return true;
+}
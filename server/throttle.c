@@ -0,0 +1,115 @@
+/*
+ * throttle.c - 'throttle' module
+ *
+ * See throttle.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mem.h"
+#include "arena.h"
+#include "throttle.h"
+
+typedef struct throttle
+{
+    arena_t *arena;  // where the throttle lives; NULL for malloc
+    double tokens;   // inputs it may accept now; negative while in debt
+    double refilled; // when the tokens were last topped up
+    long accepted;   // inputs accepted
+    long keys;       // their total cost
+    long dropped;    // inputs dropped
+    long keysDropped;
+} throttle_t;
+
+static int rate = 0; // inputs per second; 0 for no limit
+
+static double now(void);
+
+void throttle_set_rate(int perSecond)
+{
+    rate = perSecond;
+}
+
+int throttle_get_rate(void)
+{
+    return rate;
+}
+
+throttle_t *throttle_new(arena_t *arena)
+{
+    throttle_t *throttle = mem_assert(arena_alloc(arena, sizeof(throttle_t)), "Error allocating space for throttle");
+    throttle->arena = arena;
+    throttle_reset(throttle);
+    return throttle;
+}
+
+void throttle_reset(throttle_t *throttle)
+{
+    throttle->tokens = rate; // one second's worth
+    throttle->refilled = rate > 0 ? now() : 0;
+    throttle->accepted = throttle->keys = 0;
+    throttle->dropped = throttle->keysDropped = 0;
+}
+
+void throttle_hand_over(throttle_t *throttle)
+{
+    throttle->accepted = throttle->keys = 0;
+    throttle->dropped = throttle->keysDropped = 0;
+}
+
+bool throttle_allow(throttle_t *throttle, int cost)
+{
+    if (rate > 0)
+    {
+        double when = now();
+        throttle->tokens += (when - throttle->refilled) * rate;
+        if (throttle->tokens > rate)
+        {
+            throttle->tokens = rate;
+        }
+        throttle->refilled = when;
+        if (throttle->tokens <= 0)
+        {
+            throttle->dropped++;
+            throttle->keysDropped += cost;
+            return false;
+        }
+        throttle->tokens -= cost;
+    }
+    throttle->accepted++;
+    throttle->keys += cost;
+    return true;
+}
+
+void throttle_merge(throttle_t *total, const throttle_t *throttle)
+{
+    total->accepted += throttle->accepted;
+    total->keys += throttle->keys;
+    total->dropped += throttle->dropped;
+    total->keysDropped += throttle->keysDropped;
+}
+
+void throttle_report(throttle_t *throttle, FILE *fp, const char *label)
+{
+    fprintf(fp, "%-12s accepted %6ld (%6ld keys), dropped %6ld (%6ld keys)\n", label,
+            throttle->accepted, throttle->keys, throttle->dropped, throttle->keysDropped);
+}
+
+void throttle_delete(throttle_t *throttle)
+{
+    if (throttle != NULL)
+    {
+        arena_free(throttle->arena, throttle);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,106 @@
+/*
+ * throttle.h - header file for 'throttle' module
+ *
+ * A throttle limits how much input the server accepts from one client, so that no client,
+ * abusive or buggy, can keep the single-threaded server busy at everyone else's expense.
+ * Each throttle is a token bucket: it earns tokens at a fixed rate, up to one second's worth,
+ * and every keystroke (or other message) a client sends spends one. Input that arrives while
+ * the bucket is empty is dropped and counted. The rate is the same for every throttle and is set
+ * once, at server startup; a rate of 0 turns throttling off.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/**************** global types ****************/
+typedef struct throttle throttle_t;
+
+/**************** functions ****************/
+
+/***************** throttle_set_rate *****************/
+/* Set how many inputs per second every throttle lets through.
+ *
+ * Caller provides:
+ *   the rate; 0 for no limit.
+ * Notes:
+ *   meant to be called once, at startup, before any throttle is created.
+ */
+void throttle_set_rate(int perSecond);
+
+/***************** throttle_get_rate *****************/
+/* Return the number of inputs per second every throttle lets through, or 0 if there is no limit. */
+int throttle_get_rate(void);
+
+/***************** throttle_new *****************/
+/* Create a throttle with a full bucket.
+ *
+ * Caller provides:
+ *   the arena to allocate it in, or NULL for malloc.
+ * We guarantee:
+ *   a new throttle is returned; we exit with an error if memory allocation fails.
+ * Notes:
+ *   the caller must call throttle_delete to free one made with malloc; one made in an arena goes with it.
+ */
+throttle_t *throttle_new(arena_t *arena);
+
+/***************** throttle_reset *****************/
+/* Give a throttle to a new client: refill its bucket and zero its counts.
+ *
+ * Caller provides:
+ *   a valid throttle.
+ */
+void throttle_reset(throttle_t *throttle);
+
+/***************** throttle_hand_over *****************/
+/* Give a throttle to a new client as it is: its bucket stays, debt and all; only its counts are zeroed.
+ *
+ * Caller provides:
+ *   a valid throttle.
+ * Notes:
+ *   for a throttle taken from another client, so that clients handed the same throttle in turn
+ *   share one bucket between them instead of each getting a fresh second's worth.
+ */
+void throttle_hand_over(throttle_t *throttle);
+
+/***************** throttle_allow *****************/
+/* Decide whether to accept an input.
+ *
+ * Caller provides:
+ *   a valid throttle, and the cost of the input: the number of keystrokes it carries, or 1.
+ * We guarantee:
+ *   returns true, and takes the cost from the bucket, if the bucket is not empty;
+ *   otherwise returns false and counts the input as dropped.
+ * Notes:
+ *   an input that costs more than what is left still goes through, leaving the bucket in debt,
+ *   so a batch of keys is never starved; the debt is paid off before anything else is accepted.
+ */
+bool throttle_allow(throttle_t *throttle, int cost);
+
+/***************** throttle_merge *****************/
+/* Add the counts of one throttle to another's, to report several as one; neither bucket changes.
+ *
+ * Caller provides:
+ *   two valid throttles: the one to add to, and the one to add.
+ */
+void throttle_merge(throttle_t *total, const throttle_t *throttle);
+
+/***************** throttle_report *****************/
+/* Print how many inputs (and keystrokes) the throttle accepted and dropped, on one line after a label.
+ *
+ * Caller provides:
+ *   a valid throttle, an open file, and a label naming the client.
+ */
+void throttle_report(throttle_t *throttle, FILE *fp, const char *label);
+
+/***************** throttle_delete *****************/
+/* Free a throttle; NULL is ignored, as is a throttle in an arena. */
+void throttle_delete(throttle_t *throttle);
+
+#endif // THROTTLE_H
@@ -0,0 +1,149 @@
+/*
+ * tiles.c - 'tiles' module
+ *
+ * See tiles.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+#include "arena.h"
+#include "tiles.h"
+
+typedef struct tiles
+{
+    arena_t *arena; // where the layer and its tiles live; NULL for malloc
+    int nrows;
+    int ncols;
+    int tileCols;  // tiles across a row of the map
+    int tileCount; // tiles the layer would take if it were dense
+    size_t size;   // bytes per value
+    char **tiles;  // tileCount slots, row-major; NULL until the tile is first touched
+    char *fill;    // a row of a tile, holding nothing but the fill value; every untouched tile reads from it
+    int allocated; // tiles allocated
+    char *spare;   // in an arena, tiles given up by tiles_clear, each holding a pointer to the next
+} tiles_t;
+
+static const size_t TileCells = TILES_SIDE * TILES_SIDE;
+
+/* Byte offset of cell (i, j) within its tile. */
+#define TILE_OFFSET(tiles, i, j) (((size_t)((i) & (TILES_SIDE - 1)) * TILES_SIDE + ((j) & (TILES_SIDE - 1))) * (tiles)->size)
+/* Slot of the tile holding cell (i, j). */
+#define TILE_SLOT(tiles, i, j) (((i) >> TILES_SHIFT) * (tiles)->tileCols + ((j) >> TILES_SHIFT))
+
+tiles_t *tiles_new(arena_t *arena, int nrows, int ncols, size_t size, const void *fill)
+{
+    tiles_t *tiles = mem_assert(arena_alloc(arena, sizeof(tiles_t)), "Error allocating space for tiles\n");
+    tiles->arena = arena;
+    tiles->nrows = nrows;
+    tiles->ncols = ncols;
+    tiles->tileCols = (ncols + TILES_SIDE - 1) >> TILES_SHIFT;
+    tiles->tileCount = ((nrows + TILES_SIDE - 1) >> TILES_SHIFT) * tiles->tileCols;
+    tiles->size = size;
+    tiles->tiles = mem_assert(arena_calloc(arena, tiles->tileCount > 0 ? tiles->tileCount : 1, sizeof(char *)), "Error allocating space for tile index\n");
+    tiles->fill = mem_assert(arena_alloc(arena, TILES_SIDE * size), "Error allocating space for fill row\n");
+    for (int j = 0; j < TILES_SIDE; j++)
+    {
+        memcpy(tiles->fill + j * size, fill, size);
+    }
+    tiles->allocated = 0;
+    tiles->spare = NULL;
+    return tiles;
+}
+
+const void *tiles_get(const tiles_t *tiles, int i, int j)
+{
+    const char *tile = tiles->tiles[TILE_SLOT(tiles, i, j)];
+    return tile != NULL ? tile + TILE_OFFSET(tiles, i, j) : tiles->fill;
+}
+
+void *tiles_touch(tiles_t *tiles, int i, int j)
+{
+    char **slot = &tiles->tiles[TILE_SLOT(tiles, i, j)];
+    if (*slot == NULL)
+    {
+        if (tiles->spare != NULL)
+        {
+            *slot = tiles->spare;
+            memcpy(&tiles->spare, *slot, sizeof(char *));
+        }
+        else
+        {
+            *slot = mem_assert(arena_alloc(tiles->arena, TileCells * tiles->size), "Error allocating space for tile\n");
+        }
+        for (int row = 0; row < TILES_SIDE; row++)
+        {
+            memcpy(*slot + row * TILES_SIDE * tiles->size, tiles->fill, TILES_SIDE * tiles->size);
+        }
+        tiles->allocated++;
+    }
+    return *slot + TILE_OFFSET(tiles, i, j);
+}
+
+void tiles_copy_row(const tiles_t *tiles, int i, int j, int n, void *out)
+{
+    char *to = out;
+    while (n > 0)
+    {
+        // the run of cells up to the end of this tile
+        int run = TILES_SIDE - (j & (TILES_SIDE - 1));
+        run = run < n ? run : n;
+        memcpy(to, tiles_get(tiles, i, j), run * tiles->size);
+        to += run * tiles->size;
+        j += run;
+        n -= run;
+    }
+}
+
+void tiles_clear(tiles_t *tiles)
+{
+    for (int k = 0; k < tiles->tileCount && tiles->allocated > 0; k++)
+    {
+        if (tiles->tiles[k] != NULL)
+        {
+            if (tiles->arena != NULL)
+            {
+                // an arena cannot take the tile back, so the layer keeps it for its next tiles_touch
+                memcpy(tiles->tiles[k], &tiles->spare, sizeof(char *));
+                tiles->spare = tiles->tiles[k];
+            }
+            else
+            {
+                free(tiles->tiles[k]);
+            }
+            tiles->tiles[k] = NULL;
+            tiles->allocated--;
+        }
+    }
+}
+
+int tiles_count(const tiles_t *tiles, int *total)
+{
+    if (total != NULL)
+    {
+        *total = tiles->tileCount;
+    }
+    return tiles->allocated;
+}
+
+size_t tiles_bytes(const tiles_t *tiles)
+{
+    return sizeof(tiles_t) + tiles->tileCount * sizeof(char *) + (tiles->allocated * TileCells + TILES_SIDE) * tiles->size;
+}
+
+void tiles_delete(tiles_t *tiles)
+{
+    if (tiles != NULL)
+    {
+        if (tiles->arena == NULL)
+        {
+            tiles_clear(tiles);
+            free(tiles->tiles);
+            free(tiles->fill);
+            free(tiles);
+        }
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * tiles.h - header file for 'tiles' module
+ *
+ * A tiled layer stores one value per cell of the map, in square tiles of TILES_SIDE x TILES_SIDE
+ * cells that are only allocated when a cell in them is first written. Every tile never written
+ * reads as the layer's fill value, from a single shared row of fill values, so a layer costs memory only
+ * where something happened: a player's sight only where they have looked, gold only where it lies.
+ * Tiles take TILES_SIDE cells on a side even at the map's edges, so a small map costs a little more than it
+ * would stored densely.
+ * Values are fixed-size (a char, an int, ...), and are read and written through pointers.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/**************** constants ****************/
+#define TILES_SHIFT 5
+#define TILES_SIDE (1 << TILES_SHIFT) // cells along each side of a tile
+
+/**************** global types ****************/
+typedef struct tiles tiles_t;
+
+/**************** functions ****************/
+
+/***************** tiles_new *****************/
+/* Create a layer of nrows x ncols cells, every one of them holding the fill value.
+ *
+ * Caller provides:
+ *   the arena to allocate the layer and its tiles in, or NULL for malloc;
+ *   the map's dimensions, the size of one value in bytes, and the fill value (which is copied).
+ * We guarantee:
+ *   a new layer is returned; no tile is allocated yet.
+ *   we exit with an error if memory allocation fails.
+ * Notes:
+ *   the caller must call tiles_delete to free a layer made with malloc; one made in an arena goes with it.
+ */
+tiles_t *tiles_new(arena_t *arena, int nrows, int ncols, size_t size, const void *fill);
+
+/***************** tiles_get *****************/
+/* Return a pointer to the value of cell (i, j), for reading only.
+ *
+ * Caller provides:
+ *   a valid layer and a cell inside it.
+ * Notes:
+ *   never allocates; a cell in a tile never written points at the shared fill value,
+ *   which must not be written through. The pointer is good until the next tiles_touch or tiles_clear.
+ */
+const void *tiles_get(const tiles_t *tiles, int i, int j);
+
+/***************** tiles_touch *****************/
+/* Return a pointer to the value of cell (i, j), for reading and writing.
+ *
+ * Caller provides:
+ *   a valid layer and a cell inside it.
+ * We guarantee:
+ *   the cell's tile is allocated, filled with the fill value, if it was not already.
+ * Notes:
+ *   only call this to write; reading through tiles_get keeps untouched tiles shared.
+ */
+void *tiles_touch(tiles_t *tiles, int i, int j);
+
+/***************** tiles_copy_row *****************/
+/* Copy n values of row i, starting at column j, into out.
+ *
+ * Caller provides:
+ *   a valid layer, a run of cells inside it, and room for n values in out.
+ */
+void tiles_copy_row(const tiles_t *tiles, int i, int j, int n, void *out);
+
+/***************** tiles_clear *****************/
+/* Free every tile, so that every cell holds the fill value again.
+ * In an arena the tiles cannot be freed; the layer keeps them, to reuse before it allocates any more.
+ */
+void tiles_clear(tiles_t *tiles);
+
+/***************** tiles_count *****************/
+/* Return the number of tiles allocated so far, out of the number the layer would take if it were dense.
+ *
+ * Caller provides:
+ *   a valid layer, and where to put the dense count (may be NULL).
+ */
+int tiles_count(const tiles_t *tiles, int *total);
+
+/***************** tiles_bytes *****************/
+/* Return the bytes the layer holds: its tiles, the fill values and the tile index. */
+size_t tiles_bytes(const tiles_t *tiles);
+
+/***************** tiles_delete *****************/
+/* Free a layer and all its tiles; NULL is ignored, as is a layer in an arena. */
+void tiles_delete(tiles_t *tiles);
+
+#endif // TILES_H
@@ -0,0 +1,179 @@
+/*
+ * visbench.c - benchmark for the visibility engines and ray kernels
+ *
+ * For each map given on the command line, computes visibility from every spot
+ * ('.' or '#') with the raycast engine on each ray kernel, and with the shadowcast
+ * engine, and prints the time per spot and the speedup over the scalar kernel.
+ * Before timing, it checks that the AVX2 kernel returns exactly the bits of the
+ * scalar kernel for every line of sight tested from each spot.
+ * With -s, only that many spots, drawn at random (the same ones each run), are
+ * checked and timed, so that very large maps (see mapgen.c) take seconds, not hours.
+ *
+ * Usage: ./visbench [-r radius] [-s spots] map.txt...
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "grid.h"
+#include "mem.h"
+#include "visibility.h"
+#include "raykernel.h"
+#include "tiles.h"
+
+static double time_engine(grid_t* grid, visengine_t engine, int radius, tiles_t* vis, const int* spots, int nspots);
+static long check_kernels(grid_t* grid, const int* spots, int nspots);
+static int pick_spots(grid_t* grid, int samples, int** spots);
+static void bench_map(const char* path, int radius, int samples);
+static double now(void);
+
+int main(int argc, char* argv[]) {
+    int radius = 0;
+    int samples = 0;
+    int first = 1;
+    while (first + 1 < argc && (strcmp(argv[first], "-r") == 0 || strcmp(argv[first], "-s") == 0)) {
+        *(argv[first][1] == 'r' ? &radius : &samples) = atoi(argv[first + 1]);
+        first += 2;
+    }
+    if (first >= argc) {
+        printf("Usage: %s [-r radius] [-s spots] map.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool avx2 = raykernel_select(RAYKERNEL_AVX2);
+    raykernel_select(RAYKERNEL_AUTO);
+    printf("%-44s %7s %6s %12s %12s %12s %8s\n", "map", "spots", "diffs",
+           "scalar us", avx2 ? "avx2 us" : "(no avx2)", "shadow us", "speedup");
+    for (int k = first; k < argc; k++) {
+        bench_map(argv[k], radius, samples);
+    }
+    return EXIT_SUCCESS;
+}
+
+static void bench_map(const char* path, int radius, int samples) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return;
+    }
+    grid_t* grid = grid_load(file);
+    fclose(file);
+    int nr = grid_getnrows(grid);
+    unsigned char unseen = 0;
+    tiles_t* vis = tiles_new(NULL, nr, grid_getncols(grid), sizeof(unsigned char), &unseen);
+
+    int* list;
+    int spots = pick_spots(grid, samples, &list);
+    long diffs = check_kernels(grid, list, spots);
+
+    raykernel_select(RAYKERNEL_SCALAR);
+    double scalar = time_engine(grid, VIS_RAYCAST, radius, vis, list, spots);
+    double avx2 = 0;
+    if (raykernel_select(RAYKERNEL_AVX2)) {
+        avx2 = time_engine(grid, VIS_RAYCAST, radius, vis, list, spots);
+    }
+    raykernel_select(RAYKERNEL_AUTO);
+    double shadow = time_engine(grid, VIS_SHADOWCAST, radius, vis, list, spots);
+
+    double per = spots > 0 ? 1e6 / spots : 0;
+    printf("%-44s %7d %6ld %12.2f %12.2f %12.2f %7.2fx\n", path, spots, diffs,
+           scalar * per, avx2 * per, shadow * per, avx2 > 0 ? scalar / avx2 : 0.0);
+
+    tiles_delete(vis);
+    free(list);
+    grid_delete(grid);
+}
+
+/* the spots ('.' or '#') to measure, as indices (row * ncols + col): every one, in order,
+ * or, if samples > 0, that many drawn at random; returns how many */
+static int pick_spots(grid_t* grid, int samples, int** spots) {
+    int nr = grid_getnrows(grid);
+    int nc = grid_getncols(grid);
+    char** map = grid_getcells(grid);
+    int count = 0;
+    for (int i = 0; i < nr; i++) {
+        for (int j = 0; j < nc; j++) {
+            count += (map[i][j] == '.' || map[i][j] == '#');
+        }
+    }
+    int n = samples > 0 && samples < count ? samples : count;
+    *spots = mem_assert(malloc((n > 0 ? n : 1) * sizeof(int)), "Error allocating spots");
+    if (n == count) {
+        int k = 0;
+        for (int i = 0; i < nr; i++) {
+            for (int j = 0; j < nc; j++) {
+                if (map[i][j] == '.' || map[i][j] == '#') {
+                    (*spots)[k++] = i * nc + j;
+                }
+            }
+        }
+        return n;
+    }
+    srand(1);
+    for (int k = 0; k < n; k++) {
+        int i, j;
+        do {
+            i = rand() % nr;
+            j = rand() % nc;
+        } while (map[i][j] != '.' && map[i][j] != '#');
+        (*spots)[k] = i * nc + j;
+    }
+    return n;
+}
+
+/* seconds to compute visibility from each of the spots */
+static double time_engine(grid_t* grid, visengine_t engine, int radius, tiles_t* vis, const int* spots, int nspots) {
+    int nc = grid_getncols(grid);
+    double start = now();
+    for (int k = 0; k < nspots; k++) {
+        tiles_clear(vis);
+        visibility_compute(engine, radius, grid_getvismap(grid), spots[k] / nc, spots[k] % nc, vis, NULL, NULL, NULL);
+    }
+    return now() - start;
+}
+
+/* number of batches, over the room spots among the spots and all targets, where the kernels disagree */
+static long check_kernels(grid_t* grid, const int* spots, int nspots) {
+    int nr = grid_getnrows(grid);
+    int nc = grid_getncols(grid);
+    char** map = grid_getcells(grid);
+    unsigned char* floor = mem_assert(calloc((size_t)nr * nc + RAYKERNEL_PADDING, 1), "Error allocating floor");
+    for (int i = 0; i < nr; i++) {
+        for (int j = 0; j < nc; j++) {
+            floor[i * nc + j] = (map[i][j] == '.');
+        }
+    }
+    long diffs = 0;
+    for (int k = 0; k < nspots; k++) {
+        int x = spots[k] / nc;
+        int y = spots[k] % nc;
+        if (map[x][y] != '.') {
+            continue;
+        }
+        for (int i = 0; i < nr; i++) {
+            for (int j = 0; j < nc; j += RAYKERNEL_LANES) {
+                int n = nc - j < RAYKERNEL_LANES ? nc - j : RAYKERNEL_LANES;
+                unsigned s = raykernel_batch_with(RAYKERNEL_SCALAR, floor, nc, x, y, i, j, n);
+                unsigned v = raykernel_batch_with(RAYKERNEL_AVX2, floor, nc, x, y, i, j, n);
+                if (s != v) {
+                    diffs++;
+                    if (diffs <= 5) {
+                        printf("kernels differ from (%d, %d) to row %d, columns %d..%d: scalar %02x, avx2 %02x\n",
+                               x, y, i, j, j + n - 1, s, v);
+                    }
+                }
+            }
+        }
+    }
+    free(floor);
+    return diffs;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
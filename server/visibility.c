@@ -0,0 +1,391 @@
+/*
+ * visibility.c - 'visibility' module
+ *
+ * see visibility.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "visibility.h"
+#include "mem.h"
+#include "raykernel.h"
+#include "tiles.h"
+#include "arena.h"
+
+/**************** global types ****************/
+typedef struct vismap
+{
+	arena_t *arena; // where the vismap lives; NULL for malloc
+	char **map;
+	int nrows;
+	int ncols;
+	unsigned char *floor; // nrows * ncols bytes, non-zero where the map has room floor ('.')
+} vismap_t;
+
+/**************** file-local types ****************/
+typedef struct viewer
+{
+	const unsigned char *floor;
+	char **map;
+	int nrows;
+	int ncols;
+	int x;
+	int y;
+	tiles_t *vis;
+	arena_t *arena; // where visible grows
+	int **visible; // grows as cells are recorded
+	int *visibleSize;
+	int count;
+	int radius;	  // zero if unlimited
+	bool passage; // '#' cells are only visible when adjacent to (x, y)
+} viewer_t;
+
+typedef struct slope
+{
+	int num;
+	int den; // always positive
+} slope_t;
+
+/* the eight octants, as (xx, xy, yx, yy) transforms from (depth, col) to (row, column) offsets */
+static const int octants[8][4] = {
+	{1, 0, 0, 1}, {1, 0, 0, -1}, {-1, 0, 0, 1}, {-1, 0, 0, -1},
+	{0, 1, 1, 0}, {0, 1, -1, 0}, {0, -1, 1, 0}, {0, -1, -1, 0}};
+
+static visengine_t currentEngine = VIS_RAYCAST;
+static int currentRadius = 0;
+
+static void visibility_raycast(viewer_t *v);
+static void visibility_shadowcast(viewer_t *v);
+static void shadowcast_scan(viewer_t *v, const int *oct, int depth, slope_t start, slope_t end);
+static void mark(viewer_t *v, int i, int j);
+static bool in_range(viewer_t *v, int di, int dj);
+static int passage_neighbors(viewer_t *v);
+static int floor_div(int a, int b);
+static int ceil_div(int a, int b);
+static int min(int a, int b);
+static int max(int a, int b);
+
+void visibility_set_engine(visengine_t engine)
+{
+	currentEngine = engine;
+}
+
+visengine_t visibility_get_engine(void)
+{
+	return currentEngine;
+}
+
+void visibility_set_radius(int radius)
+{
+	currentRadius = radius > 0 ? radius : 0;
+}
+
+int visibility_get_radius(void)
+{
+	return currentRadius;
+}
+
+vismap_t *visibility_map_new(arena_t *arena, char **map, int nrows, int ncols)
+{
+	vismap_t *vm = (vismap_t *)mem_assert(arena_alloc(arena, sizeof(vismap_t)), "Error allocating space for vismap\n");
+	vm->arena = arena;
+	vm->map = map;
+	vm->nrows = nrows;
+	vm->ncols = ncols;
+	vm->floor = (unsigned char *)mem_assert(arena_calloc(arena, (size_t)nrows * ncols + RAYKERNEL_PADDING, 1), "Error allocating floor layer\n");
+	for (int i = 0; i < nrows; i++)
+	{
+		for (int j = 0; j < ncols; j++)
+		{
+			vm->floor[i * ncols + j] = (map[i][j] == '.');
+		}
+	}
+	return vm;
+}
+
+void visibility_map_delete(vismap_t *vm)
+{
+	if (vm != NULL)
+	{
+		arena_free(vm->arena, vm->floor);
+		arena_free(vm->arena, vm);
+	}
+}
+
+bool visibility_parse_engine(const char *name, visengine_t *engine)
+{
+	if (name == NULL || engine == NULL)
+	{
+		return false;
+	}
+	if (strcmp(name, "raycast") == 0)
+	{
+		*engine = VIS_RAYCAST;
+		return true;
+	}
+	if (strcmp(name, "shadowcast") == 0)
+	{
+		*engine = VIS_SHADOWCAST;
+		return true;
+	}
+	return false;
+}
+
+const char *visibility_engine_name(visengine_t engine)
+{
+	return engine == VIS_SHADOWCAST ? "shadowcast" : "raycast";
+}
+
+int visibility_compute(visengine_t engine, int radius, const vismap_t *vm,
+					   int x, int y, tiles_t *vis, arena_t *arena, int **visible, int *visibleSize)
+{
+	char **map = vm->map;
+	int nrows = vm->nrows;
+	int ncols = vm->ncols;
+	viewer_t v = {vm->floor, map, nrows, ncols, x, y, vis, arena, visible, visibleSize, 0, radius > 0 ? radius : 0, false};
+	if (map[x][y] == '#')
+	{
+		if (passage_neighbors(&v) != 1)
+		{
+			// inside a passage only the spot itself and the adjoining passage are visible
+			mark(&v, x, y);
+			for (int d = -1; d <= 1; d = d + 2)
+			{
+				if (0 <= x + d && x + d < nrows && map[x + d][y] == '#')
+				{
+					mark(&v, x + d, y);
+				}
+				if (0 <= y + d && y + d < ncols && map[x][y + d] == '#')
+				{
+					mark(&v, x, y + d);
+				}
+			}
+			return v.count;
+		}
+		v.passage = true; // at the end of a passage, looking out into a room
+	}
+	else if (map[x][y] != '.')
+	{
+		return 0;
+	}
+
+	if (engine == VIS_SHADOWCAST)
+	{
+		visibility_shadowcast(&v);
+	}
+	else
+	{
+		visibility_raycast(&v);
+	}
+	return v.count;
+}
+
+/**************** visibility_raycast ****************/
+/* The original engine: test a line of sight from (x, y) to every cell of the map,
+ * or of the window around the sight disc if there is a radius.
+ * A line is blocked when, at some row (column) strictly between the two ends,
+ * neither of the cells it passes between is room floor ('.'); see raykernel.h.
+ * From the end of a passage the test is stricter, and coarser: the line's slope is
+ * truncated to an integer, and the one cell it then passes through must be floor.
+ */
+static void visibility_raycast(viewer_t *v)
+{
+	int x = v->x;
+	int y = v->y;
+	char **map = v->map;
+	int imin = 0, imax = v->nrows - 1;
+	int jmin = 0, jmax = v->ncols - 1;
+	if (v->radius > 0)
+	{
+		imin = max(imin, x - v->radius);
+		imax = min(imax, x + v->radius);
+		jmin = max(jmin, y - v->radius);
+		jmax = min(jmax, y + v->radius);
+	}
+	for (int i = imin; i <= imax; i++)
+	{
+		if (!v->passage)
+		{
+			// room floor: lines of sight are tested in batches along the row
+			for (int j = jmin; j <= jmax; j += RAYKERNEL_LANES)
+			{
+				int n = min(RAYKERNEL_LANES, jmax - j + 1);
+				unsigned mask = raykernel_batch(v->floor, v->ncols, x, y, i, j, n);
+				for (int k = 0; k < n; k++)
+				{
+					if ((mask & (1u << k)) && in_range(v, i - x, j + k - y))
+					{
+						mark(v, i, j + k);
+					}
+				}
+			}
+			continue;
+		}
+		for (int j = jmin; j <= jmax; j++)
+		{
+			if (!in_range(v, i - x, j - y))
+			{
+				continue;
+			}
+			bool visible = true;
+			if (map[i][j] == '#')
+			{
+				visible = (abs(x - i) + abs(y - j) <= 1); // only adjacent hashes are shown
+			}
+			else
+			{
+				for (int dx = min(x, i) + 1; dx < max(x, i); dx++)
+				{
+					int cy = y + (y - j) / (x - i) * (dx - x);
+					if (map[dx][cy] != '.')
+					{
+						visible = false;
+						break;
+					}
+				}
+				for (int dy = min(y, j) + 1; visible && dy < max(y, j); dy++)
+				{
+					int cx = x + (x - i) / (y - j) * (dy - y);
+					if (map[cx][dy] != '.')
+					{
+						visible = false;
+						break;
+					}
+				}
+			}
+			if (visible)
+			{
+				mark(v, i, j);
+			}
+		}
+	}
+}
+
+/**************** visibility_shadowcast ****************/
+/* Symmetric shadowcasting: scan each octant row by row, outward from (x, y),
+ * narrowing the beam of slopes [start, end] at every opaque cell.
+ * Any cell other than room floor ('.') is opaque. Opaque cells are visible if
+ * any part of them lies in the beam; floor cells only if their centre does,
+ * which makes the relation symmetric between two floor cells.
+ * Slopes are kept as exact fractions, so no floating point is involved.
+ * With a radius, scanning stops at the row of that depth.
+ */
+static void visibility_shadowcast(viewer_t *v)
+{
+	slope_t start = {0, 1};
+	slope_t end = {1, 1};
+	mark(v, v->x, v->y);
+	for (int k = 0; k < 8; k++)
+	{
+		shadowcast_scan(v, octants[k], 1, start, end);
+	}
+}
+
+static void shadowcast_scan(viewer_t *v, const int *oct, int depth, slope_t start, slope_t end)
+{
+	// columns whose centre lies within [start, end], with ties rounded outward
+	int mincol = floor_div(2 * depth * start.num + start.den, 2 * start.den);
+	int maxcol = ceil_div(2 * depth * end.num - end.den, 2 * end.den);
+	int prev = -1; // -1 before the first cell, otherwise whether the previous cell was opaque
+	for (int col = mincol; col <= maxcol; col++)
+	{
+		int i = v->x + depth * oct[0] + col * oct[1];
+		int j = v->y + depth * oct[2] + col * oct[3];
+		bool inside = (0 <= i && i < v->nrows && 0 <= j && j < v->ncols);
+		bool opaque = !inside || v->map[i][j] != '.';
+		if (inside && in_range(v, depth, col))
+		{
+			bool symmetric = col * start.den >= depth * start.num && col * end.den <= depth * end.num;
+			if (opaque || symmetric)
+			{
+				if (!v->passage || v->map[i][j] != '#' || abs(v->x - i) + abs(v->y - j) <= 1)
+				{
+					mark(v, i, j);
+				}
+			}
+		}
+		slope_t edge = {2 * col - 1, 2 * depth}; // slope of the cell's near edge
+		if (prev == 1 && !opaque)
+		{
+			start = edge;
+		}
+		if (prev == 0 && opaque && (v->radius == 0 || depth < v->radius))
+		{
+			shadowcast_scan(v, oct, depth + 1, start, edge);
+		}
+		prev = opaque;
+	}
+	if (prev == 0 && (v->radius == 0 || depth < v->radius))
+	{
+		shadowcast_scan(v, oct, depth + 1, start, end);
+	}
+}
+
+/**************** mark ****************/
+/* Mark cell (i, j) visible, recording it the first time it is seen. */
+static void mark(viewer_t *v, int i, int j)
+{
+	unsigned char *cell = tiles_touch(v->vis, i, j); // the cell's tile holds a visible cell either way
+	if (*cell != 1)
+	{
+		*cell = 1;
+		if (v->visible != NULL)
+		{
+			if (v->count == *v->visibleSize)
+			{
+				int size = *v->visibleSize == 0 ? 64 : 2 * *v->visibleSize;
+				*v->visible = (int *)mem_assert(arena_grow(v->arena, *v->visible, *v->visibleSize * sizeof(int), size * sizeof(int)), "Error allocating visible cell list\n");
+				*v->visibleSize = size;
+			}
+			(*v->visible)[v->count] = i * v->ncols + j;
+		}
+		v->count++;
+	}
+}
+
+/* is the offset (di, dj) within the sight radius? */
+static bool in_range(viewer_t *v, int di, int dj)
+{
+	return v->radius == 0 || di * di + dj * dj <= v->radius * v->radius;
+}
+
+/* number of passage cells orthogonally adjacent to (x, y) */
+static int passage_neighbors(viewer_t *v)
+{
+	int count = 0;
+	for (int d = -1; d <= 1; d = d + 2)
+	{
+		if (0 <= v->x + d && v->x + d < v->nrows && v->map[v->x + d][v->y] == '#')
+		{
+			count++;
+		}
+		if (0 <= v->y + d && v->y + d < v->ncols && v->map[v->x][v->y + d] == '#')
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+static int floor_div(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int ceil_div(int a, int b)
+{
+	return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+static int min(int a, int b)
+{
+	return a > b ? b : a;
+}
+
+static int max(int a, int b)
+{
+	return a > b ? a : b;
+}
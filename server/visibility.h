@@ -0,0 +1,126 @@
+/*
+ * visibility.h - header file for 'visibility' module
+ *
+ * The visibility module decides which cells of the map a player can see from a given spot.
+ * Two engines are provided: the original "raycast" engine, which tests a line of sight to
+ * every cell of the map (in batches; see raykernel.h), and a "shadowcast" engine, which uses symmetric recursive shadowcasting
+ * over the eight octants around the player and only touches the cells it can actually see.
+ * The engine, and optionally a sight radius, are selected once, at server startup.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "tiles.h"
+#include "arena.h"
+
+/**************** global types ****************/
+typedef struct vismap vismap_t; // opaque; the map as the engines read it
+
+typedef enum visengine {
+    VIS_RAYCAST,    // line of sight tested to every cell of the map
+    VIS_SHADOWCAST  // symmetric recursive shadowcasting over eight octants
+} visengine_t;
+
+/**************** functions ****************/
+
+/***************** visibility_map_new *****************/
+/* Prepare a map for the visibility engines.
+ *
+ * Caller provides:
+ *   the arena to allocate it in, or NULL for malloc; the map cells and their dimensions.
+ * We guarantee:
+ *   returns a new vismap that refers to (does not copy) the cells, along with
+ *   a flat floor layer derived from them.
+ * Notes:
+ *   the cells must outlive the vismap and must not change while it is in use.
+ *   the caller must call visibility_map_delete to free one made with malloc; one made in an arena goes with it.
+ */
+vismap_t* visibility_map_new(arena_t* arena, char** map, int nrows, int ncols);
+
+/***************** visibility_map_delete *****************/
+/* Free a vismap; the cells it refers to are untouched. NULL is ignored, as is a vismap in an arena.
+ */
+void visibility_map_delete(vismap_t* vm);
+
+/***************** visibility_set_engine *****************/
+/* Select the engine used by player_update_visibility.
+ *
+ * Caller provides:
+ *   one of the visengine_t values.
+ * We guarantee:
+ *   all later visibility updates use that engine.
+ * Notes:
+ *   the default engine is VIS_RAYCAST.
+ */
+void visibility_set_engine(visengine_t engine);
+
+/***************** visibility_get_engine *****************/
+/* Return the currently selected engine.
+ */
+visengine_t visibility_get_engine(void);
+
+/***************** visibility_parse_engine *****************/
+/* Translate an engine name into a visengine_t.
+ *
+ * Caller provides:
+ *   a name, either "raycast" or "shadowcast", and a pointer to fill in.
+ * We guarantee:
+ *   returns true and fills in *engine if the name is known.
+ *   returns false, and leaves *engine unchanged, otherwise.
+ */
+bool visibility_parse_engine(const char* name, visengine_t* engine);
+
+/***************** visibility_engine_name *****************/
+/* Return the printable name of an engine, e.g., for logging.
+ */
+const char* visibility_engine_name(visengine_t engine);
+
+/***************** visibility_set_radius *****************/
+/* Limit sight to a disc of the given radius around the player.
+ *
+ * Caller provides:
+ *   a radius in cells; zero means unlimited.
+ * We guarantee:
+ *   all later visibility updates by player_update_visibility use that radius.
+ * Notes:
+ *   the default is unlimited. Negative radii are treated as unlimited.
+ */
+void visibility_set_radius(int radius);
+
+/***************** visibility_get_radius *****************/
+/* Return the current sight radius; zero means unlimited.
+ */
+int visibility_get_radius(void);
+
+/***************** visibility_compute *****************/
+/* Mark every cell visible from spot (x, y) with the given engine.
+ *
+ * Caller provides:
+ *   an engine, a sight radius (zero for unlimited), a vismap, a spot (x, y) within the map,
+ *   a tiled layer of unsigned char of the map's dimensions, and an array of *visibleSize ints
+ *   allocated in arena (or with malloc, if arena is NULL) to collect the visible cells
+ *   (visible may be NULL; *visible may be NULL if the size is 0).
+ * We guarantee:
+ *   every visible cell whose value in vis is not already 1 is set to 1, and
+ *   its index (i * ncols + j) is appended to *visible, which is grown (and *visibleSize updated) as needed.
+ *   returns the number of indices appended.
+ * Notes:
+ *   cells already marked 1 are neither appended nor counted, so callers that
+ *   want the complete set should first demote their previous visible cells.
+ *   only the tiles of vis that hold a visible cell are allocated.
+ *   both engines share the rules for passages; they differ only in how
+ *   lines of sight are tested inside rooms.
+ *   with a radius, only cells within that Euclidean distance of (x, y) are
+ *   visible, and neither engine looks outside the square window around that
+ *   disc, so the cost no longer depends on the size of the map.
+ */
+int visibility_compute(visengine_t engine, int radius, const vismap_t* vm,
+                       int x, int y, tiles_t* vis, arena_t* arena, int** visible, int* visibleSize);
+
+#endif //__VISIBILITY_H
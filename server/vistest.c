@@ -0,0 +1,125 @@
+/*
+ * vistest.c - equivalence test for the visibility engines
+ *
+ * Runs the raycast and shadowcast engines from every spot ('.' or '#') of each
+ * map given on the command line and reports the cells where they disagree.
+ * Disagreements are expected: the engines use different line-of-sight rules,
+ * and this report is how those differences get reviewed.
+ *
+ * Usage: ./vistest [-v] [-r radius] map.txt...
+ *   -v lists every disagreeing cell, not just the count for each spot.
+ *   -r compares the engines with the given sight radius (default unlimited).
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "grid.h"
+#include "mem.h"
+#include "visibility.h"
+#include "tiles.h"
+
+static bool seen(const tiles_t* vis, int i, int j);
+static void compare_map(const char* path, bool verbose, int radius);
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    int radius = 0;
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "-v") == 0) {
+            verbose = true;
+            first++;
+        } else if (strcmp(argv[first], "-r") == 0 && first + 1 < argc) {
+            radius = atoi(argv[first + 1]);
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    if (first >= argc) {
+        printf("Usage: %s [-v] [-r radius] map.txt...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int k = first; k < argc; k++) {
+        compare_map(argv[k], verbose, radius);
+    }
+    return EXIT_SUCCESS;
+}
+
+static void compare_map(const char* path, bool verbose, int radius) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return;
+    }
+    grid_t* grid = grid_load(file);
+    fclose(file);
+
+    int nr = grid_getnrows(grid);
+    int nc = grid_getncols(grid);
+    char** map = grid_getcells(grid);
+    unsigned char unseen = 0;
+    tiles_t* ray = tiles_new(NULL, nr, nc, sizeof(unsigned char), &unseen);
+    tiles_t* shadow = tiles_new(NULL, nr, nc, sizeof(unsigned char), &unseen);
+
+    int spots = 0;
+    int disagreeing = 0;
+    long rayOnly = 0;
+    long shadowOnly = 0;
+    for (int x = 0; x < nr; x++) {
+        for (int y = 0; y < nc; y++) {
+            if (map[x][y] != '.' && map[x][y] != '#') {
+                continue;
+            }
+            spots++;
+            tiles_clear(ray);
+            tiles_clear(shadow);
+            visibility_compute(VIS_RAYCAST, radius, grid_getvismap(grid), x, y, ray, NULL, NULL, NULL);
+            visibility_compute(VIS_SHADOWCAST, radius, grid_getvismap(grid), x, y, shadow, NULL, NULL, NULL);
+
+            int r = 0;
+            int s = 0;
+            for (int i = 0; i < nr; i++) {
+                for (int j = 0; j < nc; j++) {
+                    if (seen(ray, i, j) != seen(shadow, i, j)) {
+                        if (seen(ray, i, j)) {
+                            r++;
+                        } else {
+                            s++;
+                        }
+                    }
+                }
+            }
+            if (r + s == 0) {
+                continue;
+            }
+            disagreeing++;
+            rayOnly += r;
+            shadowOnly += s;
+            printf("%s: from (%d, %d) '%c': %d raycast-only, %d shadowcast-only\n", path, x, y, map[x][y], r, s);
+            if (verbose) {
+                for (int i = 0; i < nr; i++) {
+                    for (int j = 0; j < nc; j++) {
+                        if (seen(ray, i, j) != seen(shadow, i, j)) {
+                            printf("    (%d, %d) '%c' seen by %s only\n", i, j, map[i][j], seen(ray, i, j) ? "raycast" : "shadowcast");
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("%s: %d spots, %d with disagreements, %ld raycast-only cells, %ld shadowcast-only cells\n",
+           path, spots, disagreeing, rayOnly, shadowOnly);
+
+    tiles_delete(ray);
+    tiles_delete(shadow);
+    grid_delete(grid);
+}
+
+/* is cell (i, j) marked visible? */
+static bool seen(const tiles_t* vis, int i, int j) {
+    return *(const unsigned char*)tiles_get(vis, i, j) == 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * codec - a small, fast compressor for text frames
+ *
+ * See codec.h for the format and for the interface.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "codec.h"
+
+/**************** file-local constants ****************/
+static const int MinToken = 4;           // shortest run or copy worth a token
+static const int MaxToken = 4 + 0x3f;    // longest run or copy one token can hold
+static const size_t MaxDistance = 255 * 255; // farthest back a copy can reach
+#define HashBits 12                      // the hash table has 1 << HashBits entries
+
+/**************** hash ****************/
+/* Hash the four bytes at p (Knuth's multiplicative hash). */
+static inline unsigned int
+hash(const unsigned char* p)
+{
+  uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  return (v * 2654435761u) >> (32 - HashBits);
+}
+
+/**************** codec_bound ****************/
+size_t
+codec_bound(const size_t length)
+{
+  return length + 1;
+}
+
+/**************** codec_encode ****************/
+size_t
+codec_encode(const char* in, const size_t length, char* out)
+{
+  const unsigned char* src = (const unsigned char*)in;
+  unsigned char* dst = (unsigned char*)out;
+  size_t last[1 << HashBits];  // position after the latest 4 bytes with each hash
+  memset(last, 0, sizeof(last));
+  size_t i = 0;
+  while (i < length) {
+    if (src[i] == 0 || src[i] > 0x7f) {
+      return 0; // not 7-bit text
+    }
+
+    // a run of the same byte?
+    size_t run = 1;
+    while (i + run < length && src[i + run] == src[i] && run < MaxToken) {
+      run++;
+    }
+    if (run >= MinToken) {
+      *dst++ = 0x80 | (run - MinToken);
+      *dst++ = src[i];
+      i += run;
+      continue;
+    }
+
+    // a copy of something earlier?
+    if (i + MinToken <= length) {
+      unsigned int h = hash(src + i);
+      size_t candidate = last[h];  // 0 for none; else the position + 1
+      last[h] = i + 1;
+      if (candidate != 0 && i - (candidate - 1) <= MaxDistance
+          && memcmp(src + candidate - 1, src + i, MinToken) == 0) {
+        const unsigned char* from = src + candidate - 1;
+        size_t len = MinToken;
+        while (i + len < length && len < MaxToken && from[len] == src[i + len]) {
+          len++;
+        }
+        size_t distance = i - (candidate - 1) - 1;  // 0 .. MaxDistance-1
+        *dst++ = 0xc0 | (len - MinToken);
+        *dst++ = distance / 255 + 1;
+        *dst++ = distance % 255 + 1;
+        i += len;
+        continue;
+      }
+    }
+
+    // a literal
+    *dst++ = src[i++];
+  }
+  *dst = '\0';
+  return dst - (unsigned char*)out;
+}
+
+/**************** codec_decode ****************/
+size_t
+codec_decode(const char* in, const size_t length, char* out, const size_t capacity)
+{
+  const unsigned char* src = (const unsigned char*)in;
+  const unsigned char* end = src + length;
+  size_t n = 0;  // bytes written to out
+  while (src < end) {
+    unsigned char token = *src++;
+    if (token < 0x80) {
+      if (n + 1 >= capacity) {
+        return 0;
+      }
+      out[n++] = token;
+    } else if (token < 0xc0) {
+      size_t run = (token & 0x3f) + MinToken;
+      if (src == end || n + run >= capacity) {
+        return 0;
+      }
+      memset(out + n, *src++, run);
+      n += run;
+    } else {
+      size_t len = (token & 0x3f) + MinToken;
+      if (end - src < 2 || src[0] == 0 || src[1] == 0) {
+        return 0;
+      }
+      size_t distance = (size_t)(src[0] - 1) * 255 + (src[1] - 1) + 1;
+      src += 2;
+      if (distance > n || n + len >= capacity) {
+        return 0;
+      }
+      for (size_t k = 0; k < len; k++, n++) {
+        out[n] = out[n - distance]; // byte by byte: a copy may overlap itself
+      }
+    }
+  }
+  if (n >= capacity) {
+    return 0;
+  }
+  out[n] = '\0';
+  return n;
+}
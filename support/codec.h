@@ -0,0 +1,66 @@
+/*
+ * codec - a small, fast compressor for text frames
+ *
+ * Compresses text such as the map of a DISPLAY message, which is mostly
+ * runs of blanks and of '-', '|', '.', '#', and rows that repeat rows
+ * above them.  The format is a byte-oriented LZ77 with a run-length
+ * token, in the spirit of LZ4 but simpler:
+ *   a byte 0x01..0x7f          stands for itself;
+ *   10nnnnnn c                 is a run of (n + 4) copies of the byte c;
+ *   11nnnnnn h l               copies (n + 4) bytes from (h-1)*255 + l
+ *                              bytes back in the output, with h, l in 1..255.
+ * The input must be 7-bit text without NUL bytes; the output never contains
+ * a NUL byte either, so it can be sent and received as a C string, as the
+ * message module expects.
+ *
+ * Typical use, to send and to receive a frame:
+ *   char* packed = malloc(codec_bound(length));
+ *   size_t n = codec_encode(frame, length, packed); // 0: not text; send frame as is
+ *   ...
+ *   size_t m = codec_decode(packed, n, frame, capacity); // 0: malformed
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <stddef.h>
+
+/******************************************/
+/* codec_bound: the most bytes codec_encode can produce.
+ * Caller provides:
+ *   the length of the input.
+ * Function returns:
+ *   the size of output buffer codec_encode needs for such an input,
+ *   including the NUL byte it appends.
+ */
+size_t codec_bound(const size_t length);
+
+/******************************************/
+/* codec_encode: compress text.
+ * Caller provides:
+ *   the text to compress, and its length (excluding any NUL);
+ *   an output buffer of at least codec_bound(length) bytes.
+ * Function returns:
+ *   the length of the compressed text written to out, which is then
+ *   NUL-terminated; or 0 if the input holds a byte outside 0x01..0x7f,
+ *   in which case it cannot be encoded (and out is undefined).
+ * Notes:
+ *   Never longer than the input.  Runs in linear time, with a 4K-entry
+ *   hash table on the stack.
+ */
+size_t codec_encode(const char* in, const size_t length, char* out);
+
+/******************************************/
+/* codec_decode: decompress text produced by codec_encode.
+ * Caller provides:
+ *   the compressed text, and its length;
+ *   an output buffer and its capacity.
+ * Function returns:
+ *   the length of the text written to out, which is then NUL-terminated;
+ *   or 0 if the input is malformed or would not fit in capacity - 1 bytes.
+ */
+size_t codec_decode(const char* in, const size_t length, char* out, const size_t capacity);
+
+#endif // _CODEC_H_
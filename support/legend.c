@@ -0,0 +1,102 @@
+/*
+ * legend - telling apart players who share a map symbol
+ *
+ * see legend.h for more information.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "legend.h"
+
+/**************** file-local constants ****************/
+static const int Marked = 0x80; // a marked cell holds this plus the player's number past cycle 1
+
+/**************** legend_symbol ****************/
+char
+legend_symbol(const int k)
+{
+  return LEGEND_SYMBOLS[k % LEGEND_NSYMBOLS];
+}
+
+/**************** legend_cycle ****************/
+int
+legend_cycle(const int k)
+{
+  return k / LEGEND_NSYMBOLS + 1;
+}
+
+/**************** legend_id ****************/
+void
+legend_id(const int k, char* id)
+{
+  if (legend_cycle(k) == 1) {
+    snprintf(id, LEGEND_ID_SIZE, "%c", legend_symbol(k));
+  } else {
+    snprintf(id, LEGEND_ID_SIZE, "%c%d", legend_symbol(k), legend_cycle(k));
+  }
+}
+
+/**************** legend_player ****************/
+int
+legend_player(const char* id)
+{
+  const char* symbol = id[0] == '\0' ? NULL : strchr(LEGEND_SYMBOLS, id[0]);
+  if (symbol == NULL) {
+    return -1;
+  }
+  int cycle = 1;
+  int length = 0;
+  if (id[1] != '\0'
+      && (sscanf(id + 1, "%d%n", &cycle, &length) != 1 || id[1 + length] != '\0'
+          || cycle < 2 || cycle > LEGEND_CYCLES)) {
+    return -1; // a cycle is written only from 2 on
+  }
+  return (cycle - 1) * LEGEND_NSYMBOLS + (symbol - LEGEND_SYMBOLS);
+}
+
+/**************** legend_apply ****************/
+int
+legend_apply(const char* legend, char* body)
+{
+  int width = strcspn(body, "\n");
+  size_t length = strlen(body);
+  int marked = 0;
+  const char* p = legend;
+  while (*p != '\n' && *p != '\0') {
+    if (*p == ' ') {
+      p++;
+      continue;
+    }
+    int row, col, n = 0;
+    char id[LEGEND_ID_SIZE];
+    if (sscanf(p, "%d,%d,%7[^ \n]%n", &row, &col, id, &n) != 3) {
+      return -1;
+    }
+    p += n;
+    int k = legend_player(id);
+    if (k < LEGEND_NSYMBOLS) {
+      return -1; // only players past cycle 1 are named
+    }
+    size_t offset = (size_t)row * (width + 1) + col;
+    if (row >= 0 && col >= 0 && col < width && offset < length && body[offset] == legend_symbol(k)) {
+      body[offset] = (char)(Marked + k - LEGEND_NSYMBOLS);
+      marked++;
+    }
+  }
+  return marked;
+}
+
+/**************** legend_cellPlayer ****************/
+int
+legend_cellPlayer(const char cell)
+{
+  unsigned char c = cell;
+  if (c >= Marked) {
+    int k = LEGEND_NSYMBOLS + c - Marked;
+    return k < LEGEND_MAX_PLAYERS ? k : -1;
+  }
+  const char* symbol = c == '\0' ? NULL : strchr(LEGEND_SYMBOLS, c);
+  return symbol == NULL ? -1 : symbol - LEGEND_SYMBOLS;
+}
@@ -0,0 +1,91 @@
+/*
+ * legend - telling apart players who share a map symbol
+ *
+ * A DISPLAY frame has one character per cell, and players are drawn with
+ * the LEGEND_NSYMBOLS characters of LEGEND_SYMBOLS: player k with the
+ * (k % LEGEND_NSYMBOLS)-th of them.  Past the first LEGEND_NSYMBOLS players
+ * the symbols come round again, in a new cycle: player k is in cycle
+ * k / LEGEND_NSYMBOLS + 1, and is named in OK and GAME OVER messages by
+ * its id, the symbol alone in cycle 1 and the symbol followed by the cycle
+ * after that ("A", ..., "9", "A2", ..., "92", "A3", ...).
+ *
+ * A client that sends LEGEND gets, in the first line of each frame that
+ * shows a player past cycle 1, a legend: after the header's own fields,
+ * one "row,col,id" field for each such player, giving the cell of the
+ * frame's body (row 0 is the first line after the header) where it is.
+ *   DISPLAY 3,14,A2 20,7,c3
+ *   DISPLAYV 10 40 3,14,A2
+ * Every other player on the frame is in cycle 1.  legend_apply marks the
+ * legend's cells in the body, so that each cell then tells its player
+ * alone (legend_cellPlayer), and a client can draw each cycle its own way.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#ifndef _LEGEND_H_
+#define _LEGEND_H_
+
+#include <stddef.h>
+
+#define LEGEND_SYMBOLS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+#define LEGEND_NSYMBOLS 62
+#define LEGEND_CYCLES 3      // the most cycles a client is expected to draw apart
+#define LEGEND_MAX_PLAYERS (LEGEND_NSYMBOLS * LEGEND_CYCLES)
+#define LEGEND_ID_SIZE 8     // the longest id, with its NUL
+
+/******************************************/
+/* legend_symbol: the symbol player k is drawn with.
+ * Caller provides:
+ *   a player number from 0 to LEGEND_MAX_PLAYERS - 1.
+ */
+char legend_symbol(const int k);
+
+/******************************************/
+/* legend_cycle: the cycle of symbols player k is in: 1 for the first
+ * LEGEND_NSYMBOLS players, 2 for the next, and so on.
+ */
+int legend_cycle(const int k);
+
+/******************************************/
+/* legend_id: write the id of player k.
+ * Caller provides:
+ *   a player number from 0 to LEGEND_MAX_PLAYERS - 1, and a buffer of
+ *   LEGEND_ID_SIZE bytes.
+ */
+void legend_id(const int k, char* id);
+
+/******************************************/
+/* legend_player: the number of the player with this id.
+ * Function returns:
+ *   the player number, or -1 if the id is not one legend_id makes.
+ */
+int legend_player(const char* id);
+
+/******************************************/
+/* legend_apply: mark the cells a frame's legend names.
+ * Caller provides:
+ *   the legend: the fields that follow the header's own in the frame's
+ *   first line, up to its newline or NUL (a line with no legend is fine);
+ *   the frame's body, rows of equal length each ending in a newline,
+ *   which is changed in place.
+ * Function returns:
+ *   the number of cells marked, or -1 if the legend is malformed.
+ * Notes:
+ *   Each cell named is given a byte from 0x80 up, which legend_cellPlayer
+ *   reads back, if it holds the named player's symbol; cells outside the
+ *   body, or that hold something else, are left alone.  The marked body
+ *   is no longer 7-bit text: it is for the client's own use.
+ */
+int legend_apply(const char* legend, char* body);
+
+/******************************************/
+/* legend_cellPlayer: the player a cell of a frame's body shows, once
+ * legend_apply has marked it.
+ * Function returns:
+ *   the player number, or -1 if the cell shows none.
+ * Notes:
+ *   A player's own cell shows '@', not its symbol, so it gives -1 here.
+ */
+int legend_cellPlayer(const char cell);
+
+#endif // _LEGEND_H_
@@ -4,6 +4,23 @@
  * Provides a message-passing abstraction among Internet hosts.  Messages
  * are sent via UDP and are thus limited to UDP packet size, may be lost,
  * and may be reordered, but require no connection setup or teardown.
+ *
+ * An optional reliability layer rides on the same socket: messages sent
+ * with message_sendReliable carry a sequence number, are acknowledged,
+ * retransmitted until acknowledged, and delivered once and in order;
+ * messages sent with message_sendLatest carry a sequence number only so
+ * that a stale one arriving after a newer one can be dropped.  Framed
+ * datagrams start with the byte '\001', which never begins a plain
+ * message, so framed and plain peers can share one socket.
+ *
+ * A framed datagram too long for the path MTU travels as fragments,
+ * which the receiver reassembles into the framed datagram before
+ * unframing it; fragments may be paced, sent one packet at a time.
+ *
+ * All of this state belongs to a context (message_ctx_t): one socket and
+ * its peers.  The message_ctx_ functions take one explicitly; the original
+ * functions use the module's own, so a program may have several sockets,
+ * one per thread, even sharing a port (SO_REUSEPORT).
  * 
  * See message.h for detailed interface description for each function.
  * Depends on the 'log' module and thus must be linked with log.o.
@@ -13,6 +30,7 @@
  * David Kotz - May 2019
  */
 
+#define _DEFAULT_SOURCE  // for SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -24,6 +42,7 @@
 #include <arpa/inet.h>
 #include <sys/select.h>
 #include <math.h>
+#include <time.h>
 #include "message.h"
 #include "log.h"
 
@@ -35,24 +54,189 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+/* The reliability layer.  Framed datagrams look like
+ *   "\001R<seq> <message>"  a reliable message, number seq from its sender;
+ *   "\001U<seq> <message>"  a latest-wins message, number seq from its sender;
+ *   "\001A<seq>"            every reliable message up to seq has arrived;
+ *   "\001F<id> <i> <n> ..."  fragment i (from 0) of n of framed datagram id.
+ * Retransmission timeouts follow the usual smoothed round-trip estimate
+ * (RFC 6298), doubling on each retry; after MaxTries we give up.
+ */
+static const char Framed = '\001';    // first byte of every framed datagram
+static const double InitialRTO = 0.25; // seconds, before any round trip is measured
+static const double MinRTO = 0.05;     // seconds
+static const double MaxRTO = 2.0;      // seconds
+static const int MaxTries = 12;        // transmissions of one message before giving up
+static const int MaxEarly = 256;       // out-of-order reliable messages held per peer
+static const long MaxEarlyBytes = 16L * 1024 * 1024; // bytes held in them, all peers together
+
+/* Peers.  The table keeps at most MaxPeers of them; a datagram from a new
+ * address past that takes the place of the peer used longest ago, if it
+ * has been idle for PeerIdleSeconds with nothing in flight either way
+ * (forgetting a peer forgets its sequence numbers, so it must be one that
+ * has gone away), and is dropped if there is no such peer.
+ */
+static const int MaxPeers = 256;
+static const double PeerIdleSeconds = 60.0;
+
+/* Fragmentation.  A fragment carries the bytes of its datagram that
+ * follow its own header, which never takes more than FragmentHeader
+ * bytes.  A datagram has no more fragments than one of
+ * message_MaxFramedBytes sent over a MinMTU path (see maxFragments).
+ * Partial datagrams are dropped when no fragment of theirs has
+ * arrived for ReassemblySeconds, and the oldest go first when a peer has
+ * MaxPartials of them or all peers together hold MaxReassembly bytes,
+ * counting the slots for their fragments as well as the fragments.
+ */
+static const int IPHeaders = 28;       // IPv4 and UDP headers, within the path MTU
+static const int DefaultMTU = 1500;    // Ethernet
+static const int MinMTU = 576;         // every IPv4 path carries packets this long
+static const int MaxMTU = 65535;
+static const int FragmentHeader = 32;  // "\001F<id> <i> <n> ", at most
+static const double ReassemblySeconds = 2.0;
+static const int MaxPartials = 8;      // partial datagrams held per peer
+static const long MaxReassembly = 64L * 1024 * 1024; // bytes held in partial datagrams
+
+/**************** file-local types ****************/
+/* a reliable message we sent, not yet acknowledged */
+typedef struct outbound {
+  unsigned int seq;
+  char* datagram;           // the framed datagram, as sent
+  int length;
+  double sentAt;            // time of the latest transmission
+  int tries;                // transmissions so far
+  bool queued;              // its fragments are waiting for the pace
+  struct outbound* next;    // the next newer one
+} outbound_t;
+
+/* a fragment we are to send, when the pace allows */
+typedef struct fragment {
+  char* datagram;
+  int length;
+  char kind;                // of the message it belongs to: 'R' or 'U'
+  unsigned int seq;         // the message's seq, on the last fragment of a reliable one; else 0
+  struct fragment* next;
+} fragment_t;
+
+/* a framed datagram whose fragments are arriving */
+typedef struct partial {
+  unsigned int id;
+  int count;                // fragments in all
+  int received;             // fragments arrived so far
+  char** parts;             // count slots, NULL until that fragment arrives
+  int* lengths;
+  long bytes;               // held in parts
+  double updated;           // when its latest fragment arrived
+  struct partial* next;
+} partial_t;
+
+/* a reliable message that arrived before the ones it follows */
+typedef struct inbound {
+  unsigned int seq;
+  char* message;
+  struct inbound* next;     // ordered by seq
+} inbound_t;
+
+/* what we know about one correspondent */
+typedef struct peer {
+  addr_t addr;
+  bool framed;              // send framed datagrams to it
+  unsigned int sendSeq;     // last reliable seq we used
+  unsigned int recvSeq;     // last reliable seq we delivered, in order
+  unsigned int latestSent;  // last latest-wins seq we used
+  unsigned int latestRecv;  // newest latest-wins seq we delivered
+  outbound_t* unacked;      // oldest first
+  outbound_t* unackedTail;
+  inbound_t* early;
+  int nearly;
+  double srtt;              // smoothed round-trip time; 0 until measured
+  double rttvar;
+  double rto;               // current retransmission timeout
+  unsigned int fragmentId;  // last fragmented datagram we sent
+  fragment_t* paced;        // fragments waiting for the pace, oldest first
+  fragment_t* pacedTail;
+  double allowance;         // bytes the pace lets us send now; negative after a burst
+  double refilled;          // when the allowance was last topped up
+  partial_t* partials;      // datagrams being reassembled, newest first
+  int npartials;
+  double used;              // when we last sent it anything or heard from it
+  bool forgotten;           // drop it once nothing we sent it is outstanding
+} peer_t;
+
+/* everything one socket needs: see message.h */
+struct message_ctx {
+  int fd;                   // socket on which to receive messages; 0 if none
+  FILE* logFP;              // where to log; NULL for nowhere
+  bool reliable;            // frame our messages to every peer, not just framed ones
+  peer_t* peers;            // correspondents of the reliability layer
+  int npeers;
+  int peersSize;
+  float lossRate;           // fraction of outgoing datagrams to drop, for testing
+  unsigned int lossState;   // random state for dropping them
+  int givenUp;              // reliable messages never acknowledged
+  int mtu;                  // path MTU; 0 for DefaultMTU; see fragmentSize
+  int paceRate;             // bytes per second to each peer; 0 to send fragments at once
+  long reassembling;        // bytes held in partial datagrams, all peers together
+  long earlyBytes;          // bytes held in early messages, all peers together
+  bool (*admit)(void* arg, const addr_t from, const char* message); // may refuse a message; NULL to take all
+  bool (*afterDatagram)(void* arg); // called once each datagram is dealt with; NULL for none
+};
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
- * This module provides init() and done() functions that allow it
- * to initialize and cleanup; specifically, it needs to open and close
- * a socket it will use for all the messaging operations. We keep the
- * socket number (a file descriptor) here inside the module, unseen by
- * any code outside this module, but convenient for use internally.
- * One disadvantage to this approach is that all users of this module
- * must work with the same socket, and thus the same port number,
- * but a more flexible approach would require a much more complex interface.
+ * The original interface of this module (message_init, message_send, ...)
+ * works with one socket, which the module keeps here, unseen by any code
+ * outside this module, in a context like any other; those functions are
+ * thin wrappers around the message_ctx_ functions with this context.
+ * Programs that need more than one socket, or one per thread, create
+ * contexts of their own with message_ctx_new.
  */
-static int ourSocket = 0;     // socket on which to receive messages
+static message_ctx_t ourContext;  // all zero: no socket, default settings
+
+/**************** file-local functions ****************/
+static double now(void);
+static bool openSocket(message_ctx_t* ctx, const int port, const bool sharePort);
+static void closeContext(message_ctx_t* ctx);
+static int fragmentSize(const message_ctx_t* ctx);
+static bool transmit(message_ctx_t* ctx, const addr_t to, const char* datagram, const int length);
+static peer_t* findPeer(message_ctx_t* ctx, const addr_t addr, const bool create);
+static peer_t* idlestPeer(message_ctx_t* ctx, const double t);
+static void clearPeer(message_ctx_t* ctx, peer_t* peer);
+static void sweepPeers(message_ctx_t* ctx);
+static void freeInbound(message_ctx_t* ctx, inbound_t* in);
+static void sendFramed(message_ctx_t* ctx, const addr_t to, const char kind, const char* message);
+static bool sendDatagram(message_ctx_t* ctx, peer_t* peer,
+                         const char* datagram, const int length,
+                         const char kind, outbound_t* out);
+static void refill(message_ctx_t* ctx, peer_t* peer, const double t);
+static double pacePeer(message_ctx_t* ctx, peer_t* peer, const double t);
+static double pace(message_ctx_t* ctx);
+static double service(message_ctx_t* ctx);
+static void dropPaced(message_ctx_t* ctx, peer_t* peer, const char kind);
+static char* reassemble(message_ctx_t* ctx, peer_t* peer, const char* buf, const int nbytes);
+static void expirePartials(message_ctx_t* ctx, const double t);
+static bool dropStalest(message_ctx_t* ctx, peer_t* only, const partial_t* spare);
+static void freePartial(message_ctx_t* ctx, partial_t* partial);
+static int maxFragments(void);
+static long partialSlots(const int count);
+static void sendAck(message_ctx_t* ctx, peer_t* peer);
+static bool admitted(message_ctx_t* ctx, void* arg, const addr_t sender, const char* message);
+static void handleAck(peer_t* peer, const unsigned int seq);
+static double backoff(const peer_t* peer, const outbound_t* out);
+static double retransmit(message_ctx_t* ctx);
+static bool receive(message_ctx_t* ctx, void* arg,
+                    bool (*handleMessage)(void* arg,
+                                          const addr_t from, const char* buf));
+static bool deliver(message_ctx_t* ctx, void* arg,
+                    bool (*handleMessage)(void* arg,
+                                          const addr_t from, const char* buf),
+                    const addr_t sender, const char* buf);
 
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
  * Set up a socket on which to receive messages; return the port number.
- * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
+ * Invariant: ourContext.fd = 0 if we return with error, else > 0.
  * Log error and return zero if any error.
  * See message.h for detailed description.
  */
@@ -62,44 +246,192 @@ message_init(FILE* logFP)
   log_init(logFP);
 
   // Have we already been initialized?
-  if (ourSocket != 0) {
+  if (ourContext.fd != 0) {
     log_v("message_init: called again, when already initialized");
     return 0;
   }
+  ourContext.logFP = logFP;
+  if (!openSocket(&ourContext, 0, false)) {
+    return 0;
+  }
+  return message_ctx_port(&ourContext);
+}
 
-  // Create socket on which to listen (file descriptor)
-  ourSocket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (ourSocket < 0) {
-    log_e("message_init: error opening datagram socket");
-    ourSocket = 0;
+/**************** message_ctx_new ****************/
+/* 
+ * Create a context with a socket of its own.
+ * See message.h for detailed description.
+ */
+message_ctx_t*
+message_ctx_new(FILE* logFP, const int port, const bool sharePort)
+{
+  message_ctx_t* ctx = calloc(1, sizeof(message_ctx_t));
+  if (ctx == NULL) {
+    flog_v(logFP, "message_ctx_new: out of memory");
+    return NULL;
+  }
+  ctx->logFP = logFP;
+  if (!openSocket(ctx, port, sharePort)) {
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+/**************** message_ctx_port ****************/
+/* 
+ * Return the port number of the context's socket.
+ * See message.h for detailed description.
+ */
+int
+message_ctx_port(const message_ctx_t* ctx)
+{
+  struct sockaddr_in self;
+  socklen_t selflen = sizeof(self);
+  if (ctx == NULL || ctx->fd == 0
+      || getsockname(ctx->fd, (struct sockaddr *) &self, &selflen)) {
     return 0;
   }
+  return ntohs(self.sin_port);
+}
+
+/**************** openSocket ****************/
+/* Open and bind the context's socket, at the given port or (if 0) any;
+ * let other sockets bind the same port if asked.
+ * Log error and return false if any error.
+ */
+static bool
+openSocket(message_ctx_t* ctx, const int port, const bool sharePort)
+{
+  // Create socket on which to listen (file descriptor)
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    flog_e(ctx->logFP, "message_init: error opening datagram socket");
+    return false;
+  }
+  if (sharePort) {
+    // every socket bound to the port with this option gets a share of
+    // the datagrams arriving at it, by a hash of the sender's address
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+      flog_e(ctx->logFP, "message_init: setting SO_REUSEPORT");
+      close(fd);
+      return false;
+    }
+  }
 
   // Name socket using wildcards
   struct sockaddr_in self;  // our address
   self.sin_family = AF_INET;
   self.sin_addr.s_addr = INADDR_ANY;
-  self.sin_port = 0;
-  if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
-    log_e("message_init: binding socket name");
-    close(ourSocket);
-    ourSocket = 0;
-    return 0;
+  self.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr *) &self, sizeof(self))) {
+    flog_e(ctx->logFP, "message_init: binding socket name");
+    close(fd);
+    return false;
   }
+  ctx->fd = fd;
+  flog_d(ctx->logFP, "message_init: ready at port '%d'", message_ctx_port(ctx));
+  return true;
+}
 
-  // get our assigned address
-  socklen_t selflen = sizeof(self); // length of our address
-  if (getsockname(ourSocket, (struct sockaddr *) &self, &selflen)) {
-    log_e("message_init: getting socket name");
-    close(ourSocket);
-    ourSocket = 0;
-    return 0;
-  }
-  // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
+/**************** the original interface ****************/
+/* Each of these does what its message_ctx_ counterpart does, with the
+ * module's own context; see message.h.
+ */
+void
+message_send(const addr_t to, const char* message)
+{
+  message_ctx_send(&ourContext, to, message);
+}
 
-  return port;
+void
+message_sendReliable(const addr_t to, const char* message)
+{
+  message_ctx_sendReliable(&ourContext, to, message);
+}
+
+void
+message_sendLatest(const addr_t to, const char* message)
+{
+  message_ctx_sendLatest(&ourContext, to, message);
+}
+
+void
+message_setReliable(const bool on)
+{
+  message_ctx_setReliable(&ourContext, on);
+}
+
+void
+message_setLoss(const float rate, const unsigned int seed)
+{
+  message_ctx_setLoss(&ourContext, rate, seed);
+}
+
+void
+message_setPathMTU(const int bytes)
+{
+  message_ctx_setPathMTU(&ourContext, bytes);
+}
+
+void
+message_setPace(const int bytesPerSecond)
+{
+  message_ctx_setPace(&ourContext, bytesPerSecond);
+}
+
+void
+message_setAdmit(bool (*admit)(void* arg, const addr_t from, const char* message))
+{
+  message_ctx_setAdmit(&ourContext, admit);
+}
+
+void
+message_setAfterDatagram(bool (*handleAfter)(void* arg))
+{
+  message_ctx_setAfterDatagram(&ourContext, handleAfter);
+}
+
+void
+message_forget(const addr_t addr)
+{
+  message_ctx_forget(&ourContext, addr);
+}
+
+bool
+message_pending(void)
+{
+  return message_ctx_pending(&ourContext);
+}
+
+bool
+message_loop(void* arg, const float timeout,
+             bool (*handleTimeout)(void* arg),
+             bool (*handleInput)  (void* arg),
+             bool (*handleMessage)(void* arg,
+                                   const addr_t from, const char* buf))
+{
+  return message_ctx_loop(&ourContext, arg, timeout,
+                          handleTimeout, handleInput, handleMessage);
+}
+
+bool
+message_flush(const float timeout)
+{
+  return message_ctx_flush(&ourContext, timeout);
+}
+
+/**************** message_done ****************/
+/* 
+ * Clean up the message module, prior to exit.
+ * See message.h for detailed description.
+ */
+void
+message_done(void)
+{
+  closeContext(&ourContext);
+  log_v("message_done: message module closing down.");
 }
 
 /**************** message_noAddr ****************/
@@ -199,7 +531,7 @@ message_stringAddr(const addr_t addr)
 {
   // Maximum string length to hold an IP address and port, plus null.
   // e.g., 255.255.255.255:65507
-  static char addrString[22]; // constant appears in snprintf below
+  static _Thread_local char addrString[22]; // constant appears in snprintf below
 
   snprintf(addrString, 22, "%s:%05d",
 	   inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
@@ -237,33 +569,187 @@ numLines(const char* string)
   }
 }
 
-/**************** message_send ****************/
+/**************** message_ctx_send ****************/
 /* 
  * Send a string message to the correspondent address.
  * See message.h for detailed description.
  */
 void
-message_send(const addr_t to, const char* message)
+message_ctx_send(message_ctx_t* ctx, const addr_t to, const char* message)
 {
-  if (ourSocket == 0) {
-    log_v("message_send: called before message_init");
+  if (ctx->fd == 0) {
+    flog_v(ctx->logFP, "message_send: called before message_init");
     return; // error in usage of this function.
   }
   if (message == NULL) {
-    log_v("message_send: called with null message");
+    flog_v(ctx->logFP, "message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
-             (struct sockaddr *) &to, sizeof(to)) < 0) {
-    log_e("message_send: error sending to datagram socket");
+  if (!transmit(ctx, to, message, strlen(message))) {
+    flog_e(ctx->logFP, "message_send: error sending to datagram socket");
   } else {
-    log_s("message_send: TO %s", message_stringAddr(to));
-    log_d("message_send: %d lines:", numLines(message));
-    log_s("%s", message);
+    flog_s(ctx->logFP, "message_send: TO %s", message_stringAddr(to));
+    flog_d(ctx->logFP, "message_send: %d lines:", numLines(message));
+    flog_s(ctx->logFP, "%s", message);
+  }
+}
+
+/**************** message_ctx_sendReliable ****************/
+/* 
+ * Send a message that must arrive: once, and in order.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_sendReliable(message_ctx_t* ctx, const addr_t to, const char* message)
+{
+  if (ctx->fd == 0) {
+    flog_v(ctx->logFP, "message_sendReliable: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (message == NULL) {
+    flog_v(ctx->logFP, "message_sendReliable: called with null message");
+    return; // error in usage of this function.
   }
+  sendFramed(ctx, to, 'R', message);
 }
 
-/**************** message_loop ****************/
+/**************** message_ctx_sendLatest ****************/
+/* 
+ * Send a message that only matters until a newer one arrives.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_sendLatest(message_ctx_t* ctx, const addr_t to, const char* message)
+{
+  if (ctx->fd == 0) {
+    flog_v(ctx->logFP, "message_sendLatest: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (message == NULL) {
+    flog_v(ctx->logFP, "message_sendLatest: called with null message");
+    return; // error in usage of this function.
+  }
+  sendFramed(ctx, to, 'U', message);
+}
+
+/**************** message_ctx_setReliable ****************/
+/* 
+ * Frame our messages to every peer, even before it has framed one to us.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setReliable(message_ctx_t* ctx, const bool on)
+{
+  ctx->reliable = on;
+}
+
+/**************** message_ctx_setLoss ****************/
+/* 
+ * Drop a fraction of outgoing datagrams, for testing.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setLoss(message_ctx_t* ctx, const float rate, const unsigned int seed)
+{
+  ctx->lossRate = rate;
+  ctx->lossState = seed != 0 ? seed : 1;
+}
+
+/**************** message_ctx_setPathMTU ****************/
+/* 
+ * Fragment framed datagrams to fit packets of this many bytes.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setPathMTU(message_ctx_t* ctx, const int bytes)
+{
+  ctx->mtu = bytes < MinMTU ? MinMTU : (bytes > MaxMTU ? MaxMTU : bytes);
+}
+
+/**************** message_ctx_setPace ****************/
+/* 
+ * Send fragments to each peer no faster than this.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setPace(message_ctx_t* ctx, const int bytesPerSecond)
+{
+  ctx->paceRate = bytesPerSecond > 0 ? bytesPerSecond : 0;
+}
+
+/**************** message_ctx_setAdmit ****************/
+/* 
+ * Set the function that decides whether to take each message.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setAdmit(message_ctx_t* ctx,
+                     bool (*admit)(void* arg, const addr_t from, const char* message))
+{
+  ctx->admit = admit;
+}
+
+/**************** message_ctx_setAfterDatagram ****************/
+/* 
+ * Set the handler message_loop calls after every datagram.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setAfterDatagram(message_ctx_t* ctx, bool (*handleAfter)(void* arg))
+{
+  ctx->afterDatagram = handleAfter;
+}
+
+/**************** message_ctx_forget ****************/
+/* 
+ * Drop what we know about a correspondent, once it is safe to.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_forget(message_ctx_t* ctx, const addr_t addr)
+{
+  for (int i = 0; i < ctx->npeers; i++) {
+    peer_t* peer = &ctx->peers[i];
+    if (message_eqAddr(peer->addr, addr)) {
+      // nothing it sends will be delivered any more, so let go of its pieces now
+      while (peer->early != NULL) {
+        inbound_t* in = peer->early;
+        peer->early = in->next;
+        freeInbound(ctx, in);
+      }
+      peer->nearly = 0;
+      while (peer->partials != NULL) {
+        partial_t* partial = peer->partials;
+        peer->partials = partial->next;
+        freePartial(ctx, partial);
+      }
+      peer->npartials = 0;
+      peer->forgotten = true;
+      flog_s(ctx->logFP, "message_forget: %s", message_stringAddr(addr));
+      return;
+    }
+  }
+}
+
+/**************** message_ctx_pending ****************/
+/* 
+ * Is a datagram waiting on our socket?
+ * See message.h for detailed description.
+ */
+bool
+message_ctx_pending(message_ctx_t* ctx)
+{
+  if (ctx->fd == 0) {
+    return false;
+  }
+  fd_set rfds;
+  FD_ZERO(&rfds);
+  FD_SET(ctx->fd, &rfds);
+  struct timeval now = {0, 0};  // poll; do not wait
+  return select(ctx->fd+1, &rfds, NULL, NULL, &now) > 0;
+}
+
+/**************** message_ctx_loop ****************/
 /* 
  * Loop forever, calling handler functions for stdin or socket,
  * as input is available from either.
@@ -271,40 +757,39 @@ message_send(const addr_t to, const char* message)
  * See message.h for detailed description.
  */
 bool
-message_loop(void* arg, const float timeout,
-             bool (*handleTimeout)(void* arg),
-             bool (*handleInput)  (void* arg),
-             bool (*handleMessage)(void* arg,
-                                   const addr_t from, const char* buf))
+message_ctx_loop(message_ctx_t* ctx, void* arg, const float timeout,
+                 bool (*handleTimeout)(void* arg),
+                 bool (*handleInput)  (void* arg),
+                 bool (*handleMessage)(void* arg,
+                                       const addr_t from, const char* buf))
 {
   // check if we're ready for messaging
-  if (ourSocket == 0) {
-    log_v("message_loop called before message_init");
+  if (ctx->fd == 0) {
+    flog_v(ctx->logFP, "message_loop called before message_init");
     return false; // error in usage of this function.
   }
 
   // check parameters
   if (handleTimeout == NULL && handleInput == NULL && handleMessage == NULL) {
-    log_v("message_loop called with all handlers null");
+    flog_v(ctx->logFP, "message_loop called with all handlers null");
     return false; // error in usage of this function.
   }
   if (handleTimeout == NULL && timeout > 0.0) {
-    log_v("message_loop called with null handleTimeout but timeout > 0");
+    flog_v(ctx->logFP, "message_loop called with null handleTimeout but timeout > 0");
     return false; // error in usage of this function.
   }
   if (handleTimeout != NULL && timeout <= 0.0) {
-    log_v("message_loop called with Timeout handler but timeout <= 0");
+    flog_v(ctx->logFP, "message_loop called with Timeout handler but timeout <= 0");
     return false; // error in usage of this function.
   }
 
-  // set up for timeouts, if desired
-  struct timeval* timerp = NULL; // stays null if no timeout desired
-  struct timeval  timer;          // timerp = &timer if timeout desired
-  struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
-  if (timeout > 0.0) {
-    timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
-  }
+  // set up for timeouts, if desired: handleTimeout is due once nothing has
+  // happened for 'timeout' seconds; the select timer may also wake us earlier,
+  // to retransmit reliable messages that are still unacknowledged, or to
+  // send fragments the pace held back
+  struct timeval* timerp = NULL; // stays null if no wakeup desired
+  struct timeval  timer;          // timerp = &timer if wakeup desired
+  double idleSince = now();       // when input or a message last arrived
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
@@ -318,12 +803,24 @@ message_loop(void* arg, const float timeout,
       FD_SET(0, &rfds);       // monitor stdin
       nfds = 1;
     }
-    if (handleMessage != NULL && ourSocket != 0) {
-      FD_SET(ourSocket, &rfds); // monitor the socket
-      nfds = ourSocket+1;       // highest-numbered fd in rfds
+    if (handleMessage != NULL && ctx->fd != 0) {
+      FD_SET(ctx->fd, &rfds); // monitor the socket
+      nfds = ctx->fd+1;       // highest-numbered fd in rfds
     }
+    double wait = -1;         // seconds until we must wake up; negative if never
     if (timeout > 0.0) {      // is timeout desired?
-      timer = timeoutval;     // set the timer to the timeout value
+      wait = idleSince + timeout - now();
+      if (wait < 0) {
+        wait = 0;
+      }
+    }
+    double resend = service(ctx); // seconds until the next retransmission or paced fragment, if any
+    if (resend >= 0 && (wait < 0 || resend < wait)) {
+      wait = resend;
+    }
+    if (wait >= 0) {
+      timer.tv_sec  = (int)wait;  // set the timer to the wait
+      timer.tv_usec = (wait - (int)wait) * 1000000;
       timerp = &timer;        // pass that timer to select
     } else {
       timerp = NULL;          // no timeout is desired
@@ -337,57 +834,40 @@ message_loop(void* arg, const float timeout,
       if (errno == EINTR) {
 	// select() was interrupted by a signal - most likely SIGWINCH;
 	// just ignore this and loop around to select() again.
-	log_e("message_loop: select() EINTR: interrupted by signal");
+	flog_e(ctx->logFP, "message_loop: select() EINTR: interrupted by signal");
       } else {
 	// some error occurred; this should not happen
-	log_e("message_loop: select()");
+	flog_e(ctx->logFP, "message_loop: select()");
 	return false; // error
       }
     } else if (select_response == 0) {
-      // timeout occurred
-      log_v("message_loop: select() timed out");
-      if (handleTimeout != NULL && (*handleTimeout)(arg)) {
-        break; // handler says to exit loop 
+      // timeout occurred; it may only have been time to retransmit
+      if (timeout > 0.0 && now() - idleSince >= timeout) {
+        flog_v(ctx->logFP, "message_loop: select() timed out");
+        idleSince = now();
+        if (handleTimeout != NULL && (*handleTimeout)(arg)) {
+          break; // handler says to exit loop 
+        }
       }
     } else if (select_response > 0) {
       // some data is ready on either source, or both
+      idleSince = now();
 
       if (FD_ISSET(0, &rfds)) {
         // stdin has input ready
-        log_v("message_loop: input ready on stdin");
+        flog_v(ctx->logFP, "message_loop: input ready on stdin");
         if (handleInput != NULL && (*handleInput)(arg)) {
           break; // handler says to exit loop 
         }
       }
-      if (FD_ISSET(ourSocket, &rfds)) {
+      if (FD_ISSET(ctx->fd, &rfds)) {
         // socket has input ready
-        log_v("message_loop: message ready on socket");
-        struct sockaddr_in sender;     // sender of this message
-        struct sockaddr *senderp = (struct sockaddr *) &sender;
-        socklen_t senderlen = sizeof(sender);  // must pass address to length
-        char buf[message_MaxBytes]; // buffer for reading data from socket
-        int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
-                              0, senderp, &senderlen);
-        if (nbytes < 0) {
-          // error, ignore it
-          log_e("message_loop: receiving from socket");
-        } else {
-          buf[nbytes] = '\0';     // null terminate message string
-          // where was it from?
-          if (sender.sin_family != AF_INET) {
-            // ignore it
-            log_d("message_loop: non-Internet family %d\n", sender.sin_family);
-          } else {
-	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
-
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
-              break; // handler says to exit loop 
-            }
-          }
+        flog_v(ctx->logFP, "message_loop: message ready on socket");
+        if (receive(ctx, arg, handleMessage)) {
+          break; // handler says to exit loop 
+        }
+        if (ctx->afterDatagram != NULL && (*ctx->afterDatagram)(arg)) {
+          break; // handler says to exit loop 
         }
       }
     }
@@ -395,21 +875,982 @@ message_loop(void* arg, const float timeout,
   return true;
 }
 
-/**************** message_done ****************/
+/**************** message_ctx_flush ****************/
 /* 
- * Clean up the message module, prior to exit.
+ * Wait until every reliable message has been acknowledged, or given up on,
+ * and every paced fragment has been sent.
+ * See message.h for detailed description.
+ */
+bool
+message_ctx_flush(message_ctx_t* ctx, const float timeout)
+{
+  if (ctx->fd == 0) {
+    flog_v(ctx->logFP, "message_flush: called before message_init");
+    return false; // error in usage of this function.
+  }
+  const double deadline = now() + timeout;
+  const int givenUpBefore = ctx->givenUp;
+  double resend;
+  while ((resend = service(ctx)) >= 0) {
+    double wait = deadline - now();
+    if (wait <= 0) {
+      flog_v(ctx->logFP, "message_flush: timed out with messages unacknowledged");
+      return false;
+    }
+    if (resend < wait) {
+      wait = resend;
+    }
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(ctx->fd, &rfds);
+    struct timeval timer;
+    timer.tv_sec = (int)wait;
+    timer.tv_usec = (wait - (int)wait) * 1000000;
+    if (select(ctx->fd+1, &rfds, NULL, NULL, &timer) > 0) {
+      receive(ctx, NULL, NULL); // acknowledgements; other messages are dropped
+    }
+  }
+  return ctx->givenUp == givenUpBefore;
+}
+
+/**************** message_ctx_delete ****************/
+/* 
+ * Close a context's socket and free it.
  * See message.h for detailed description.
  */
 void
-message_done(void)
+message_ctx_delete(message_ctx_t* ctx)
 {
-  if (ourSocket != 0) {
-    close(ourSocket);
-    ourSocket = 0;
+  if (ctx != NULL) {
+    closeContext(ctx);
+    flog_v(ctx->logFP, "message_ctx_delete: context closing down.");
+    free(ctx);
   }
-  log_v("message_done: message module closing down.");
 }
 
+/**************** closeContext ****************/
+/* Close the context's socket and forget every peer; keep its settings. */
+static void
+closeContext(message_ctx_t* ctx)
+{
+  if (ctx->fd != 0) {
+    close(ctx->fd);
+    ctx->fd = 0;
+  }
+  for (int i = 0; i < ctx->npeers; i++) {
+    clearPeer(ctx, &ctx->peers[i]);
+  }
+  free(ctx->peers);
+  ctx->peers = NULL;
+  ctx->npeers = ctx->peersSize = 0;
+}
+
+/**************** now ****************/
+/* The time in seconds; only differences between times are used. */
+static double
+now(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**************** fragmentSize ****************/
+/* The longest framed datagram we send whole; longer ones go in fragments. */
+static int
+fragmentSize(const message_ctx_t* ctx)
+{
+  return (ctx->mtu > 0 ? ctx->mtu : DefaultMTU) - IPHeaders;
+}
+
+/**************** transmit ****************/
+/* Send one datagram, unless loss injection drops it.
+ * Return false on a send error.
+ */
+static bool
+transmit(message_ctx_t* ctx, const addr_t to, const char* datagram, const int length)
+{
+  if (ctx->lossRate > 0) {
+    ctx->lossState = ctx->lossState * 1103515245 + 12345; // same recurrence as the C standard's sample rand()
+    if ((ctx->lossState >> 16 & 0x7fff) < ctx->lossRate * 0x8000) {
+      flog_d(ctx->logFP, "transmit: dropped a datagram of %d bytes", length);
+      return true;
+    }
+  }
+  return sendto(ctx->fd, datagram, length, 0,
+                (struct sockaddr *) &to, sizeof(to)) >= 0;
+}
+
+/**************** findPeer ****************/
+/* The reliability state for this address; created if asked, else NULL if none. */
+static peer_t*
+findPeer(message_ctx_t* ctx, const addr_t addr, const bool create)
+{
+  double t = now();
+  for (int i = 0; i < ctx->npeers; i++) {
+    if (message_eqAddr(ctx->peers[i].addr, addr)) {
+      ctx->peers[i].used = t;
+      return &ctx->peers[i];
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  peer_t* peer;
+  if (ctx->npeers >= MaxPeers) {
+    peer = idlestPeer(ctx, t);
+    if (peer == NULL) {
+      flog_s(ctx->logFP, "findPeer: no room for %s", message_stringAddr(addr));
+      return NULL;
+    }
+    flog_s(ctx->logFP, "findPeer: forgot %s", message_stringAddr(peer->addr));
+    clearPeer(ctx, peer);
+  } else {
+    if (ctx->npeers == ctx->peersSize) {
+      ctx->peersSize = ctx->peersSize == 0 ? 8 : 2 * ctx->peersSize;
+      ctx->peers = realloc(ctx->peers, ctx->peersSize * sizeof(peer_t));
+      if (ctx->peers == NULL) {
+        flog_v(ctx->logFP, "findPeer: out of memory");
+        exit(99);
+      }
+    }
+    peer = &ctx->peers[ctx->npeers++];
+  }
+  peer->addr = addr;
+  peer->framed = ctx->reliable;
+  peer->sendSeq = peer->recvSeq = 0;
+  peer->latestSent = peer->latestRecv = 0;
+  peer->unacked = peer->unackedTail = NULL;
+  peer->early = NULL;
+  peer->nearly = 0;
+  peer->srtt = peer->rttvar = 0;
+  peer->rto = InitialRTO;
+  peer->fragmentId = 0;
+  peer->paced = peer->pacedTail = NULL;
+  peer->allowance = peer->refilled = 0;
+  peer->partials = NULL;
+  peer->npartials = 0;
+  peer->used = t;
+  peer->forgotten = false;
+  return peer;
+}
+
+/**************** idlestPeer ****************/
+/* The peer used longest ago, of those idle for PeerIdleSeconds at time t
+ * with nothing unacknowledged, paced, held or being reassembled; or NULL.
+ */
+static peer_t*
+idlestPeer(message_ctx_t* ctx, const double t)
+{
+  peer_t* idlest = NULL;
+  for (int i = 0; i < ctx->npeers; i++) {
+    peer_t* peer = &ctx->peers[i];
+    if (t - peer->used >= PeerIdleSeconds
+        && peer->unacked == NULL && peer->paced == NULL
+        && peer->early == NULL && peer->partials == NULL
+        && (idlest == NULL || peer->used < idlest->used)) {
+      idlest = peer;
+    }
+  }
+  return idlest;
+}
+
+/**************** clearPeer ****************/
+/* Free everything a peer holds: unacknowledged and paced messages,
+ * early messages and partial datagrams.
+ */
+static void
+clearPeer(message_ctx_t* ctx, peer_t* peer)
+{
+  while (peer->unacked != NULL) {
+    outbound_t* out = peer->unacked;
+    peer->unacked = out->next;
+    free(out->datagram);
+    free(out);
+  }
+  peer->unackedTail = NULL;
+  while (peer->early != NULL) {
+    inbound_t* in = peer->early;
+    peer->early = in->next;
+    freeInbound(ctx, in);
+  }
+  peer->nearly = 0;
+  dropPaced(ctx, peer, 0);
+  while (peer->partials != NULL) {
+    partial_t* partial = peer->partials;
+    peer->partials = partial->next;
+    freePartial(ctx, partial);
+  }
+  peer->npartials = 0;
+}
+
+/**************** sweepPeers ****************/
+/* Drop the forgotten peers that have nothing unacknowledged or paced. */
+static void
+sweepPeers(message_ctx_t* ctx)
+{
+  for (int i = ctx->npeers - 1; i >= 0; i--) {
+    peer_t* peer = &ctx->peers[i];
+    if (peer->forgotten && peer->unacked == NULL && peer->paced == NULL) {
+      clearPeer(ctx, peer);
+      *peer = ctx->peers[--ctx->npeers];
+    }
+  }
+}
+
+/**************** freeInbound ****************/
+/* Free an early message, no longer in any list. */
+static void
+freeInbound(message_ctx_t* ctx, inbound_t* in)
+{
+  ctx->earlyBytes -= strlen(in->message) + 1;
+  free(in->message);
+  free(in);
+}
+
+/**************** sendFramed ****************/
+/* Send a reliable ('R') or latest-wins ('U') message, framed if the peer
+ * understands frames, and plain otherwise.
+ */
+static void
+sendFramed(message_ctx_t* ctx, const addr_t to, const char kind, const char* message)
+{
+  peer_t* peer = findPeer(ctx, to, ctx->reliable);
+  if (peer == NULL || !peer->framed) {
+    message_ctx_send(ctx, to, message); // a plain peer: best effort, as ever
+    return;
+  }
+  unsigned int seq = kind == 'R' ? ++peer->sendSeq : ++peer->latestSent;
+  char header[16];
+  int headerLength = snprintf(header, sizeof(header), "%c%c%u ", Framed, kind, seq);
+  int length = headerLength + strlen(message);
+  if (length > message_MaxFramedBytes) {
+    flog_d(ctx->logFP, "sendFramed: message too long by %d bytes", length - message_MaxFramedBytes);
+    return;
+  }
+  char* datagram = malloc(length + 1);
+  if (datagram == NULL) {
+    flog_v(ctx->logFP, "sendFramed: out of memory");
+    exit(99);
+  }
+  strcpy(datagram, header);
+  strcpy(datagram + headerLength, message);
+
+  // keep a reliable one until it is acknowledged
+  outbound_t* out = NULL;
+  if (kind == 'R') {
+    out = malloc(sizeof(outbound_t));
+    if (out == NULL) {
+      flog_v(ctx->logFP, "sendFramed: out of memory");
+      exit(99);
+    }
+    out->seq = seq;
+    out->datagram = datagram;
+    out->length = length;
+    out->sentAt = now();
+    out->tries = 1;
+    out->queued = false;
+    out->next = NULL;
+    if (peer->unackedTail == NULL) {
+      peer->unacked = out;
+    } else {
+      peer->unackedTail->next = out;
+    }
+    peer->unackedTail = out;
+  }
+  if (!sendDatagram(ctx, peer, datagram, length, kind, out)) {
+    flog_e(ctx->logFP, "sendFramed: error sending to datagram socket");
+  }
+  flog_s(ctx->logFP, "message_send: TO %s", message_stringAddr(to));
+  flog_d(ctx->logFP, "message_send: framed message %d:", seq);
+  flog_s(ctx->logFP, "%s", message);
+  if (out == NULL) {
+    free(datagram);
+  }
+}
+
+/**************** sendDatagram ****************/
+/* Send a framed datagram of a reliable ('R') or latest-wins ('U') message
+ * to a framed peer: whole if it fits the path, else in fragments, which
+ * wait their turn if there is a pace.  Any fragments of an older
+ * latest-wins message still waiting are dropped first, and out, the
+ * message if it is reliable, is marked queued while its fragments wait.
+ * Return false on a send error.
+ */
+static bool
+sendDatagram(message_ctx_t* ctx, peer_t* peer,
+             const char* datagram, const int length,
+             const char kind, outbound_t* out)
+{
+  double t = 0;
+  if (ctx->paceRate > 0) {
+    t = now();
+    refill(ctx, peer, t);
+    if (kind == 'U') {
+      dropPaced(ctx, peer, 'U'); // superseded by this one
+    }
+  }
+  if (length <= fragmentSize(ctx)) {
+    peer->allowance -= ctx->paceRate > 0 ? length : 0;
+    return transmit(ctx, peer->addr, datagram, length);
+  }
+
+  int chunk = fragmentSize(ctx) - FragmentHeader; // bytes of the datagram in each fragment
+  int count = (length + chunk - 1) / chunk;
+  unsigned int id = ++peer->fragmentId;
+  bool ok = true;
+  char* fragment = NULL;
+  for (int index = 0; index < count; index++) {
+    if (fragment == NULL) {
+      fragment = malloc(fragmentSize(ctx));
+      if (fragment == NULL) {
+        flog_v(ctx->logFP, "sendDatagram: out of memory");
+        exit(99);
+      }
+    }
+    int headerLength = snprintf(fragment, FragmentHeader, "%cF%u %d %d ",
+                                Framed, id, index, count);
+    int bytes = index < count - 1 ? chunk : length - index * chunk;
+    memcpy(fragment + headerLength, datagram + index * chunk, bytes);
+    if (ctx->paceRate == 0) {
+      ok = transmit(ctx, peer->addr, fragment, headerLength + bytes) && ok;
+      continue;
+    }
+    fragment_t* node = malloc(sizeof(fragment_t));
+    if (node == NULL) {
+      flog_v(ctx->logFP, "sendDatagram: out of memory");
+      exit(99);
+    }
+    node->datagram = fragment;
+    node->length = headerLength + bytes;
+    node->kind = kind;
+    node->seq = out != NULL && index == count - 1 ? out->seq : 0;
+    node->next = NULL;
+    if (peer->pacedTail == NULL) {
+      peer->paced = node;
+    } else {
+      peer->pacedTail->next = node;
+    }
+    peer->pacedTail = node;
+    fragment = NULL; // the queue owns it now
+  }
+  free(fragment);
+  flog_d(ctx->logFP, "sendDatagram: sent in %d fragments", count);
+  if (ctx->paceRate > 0) {
+    if (out != NULL) {
+      out->queued = true;
+    }
+    pacePeer(ctx, peer, t);
+  }
+  return ok;
+}
+
+/**************** refill ****************/
+/* Top up the peer's allowance for the time since the last top-up; it
+ * never builds up past one datagram, so paced fragments go singly.
+ */
+static void
+refill(message_ctx_t* ctx, peer_t* peer, const double t)
+{
+  peer->allowance += (t - peer->refilled) * ctx->paceRate;
+  if (peer->allowance > fragmentSize(ctx)) {
+    peer->allowance = fragmentSize(ctx);
+  }
+  peer->refilled = t;
+}
+
+/**************** pacePeer ****************/
+/* Send the peer's waiting fragments as far as its allowance goes.
+ * Return the seconds until the next one may go, or -1 if none wait.
+ */
+static double
+pacePeer(message_ctx_t* ctx, peer_t* peer, const double t)
+{
+  refill(ctx, peer, t);
+  while (peer->paced != NULL) {
+    fragment_t* node = peer->paced;
+    if (peer->allowance < node->length) {
+      return (node->length - peer->allowance) / ctx->paceRate;
+    }
+    if (!transmit(ctx, peer->addr, node->datagram, node->length)) {
+      flog_e(ctx->logFP, "pacePeer: error sending to datagram socket");
+    }
+    peer->allowance -= node->length;
+    peer->paced = node->next;
+    if (peer->paced == NULL) {
+      peer->pacedTail = NULL;
+    }
+    if (node->seq != 0) {
+      // the whole reliable message is out: its retransmission timer starts now
+      for (outbound_t* out = peer->unacked; out != NULL; out = out->next) {
+        if (out->seq == node->seq) {
+          out->queued = false;
+          out->sentAt = t;
+        }
+      }
+    }
+    free(node->datagram);
+    free(node);
+  }
+  return -1;
+}
+
+/**************** pace ****************/
+/* Send waiting fragments to every peer as far as the pace allows.
+ * Return the seconds until the next one may go, or -1 if none wait.
+ */
+static double
+pace(message_ctx_t* ctx)
+{
+  if (ctx->paceRate == 0) {
+    return -1; // nothing is ever queued
+  }
+  double t = now();
+  double next = -1;
+  for (int i = 0; i < ctx->npeers; i++) {
+    double wait = pacePeer(ctx, &ctx->peers[i], t);
+    if (wait >= 0 && (next < 0 || wait < next)) {
+      next = wait;
+    }
+  }
+  return next;
+}
+
+/**************** service ****************/
+/* Send what the pace allows and retransmit what has fallen due.
+ * Return the seconds until there is more to do, or -1 if nothing waits.
+ */
+static double
+service(message_ctx_t* ctx)
+{
+  double paced = pace(ctx);
+  double resend = retransmit(ctx);
+  sweepPeers(ctx);
+  return paced < 0 || (resend >= 0 && resend < paced) ? resend : paced;
+}
+
+/**************** dropPaced ****************/
+/* Forget the peer's waiting fragments of the given kind of message, or all
+ * of them if kind is 0.
+ */
+static void
+dropPaced(message_ctx_t* ctx, peer_t* peer, const char kind)
+{
+  fragment_t** nodep = &peer->paced;
+  peer->pacedTail = NULL;
+  int dropped = 0;
+  while (*nodep != NULL) {
+    fragment_t* node = *nodep;
+    if (kind == 0 || node->kind == kind) {
+      *nodep = node->next;
+      free(node->datagram);
+      free(node);
+      dropped++;
+    } else {
+      peer->pacedTail = node;
+      nodep = &node->next;
+    }
+  }
+  if (dropped > 0) {
+    flog_d(ctx->logFP, "dropPaced: dropped %d waiting fragments", dropped);
+  }
+}
+
+/**************** sendAck ****************/
+/* Tell the peer every reliable message up to the last one delivered has arrived. */
+static void
+sendAck(message_ctx_t* ctx, peer_t* peer)
+{
+  char ack[16];
+  int length = snprintf(ack, sizeof(ack), "%cA%u", Framed, peer->recvSeq);
+  if (!transmit(ctx, peer->addr, ack, length)) {
+    flog_e(ctx->logFP, "sendAck: error sending to datagram socket");
+  }
+}
+
+/**************** handleAck ****************/
+/* Forget the messages the peer has acknowledged, learning from the round trip. */
+static void
+handleAck(peer_t* peer, const unsigned int seq)
+{
+  double t = now();
+  while (peer->unacked != NULL && peer->unacked->seq <= seq) {
+    outbound_t* out = peer->unacked;
+    if (out->tries == 1) {
+      // only a message sent once tells us the round trip (Karn's rule)
+      double rtt = t - out->sentAt;
+      if (peer->srtt == 0) {
+        peer->srtt = rtt;
+        peer->rttvar = rtt / 2;
+      } else {
+        double error = peer->srtt > rtt ? peer->srtt - rtt : rtt - peer->srtt;
+        peer->rttvar = 0.75 * peer->rttvar + 0.25 * error;
+        peer->srtt = 0.875 * peer->srtt + 0.125 * rtt;
+      }
+      peer->rto = peer->srtt + 4 * peer->rttvar;
+      peer->rto = peer->rto < MinRTO ? MinRTO : (peer->rto > MaxRTO ? MaxRTO : peer->rto);
+    }
+    peer->unacked = out->next;
+    free(out->datagram);
+    free(out);
+  }
+  if (peer->unacked == NULL) {
+    peer->unackedTail = NULL;
+  }
+}
+
+/**************** backoff ****************/
+/* Seconds to wait for an acknowledgement of this message's latest
+ * transmission: the peer's timeout, doubled for every retry, up to MaxRTO.
+ */
+static double
+backoff(const peer_t* peer, const outbound_t* out)
+{
+  double rto = peer->rto * (1 << (out->tries - 1));
+  return rto < MaxRTO ? rto : MaxRTO;
+}
+
+/**************** retransmit ****************/
+/* Resend every unacknowledged message whose timeout has passed; give up on
+ * those sent MaxTries times already.  Return the seconds until the next one
+ * falls due, or -1 if none are unacknowledged.
+ */
+static double
+retransmit(message_ctx_t* ctx)
+{
+  double t = now();
+  double next = -1;
+  for (int i = 0; i < ctx->npeers; i++) {
+    peer_t* peer = &ctx->peers[i];
+    outbound_t** outp = &peer->unacked;
+    outbound_t* prev = NULL;
+    while (*outp != NULL) {
+      outbound_t* out = *outp;
+      if (out->queued) {
+        // still going out at the pace; its timer has not started
+        prev = out;
+        outp = &out->next;
+        continue;
+      }
+      double due = out->sentAt + backoff(peer, out);
+      if (due <= t) {
+        if (out->tries == MaxTries) {
+          flog_d(ctx->logFP, "retransmit: giving up on message %d", out->seq);
+          ctx->givenUp++;
+          flog_s(ctx->logFP, "retransmit: to %s", message_stringAddr(peer->addr));
+          *outp = out->next;
+          free(out->datagram);
+          free(out);
+          continue;
+        }
+        sendDatagram(ctx, peer, out->datagram, out->length, 'R', out);
+        flog_d(ctx->logFP, "retransmit: resent message %d", out->seq);
+        out->sentAt = t;
+        out->tries++;
+        due = t + backoff(peer, out);
+      }
+      if (next < 0 || due - t < next) {
+        next = due - t;
+      }
+      prev = out;
+      outp = &out->next;
+    }
+    peer->unackedTail = prev;
+  }
+  return next;
+}
+
+/**************** receive ****************/
+/* Read one datagram from the socket and deliver what it carries to
+ * handleMessage: a plain message as is, framed messages unframed, in order,
+ * and without duplicates or stale ones.  With handleMessage NULL only
+ * acknowledgements are processed.
+ * Return true if the handler says to exit the loop.
+ */
+static bool
+receive(message_ctx_t* ctx, void* arg,
+        bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  struct sockaddr_in sender;     // sender of this message
+  struct sockaddr *senderp = (struct sockaddr *) &sender;
+  socklen_t senderlen = sizeof(sender);  // must pass address to length
+  char buf[message_MaxBytes]; // buffer for reading data from socket
+  int nbytes = recvfrom(ctx->fd, buf, message_MaxBytes-1, 
+                        0, senderp, &senderlen);
+  if (nbytes < 0) {
+    // error, ignore it
+    flog_e(ctx->logFP, "message_loop: receiving from socket");
+    return false;
+  }
+  buf[nbytes] = '\0';     // null terminate message string
+  // where was it from?
+  if (sender.sin_family != AF_INET) {
+    // ignore it
+    flog_d(ctx->logFP, "message_loop: non-Internet family %d\n", sender.sin_family);
+    return false;
+  }
+
+  // a fragment: deliver its datagram once it is whole
+  if (buf[0] == Framed && buf[1] == 'F') {
+    peer_t* peer = findPeer(ctx, sender, true);
+    if (peer == NULL) {
+      return false; // no room for another peer
+    }
+    peer->framed = true;
+    char* whole = reassemble(ctx, peer, buf, nbytes);
+    if (whole == NULL) {
+      return false;
+    }
+    bool quit = false;
+    if (whole[0] == Framed && (whole[1] == 'R' || whole[1] == 'U')) {
+      quit = deliver(ctx, arg, handleMessage, sender, whole);
+    } else {
+      flog_s(ctx->logFP, "message_loop: malformed fragments from %s", message_stringAddr(sender));
+    }
+    free(whole);
+    return quit;
+  }
+  return deliver(ctx, arg, handleMessage, sender, buf);
+}
+
+/**************** deliver ****************/
+/* Deliver what one whole datagram carries to handleMessage, as receive
+ * describes.  Return true if the handler says to exit the loop.
+ */
+static bool
+deliver(message_ctx_t* ctx, void* arg,
+        bool (*handleMessage)(void* arg, const addr_t from, const char* buf),
+        const addr_t sender, const char* buf)
+{
+  // unframe it
+  const char* message = buf;
+  char kind = 0;
+  unsigned int seq = 0;
+  peer_t* peer = NULL;
+  if (buf[0] == Framed) {
+    int headerLength = 0;
+    if (sscanf(buf + 1, "%c%u%n", &kind, &seq, &headerLength) != 2
+        || (kind != 'A' && buf[1 + headerLength] != ' ')) {
+      flog_s(ctx->logFP, "message_loop: malformed frame from %s", message_stringAddr(sender));
+      return false;
+    }
+    message = buf + 1 + headerLength + (kind != 'A');
+    peer = findPeer(ctx, sender, true);
+    if (peer == NULL) {
+      return false; // no room for another peer; a reliable message comes again
+    }
+    peer->framed = true; // it speaks frames, so we answer in frames
+    if (kind == 'A') {
+      handleAck(peer, seq);
+      return false;
+    }
+  }
+  if (handleMessage == NULL) {
+    if (kind == 'R' && seq <= peer->recvSeq) {
+      sendAck(ctx, peer); // a duplicate: our acknowledgement was lost
+    }
+    return false;
+  }
+  if (kind == 'U') {
+    if (seq <= peer->latestRecv) {
+      flog_d(ctx->logFP, "message_loop: dropped stale message %d", seq);
+      return false;
+    }
+    peer->latestRecv = seq; // even if refused: anything older is stale all the same
+    if (!admitted(ctx, arg, sender, message)) {
+      return false;
+    }
+  } else if (kind == 'R') {
+    if (seq > peer->recvSeq + 1) {
+      // early: hold it until the ones before it arrive
+      inbound_t** inp = &peer->early;
+      while (*inp != NULL && (*inp)->seq < seq) {
+        inp = &(*inp)->next;
+      }
+      long length = strlen(message) + 1;
+      if ((*inp == NULL || (*inp)->seq != seq) && peer->nearly < MaxEarly
+          && ctx->earlyBytes + length <= MaxEarlyBytes) {
+        inbound_t* in = malloc(sizeof(inbound_t));
+        char* copy = malloc(length);
+        if (in == NULL || copy == NULL) {
+          flog_v(ctx->logFP, "message_loop: out of memory");
+          exit(99);
+        }
+        in->seq = seq;
+        in->message = strcpy(copy, message);
+        in->next = *inp;
+        *inp = in;
+        peer->nearly++;
+        ctx->earlyBytes += length;
+      }
+      sendAck(ctx, peer);
+      return false;
+    }
+    if (seq <= peer->recvSeq) {
+      sendAck(ctx, peer); // a duplicate: our acknowledgement was lost
+      return false;
+    }
+    if (!admitted(ctx, arg, sender, message)) {
+      return false; // unacknowledged, so the peer sends it again later
+    }
+    peer->recvSeq = seq;
+    sendAck(ctx, peer);
+  } else if (!admitted(ctx, arg, sender, message)) {
+    return false;
+  }
+
+  if (peer != NULL) {
+    peer->forgotten = false; // it is talking to us again
+  }
+
+  // record it
+  flog_s(ctx->logFP, "message_loop: FROM %s", message_stringAddr(sender));
+  flog_d(ctx->logFP, "message_loop: %d lines:", numLines(message));
+  flog_s(ctx->logFP, "%s", message);
+
+  // handle it
+  if ((*handleMessage)(arg, sender, message)) {
+    return true;
+  }
+
+  // deliver any held messages it was holding up
+  // (the peer may have moved in the table, so find it again)
+  while (kind == 'R' && (peer = findPeer(ctx, sender, false)) != NULL
+         && peer->early != NULL && peer->early->seq == peer->recvSeq + 1) {
+    inbound_t* in = peer->early;
+    peer->early = in->next;
+    peer->nearly--;
+    if (!admitted(ctx, arg, sender, in->message)) {
+      // unacknowledged, so the peer sends it again, and the ones after it wait for it as before
+      freeInbound(ctx, in);
+      break;
+    }
+    peer->recvSeq = in->seq;
+    sendAck(ctx, peer);
+    flog_s(ctx->logFP, "message_loop: FROM %s", message_stringAddr(sender));
+    flog_s(ctx->logFP, "%s", in->message);
+    bool quit = (*handleMessage)(arg, sender, in->message);
+    freeInbound(ctx, in);
+    if (quit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** admitted ****************/
+/* Ask the admit function, if there is one, whether to take a message
+ * from this sender; log it if not.
+ */
+static bool
+admitted(message_ctx_t* ctx, void* arg, const addr_t sender, const char* message)
+{
+  if (ctx->admit == NULL || (*ctx->admit)(arg, sender, message)) {
+    return true;
+  }
+  flog_s(ctx->logFP, "message_loop: refused message from %s", message_stringAddr(sender));
+  return false;
+}
+
+/**************** reassemble ****************/
+/* Keep one fragment of nbytes in buf, from this peer.  Return its whole
+ * datagram, null-terminated, for the caller to free, once every fragment
+ * has arrived; else NULL.  Partial datagrams that have waited too long,
+ * or that do not fit the memory caps, are dropped.
+ */
+static char*
+reassemble(message_ctx_t* ctx, peer_t* peer, const char* buf, const int nbytes)
+{
+  unsigned int id;
+  int index, count;
+  int headerLength = 0;
+  if (sscanf(buf + 2, "%u %d %d%n", &id, &index, &count, &headerLength) != 3
+      || buf[2 + headerLength] != ' '
+      || count < 2 || count > maxFragments() || index < 0 || index >= count) {
+    flog_s(ctx->logFP, "message_loop: malformed fragment from %s", message_stringAddr(peer->addr));
+    return NULL;
+  }
+  const char* data = buf + 3 + headerLength;
+  const int length = nbytes - 3 - headerLength;
+  double t = now();
+  expirePartials(ctx, t);
+
+  // find the datagram it is part of, or start one
+  partial_t* partial = peer->partials;
+  while (partial != NULL && partial->id != id) {
+    partial = partial->next;
+  }
+  if (partial == NULL) {
+    if (peer->npartials == MaxPartials) {
+      dropStalest(ctx, peer, NULL);
+    }
+    // its slots count against MaxReassembly too, before they are allocated
+    long slots = partialSlots(count);
+    while (ctx->reassembling + slots > MaxReassembly && dropStalest(ctx, NULL, NULL)) {
+    }
+    if (ctx->reassembling + slots > MaxReassembly) {
+      flog_d(ctx->logFP, "message_loop: no room to reassemble a datagram of %d fragments", count);
+      return NULL;
+    }
+    partial = malloc(sizeof(partial_t));
+    char** parts = calloc(count, sizeof(char*));
+    int* lengths = calloc(count, sizeof(int));
+    if (partial == NULL || parts == NULL || lengths == NULL) {
+      flog_v(ctx->logFP, "message_loop: out of memory");
+      exit(99);
+    }
+    partial->id = id;
+    partial->count = count;
+    partial->received = 0;
+    partial->parts = parts;
+    partial->lengths = lengths;
+    partial->bytes = 0;
+    partial->next = peer->partials;
+    peer->partials = partial;
+    peer->npartials++;
+    ctx->reassembling += slots;
+  } else if (partial->count != count) {
+    flog_s(ctx->logFP, "message_loop: malformed fragment from %s", message_stringAddr(peer->addr));
+    return NULL;
+  }
+  if (partial->parts[index] != NULL) {
+    return NULL; // a duplicate
+  }
+
+  // make room for it
+  while (ctx->reassembling + length > MaxReassembly && dropStalest(ctx, NULL, partial)) {
+  }
+  if (ctx->reassembling + length > MaxReassembly) {
+    flog_d(ctx->logFP, "message_loop: no room to reassemble a datagram of %d fragments", count);
+    dropStalest(ctx, peer, NULL); // it is the only one left
+    return NULL;
+  }
+  partial->parts[index] = malloc(length);
+  if (partial->parts[index] == NULL) {
+    flog_v(ctx->logFP, "message_loop: out of memory");
+    exit(99);
+  }
+  memcpy(partial->parts[index], data, length);
+  partial->lengths[index] = length;
+  partial->bytes += length;
+  partial->received++;
+  partial->updated = t;
+  ctx->reassembling += length;
+  if (partial->received < count) {
+    return NULL;
+  }
+
+  // it is whole
+  char* whole = malloc(partial->bytes + 1);
+  if (whole == NULL) {
+    flog_v(ctx->logFP, "message_loop: out of memory");
+    exit(99);
+  }
+  long offset = 0;
+  for (int i = 0; i < count; i++) {
+    memcpy(whole + offset, partial->parts[i], partial->lengths[i]);
+    offset += partial->lengths[i];
+  }
+  whole[offset] = '\0';
+  partial_t** pp = &peer->partials;
+  while (*pp != partial) {
+    pp = &(*pp)->next;
+  }
+  *pp = partial->next;
+  peer->npartials--;
+  freePartial(ctx, partial);
+  flog_d(ctx->logFP, "message_loop: reassembled a datagram from %d fragments", count);
+  return whole;
+}
+
+/**************** expirePartials ****************/
+/* Drop every partial datagram no fragment of which has arrived lately. */
+static void
+expirePartials(message_ctx_t* ctx, const double t)
+{
+  for (int i = 0; i < ctx->npeers; i++) {
+    partial_t** pp = &ctx->peers[i].partials;
+    while (*pp != NULL) {
+      partial_t* partial = *pp;
+      if (t - partial->updated > ReassemblySeconds) {
+        flog_d(ctx->logFP, "expirePartials: dropped a datagram missing %d fragments",
+              partial->count - partial->received);
+        *pp = partial->next;
+        ctx->peers[i].npartials--;
+        freePartial(ctx, partial);
+      } else {
+        pp = &partial->next;
+      }
+    }
+  }
+}
+
+/**************** dropStalest ****************/
+/* Drop the partial datagram that has waited longest for a fragment: from
+ * this peer, or from any peer if only is NULL; never spare.
+ * Return false if there was none to drop.
+ */
+static bool
+dropStalest(message_ctx_t* ctx, peer_t* only, const partial_t* spare)
+{
+  peer_t* owner = NULL;
+  partial_t** stalest = NULL;
+  for (int i = 0; i < ctx->npeers; i++) {
+    peer_t* peer = &ctx->peers[i];
+    if (only != NULL && peer != only) {
+      continue;
+    }
+    for (partial_t** pp = &peer->partials; *pp != NULL; pp = &(*pp)->next) {
+      if (*pp != spare && (stalest == NULL || (*pp)->updated < (*stalest)->updated)) {
+        owner = peer;
+        stalest = pp;
+      }
+    }
+  }
+  if (stalest == NULL) {
+    return false;
+  }
+  partial_t* partial = *stalest;
+  flog_d(ctx->logFP, "dropStalest: dropped a datagram missing %d fragments",
+        partial->count - partial->received);
+  *stalest = partial->next;
+  owner->npartials--;
+  freePartial(ctx, partial);
+  return true;
+}
+
+/**************** freePartial ****************/
+/* Free a partial datagram, no longer in any list, and what it holds. */
+static void
+freePartial(message_ctx_t* ctx, partial_t* partial)
+{
+  for (int i = 0; i < partial->count; i++) {
+    free(partial->parts[i]);
+  }
+  ctx->reassembling -= partial->bytes + partialSlots(partial->count);
+  free(partial->parts);
+  free(partial->lengths);
+  free(partial);
+}
+
+/**************** maxFragments ****************/
+/* The most fragments a datagram can take: one of message_MaxFramedBytes,
+ * in fragments as small as the smallest path MTU makes them.
+ */
+static int
+maxFragments(void)
+{
+  int chunk = MinMTU - IPHeaders - FragmentHeader;
+  return (message_MaxFramedBytes + chunk - 1) / chunk;
+}
+
+/**************** partialSlots ****************/
+/* The bytes a partial datagram of count fragments takes to keep track of them. */
+static long
+partialSlots(const int count)
+{
+  return (long) count * (sizeof(char*) + sizeof(int));
+}
 
 /* ****************************************************************** */
 /* ************************* UNIT_TEST ****************************** */
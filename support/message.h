@@ -15,6 +15,30 @@
  *   message_send(serverAddress, message); // client speaks first
  *   message_loop(arg, timeout, handleTimeout, handleStdin, handleMessage);
  *   message_done();
+ * Reliable delivery (optional):
+ *   message_sendReliable(to, message); // arrives once, in order, or is given up on
+ *   message_sendLatest(to, message);   // may be lost; never arrives after a newer one
+ *   ...
+ *   message_flush(seconds);            // before message_done, to let the last ones land
+ * A peer that has never sent us a framed message gets plain datagrams from
+ * both functions, so old peers keep working; a client that wants the framed
+ * protocol from the start calls message_setReliable(true) before it speaks.
+ * Long messages (optional):
+ *   message_setPathMTU(1500);          // fragment framed messages to fit the path
+ *   message_setPace(bytesPerSecond);   // and send those fragments no faster than this
+ * A framed peer may be sent messages up to message_MaxFramedBytes; those
+ * too long for one datagram of the path go as fragments, reassembled by
+ * the peer's message_loop.
+ * Contexts (optional):
+ *   Each function above works with the one socket message_init opens.
+ *   A program that needs several, such as one per receiving thread,
+ *   creates contexts with message_ctx_new and passes one to the
+ *   message_ctx_ counterpart of each function:
+ *     message_ctx_t* ctx = message_ctx_new(logFP, port, true);
+ *     message_ctx_loop(ctx, arg, timeout, handleTimeout, handleStdin, handleMessage);
+ *     message_ctx_delete(ctx);
+ *   Contexts share nothing, so each may be used by a different thread;
+ *   one context must not be used by two threads at once.
  * Note:
  *  handleTimeout may be NULL (and timeout==0) if no timers needed.
  *  handleInput may be NULL if no input expected.
@@ -45,11 +69,20 @@
  */
 typedef struct sockaddr_in addr_t;
 
+/* A messaging context: one socket, and the reliability layer's state for
+ * every peer it talks to.  Opaque; see message_ctx_new.
+ */
+typedef struct message_ctx message_ctx_t;
+
 /****************** constants *********************/
 // Maximum payload size for UDP messages, according to
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
 static const int message_MaxBytes = 65507;
 
+// Longest message that may be sent to a peer speaking the framed protocol,
+// which carries it in as many datagrams as it takes.
+static const int message_MaxFramedBytes = 16 * 1024 * 1024;
+
 /****************** global functions *********************/
 
 /******************************************/
@@ -115,6 +148,7 @@ bool message_setAddr(const char* hostname, const char* portStr, addr_t* addr);
  * Returns:
  *   a string representation of the address,
  *   which is a pointer to static storage that cannot be retained!
+ *   (The storage is per thread, so threads do not overwrite each other's.)
  * Logs:
  *   nothing.
  */
@@ -133,6 +167,175 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendReliable: send a message that must be delivered.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a string containing the message.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Notes:
+ *   If the peer speaks the framed protocol (it has sent us a framed
+ *   message, or we called message_setReliable(true)), the message is
+ *   numbered, kept, and retransmitted by message_loop or message_flush
+ *   until the peer acknowledges it, with a timeout that adapts to the
+ *   measured round trip; the peer's message_loop delivers it exactly
+ *   once, after every reliable message we sent it before.  After 12
+ *   transmissions without acknowledgement the message is given up on.
+ *   Otherwise it is sent just as message_send would.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message.
+ */
+void message_sendReliable(const addr_t to, const char* message);
+
+/******************************************/
+/* message_sendLatest: send a message that only matters until a newer one.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a string containing the message.
+ * Function returns: none
+ * Notes:
+ *   Like message_send, the message may be lost, and is never retransmitted;
+ *   but to a peer that speaks the framed protocol it is numbered, and the
+ *   peer drops it if a newer message sent with message_sendLatest has
+ *   already arrived.  Suited to complete snapshots, such as a display.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message.
+ */
+void message_sendLatest(const addr_t to, const char* message);
+
+/******************************************/
+/* message_setReliable: speak the framed protocol to every peer.
+ * Caller provides: true to turn it on, false to turn it off.
+ * Notes:
+ *   Affects peers not yet known to this module; a peer that sends us a
+ *   framed message is always answered with framed messages.  A client
+ *   calls this before sending its first message to a server.
+ */
+void message_setReliable(const bool on);
+
+/******************************************/
+/* message_setLoss: drop some outgoing datagrams, for testing.
+ * Caller provides:
+ *   the fraction of datagrams to drop, from 0 (the default) to 1,
+ *   a seed for the choice of datagrams to drop.
+ * Notes:
+ *   Every datagram is subject to loss: plain and framed messages,
+ *   retransmissions and acknowledgements alike.  Dropped datagrams
+ *   are logged and otherwise treated as sent.
+ */
+void message_setLoss(const float rate, const unsigned int seed);
+
+/******************************************/
+/* message_setPathMTU: fit framed datagrams to the network path.
+ * Caller provides:
+ *   the largest IP packet, in bytes, that the path to our peers carries
+ *   without fragmenting it; 1500 (Ethernet) by default.
+ * Notes:
+ *   A framed message whose datagram would not fit in one such packet
+ *   (less 28 bytes of IPv4 and UDP headers) is split into fragments that
+ *   do, so the network never fragments it; the peer's message_loop
+ *   puts them back together and delivers the message as usual.  If any
+ *   fragment is lost the whole message is: a latest-wins message is
+ *   simply gone, a reliable one is retransmitted in full.  Plain
+ *   datagrams are never fragmented.  Values are clamped to the range
+ *   576 (the IPv4 minimum) to 65535.
+ */
+void message_setPathMTU(const int bytes);
+
+/******************************************/
+/* message_setPace: send fragments no faster than a given rate.
+ * Caller provides:
+ *   bytes per second to each peer; 0 (the default) to send at once.
+ * Notes:
+ *   With a pace, the fragments of a long message are queued and sent
+ *   one packet at a time by message_loop (or message_flush) as the pace
+ *   allows, rather than in one burst that overflows a queue somewhere
+ *   on the path; other datagrams go at once but count against the pace.
+ *   The fragments of a latest-wins message still queued when a newer
+ *   latest-wins message is sent to the same peer are dropped.
+ */
+void message_setPace(const int bytesPerSecond);
+
+/******************************************/
+/* message_setAdmit: decide whether to take each message.
+ * Caller provides:
+ *   a function for message_loop to ask, with its 'arg', the sender and
+ *   the message, before handing a message to handleMessage; or NULL (the
+ *   default) to take every message.
+ * Notes:
+ *   A message it refuses is dropped as if it never arrived: a reliable
+ *   one is not acknowledged, so the peer sends it again after its
+ *   retransmission timeout, and the messages after it wait for it, in
+ *   order, as usual.  A receiver that limits its peers' input (a token
+ *   bucket, say) should refuse here rather than in handleMessage, which
+ *   is too late for a reliable message: it has been acknowledged, and
+ *   the peer will never send it again.
+ */
+void message_setAdmit(bool (*admit)(void* arg, const addr_t from, const char* message));
+
+/******************************************/
+/* message_setAfterDatagram: be told when each datagram has been dealt with.
+ * Caller provides:
+ *   a function for message_loop to call after every datagram it reads
+ *   from the socket, or NULL (the default) for none.
+ * Notes:
+ *   It is called whether or not the datagram carried a message for
+ *   handleMessage: acknowledgements, duplicates, fragments and messages
+ *   held until earlier ones arrive count too.  It is given message_loop's
+ *   'arg', and returns true to end the loop, as the handlers do.  With
+ *   message_pending, it tells a handler that held back work for the rest
+ *   of a burst when the burst is over, however the burst ended.
+ */
+void message_setAfterDatagram(bool (*handleAfter)(void* arg));
+
+/******************************************/
+/* message_forget: drop what we know about a correspondent.
+ * Caller provides:
+ *   the address of a correspondent we are done with, such as a client
+ *   that has quit.
+ * Notes:
+ *   Its early messages and partial datagrams are freed at once; the
+ *   rest of its state (sequence numbers, round-trip estimate) once every
+ *   reliable message to it is acknowledged or given up on, and every
+ *   paced fragment sent, so a goodbye sent just before still arrives.
+ *   If it sends us a message before then, it is remembered after all.
+ *   A correspondent that talks to us again after it is dropped is a new
+ *   one: a reliable sender must start again from a new socket.
+ * Logs: the address forgotten.
+ */
+void message_forget(const addr_t addr);
+
+/******************************************/
+/* message_flush: wait for reliable messages to be acknowledged.
+ * Caller provides:
+ *   the most seconds to wait.
+ * Function returns:
+ *   true if every reliable message has been acknowledged,
+ *   false if the time ran out first, a message was given up on
+ *   meanwhile, or on error.
+ * Notes:
+ *   Meant for just before message_done, once message_loop has returned:
+ *   it keeps retransmitting, sends any fragments the pace held back,
+ *   and processes acknowledgements, but any other message that arrives
+ *   meanwhile is discarded.
+ */
+bool message_flush(const float timeout);
+
+/******************************************/
+/* message_pending: is a message waiting to be received?
+ * Caller provides: nothing.
+ * Function returns:
+ *   true iff a datagram is already queued on our socket, so that
+ *   message_loop would hand it to handleMessage without waiting.
+ * Notes:
+ *   handlers may use this to tell whether a burst of messages is over.
+ * Logs: nothing.
+ */
+bool message_pending(void);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -154,6 +357,11 @@ void message_send(const addr_t to, const char* message);
  *   Handlers should return true to terminate looping, false to keep looping.
  * Notes:
  *   The timeout feature is optional; use timeout=0 and handleTimeout=NULL.
+ *   Framed messages are handed to handleMessage without their framing,
+ *   once all their fragments have arrived;
+ *   the loop also acknowledges them, retransmits our own reliable
+ *   messages as they fall due, and sends fragments as the pace allows,
+ *   whatever the timeout.
  * Logs:
  *   errors in arguments,
  *   errors in monitoring stdin and/or network,
@@ -177,5 +385,66 @@ bool message_loop(void* arg, const float timeout,
  */
 void message_done(void);
 
+/****************** contexts *********************/
+
+/******************************************/
+/* message_ctx_new: create a context, with a socket of its own.
+ * Caller provides:
+ *   file pointer to log to, or NULL for no logging,
+ *   the port to bind, or 0 for any free port,
+ *   true to share the port with other sockets that also ask to.
+ * Function returns:
+ *   a new context, or NULL on error (such as a port already taken).
+ * Caller expectations:
+ *   call message_ctx_delete() when done with it.
+ * Notes:
+ *   Sockets that share a port (with SO_REUSEPORT) each receive a share
+ *   of the datagrams sent to it: the kernel picks the socket by a hash
+ *   of the sender's address, so all of one peer's datagrams reach the
+ *   same context while the set of sockets stays the same.  That context
+ *   holds the reliability state for the peer, so it is the one to answer
+ *   the peer with.  Any of them may send; replies come from the port.
+ *   The context logs with log.c's flog_ functions, not log_init's file.
+ * Logs: information about errors; the port number.
+ */
+message_ctx_t* message_ctx_new(FILE* logFP, const int port, const bool sharePort);
+
+/******************************************/
+/* message_ctx_port: the port number of a context's socket, or 0 on error. */
+int message_ctx_port(const message_ctx_t* ctx);
+
+/******************************************/
+/* The message_ctx_ counterparts of the functions above: each takes a
+ * context first, then the same arguments, and does the same with that
+ * context's socket and state instead of message_init's.
+ */
+void message_ctx_send(message_ctx_t* ctx, const addr_t to, const char* message);
+void message_ctx_sendReliable(message_ctx_t* ctx, const addr_t to, const char* message);
+void message_ctx_sendLatest(message_ctx_t* ctx, const addr_t to, const char* message);
+void message_ctx_setReliable(message_ctx_t* ctx, const bool on);
+void message_ctx_setLoss(message_ctx_t* ctx, const float rate, const unsigned int seed);
+void message_ctx_setPathMTU(message_ctx_t* ctx, const int bytes);
+void message_ctx_setPace(message_ctx_t* ctx, const int bytesPerSecond);
+void message_ctx_setAdmit(message_ctx_t* ctx,
+                          bool (*admit)(void* arg, const addr_t from, const char* message));
+void message_ctx_setAfterDatagram(message_ctx_t* ctx, bool (*handleAfter)(void* arg));
+void message_ctx_forget(message_ctx_t* ctx, const addr_t addr);
+bool message_ctx_flush(message_ctx_t* ctx, const float timeout);
+bool message_ctx_pending(message_ctx_t* ctx);
+bool message_ctx_loop(message_ctx_t* ctx, void* arg, const float timeout,
+                      bool (*handleTimeout)(void* arg),
+                      bool (*handleInput)  (void* arg),
+                      bool (*handleMessage)(void* arg,
+                                            const addr_t from,
+                                            const char* message));
+
+/******************************************/
+/* message_ctx_delete: close a context's socket and free it.
+ * Caller provides: a context from message_ctx_new; NULL is ignored.
+ * Notes: like message_done, it does not wait for unacknowledged
+ *   messages; call message_ctx_flush first for that.
+ */
+void message_ctx_delete(message_ctx_t* ctx);
+
 
 #endif // _MESSAGE_H_
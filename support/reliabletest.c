@@ -0,0 +1,196 @@
+/*
+ * reliabletest - test the message module's reliability layer under loss
+ *
+ * Two processes talk over loopback, each dropping a share of the datagrams
+ * it sends (see message_setLoss).  The sender sends Count numbered messages
+ * with message_sendReliable, each followed by one with message_sendLatest,
+ * and then waits for the receiver's reliable "DONE"; both sides then stay
+ * a few seconds to acknowledge any retransmissions.  The receiver checks
+ * that every reliable message arrived exactly once and in order, and that
+ * no latest-wins message arrived after a newer one.
+ * Given a length, every BigEvery'th reliable message is padded out to it,
+ * so that it travels in fragments, sent at Pace; the receiver checks that
+ * each arrives whole.
+ *
+ * usage: ./reliabletest [lossrate [length]]   (default 0.3, no padding)
+ * Exit status 0 if all checks pass.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "message.h"
+
+static const int Count = 300;       // messages of each kind
+static const float MaxSeconds = 30; // longest either side waits
+static const float Linger = 5;      // seconds of silence before either side leaves
+static const int BigEvery = 50;     // every this many reliable messages, one is padded
+static const int Pace = 8000000;    // bytes per second the sender's fragments go at
+
+/**************** file-local types ****************/
+typedef struct tally {
+  int reliable;   // last reliable message number received in order
+  int errors;     // reliable messages out of order, duplicated, or malformed
+  int latest;     // latest-wins messages received
+  int latestLast; // number of the newest one
+  int stale;      // latest-wins messages older than one received before
+  int big;        // length of the padded reliable messages; 0 for none
+  addr_t peer;    // the sender
+} tally_t;
+
+static int sender(const char* port, float loss, int big);
+static bool senderMessage(void* arg, const addr_t from, const char* message);
+static bool receiverMessage(void* arg, const addr_t from, const char* message);
+static bool giveUp(void* arg);
+
+/***************** main *******************************/
+int
+main(const int argc, char* argv[])
+{
+  float loss = 0.3;
+  int big = 0;
+  char extra;
+  if (argc > 3 || (argc >= 2 && (sscanf(argv[1], "%f%c", &loss, &extra) != 1
+                                 || loss < 0 || loss >= 1))
+      || (argc == 3 && (sscanf(argv[2], "%d%c", &big, &extra) != 1
+                        || big < 16 || big > message_MaxFramedBytes - 16))) {
+    fprintf(stderr, "usage: %s [lossrate [length]]\n", argv[0]);
+    return 1;
+  }
+
+  // the receiver is this process; the sender a child
+  int ourPort = message_init(NULL);
+  if (ourPort == 0) {
+    return 2;
+  }
+  char port[10];
+  snprintf(port, sizeof(port), "%d", ourPort);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 2;
+  }
+  if (pid == 0) {
+    message_done(); // the child gets a socket of its own
+    exit(sender(port, loss, big));
+  }
+
+  message_setLoss(loss, 2);
+  tally_t tally = {0, 0, 0, 0, 0, big, message_noAddr()};
+  message_loop(&tally, MaxSeconds, giveUp, NULL, receiverMessage);
+  bool flushed = message_flush(MaxSeconds);
+  // stay to acknowledge again whatever the sender still retransmits
+  message_loop(&tally, Linger, giveUp, NULL, receiverMessage);
+  message_done();
+  int status;
+  waitpid(pid, &status, 0);
+  bool senderOk = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+  printf("loss %.0f%%, %d-byte padding: reliable %d/%d in order, %d errors; "
+         "latest %d/%d delivered, %d stale; DONE %s; sender %s\n",
+         loss * 100, big, tally.reliable, Count, tally.errors,
+         tally.latest, Count, tally.stale,
+         flushed ? "acknowledged" : "unacknowledged",
+         senderOk ? "ok" : "failed");
+  bool ok = tally.reliable == Count && tally.errors == 0 && tally.stale == 0
+    && tally.latest > 0 && flushed && senderOk;
+  return ok ? 0 : 1;
+}
+
+/**************** sender ****************/
+/* Send the messages and wait for DONE; return the exit status. */
+static int
+sender(const char* port, float loss, int big)
+{
+  if (message_init(NULL) == 0) {
+    return 2;
+  }
+  addr_t receiver;
+  if (!message_setAddr("localhost", port, &receiver)) {
+    return 2;
+  }
+  message_setReliable(true);
+  message_setLoss(loss, 1);
+  message_setPace(Pace);
+  char* message = malloc(big + 32);
+  if (message == NULL) {
+    return 2;
+  }
+  for (int i = 1; i <= Count; i++) {
+    int length = snprintf(message, 32, "R %d ", i);
+    if (big > 0 && i % BigEvery == 0) {
+      memset(message + length, '.', big - length);
+      message[big] = '\0';
+    }
+    message_sendReliable(receiver, message);
+    snprintf(message, 32, "U %d", i);
+    message_sendLatest(receiver, message);
+  }
+  free(message);
+  bool done = false;
+  message_loop(&done, MaxSeconds, giveUp, NULL, senderMessage);
+  bool flushed = message_flush(MaxSeconds);
+  message_loop(&done, Linger, giveUp, NULL, senderMessage);
+  message_done();
+  return done && flushed ? 0 : 1;
+}
+
+/**************** senderMessage ****************/
+static bool
+senderMessage(void* arg, const addr_t from, const char* message)
+{
+  bool* done = arg;
+  if (strcmp(message, "DONE") == 0) {
+    *done = true;
+    return true;
+  }
+  return false;
+}
+
+/**************** receiverMessage ****************/
+static bool
+receiverMessage(void* arg, const addr_t from, const char* message)
+{
+  tally_t* tally = arg;
+  char kind;
+  int i;
+  if (sscanf(message, "%c %d", &kind, &i) != 2) {
+    tally->errors++;
+  } else if (kind == 'R') {
+    bool padded = tally->big > 0 && i % BigEvery == 0;
+    if (padded && strlen(message) != tally->big) {
+      tally->errors++; // not whole
+    } else if (i == tally->reliable + 1) {
+      tally->reliable = i;
+    } else {
+      tally->errors++;
+    }
+  } else if (kind == 'U') {
+    tally->latest++;
+    if (i <= tally->latestLast) {
+      tally->stale++;
+    } else {
+      tally->latestLast = i;
+    }
+  }
+  if (tally->reliable == Count && !message_isAddr(tally->peer)) {
+    tally->peer = from;
+    message_sendReliable(from, "DONE");
+    return true;
+  }
+  return false;
+}
+
+/**************** giveUp ****************/
+/* Nothing arrived for a while: stop waiting. */
+static bool
+giveUp(void* arg)
+{
+  return true;
+}
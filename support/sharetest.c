@@ -0,0 +1,153 @@
+/*
+ * sharetest - test message contexts sharing one port across threads
+ *
+ * Receiver contexts bind the same port with SO_REUSEPORT (see
+ * message_ctx_new), each looping in a thread of its own.  Sender
+ * contexts, each on a port of its own, send Count numbered reliable
+ * messages apiece to that port and flush them.  Each receiver checks that
+ * the messages it gets arrive in order; then the main thread checks that
+ * every message arrived, that all of one sender's messages reached the
+ * same receiver, and that the kernel spread the senders over more than
+ * one receiver.
+ *
+ * usage: ./sharetest
+ * Exit status 0 if all checks pass.
+ *
+ * ctrl-zzz, Winter 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "message.h"
+
+enum { Receivers = 4, Senders = 16 };
+static const int Count = 50;         // messages from each sender
+static const float MaxSeconds = 10;  // longest a sender waits for acknowledgements
+static const float Linger = 2;       // seconds of silence before a receiver leaves
+
+/**************** file-local types ****************/
+typedef struct receiver {
+  message_ctx_t* ctx;
+  pthread_t thread;
+  int last[Senders];  // number of the last message from each sender, in order
+  int total;          // messages received
+  int errors;         // out of order or malformed
+} receiver_t;
+
+static void* receive(void* arg);
+static bool handleMessage(void* arg, const addr_t from, const char* message);
+static bool giveUp(void* arg);
+
+/***************** main *******************************/
+int
+main(const int argc, char* argv[])
+{
+  if (argc != 1) {
+    fprintf(stderr, "usage: %s\n", argv[0]);
+    return 1;
+  }
+
+  // the first receiver picks the port; the rest share it
+  receiver_t receivers[Receivers];
+  memset(receivers, 0, sizeof(receivers));
+  int port = 0;
+  for (int r = 0; r < Receivers; r++) {
+    receivers[r].ctx = message_ctx_new(NULL, port, true);
+    if (receivers[r].ctx == NULL) {
+      fprintf(stderr, "cannot bind receiver %d to port %d\n", r, port);
+      return 2;
+    }
+    port = message_ctx_port(receivers[r].ctx);
+  }
+  for (int r = 0; r < Receivers; r++) {
+    pthread_create(&receivers[r].thread, NULL, receive, &receivers[r]);
+  }
+
+  // every sender sends all its messages, then waits for them to be acknowledged
+  char portString[10];
+  snprintf(portString, sizeof(portString), "%d", port);
+  addr_t to;
+  if (!message_setAddr("localhost", portString, &to)) {
+    return 2;
+  }
+  message_ctx_t* senders[Senders];
+  for (int s = 0; s < Senders; s++) {
+    senders[s] = message_ctx_new(NULL, 0, false);
+    if (senders[s] == NULL) {
+      return 2;
+    }
+    message_ctx_setReliable(senders[s], true);
+  }
+  char message[32];
+  for (int i = 1; i <= Count; i++) {
+    for (int s = 0; s < Senders; s++) {
+      snprintf(message, sizeof(message), "%d %d", s, i);
+      message_ctx_sendReliable(senders[s], to, message);
+    }
+  }
+  int unflushed = 0;
+  for (int s = 0; s < Senders; s++) {
+    unflushed += !message_ctx_flush(senders[s], MaxSeconds);
+    message_ctx_delete(senders[s]);
+  }
+
+  // tally what each receiver got
+  int total = 0, errors = 0, busy = 0, split = 0;
+  for (int r = 0; r < Receivers; r++) {
+    pthread_join(receivers[r].thread, NULL);
+    message_ctx_delete(receivers[r].ctx);
+    printf("receiver %d: %d messages\n", r, receivers[r].total);
+    total += receivers[r].total;
+    errors += receivers[r].errors;
+    busy += receivers[r].total > 0;
+  }
+  for (int s = 0; s < Senders; s++) {
+    int reached = 0;
+    for (int r = 0; r < Receivers; r++) {
+      reached += receivers[r].last[s] > 0;
+    }
+    split += reached > 1;
+  }
+  printf("%d/%d messages on %d of %d receivers, %d errors, %d senders split, %d unflushed\n",
+         total, Senders * Count, busy, Receivers, errors, split, unflushed);
+  bool ok = total == Senders * Count && errors == 0 && split == 0
+    && unflushed == 0 && busy > 1;
+  return ok ? 0 : 1;
+}
+
+/**************** receive ****************/
+/* A receiver's thread: loop on its context until things go quiet. */
+static void*
+receive(void* arg)
+{
+  receiver_t* receiver = arg;
+  message_ctx_loop(receiver->ctx, receiver, Linger, giveUp, NULL, handleMessage);
+  return NULL;
+}
+
+/**************** handleMessage ****************/
+static bool
+handleMessage(void* arg, const addr_t from, const char* message)
+{
+  receiver_t* receiver = arg;
+  int s, i;
+  if (sscanf(message, "%d %d", &s, &i) != 2 || s < 0 || s >= Senders
+      || i != receiver->last[s] + 1) {
+    receiver->errors++;
+  } else {
+    receiver->last[s] = i;
+    receiver->total++;
+  }
+  return false;
+}
+
+/**************** giveUp ****************/
+/* Nothing arrived for a while: stop waiting. */
+static bool
+giveUp(void* arg)
+{
+  return true;
+}